@@ -45,7 +45,7 @@ namespace loopp
         ScanResult() = default;
         ScanResult(esp_ble_gap_cb_param_t::ble_scan_result_evt_param *scan_result);
 
-        std::string bda_as_string();
+        std::string bda_as_string() const;
 
       public:
         uint8_t bda[6];
@@ -0,0 +1,88 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_COMPRESS_HEATSHRINKDECODER_HPP
+#define LOOPP_COMPRESS_HEATSHRINKDECODER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace compress
+  {
+    // Streaming decoder for the heatshrink format produced by
+    // HeatshrinkEncoder. The working memory is the window: 2^window_bits bytes.
+    class HeatshrinkDecoder
+    {
+    public:
+      using output_callback_t = std::function<void(loopp::utils::string_view data)>;
+
+      explicit HeatshrinkDecoder(int window_bits = default_window_bits, int lookahead_bits = default_lookahead_bits);
+
+      HeatshrinkDecoder(const HeatshrinkDecoder &) = delete;
+      HeatshrinkDecoder &operator=(const HeatshrinkDecoder &) = delete;
+
+      // Decodes input and passes the result to output. Returns false if the
+      // input refers to data before the start of the output.
+      bool decode(loopp::utils::string_view input, const output_callback_t &output);
+
+      std::size_t get_output_size() const noexcept;
+
+      static constexpr int default_window_bits = 8;
+      static constexpr int default_lookahead_bits = 4;
+
+    private:
+      enum class State
+      {
+        Tag,
+        Literal,
+        Offset,
+        Length,
+      };
+
+      bool get_bits(int count, std::uint32_t &value);
+      void put(std::uint8_t c, const output_callback_t &output);
+      void flush(const output_callback_t &output);
+
+    private:
+      int window_bits = default_window_bits;
+      int lookahead_bits = default_lookahead_bits;
+      std::vector<std::uint8_t> window;
+      std::size_t window_mask = 0;
+      std::size_t output_size = 0;
+      State state = State::Tag;
+      std::uint32_t offset = 0;
+
+      loopp::utils::string_view input;
+      std::uint32_t bit_buffer = 0;
+      int bit_count = 0;
+
+      // Output produced since the last flush; contiguous in the window.
+      std::size_t pending_start = 0;
+      std::size_t pending_size = 0;
+    };
+  } // namespace compress
+} // namespace loopp
+
+#endif // LOOPP_COMPRESS_HEATSHRINKDECODER_HPP
@@ -0,0 +1,90 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_COMPRESS_HEATSHRINKENCODER_HPP
+#define LOOPP_COMPRESS_HEATSHRINKENCODER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <streambuf>
+#include <string>
+#include <vector>
+
+namespace loopp
+{
+  namespace compress
+  {
+    // Streaming LZSS compressor producing the heatshrink format. Data written to
+    // the encoder is compressed into the output stream buffer. The working
+    // memory is twice the window size: 2^(window_bits + 1) bytes.
+    //
+    // Literals are encoded as a 1 bit followed by the byte, back references
+    // as a 0 bit, the offset minus one in window_bits bits and the length
+    // minus one in lookahead_bits bits. Bits are packed MSB first.
+    class HeatshrinkEncoder : public std::streambuf
+    {
+    public:
+      explicit HeatshrinkEncoder(std::streambuf *output,
+                                 int window_bits = default_window_bits,
+                                 int lookahead_bits = default_lookahead_bits);
+
+      HeatshrinkEncoder(const HeatshrinkEncoder &) = delete;
+      HeatshrinkEncoder &operator=(const HeatshrinkEncoder &) = delete;
+
+      bool finish();
+
+      std::size_t get_input_size() const noexcept;
+      std::size_t get_output_size() const noexcept;
+      std::chrono::microseconds get_time() const noexcept;
+
+      static bool is_valid(int window_bits, int lookahead_bits);
+      static std::string name(int window_bits, int lookahead_bits);
+
+      static constexpr int default_window_bits = 8;
+      static constexpr int default_lookahead_bits = 4;
+
+    private:
+      int_type overflow(int_type ch) override;
+      std::streamsize xsputn(const char *data, std::streamsize size) override;
+
+      void encode(bool flush);
+      std::size_t find_match(std::size_t max_length, std::size_t &offset) const;
+      void emit(std::uint32_t value, int count);
+
+    private:
+      std::streambuf *output = nullptr;
+      int window_bits = default_window_bits;
+      int lookahead_bits = default_lookahead_bits;
+      std::size_t window_size = 0;
+      std::size_t lookahead_size = 0;
+      std::vector<std::uint8_t> buffer;
+      std::size_t position = 0;
+      std::size_t end = 0;
+      std::uint8_t bit_buffer = 0;
+      int bit_count = 0;
+      std::size_t input_size = 0;
+      std::size_t output_size = 0;
+      std::chrono::microseconds time{ 0 };
+      bool failed = false;
+    };
+  } // namespace compress
+} // namespace loopp
+
+#endif // LOOPP_COMPRESS_HEATSHRINKENCODER_HPP
@@ -28,6 +28,8 @@
 #include "loopp/drivers/IDriver.hpp"
 #include "loopp/drivers/DriverRegistry.hpp"
 #include "loopp/mqtt/MqttClient.hpp"
+#include "loopp/net/DatagramTransport.hpp"
+#include "loopp/storage/StoreAndForward.hpp"
 #include "loopp/ble/BLEScanner.hpp"
 
 #include "loopp/utils/json.hpp"
@@ -46,6 +48,10 @@ namespace loopp
 
     private:
       static std::string base64_encode(const std::string &in);
+      static std::string hex_decode(const std::string &in);
+
+      nlohmann::json scan_result_to_json(const loopp::ble::BLEScanner::ScanResult &result);
+      void send_scan_datagrams();
 
       void on_ble_scanner_scan_result(const loopp::ble::BLEScanner::ScanResult &result);
       void on_scan_timer();
@@ -56,10 +62,16 @@ namespace loopp
     private:
       std::shared_ptr<loopp::core::MainLoop> loop;
       std::shared_ptr<loopp::mqtt::MqttClient> mqtt;
+      std::shared_ptr<loopp::storage::StoreAndForward> store;
+      std::shared_ptr<loopp::mqtt::PublishScheduler> scheduler;
+      std::shared_ptr<Publisher> publisher;
+      std::shared_ptr<loopp::net::DatagramTransport> transport;
       loopp::ble::BLEScanner &ble_scanner;
       loopp::core::MainLoop::timer_id scan_timer = 0;
+      loopp::mqtt::PublishScheduler::id_t scan_task = 0;
       std::list<loopp::ble::BLEScanner::ScanResult> scan_results;
       std::string topic_scan;
+      loopp::mqtt::PublishOptions publish_options = loopp::mqtt::PublishOptions::None;
       loopp::core::ScopedConnection scan_result_signal_connection;
       loopp::ble::AdvertisementDecoder decoder;
 
@@ -26,8 +26,11 @@
 
 #include "loopp/core/MainLoop.hpp"
 #include "loopp/mqtt/MqttClient.hpp"
+#include "loopp/mqtt/PublishScheduler.hpp"
+#include "loopp/storage/StoreAndForward.hpp"
 
 #include "IDriver.hpp"
+#include "Publisher.hpp"
 
 #include "esp_log.h"
 
@@ -39,16 +42,27 @@ namespace loopp
     {
     public:
       DriverContext() = default;
-      DriverContext(std::shared_ptr<loopp::core::MainLoop> loop, std::shared_ptr<loopp::mqtt::MqttClient> mqtt, std::string topic_root);
+      DriverContext(std::shared_ptr<loopp::core::MainLoop> loop,
+                    std::shared_ptr<loopp::mqtt::MqttClient> mqtt,
+                    std::string topic_root,
+                    std::shared_ptr<loopp::storage::StoreAndForward> store = nullptr,
+                    std::shared_ptr<loopp::mqtt::PublishScheduler> scheduler = nullptr,
+                    std::shared_ptr<Publisher> publisher = nullptr);
 
       std::shared_ptr<loopp::core::MainLoop> get_loop() const;
       std::shared_ptr<loopp::mqtt::MqttClient> const get_mqtt();
       std::string get_topic_root() const;
+      std::shared_ptr<loopp::storage::StoreAndForward> get_store() const;
+      std::shared_ptr<loopp::mqtt::PublishScheduler> get_scheduler() const;
+      std::shared_ptr<Publisher> get_publisher() const;
 
     private:
       std::shared_ptr<loopp::core::MainLoop> loop;
       std::shared_ptr<loopp::mqtt::MqttClient> mqtt;
       std::string topic_root;
+      std::shared_ptr<loopp::storage::StoreAndForward> store;
+      std::shared_ptr<loopp::mqtt::PublishScheduler> scheduler;
+      std::shared_ptr<Publisher> publisher;
     };
 
     class IDriverFactory
@@ -67,6 +67,7 @@ namespace loopp
         mutable loopp::core::Mutex mutex;
         std::shared_ptr<loopp::core::MainLoop> loop;
         std::shared_ptr<loopp::mqtt::MqttClient> mqtt;
+        std::shared_ptr<Publisher> publisher;
         std::shared_ptr<loopp::core::QueueISR<gpio_num_t>> queue;
 
         gpio_config_t pin;
@@ -0,0 +1,167 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_DRIVERS_PUBLISHER_HPP
+#define LOOPP_DRIVERS_PUBLISHER_HPP
+
+#include <chrono>
+#include <deque>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "loopp/compress/HeatshrinkEncoder.hpp"
+#include "loopp/core/MainLoop.hpp"
+#include "loopp/mqtt/MqttClient.hpp"
+#include "loopp/mqtt/PublishScheduler.hpp"
+#include "loopp/storage/StoreAndForward.hpp"
+#include "loopp/utils/json.hpp"
+
+namespace loopp
+{
+  namespace drivers
+  {
+    struct PublisherStatistics
+    {
+      std::size_t submitted = 0;
+      std::size_t rate_limited = 0;
+      std::size_t overflowed = 0;
+      std::size_t messages = 0;
+    };
+
+    // Collects the events of all drivers and publishes them once per tick.
+    // With batching enabled, events of batched topics are merged into a
+    // single message on the telemetry topic:
+    //
+    //   [ { "topic": "<topic relative to the topic root>", "data": <payload> }, ... ]
+    //
+    // Events of other topics, and retained events, are published on their
+    // own topic. Each topic can have a priority and a token bucket rate limit.
+    // When more events are pending than fit, the lowest priority events are
+    // dropped first.
+    //
+    // MQTT settings of batched topics apply to the telemetry topic: it gets
+    // the highest priority of the batched topics, and is compressed when one
+    // of them has compression enabled. Batches are sent with content type
+    // "application/json" and a "count" user property holding the number of
+    // events. With store and forward, batches are kept small enough to fit in
+    // a single log record.
+    class Publisher
+    {
+    public:
+      struct TopicOptions
+      {
+        int priority = 0;
+        // Maximum sustained events per second; 0 is unlimited.
+        double rate = 0;
+        std::size_t burst = 1;
+        bool batch = true;
+      };
+
+      Publisher(std::shared_ptr<loopp::core::MainLoop> loop,
+                std::shared_ptr<loopp::mqtt::MqttClient> mqtt,
+                std::string topic_root,
+                std::shared_ptr<loopp::storage::StoreAndForward> store = nullptr,
+                std::shared_ptr<loopp::mqtt::PublishScheduler> scheduler = nullptr);
+      ~Publisher();
+
+      Publisher(const Publisher &) = delete;
+      Publisher &operator=(const Publisher &) = delete;
+
+      void set_period(std::chrono::milliseconds period);
+      void set_batching(bool enabled);
+      void set_max_pending(std::size_t max_pending);
+      void set_max_batch_size(std::size_t max_batch_size);
+      void configure(const std::string &topic, const TopicOptions &options);
+      // Reads "priority", "rate", "burst" and "batch" from a driver configuration.
+      void configure(const std::string &topic, const nlohmann::json &config);
+      void set_compression(const std::string &topic,
+                           int window_bits = loopp::compress::HeatshrinkEncoder::default_window_bits,
+                           int lookahead_bits = loopp::compress::HeatshrinkEncoder::default_lookahead_bits);
+      void clear_compression(const std::string &topic);
+
+      void start();
+      void stop();
+
+      bool submit(const std::string &topic,
+                  nlohmann::json payload,
+                  loopp::mqtt::PublishOptions options = loopp::mqtt::PublishOptions::None,
+                  const loopp::mqtt::PublishProperties &properties = loopp::mqtt::PublishProperties());
+      void flush();
+
+      const std::string &get_telemetry_topic() const;
+      const PublisherStatistics &get_statistics() const;
+
+    private:
+      struct Event
+      {
+        std::string topic;
+        nlohmann::json payload;
+        loopp::mqtt::PublishOptions options;
+        loopp::mqtt::PublishProperties properties;
+        int priority;
+        bool batch;
+      };
+
+      struct Topic
+      {
+        TopicOptions options;
+        double tokens = 0;
+        std::chrono::steady_clock::time_point last_refill;
+        bool compress = false;
+        int window_bits = 0;
+        int lookahead_bits = 0;
+      };
+
+      bool take_token(Topic &topic);
+      void drop_lowest_priority();
+      void update_telemetry_topic();
+      std::size_t get_max_batch_size() const;
+      void send(const std::string &topic,
+                const std::string &payload,
+                loopp::mqtt::PublishOptions options,
+                const loopp::mqtt::PublishProperties &properties);
+      void send_batch(std::string &batch, std::size_t count, loopp::mqtt::PublishOptions options);
+
+    private:
+      std::shared_ptr<loopp::core::MainLoop> loop;
+      std::shared_ptr<loopp::mqtt::MqttClient> mqtt;
+      std::shared_ptr<loopp::storage::StoreAndForward> store;
+      std::shared_ptr<loopp::mqtt::PublishScheduler> scheduler;
+      std::string topic_root;
+      std::string telemetry_topic;
+      std::chrono::milliseconds period{ default_period_ms };
+      bool batching = false;
+      std::size_t max_pending = default_max_pending;
+      std::size_t max_batch_size = default_max_batch_size;
+      std::map<std::string, Topic> topics;
+      std::deque<Event> pending;
+      loopp::core::MainLoop::timer_id timer = 0;
+      loopp::mqtt::PublishScheduler::id_t task = 0;
+      PublisherStatistics statistics;
+
+      static constexpr int default_period_ms = 1000;
+      static constexpr std::size_t default_max_pending = 64;
+      static constexpr std::size_t default_max_batch_size = 4096;
+    };
+  } // namespace drivers
+} // namespace loopp
+
+#endif // LOOPP_DRIVERS_PUBLISHER_HPP
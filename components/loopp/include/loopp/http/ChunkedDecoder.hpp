@@ -0,0 +1,76 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_HTTP_CHUNKEDDECODER_HPP
+#define LOOPP_HTTP_CHUNKEDDECODER_HPP
+
+#include <cstddef>
+
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace http
+  {
+    // Incremental decoder for the chunked transfer coding. The decoder does not
+    // copy: chunk data is returned as views into the input.
+    class ChunkedDecoder
+    {
+    public:
+      enum class Result
+      {
+        Incomplete,
+        Data,
+        Done,
+        Invalid,
+      };
+
+      void reset();
+
+      // Consumes input until chunk data is found (Data), the last chunk and
+      // trailer have been read (Done), or all input is consumed (Incomplete).
+      Result decode(loopp::utils::string_view &input, loopp::utils::string_view &data);
+
+    private:
+      enum class State
+      {
+        Size,
+        Extension,
+        SizeLF,
+        Data,
+        DataCR,
+        DataLF,
+        Trailer,
+        TrailerLine,
+        TrailerLF,
+        Done,
+      };
+
+      bool end_of_size_line();
+
+    private:
+      State state = State::Size;
+      std::size_t chunk_size = 0;
+      std::size_t digits = 0;
+    };
+  } // namespace http
+} // namespace loopp
+
+#endif // LOOPP_HTTP_CHUNKEDDECODER_HPP
@@ -0,0 +1,79 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_HTTP_CONNECTIONPOOL_HPP
+#define LOOPP_HTTP_CONNECTIONPOOL_HPP
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <string>
+
+#include "loopp/core/MainLoop.hpp"
+#include "loopp/net/Stream.hpp"
+
+namespace loopp
+{
+  namespace http
+  {
+    // Keeps idle HTTP connections open for reuse by later requests to the
+    // same scheme, host and port. An idle connection is closed after the idle
+    // timeout, or when the pool is full and a newer connection is released.
+    class ConnectionPool
+    {
+    public:
+      explicit ConnectionPool(std::shared_ptr<loopp::core::MainLoop> loop);
+      ~ConnectionPool();
+
+      ConnectionPool(const ConnectionPool &) = delete;
+      ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+      void set_idle_timeout(std::chrono::milliseconds timeout);
+      void set_max_idle(std::size_t max_idle);
+
+      std::shared_ptr<loopp::net::Stream> acquire(const std::string &scheme, const std::string &host, int port);
+      void release(const std::string &scheme, const std::string &host, int port, std::shared_ptr<loopp::net::Stream> stream);
+      void clear();
+
+    private:
+      struct Connection
+      {
+        std::string key;
+        std::shared_ptr<loopp::net::Stream> stream;
+        loopp::core::MainLoop::timer_id timer = 0;
+      };
+
+      static std::string make_key(const std::string &scheme, const std::string &host, int port);
+      void close(std::list<Connection>::iterator it);
+
+    private:
+      std::shared_ptr<loopp::core::MainLoop> loop;
+      std::chrono::milliseconds idle_timeout{ default_idle_timeout_ms };
+      std::size_t max_idle = default_max_idle;
+      // Most recently released first.
+      std::list<Connection> connections;
+
+      static constexpr int default_idle_timeout_ms = 10 * 1000;
+      static constexpr std::size_t default_max_idle = 2;
+    };
+  } // namespace http
+} // namespace loopp
+
+#endif // LOOPP_HTTP_CONNECTIONPOOL_HPP
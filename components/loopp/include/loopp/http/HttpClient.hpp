@@ -21,19 +21,35 @@
 #ifndef LOOPP_HTTP_CLIENT_HPP
 #define LOOPP_HTTP_CLIENT_HPP
 
+#include <deque>
 #include <string>
 #include <memory>
 #include <list>
 #include <system_error>
 
+#include "loopp/http/ChunkedDecoder.hpp"
+#include "loopp/http/ConnectionPool.hpp"
+#include "loopp/http/Inflater.hpp"
 #include "loopp/net/Stream.hpp"
 #include "loopp/http/Request.hpp"
 #include "loopp/http/Response.hpp"
+#include "loopp/http/ResponseParser.hpp"
+#include "loopp/utils/string_view.hpp"
 
 namespace loopp
 {
   namespace http
   {
+    // Executes HTTP/1.1 requests. Requests are queued and answered in order.
+    // Connections are kept alive and returned to a connection pool, so that
+    // later requests to the same host do not pay for a new TCP and TLS
+    // handshake. With pipelining enabled, queued GET and HEAD requests are
+    // sent without waiting for earlier responses.
+    //
+    // The body of a response must be read with stream_body_async or
+    // read_body_async before the next response is delivered; executing a new
+    // request while the body of the previous response is unread closes the
+    // connection.
     class HttpClient : public std::enable_shared_from_this<HttpClient>
     {
     public:
@@ -43,13 +59,28 @@ namespace loopp
       using body_function_t = void(std::error_code, loopp::net::StreamBuffer *buffer);
       using body_callback_t = std::function<body_function_t>;
 
+      using body_sink_t = std::function<void(loopp::utils::string_view data)>;
+      using body_complete_callback_t = std::function<void(std::error_code)>;
+
       HttpClient(std::shared_ptr<loopp::core::MainLoop> loop);
       ~HttpClient() = default;
 
       void set_client_certificate(const char *cert, const char *key);
       void set_ca_certificate(const char *cert);
+      void set_connection_pool(std::shared_ptr<ConnectionPool> pool);
+      void set_pipelining(bool enabled);
       void execute(Request request, request_complete_callback_t callback);
+      // Reads the next part of the decoded body into a buffer owned by the client.
+      // An empty buffer indicates the end of the body.
       void read_body_async(std::size_t size, const body_callback_t &callback);
+      // Pushes the decoded body to sink as it arrives, without buffering the
+      // whole body. The sink may throw std::system_error to abort. Chunked
+      // transfer coding and gzip or deflate content coding are decoded.
+      void stream_body_async(body_sink_t sink, body_complete_callback_t callback);
+      // Stops and restarts reading the body for stream_body_async, so that a
+      // slow sink can hold back the sender.
+      void pause_body();
+      void resume_body();
 
       std::size_t get_body_length() const
       {
@@ -61,28 +92,91 @@ namespace loopp
       }
 
     private:
-      void send_request();
-      void update_request_headers();
-      void send_body();
+      enum class BodyFraming
+      {
+        None,
+        Length,
+        Chunked,
+        UntilClose,
+      };
+
+      struct Exchange
+      {
+        Request request;
+        request_complete_callback_t callback;
+        bool sent = false;
+        bool retried = false;
+      };
+
+      void start_next();
+      void connect();
+      bool is_same_connection(const Request &request) const;
+      static bool is_idempotent(const Request &request);
+      void send_requests();
+      void write_request(Request &request);
+      void update_request_headers(Request &request);
+      void produce_request_body();
+      void flush_requests();
       void read_response();
+      void read_response_header();
       void handle_response();
-      void parse_status_line(std::istream &response_stream);
-      void parse_headers(std::istream &response_stream);
+      void complete_response();
+      void release_connection();
+      void close_connection();
+      bool process_headers(const Request &request);
+      void read_body_data(std::size_t max_size, const body_complete_callback_t &callback);
+      std::error_code decode_body(const body_sink_t &sink);
+      std::error_code deliver_body(loopp::utils::string_view data, const body_sink_t &sink);
+      void complete_body_read(std::error_code ec, const body_callback_t &callback);
+      void continue_stream_body();
+      void finish_stream_body(std::error_code ec);
       void handle_error(const std::string &what, std::error_code ec);
 
     private:
+      static const std::size_t max_header_size = 8192;
+      static const std::size_t body_read_size = 2048;
+      static const std::size_t upload_block_size = 2048;
+
       std::shared_ptr<loopp::core::MainLoop> loop;
+      std::shared_ptr<ConnectionPool> pool;
       std::shared_ptr<loopp::net::Stream> sock;
-      loopp::http::Request request;
+      std::string sock_scheme;
+      std::string sock_host;
+      int sock_port = 0;
+      bool sock_reused = false;
+      std::size_t responses_on_connection = 0;
+      std::deque<Exchange> exchanges;
       loopp::http::Response response;
-      request_complete_callback_t complete_callback;
+      ResponseParser parser;
 
+      bool pipelining = false;
+      bool connecting = false;
+      bool writing = false;
+      bool uploading = false;
+      bool upload_chunked = false;
+      std::size_t upload_left = 0;
+      Request::content_producer_t upload_producer;
+      bool awaiting_response = false;
+      bool response_active = false;
       bool keep_alive = false;
+      bool reusable = false;
       std::size_t body_length = 0;
       std::size_t body_length_left = 0;
+      BodyFraming framing = BodyFraming::None;
+      bool body_done = true;
+      ChunkedDecoder chunked_decoder;
+      std::unique_ptr<Inflater> inflater;
+      body_sink_t body_sink;
+      body_complete_callback_t body_complete;
+      bool body_paused = false;
+      bool body_read_deferred = false;
 
       loopp::net::StreamBuffer request_buffer;
       loopp::net::StreamBuffer response_buffer;
+      // Data of pipelined responses received together with the previous response.
+      loopp::net::StreamBuffer pipeline_buffer;
+      // Decoded body data for read_body_async.
+      loopp::net::StreamBuffer body_buffer;
 
       const char *client_cert = nullptr;
       const char *client_key = nullptr;
@@ -34,7 +34,9 @@ namespace loopp
       Timeout = 1,
       InternalError,
       ProtocolError,
-      InvalidURI
+      InvalidURI,
+      InvalidEncoding,
+      Cancelled
     };
 
     std::error_code make_error_code(HttpErrc);
@@ -0,0 +1,90 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_HTTP_INFLATER_HPP
+#define LOOPP_HTTP_INFLATER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <system_error>
+
+#include "rom/miniz.h"
+
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace http
+  {
+    // Streaming decoder for the gzip and deflate content codings, based on
+    // the tinfl decompressor in ROM. Output is produced in pieces of at most
+    // the 32 KiB deflate window.
+    class Inflater
+    {
+    public:
+      enum class Format
+      {
+        Deflate,
+        Gzip,
+      };
+
+      using output_callback_t = std::function<void(loopp::utils::string_view data)>;
+
+      explicit Inflater(Format format);
+      ~Inflater() = default;
+
+      Inflater(const Inflater &) = delete;
+      Inflater &operator=(const Inflater &) = delete;
+
+      std::error_code inflate(loopp::utils::string_view input, const output_callback_t &output);
+
+      bool done() const
+      {
+        return state == State::Done;
+      }
+
+    private:
+      enum class State
+      {
+        Header,
+        Data,
+        Done,
+      };
+
+      bool parse_gzip_header(loopp::utils::string_view &input);
+
+    private:
+      Format format;
+      State state = State::Header;
+      std::unique_ptr<tinfl_decompressor> decompressor;
+      std::unique_ptr<uint8_t[]> window;
+      std::size_t window_pos = 0;
+      uint32_t flags = 0;
+
+      // gzip header parsing
+      std::size_t header_pos = 0;
+      uint8_t header_flags = 0;
+      std::size_t extra_left = 0;
+    };
+  } // namespace http
+} // namespace loopp
+
+#endif // LOOPP_HTTP_INFLATER_HPP
@@ -21,11 +21,16 @@
 #ifndef LOOPP_HTTP_REQUEST_HPP
 #define LOOPP_HTTP_REQUEST_HPP
 
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <memory>
 #include <string>
 #include <map>
 
 #include "loopp/http/Headers.hpp"
 #include "loopp/http/Uri.hpp"
+#include "loopp/net/StreamBuffer.hpp"
 
 namespace loopp
 {
@@ -34,6 +39,13 @@ namespace loopp
     class Request
     {
     public:
+      // Fills buffer with at most size bytes of the body and returns the
+      // number of bytes written. Returning 0 ends the body. May throw
+      // std::system_error to abort the request.
+      using content_producer_t = std::function<std::size_t(char *buffer, std::size_t size)>;
+
+      static const std::size_t UNKNOWN_LENGTH = static_cast<std::size_t>(-1);
+
       Request(const std::string &method, const std::string &uri)
         : method_(method)
         , uri_(uri)
@@ -95,19 +107,52 @@ namespace loopp
 
       void content(std::string content)
       {
-        content_ = content;
+        content_ = std::move(content);
       }
 
-      void append_content(std::string content)
+      void append_content(const std::string &content)
       {
         content_ += content;
       }
 
-      std::string content() const
+      const std::string &content() const
       {
         return content_;
       }
 
+      // Produces the body while it is sent, instead of holding it in memory.
+      // A body of unknown length is sent with the chunked transfer coding.
+      void content_producer(content_producer_t producer, std::size_t length = UNKNOWN_LENGTH)
+      {
+        content_.clear();
+        producer_ = std::move(producer);
+        content_length_ = length;
+      }
+
+      // Sends the data in source as body. The data is consumed from source as it is sent.
+      void content_source(std::shared_ptr<loopp::net::StreamBuffer> source)
+      {
+        std::size_t length = source->consume_size();
+        content_producer(
+          [source](char *buffer, std::size_t size) {
+            size = std::min(size, source->consume_size());
+            memcpy(buffer, source->consume_data(), size);
+            source->consume_commit(size);
+            return size;
+          },
+          length);
+      }
+
+      const content_producer_t &content_producer() const
+      {
+        return producer_;
+      }
+
+      std::size_t content_length() const
+      {
+        return producer_ ? content_length_ : content_.size();
+      }
+
       Headers &headers()
       {
         return headers_;
@@ -126,6 +171,8 @@ namespace loopp
       Uri uri_;
       Headers headers_;
       std::string content_;
+      content_producer_t producer_;
+      std::size_t content_length_ = 0;
     };
 
     std::ostream &operator<<(std::ostream &stream, const Request &request);
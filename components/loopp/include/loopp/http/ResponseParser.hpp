@@ -0,0 +1,141 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_HTTP_RESPONSEPARSER_HPP
+#define LOOPP_HTTP_RESPONSEPARSER_HPP
+
+#include <array>
+#include <cstddef>
+
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace http
+  {
+    // Small flat map of header fields that refer into the receive buffer.
+    class HeaderView
+    {
+    public:
+      using field_t = std::pair<loopp::utils::string_view, loopp::utils::string_view>;
+
+      static const std::size_t max_fields = 24;
+
+      bool add(loopp::utils::string_view name, loopp::utils::string_view value);
+      void clear();
+
+      bool has(loopp::utils::string_view name) const;
+      loopp::utils::string_view find(loopp::utils::string_view name) const;
+
+      std::size_t size() const
+      {
+        return count;
+      }
+
+      const field_t *begin() const
+      {
+        return fields.data();
+      }
+
+      const field_t *end() const
+      {
+        return fields.data() + count;
+      }
+
+    private:
+      std::array<field_t, max_fields> fields;
+      std::size_t count = 0;
+    };
+
+    // Incremental HTTP/1.1 response header parser. It works in place: the parsed
+    // status line and headers refer into the data passed to parse() and remain
+    // valid only as long as that data is not moved or overwritten.
+    //
+    // Fields beyond HeaderView::max_fields are dropped, except the fields that
+    // determine the framing of the body, for which room is always kept.
+    class ResponseParser
+    {
+    public:
+      enum class Result
+      {
+        Incomplete,
+        Complete,
+        Invalid,
+      };
+
+      void reset();
+
+      // Parses a response header. Call again with the same (grown) data after
+      // Incomplete. The search for the end of the header resumes where the
+      // previous call stopped. The fields are split in a second pass over the
+      // complete header, as the data may have moved between calls.
+      Result parse(const char *data, std::size_t size);
+
+      std::size_t header_size() const
+      {
+        return header_size_;
+      }
+
+      loopp::utils::string_view http_version() const
+      {
+        return http_version_;
+      }
+
+      int status_code() const
+      {
+        return status_code_;
+      }
+
+      loopp::utils::string_view status_message() const
+      {
+        return status_message_;
+      }
+
+      const HeaderView &headers() const
+      {
+        return headers_;
+      }
+
+      std::size_t dropped_fields() const
+      {
+        return dropped_fields_;
+      }
+
+      static bool iequals(loopp::utils::string_view a, loopp::utils::string_view b);
+      static bool parse_size(loopp::utils::string_view s, std::size_t &value);
+
+    private:
+      Result parse_header(const char *data, std::size_t size);
+      static loopp::utils::string_view trim(loopp::utils::string_view s);
+      static bool is_framing_field(loopp::utils::string_view name);
+
+    private:
+      std::size_t scan_pos = 0;
+      std::size_t header_size_ = 0;
+      loopp::utils::string_view http_version_;
+      int status_code_ = 0;
+      loopp::utils::string_view status_message_;
+      HeaderView headers_;
+      std::size_t dropped_fields_ = 0;
+    };
+  } // namespace http
+} // namespace loopp
+
+#endif // LOOPP_HTTP_RESPONSEPARSER_HPP
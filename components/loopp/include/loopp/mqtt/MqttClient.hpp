@@ -21,13 +21,27 @@
 #ifndef LOOPP_MQTT_MQTTCLIENT_HPP
 #define LOOPP_MQTT_MQTTCLIENT_HPP
 
+#include <bitset>
+#include <chrono>
+#include <deque>
 #include <string>
 #include <memory>
 #include <list>
+#include <map>
+#include <set>
 #include <system_error>
+#include <utility>
+#include <vector>
 
+#include "loopp/compress/HeatshrinkEncoder.hpp"
+#include "loopp/core/Mutex.hpp"
+#include "loopp/mqtt/MqttPacket.hpp"
+#include "loopp/mqtt/MqttProperties.hpp"
+#include "loopp/mqtt/PublishQueue.hpp"
+#include "loopp/mqtt/TopicTrie.hpp"
 #include "loopp/net/Stream.hpp"
 #include "loopp/utils/bitmask.hpp"
+#include "loopp/utils/string_view.hpp"
 
 namespace loopp
 {
@@ -37,6 +51,56 @@ namespace loopp
     {
       None = 0,
       Retain = 0b00000001u,
+      QosMask = 0b00000110u,
+      Qos0 = 0b00000000u,
+      Qos1 = 0b00000010u,
+      Qos2 = 0b00000100u,
+    };
+
+    // State of the reconnect circuit breaker. The circuit opens after too many
+    // consecutive failed connection attempts; while open, no attempts are made.
+    // After the open period a single attempt is made in the half-open state.
+    enum class CircuitState
+    {
+      Closed,
+      Open,
+      HalfOpen,
+    };
+
+    // MQTT 5 properties of a published message. Ignored when the client speaks MQTT 3.1.1.
+    struct PublishProperties
+    {
+      std::string content_type;
+      std::list<std::pair<std::string, std::string>> user_properties;
+      std::uint32_t message_expiry_interval = 0;
+    };
+
+    struct PublishStatistics
+    {
+      std::size_t published = 0;
+      std::size_t acknowledged = 0;
+      std::size_t retransmitted = 0;
+      std::size_t failed = 0;
+      std::chrono::milliseconds last_ack_latency{ 0 };
+      std::chrono::milliseconds max_ack_latency{ 0 };
+      std::chrono::milliseconds total_ack_latency{ 0 };
+      std::size_t queue_depth = 0;
+      std::size_t queue_bytes = 0;
+      std::size_t queue_dropped = 0;
+      std::size_t compressed = 0;
+      std::size_t uncompressed_bytes = 0;
+      std::size_t compressed_bytes = 0;
+      std::chrono::microseconds compression_time{ 0 };
+
+      std::chrono::milliseconds average_ack_latency() const
+      {
+        return acknowledged > 0 ? total_ack_latency / static_cast<int>(acknowledged) : std::chrono::milliseconds(0);
+      }
+
+      double compression_ratio() const
+      {
+        return compressed_bytes > 0 ? static_cast<double>(uncompressed_bytes) / compressed_bytes : 0.0;
+      }
     };
   }
 
@@ -44,11 +108,25 @@ namespace loopp
 
   namespace mqtt
   {
+    class PublishWriter;
+
     // TODO: split class
     class MqttClient : public std::enable_shared_from_this<MqttClient>
     {
+      static constexpr std::size_t max_packet_ids = 256;
+
     public:
-      using subscribe_callback_t = std::function<void(const std::string &topic, const std::string &payload)>;
+      // The topic and payload refer to the receive buffer and are only valid during the callback.
+      using subscribe_callback_t = std::function<void(loopp::utils::string_view topic, loopp::utils::string_view payload)>;
+      using publish_callback_t = std::function<void(std::error_code ec)>;
+      // Receives the payload of a message in consecutive chunks. The chunk starts at offset within a payload of
+      // total bytes; the last chunk ends at total. A connection failure before the end of the payload is reported
+      // with an error and an empty chunk.
+      using stream_callback_t = std::function<void(std::error_code ec,
+                                                   loopp::utils::string_view topic,
+                                                   loopp::utils::string_view chunk,
+                                                   std::size_t offset,
+                                                   std::size_t total)>;
 
       MqttClient(std::shared_ptr<loopp::core::MainLoop> loop, std::string client_id, std::string host, int port);
       ~MqttClient();
@@ -62,31 +140,123 @@ namespace loopp
       void set_password(std::string password);
       void set_will(std::string topic, std::string data);
       void set_will_retain(bool retain);
+      void set_max_inflight(std::size_t max_inflight);
+      void set_offline_queue(std::size_t byte_budget, DropPolicy policy = DropPolicy::DropOldest);
+      void set_offline_queue_drain_rate(std::size_t messages_per_second);
+      void set_topic_priority(const std::string &topic, int priority);
+      void set_protocol_version(ProtocolVersion version);
+      void set_session_expiry(std::uint32_t seconds);
+      void set_compression(const std::string &topic,
+                           int window_bits = loopp::compress::HeatshrinkEncoder::default_window_bits,
+                           int lookahead_bits = loopp::compress::HeatshrinkEncoder::default_lookahead_bits);
+      void clear_compression(const std::string &topic);
+      void set_clean_session(bool clean_session);
+      void set_keep_alive(std::chrono::seconds keep_alive);
+      void set_response_timeout(std::chrono::seconds timeout);
+      void set_reconnect_backoff(std::chrono::milliseconds initial_delay, std::chrono::milliseconds max_delay);
+      void set_circuit_breaker(std::size_t failure_threshold, std::chrono::milliseconds open_duration);
 
       void connect();
       void disconnect();
-      void publish(const std::string &topic, const std::string &payload, PublishOptions options = PublishOptions::None);
+      void publish(const std::string &topic,
+                   const std::string &payload,
+                   PublishOptions options = PublishOptions::None,
+                   publish_callback_t callback = publish_callback_t(),
+                   const PublishProperties &properties = PublishProperties());
+      void publish(const std::string &topic,
+                   std::string &&payload,
+                   PublishOptions options = PublishOptions::None,
+                   publish_callback_t callback = publish_callback_t(),
+                   const PublishProperties &properties = PublishProperties());
+      PublishWriter begin_publish(const std::string &topic,
+                                  PublishOptions options = PublishOptions::None,
+                                  const PublishProperties &properties = PublishProperties(),
+                                  std::size_t payload_size = 0);
       void subscribe(const std::string &topic);
       void unsubscribe(const std::string &topic);
 
       void add_filter(const std::string &filter, subscribe_callback_t callback);
       void remove_filter(const std::string &filter);
+      void add_stream_filter(const std::string &filter, stream_callback_t callback);
+      void remove_stream_filter(const std::string &filter);
+      // Stops and restarts reading a streamed message, so that a slow stream
+      // filter can hold back the sender. Other packets are not read either,
+      // so a pause must be shorter than the response timeout.
+      void pause_stream();
+      void resume_stream();
 
       loopp::core::Property<bool> &connected();
+      loopp::core::Property<CircuitState> &circuit_state();
+      bool can_publish();
+      bool is_backpressured() const;
+      const PublishStatistics &get_publish_statistics() const;
+
+    private:
+      enum class InflightState
+      {
+        PubAck,
+        PubRec,
+        PubComp
+      };
+
+      struct InflightPublish
+      {
+        std::uint16_t packet_id = 0;
+        InflightState state = InflightState::PubAck;
+        std::shared_ptr<MqttPacket> packet;
+        std::chrono::steady_clock::time_point send_time;
+        bool sent = false;
+        publish_callback_t callback;
+      };
+
+      struct Compression
+      {
+        int window_bits;
+        int lookahead_bits;
+      };
+
+      struct PendingPublish
+      {
+        std::shared_ptr<MqttPacket> packet;
+        PublishOptions options;
+        publish_callback_t callback;
+      };
 
     private:
       void send_connect();
       void send_ping();
-      void send_publish(const std::string &topic, const std::string &payload, PublishOptions options = PublishOptions::None);
+      void schedule_keep_alive();
+      void check_keep_alive();
+      void stop_keep_alive();
+      std::shared_ptr<MqttPacket> acquire_packet();
+      void commit_publish(std::shared_ptr<MqttPacket> packet, const std::string &topic, PublishOptions options, publish_callback_t callback);
+      void queue_publish(std::shared_ptr<MqttPacket> packet, const std::string &topic, PublishOptions options, publish_callback_t callback);
+      void start_draining();
+      void stop_draining();
+      void drain_offline_queue();
+      void update_queue_statistics();
+      void update_compression_statistics(std::size_t input_size, std::size_t output_size, std::chrono::microseconds time);
+      void send_publish(std::shared_ptr<MqttPacket> packet, PublishOptions options, publish_callback_t callback);
+      void write_publish(std::shared_ptr<MqttPacket> packet, publish_callback_t callback);
+      void send_pending_publishes();
+      std::size_t send_window() const;
+      void send_inflight(InflightPublish &publish);
+      void send_ack(PacketType type, std::uint16_t packet_id);
+      void complete_publish(std::uint16_t packet_id, std::error_code ec);
+      void cancel_publishes(std::error_code ec);
+      std::uint16_t allocate_packet_id();
+      void release_packet_id(std::uint16_t packet_id);
       void send_subscribe(const std::list<std::string> &topics);
       void send_unsubscribe(const std::list<std::string> &topics);
 
       void async_read_control_packet();
       void async_read_remaining_length();
       void async_read_payload();
+      void async_read_stream();
 
       void handle_control_packet();
       void handle_remaining_length();
+      void handle_stream(std::size_t size);
 
       std::error_code handle_payload();
       std::error_code handle_connect_ack();
@@ -98,10 +268,20 @@ namespace loopp
       std::error_code handle_subscribe_ack();
       std::error_code handle_unsubscribe_ack();
       std::error_code handle_ping_response();
+      std::error_code handle_disconnect();
 
       void handle_error(const std::string &what, std::error_code ec);
+      void schedule_reconnect();
       std::error_code verify(const std::string &what, std::size_t actual_size, std::size_t expect_size, std::error_code ec = std::error_code());
-      bool match_topic(const std::string &topic, const std::string &filter);
+      std::error_code read_packet_id(const std::string &what, std::uint16_t &packet_id);
+      std::uint8_t read_reason_code() const;
+      std::size_t read_publish_header(const std::uint8_t *data, std::size_t size, loopp::utils::string_view &topic, std::uint16_t &packet_id);
+      bool is_new_publish(std::uint16_t packet_id);
+      void acknowledge_publish(std::uint16_t packet_id);
+      void read_connect_properties(const std::uint8_t *data, std::size_t size);
+      void dispatch(loopp::utils::string_view topic, loopp::utils::string_view payload);
+      void dispatch_stream(std::error_code ec, loopp::utils::string_view chunk);
+      void abort_stream(std::error_code ec);
 
     private:
       std::shared_ptr<loopp::core::MainLoop> loop;
@@ -111,6 +291,15 @@ namespace loopp
       int port = 0;
       std::string username;
       std::string password;
+      ProtocolVersion protocol_version = ProtocolVersion::Mqtt311;
+      bool clean_session = true;
+      std::uint32_t session_expiry = 0;
+      bool session_created = false;
+      bool subscriptions_changed = false;
+      std::size_t receive_maximum = max_packet_ids;
+      std::uint32_t maximum_packet_size = 0;
+      std::uint16_t topic_alias_maximum = 0;
+      std::map<std::string, std::uint16_t> topic_aliases;
       std::string will_topic;
       std::string will_data;
       bool will_retain = false;
@@ -121,17 +310,93 @@ namespace loopp
       std::size_t remaining_length = 0;
       int remaining_length_multiplier = 1;
       uint8_t fixed_header = 0;
-      loopp::core::MainLoop::timer_id ping_timer = 0;
-      int packet_id = 0;
+      std::chrono::seconds keep_alive{ default_keep_alive_sec };
+      std::chrono::seconds server_keep_alive{ 0 };
+      std::chrono::seconds response_timeout{ default_response_timeout_sec };
+      std::chrono::steady_clock::time_point last_sent;
+      std::chrono::steady_clock::time_point ping_sent;
+      bool ping_pending = false;
+      loopp::core::MainLoop::timer_id keep_alive_timer = 0;
       subscribe_callback_t subscribe_callback;
       loopp::core::Property<bool> connected_property{ false };
-      int pending_ping_count = 0;
       std::list<std::string> subscriptions;
-      std::map<std::string, subscribe_callback_t> filters;
+      std::map<std::uint16_t, std::list<std::string>> pending_subscribes;
+      std::map<std::uint16_t, std::list<std::string>> pending_unsubscribes;
+      std::list<std::string> unsent_unsubscribes;
+      TopicTrie<subscribe_callback_t> filters;
+      bool dispatching = false;
+      std::list<std::pair<std::string, subscribe_callback_t>> deferred_filters;
+      TopicTrie<stream_callback_t> stream_filters;
+      std::vector<stream_callback_t> stream_sinks;
+      std::string stream_topic;
+      std::uint16_t stream_packet_id = 0;
+      std::size_t stream_read = 0;
+      std::size_t stream_offset = 0;
+      std::size_t stream_size = 0;
+      bool stream_paused = false;
+      bool stream_read_deferred = false;
+      std::size_t max_inflight = default_max_inflight;
+      std::list<InflightPublish> inflight;
+      std::deque<PendingPublish> pending_publishes;
+      std::set<std::uint16_t> received_packet_ids;
+      std::bitset<max_packet_ids> packet_ids;
+      std::uint16_t next_packet_id = 1;
+      PublishStatistics publish_statistics;
+      loopp::core::Mutex packet_pool_mutex;
+      std::vector<std::shared_ptr<MqttPacket>> packet_pool;
+      std::shared_ptr<MqttPacket> ping_packet;
+      std::unique_ptr<PublishQueue> offline_queue;
+      std::map<std::string, int> topic_priorities;
+      std::map<std::string, Compression> compressed_topics;
+      std::chrono::milliseconds drain_interval{ 1000 / default_drain_rate };
+      loopp::core::MainLoop::timer_id drain_timer = 0;
+      std::chrono::milliseconds reconnect_initial_delay{ default_reconnect_initial_delay_ms };
+      std::chrono::milliseconds reconnect_max_delay{ default_reconnect_max_delay_ms };
+      std::size_t reconnect_attempts = 0;
+      loopp::core::MainLoop::timer_id reconnect_timer = 0;
+      std::size_t circuit_failure_threshold = default_circuit_failure_threshold;
+      std::chrono::milliseconds circuit_open_duration{ default_circuit_open_duration_ms };
+      loopp::core::Property<CircuitState> circuit_state_property{ CircuitState::Closed };
+
+      static constexpr int default_keep_alive_sec = 60;
+      static constexpr int default_response_timeout_sec = 30;
+      static constexpr std::size_t default_max_inflight = 4;
+      static constexpr std::size_t default_drain_rate = 10;
+      static constexpr std::size_t packet_pool_size = 4;
+      static constexpr std::size_t max_buffered_packet_size = 8 * 1024;
+      static constexpr std::size_t stream_chunk_size = 2048;
+      static constexpr int default_reconnect_initial_delay_ms = 1000;
+      static constexpr int default_reconnect_max_delay_ms = 60 * 1000;
+      static constexpr std::size_t default_circuit_failure_threshold = 10;
+      static constexpr int default_circuit_open_duration_ms = 5 * 60 * 1000;
+
+      friend class PublishWriter;
+    };
+
+    // Builds the payload of a PUBLISH packet in place. The packet header is
+    // written when the packet is sent. The payload of a topic with compression
+    // enabled is compressed while it is written.
+    class PublishWriter
+    {
+    public:
+      PublishWriter(std::shared_ptr<MqttClient> client,
+                    std::shared_ptr<MqttPacket> packet,
+                    const std::string &topic,
+                    PublishOptions options);
+
+      std::streambuf &get_buffer();
+      void append(const char *data, std::size_t size);
+      void commit(MqttClient::publish_callback_t callback = MqttClient::publish_callback_t());
+
+    private:
+      std::shared_ptr<MqttClient> client;
+      std::shared_ptr<MqttPacket> packet;
+      // Topic as passed by the caller, without a compression suffix.
+      std::string topic;
+      PublishOptions options;
+      std::unique_ptr<loopp::compress::HeatshrinkEncoder> encoder;
 
-      static constexpr int ping_interval_sec = 15;
-      static constexpr int keep_alive_sec = 60;
-      static constexpr int pending_ping_count_limit = 5;
+      friend class MqttClient;
     };
   } // namespace mqtt
 } // namespace loopp
@@ -33,7 +33,11 @@ namespace loopp
       Timeout = 1,
       InternalError,
       ProtocolError,
-      NotConnected
+      NotConnected,
+      MessageDropped,
+      PacketTooLarge,
+      Rejected,
+      ServerDisconnected
     };
 
     std::error_code make_error_code(MqttErrc);
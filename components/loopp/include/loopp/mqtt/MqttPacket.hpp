@@ -21,8 +21,9 @@
 #ifndef LOOPP_MQTT_MQTTPACKET_HPP
 #define LOOPP_MQTT_MQTTPACKET_HPP
 
+#include <cstdint>
 #include <string>
-#include <iostream>
+#include <memory>
 
 #include "loopp/net/StreamBuffer.hpp"
 #include "loopp/utils/bitmask.hpp"
@@ -49,6 +50,12 @@ namespace loopp
       Disconnect = 14,
     };
 
+    enum class ProtocolVersion : std::uint8_t
+    {
+      Mqtt311 = 4,
+      Mqtt5 = 5,
+    };
+
     enum class ConnectFlags : uint8_t
     {
       None = 0,
@@ -73,20 +80,78 @@ namespace loopp
     class MqttPacket
     {
     public:
-      MqttPacket();
+      MqttPacket() = default;
 
-      void add(uint8_t value);
-      void append(const std::string &s);
+      void begin(loopp::mqtt::PacketType type, std::uint8_t flags, std::size_t remaining_length);
+      void add(std::uint8_t value);
       void add(const std::string &str);
-      void add_length(std::size_t size);
-      void add_fixed_header(loopp::mqtt::PacketType type, std::uint8_t flags);
+      template<std::size_t N>
+      void add(const char (&str)[N]);
+      void add_uint16(std::uint16_t value);
+      void add_packet_id(std::uint16_t id);
+      void append(const char *data, std::size_t size);
+      void add_properties(const std::string &properties);
+      void begin_publish(ProtocolVersion version,
+                         const std::string &topic,
+                         std::uint8_t flags,
+                         const std::string &properties,
+                         std::size_t payload_size = 0);
+      void complete_publish(std::uint16_t topic_alias = 0, bool omit_topic = false);
+      void set_packet_id(std::uint16_t id);
+      void set_payload(std::string &&payload);
+      void rewind();
+      void set_duplicate();
+      void clear();
+      const std::string &get_topic() const noexcept;
       loopp::net::StreamBuffer &get_buffer();
+      loopp::net::StreamBuffer *get_payload_buffer();
       std::size_t size() const noexcept;
 
+      // Fixed header byte plus a remaining length of up to four bytes.
+      static constexpr std::size_t max_fixed_header_size = 5;
+
+      static constexpr std::size_t string_size(std::size_t length)
+      {
+        return 2 + length;
+      }
+
+      static constexpr std::size_t length_size(std::size_t remaining_length)
+      {
+        return remaining_length < 0x80 ? 1 : remaining_length < 0x4000 ? 2 : remaining_length < 0x200000 ? 3 : 4;
+      }
+
+      static constexpr std::size_t properties_size(std::size_t length)
+      {
+        return length_size(length) + length;
+      }
+
+      static constexpr std::size_t packet_size(std::size_t remaining_length)
+      {
+        return 1 + length_size(remaining_length) + remaining_length;
+      }
+
+    private:
+      void add_string(const char *str, std::size_t size);
+      void add_length(std::size_t size);
+
     private:
       loopp::net::StreamBuffer buffer;
-      std::ostream stream;
+      std::unique_ptr<loopp::net::StreamBuffer> payload_buffer;
+      std::size_t start = 0;
+      ProtocolVersion version = ProtocolVersion::Mqtt311;
+      std::string topic;
+      std::uint8_t flags = 0;
+      std::uint16_t packet_id = 0;
+      std::size_t header_size = 0;
+      std::size_t publish_properties_size = 0;
     };
+
+    template<std::size_t N>
+    inline void
+    MqttPacket::add(const char (&str)[N])
+    {
+      add_string(str, N - 1);
+    }
   } // namespace mqtt
 
   DEFINE_BITMASK(mqtt::ConnectFlags);
@@ -0,0 +1,117 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_MQTT_MQTTPROPERTIES_HPP
+#define LOOPP_MQTT_MQTTPROPERTIES_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace mqtt
+  {
+    // MQTT 5 property identifiers.
+    enum class PropertyId : std::uint8_t
+    {
+      PayloadFormatIndicator = 0x01,
+      MessageExpiryInterval = 0x02,
+      ContentType = 0x03,
+      ResponseTopic = 0x08,
+      CorrelationData = 0x09,
+      SubscriptionIdentifier = 0x0b,
+      SessionExpiryInterval = 0x11,
+      AssignedClientIdentifier = 0x12,
+      ServerKeepAlive = 0x13,
+      AuthenticationMethod = 0x15,
+      AuthenticationData = 0x16,
+      RequestProblemInformation = 0x17,
+      WillDelayInterval = 0x18,
+      RequestResponseInformation = 0x19,
+      ResponseInformation = 0x1a,
+      ServerReference = 0x1c,
+      ReasonString = 0x1f,
+      ReceiveMaximum = 0x21,
+      TopicAliasMaximum = 0x22,
+      TopicAlias = 0x23,
+      MaximumQos = 0x24,
+      RetainAvailable = 0x25,
+      UserProperty = 0x26,
+      MaximumPacketSize = 0x27,
+      WildcardSubscriptionAvailable = 0x28,
+      SubscriptionIdentifierAvailable = 0x29,
+      SharedSubscriptionAvailable = 0x2a,
+    };
+
+    // Encodes an MQTT 5 property list, without the leading property length.
+    class MqttProperties
+    {
+    public:
+      void add(PropertyId id, std::uint8_t value);
+      void add_uint16(PropertyId id, std::uint16_t value);
+      void add_uint32(PropertyId id, std::uint32_t value);
+      void add(PropertyId id, const std::string &value);
+      void add(PropertyId id, const std::string &name, const std::string &value);
+
+      const std::string &data() const noexcept;
+      std::size_t size() const noexcept;
+      bool empty() const noexcept;
+
+    private:
+      void add_string(const std::string &value);
+
+    private:
+      std::string properties;
+    };
+
+    // Decodes an MQTT 5 property list in place. A malformed list throws a
+    // std::system_error with MqttErrc::ProtocolError.
+    class MqttPropertyReader
+    {
+    public:
+      MqttPropertyReader(const std::uint8_t *data, std::size_t size);
+
+      bool next();
+      PropertyId id() const noexcept;
+      std::uint32_t value() const noexcept;
+      loopp::utils::string_view string() const noexcept;
+      loopp::utils::string_view name() const noexcept;
+
+      // Reads the variable byte integer at data[index] and advances index past it.
+      static std::uint32_t read_length(const std::uint8_t *data, std::size_t size, std::size_t &index);
+
+    private:
+      loopp::utils::string_view read_string();
+
+    private:
+      const std::uint8_t *data = nullptr;
+      std::size_t size = 0;
+      std::size_t index = 0;
+      PropertyId property_id = PropertyId::PayloadFormatIndicator;
+      std::uint32_t integer_value = 0;
+      loopp::utils::string_view string_value;
+      loopp::utils::string_view name_value;
+    };
+  } // namespace mqtt
+} // namespace loopp
+
+#endif // LOOPP_MQTT_MQTTPROPERTIES_HPP
@@ -0,0 +1,86 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_MQTT_PUBLISHQUEUE_HPP
+#define LOOPP_MQTT_PUBLISHQUEUE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "loopp/mqtt/MqttPacket.hpp"
+
+namespace loopp
+{
+  namespace mqtt
+  {
+    enum class PublishOptions : uint8_t;
+
+    enum class DropPolicy
+    {
+      DropOldest,
+      DropNewest,
+      DropLowestPriority,
+    };
+
+    // Holds publishes while the client is offline. The queue is bounded by a
+    // byte budget; when a new message does not fit, the drop policy decides
+    // which message is discarded.
+    class PublishQueue
+    {
+    public:
+      struct Message
+      {
+        std::string topic;
+        std::shared_ptr<MqttPacket> packet;
+        PublishOptions options;
+        std::function<void(std::error_code ec)> callback;
+        int priority = 0;
+
+        std::size_t size() const;
+      };
+
+      PublishQueue(std::size_t byte_budget, DropPolicy policy);
+
+      void push(Message message);
+      bool pop(Message &message);
+
+      bool empty() const;
+      std::size_t size() const;
+      std::size_t bytes() const;
+      std::size_t dropped() const;
+
+    private:
+      void drop(Message &message);
+
+    private:
+      std::deque<Message> queue;
+      std::size_t byte_budget = 0;
+      DropPolicy policy = DropPolicy::DropOldest;
+      std::size_t queued_bytes = 0;
+      std::size_t dropped_count = 0;
+    };
+  } // namespace mqtt
+} // namespace loopp
+
+#endif // LOOPP_MQTT_PUBLISHQUEUE_HPP
@@ -0,0 +1,85 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_MQTT_PUBLISHSCHEDULER_HPP
+#define LOOPP_MQTT_PUBLISHSCHEDULER_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+
+#include "loopp/core/MainLoop.hpp"
+
+namespace loopp
+{
+  namespace mqtt
+  {
+    // Runs periodic publish tasks at a fixed phase within their period, so
+    // that a fleet of devices that were powered on at the same moment does
+    // not publish at the same moment. The phase is derived from a stable
+    // device id, or from a slot assigned by the server. Ticks are aligned to
+    // the wall clock, so devices with synchronized clocks keep their relative
+    // phases; without a synchronized clock the phases are still spread.
+    class PublishScheduler
+    {
+    public:
+      using id_t = std::uint32_t;
+      using callback_t = std::function<void()>;
+
+      explicit PublishScheduler(std::shared_ptr<loopp::core::MainLoop> loop);
+      ~PublishScheduler();
+
+      PublishScheduler(const PublishScheduler &) = delete;
+      PublishScheduler &operator=(const PublishScheduler &) = delete;
+
+      void set_phase_from_id(const std::string &id);
+      void set_slot(std::uint32_t slot, std::uint32_t slot_count);
+      std::chrono::milliseconds get_offset(std::chrono::milliseconds period) const;
+
+      id_t add(std::chrono::milliseconds period, callback_t callback);
+      void remove(id_t id);
+
+    private:
+      struct Task
+      {
+        std::chrono::milliseconds period;
+        callback_t callback;
+        std::chrono::milliseconds next{ 0 };
+        loopp::core::MainLoop::timer_id timer = 0;
+      };
+
+      void set_phase(std::uint32_t phase);
+      void schedule(id_t id, Task &task, bool align);
+      void on_timer(id_t id);
+
+    private:
+      std::shared_ptr<loopp::core::MainLoop> loop;
+      // Fraction of the period, in units of 2^-32.
+      std::uint32_t phase = 0;
+      std::map<id_t, Task> tasks;
+      id_t next_id = 1;
+    };
+  } // namespace mqtt
+} // namespace loopp
+
+#endif // LOOPP_MQTT_PUBLISHSCHEDULER_HPP
@@ -0,0 +1,225 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_MQTT_TOPICTRIE_HPP
+#define LOOPP_MQTT_TOPICTRIE_HPP
+
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "loopp/utils/optional.hpp"
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace mqtt
+  {
+    // Maps MQTT topic filters, including '+' and '#' wildcards, to values.
+    // A topic is matched one level at a time, so the cost of a lookup depends
+    // on the number of levels in the topic and not on the number of filters.
+    template<typename T>
+    class TopicTrie
+    {
+    public:
+      TopicTrie() = default;
+      TopicTrie(const TopicTrie &) = delete;
+      TopicTrie &operator=(const TopicTrie &) = delete;
+
+      void insert(const std::string &filter, T value)
+      {
+        std::size_t hash = filter.find('#');
+        if (hash != std::string::npos && (hash != filter.size() - 1 || (hash > 0 && filter[hash - 1] != '/')))
+          {
+            throw std::runtime_error("invalid topic filter: " + filter);
+          }
+
+        Node *node = &root;
+        std::size_t pos = 0;
+
+        while (true)
+          {
+            std::size_t end = filter.find('/', pos);
+            std::size_t len = (end == std::string::npos ? filter.size() : end) - pos;
+
+            if (filter.compare(pos, len, "#") == 0)
+              {
+                node->hash_value = std::move(value);
+                return;
+              }
+
+            if (filter.compare(pos, len, "+") == 0)
+              {
+                if (!node->plus)
+                  {
+                    node->plus.reset(new Node);
+                  }
+                node = node->plus.get();
+              }
+            else
+              {
+                std::unique_ptr<Node> &child = node->children[filter.substr(pos, len)];
+                if (!child)
+                  {
+                    child.reset(new Node);
+                  }
+                node = child.get();
+              }
+
+            if (end == std::string::npos)
+              {
+                node->value = std::move(value);
+                return;
+              }
+            pos = end + 1;
+          }
+      }
+
+      void remove(const std::string &filter)
+      {
+        remove(root, filter, 0);
+      }
+
+      // Invokes f(const T &) for every filter that matches topic.
+      template<typename F>
+      void match(loopp::utils::string_view topic, F &&f) const
+      {
+        // Wildcards at the first level do not match topics starting with '$'.
+        bool system_topic = !topic.empty() && topic[0] == '$';
+        match(root, topic, 0, !system_topic, f);
+      }
+
+      bool empty() const
+      {
+        return root.empty();
+      }
+
+    private:
+      struct LevelLess
+      {
+        using is_transparent = void;
+
+        bool operator()(loopp::utils::string_view lhs, loopp::utils::string_view rhs) const
+        {
+          return lhs.compare(rhs) < 0;
+        }
+      };
+
+      struct Node
+      {
+        std::map<std::string, std::unique_ptr<Node>, LevelLess> children;
+        std::unique_ptr<Node> plus;
+        nonstd::optional<T> value;
+        nonstd::optional<T> hash_value;
+
+        bool empty() const
+        {
+          return children.empty() && !plus && !value && !hash_value;
+        }
+      };
+
+      template<typename F>
+      void match(const Node &node, loopp::utils::string_view topic, std::size_t pos, bool wildcards, F &f) const
+      {
+        // 'a/#' also matches 'a' itself.
+        if (node.hash_value && wildcards)
+          {
+            f(*node.hash_value);
+          }
+
+        if (pos == std::string::npos)
+          {
+            if (node.value)
+              {
+                f(*node.value);
+              }
+            return;
+          }
+
+        std::size_t end = topic.find('/', pos);
+        std::size_t next = (end == std::string::npos) ? std::string::npos : end + 1;
+        auto it = node.children.find(topic.substr(pos, (end == std::string::npos ? topic.size() : end) - pos));
+        if (it != node.children.end())
+          {
+            match(*it->second, topic, next, true, f);
+          }
+
+        if (node.plus && wildcards)
+          {
+            match(*node.plus, topic, next, true, f);
+          }
+      }
+
+      void remove(Node &node, const std::string &filter, std::size_t pos)
+      {
+        std::size_t end = filter.find('/', pos);
+        std::size_t len = (end == std::string::npos ? filter.size() : end) - pos;
+
+        if (filter.compare(pos, len, "#") == 0)
+          {
+            node.hash_value = nonstd::nullopt;
+            return;
+          }
+
+        std::unique_ptr<Node> *child = &node.plus;
+        auto it = node.children.end();
+        if (filter.compare(pos, len, "+") != 0)
+          {
+            it = node.children.find(loopp::utils::string_view(filter).substr(pos, len));
+            if (it == node.children.end())
+              {
+                return;
+              }
+            child = &it->second;
+          }
+
+        if (*child)
+          {
+            if (end == std::string::npos)
+              {
+                (*child)->value = nonstd::nullopt;
+              }
+            else
+              {
+                remove(**child, filter, end + 1);
+              }
+
+            if ((*child)->empty())
+              {
+                if (it != node.children.end())
+                  {
+                    node.children.erase(it);
+                  }
+                else
+                  {
+                    node.plus.reset();
+                  }
+              }
+          }
+      }
+
+    private:
+      Node root;
+    };
+  } // namespace mqtt
+} // namespace loopp
+
+#endif // LOOPP_MQTT_TOPICTRIE_HPP
@@ -0,0 +1,88 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_NET_DATAGRAMSOCKET_HPP
+#define LOOPP_NET_DATAGRAMSOCKET_HPP
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "loopp/core/MainLoop.hpp"
+#include "loopp/net/Resolver.hpp"
+#include "loopp/net/StreamBuffer.hpp"
+
+namespace loopp
+{
+  namespace net
+  {
+    // A non-blocking UDP socket driven by the main loop. Each send transmits
+    // the data available in the buffer as one datagram; each receive stores
+    // one datagram in the buffer. Sends complete in order.
+    class DatagramSocket : public std::enable_shared_from_this<DatagramSocket>
+    {
+    public:
+      using connect_callback_t = std::function<void(std::error_code ec)>;
+      using io_callback_t = std::function<void(std::error_code ec, std::size_t bytes_transferred)>;
+
+      DatagramSocket(std::shared_ptr<loopp::core::MainLoop> loop);
+      ~DatagramSocket();
+
+      DatagramSocket(const DatagramSocket &) = delete;
+      DatagramSocket &operator=(const DatagramSocket &) = delete;
+
+      // Sets the default destination; a multicast group is used as destination with the configured TTL.
+      void connect(const std::string &host, int port, const connect_callback_t &callback);
+      void bind(int port);
+      void set_multicast_ttl(int ttl);
+
+      void send_async(StreamBuffer &buffer, const io_callback_t &callback);
+      void receive_async(StreamBuffer &buffer, const io_callback_t &callback);
+      void close();
+
+      bool is_open() const;
+
+    private:
+      void open(int family);
+      void on_resolved(struct addrinfo *addr_list, const connect_callback_t &callback);
+      void do_send_async();
+      void do_wait_send_async();
+
+      static constexpr std::size_t max_datagram_size = 1472;
+
+    private:
+      int sock = -1;
+      int multicast_ttl = 1;
+      std::shared_ptr<loopp::core::MainLoop> loop;
+      loopp::net::Resolver &resolver;
+
+      struct SendOperation
+      {
+        StreamBuffer &buffer;
+        io_callback_t callback;
+      };
+
+      std::deque<SendOperation> send_op_queue;
+    };
+  } // namespace net
+} // namespace loopp
+
+#endif // LOOPP_NET_DATAGRAMSOCKET_HPP
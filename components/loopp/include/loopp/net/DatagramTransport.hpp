@@ -0,0 +1,94 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_NET_DATAGRAMTRANSPORT_HPP
+#define LOOPP_NET_DATAGRAMTRANSPORT_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "mbedtls/gcm.h"
+
+#include "loopp/core/MainLoop.hpp"
+#include "loopp/net/DatagramSocket.hpp"
+
+namespace loopp
+{
+  namespace net
+  {
+    struct DatagramStatistics
+    {
+      std::size_t sent = 0;
+      std::size_t failed = 0;
+      std::size_t bytes = 0;
+    };
+
+    // Sends loss tolerant data, such as scan results, to a collector over UDP
+    // unicast or multicast. Every datagram carries a header that lets the
+    // receiver detect lost, duplicated and reordered datagrams:
+    //
+    //   magic "LP" (2) | version (1) | flags (1) | boot id (4) | sequence (4) | device MAC (6)
+    //
+    // The boot id is random per boot and the sequence number restarts at 0.
+    // With a key, the payload is encrypted with AES-GCM and followed by a
+    // 16 byte tag. The header is authenticated as additional data and the
+    // nonce is boot id | sequence | last 4 bytes of the MAC.
+    class DatagramTransport : public std::enable_shared_from_this<DatagramTransport>
+    {
+    public:
+      using connect_callback_t = DatagramSocket::connect_callback_t;
+
+      DatagramTransport(std::shared_ptr<loopp::core::MainLoop> loop);
+      ~DatagramTransport();
+
+      DatagramTransport(const DatagramTransport &) = delete;
+      DatagramTransport &operator=(const DatagramTransport &) = delete;
+
+      // A key of 16, 24 or 32 bytes enables authenticated encryption.
+      void set_key(const std::string &key);
+      void set_multicast_ttl(int ttl);
+      void connect(const std::string &host, int port, const connect_callback_t &callback = connect_callback_t());
+
+      bool send(const std::string &payload);
+      std::size_t max_payload_size() const;
+      const DatagramStatistics &get_statistics() const;
+
+      static constexpr std::size_t header_size = 18;
+      static constexpr std::size_t tag_size = 16;
+
+    private:
+      std::shared_ptr<loopp::core::MainLoop> loop;
+      std::shared_ptr<DatagramSocket> socket;
+      mbedtls_gcm_context gcm;
+      bool authenticated = false;
+      std::uint8_t mac[6] = {};
+      std::uint32_t boot_id = 0;
+      std::uint32_t sequence = 0;
+      DatagramStatistics statistics;
+
+      static constexpr std::size_t max_datagram_size = 1472;
+      static constexpr std::uint8_t version = 1;
+      static constexpr std::uint8_t flag_authenticated = 0x01;
+    };
+  } // namespace net
+} // namespace loopp
+
+#endif // LOOPP_NET_DATAGRAMTRANSPORT_HPP
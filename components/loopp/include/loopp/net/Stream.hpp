@@ -50,6 +50,7 @@ namespace loopp
       void write_async(StreamBuffer &buffer, const io_callback_t &callback);
       void read_async(StreamBuffer &buffer, std::size_t count, const io_callback_t &callback);
       void read_until_async(StreamBuffer &buffer, const std::string &until, const io_callback_t &callback);
+      void read_some_async(StreamBuffer &buffer, std::size_t max_count, const io_callback_t &callback);
       void close();
 
       loopp::core::Property<bool> &connected();
@@ -72,6 +73,7 @@ namespace loopp
       void do_write_async();
       void do_read_async(StreamBuffer &buf, std::size_t count, std::size_t bytes_transferred, const io_callback_t &callback);
       void do_read_until_async(StreamBuffer &buf, const std::string &until, std::size_t bytes_transferred, const io_callback_t &callback);
+      void do_read_some_async(StreamBuffer &buf, std::size_t max_count, const io_callback_t &callback);
       bool match_until(StreamBuffer &buf, std::size_t &start_pos, const std::string &match);
 
     protected:
@@ -24,7 +24,7 @@
 #include <cstring>
 #include <stdexcept>
 #include <streambuf>
-#include <vector>
+#include <string>
 
 namespace loopp
 {
@@ -34,13 +34,17 @@ namespace loopp
     {
     public:
       explicit StreamBuffer(std::size_t max_buffer_size = DEFAULT_MAX_BUFFER_SIZE);
+      explicit StreamBuffer(std::string &&data);
 
       std::size_t max_size() const noexcept;
       char *produce_data(std::size_t n);
       void produce_commit(std::size_t n);
+      void produce_rewind(std::size_t n);
       char *consume_data() const noexcept;
       std::size_t consume_size() const noexcept;
       void consume_commit(std::size_t n);
+      void consume_rewind(std::size_t n);
+      void clear();
 
     private:
       int_type underflow();
@@ -49,7 +53,7 @@ namespace loopp
 
     private:
       std::size_t max_buffer_size;
-      std::vector<char> buffer;
+      std::string buffer;
 
       static constexpr std::size_t BUFFER_INCREASE_SIZE = 100;
       static constexpr std::size_t DEFAULT_MAX_BUFFER_SIZE = 10 * 1024;
@@ -0,0 +1,124 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_OTA_DELTAPATCHER_HPP
+#define LOOPP_OTA_DELTAPATCHER_HPP
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <system_error>
+
+#include "esp_partition.h"
+
+#include "loopp/http/Inflater.hpp"
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace ota
+  {
+    // Reconstructs a firmware image from a delta patch and the image in the
+    // source partition, as created by tools/make_delta.py.
+    //
+    // Patch layout (integers little endian):
+    //
+    //   magic "LPDELTA1" (8) | source size (4) | target size (4) | target SHA-256 (32) | zlib stream
+    //
+    // The zlib stream holds bsdiff style records: diff length (4), extra
+    // length (4), source seek (4, signed), diff length bytes that are added
+    // to the source, followed by extra length bytes that are copied as is.
+    //
+    // Besides the 32 KiB inflate window, the patcher only needs a small
+    // buffer for reading the source partition.
+    class DeltaPatcher
+    {
+    public:
+      using output_callback_t = std::function<void(loopp::utils::string_view data)>;
+
+      DeltaPatcher(const esp_partition_t *source, output_callback_t output);
+      ~DeltaPatcher() = default;
+
+      DeltaPatcher(const DeltaPatcher &) = delete;
+      DeltaPatcher &operator=(const DeltaPatcher &) = delete;
+
+      // Number of bytes is_patch needs to recognize a patch.
+      static constexpr std::size_t MAGIC_SIZE = 8;
+
+      // Returns true if data starts with the patch magic.
+      static bool is_patch(loopp::utils::string_view data);
+
+      // Applies the next part of the patch. The reconstructed image is passed to output.
+      std::error_code apply(loopp::utils::string_view patch);
+
+      // Returns true when the complete target image has been produced.
+      bool done() const;
+
+      std::size_t get_target_size() const
+      {
+        return target_size;
+      }
+
+      // Binary SHA-256 digest of the target image. Empty until the header has been parsed.
+      const std::string &get_target_digest() const
+      {
+        return target_digest;
+      }
+
+    private:
+      enum class State
+      {
+        Header,
+        Control,
+        Diff,
+        Extra,
+      };
+
+      std::error_code parse_header(loopp::utils::string_view &patch);
+      std::error_code process(loopp::utils::string_view data);
+      std::error_code start_record();
+      std::error_code end_record();
+      std::error_code apply_diff(loopp::utils::string_view data);
+
+    private:
+      const esp_partition_t *source;
+      output_callback_t output;
+      loopp::http::Inflater inflater;
+      State state = State::Header;
+      std::error_code error;
+
+      std::string header;
+      std::size_t source_size = 0;
+      std::size_t target_size = 0;
+      std::string target_digest;
+
+      uint8_t control[12];
+      std::size_t control_pos = 0;
+      std::size_t diff_left = 0;
+      std::size_t extra_left = 0;
+      int32_t seek = 0;
+      std::size_t source_pos = 0;
+      std::size_t produced = 0;
+      uint8_t source_buffer[256];
+    };
+  } // namespace ota
+} // namespace loopp
+
+#endif // LOOPP_OTA_DELTAPATCHER_HPP
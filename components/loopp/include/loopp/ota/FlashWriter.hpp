@@ -0,0 +1,206 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_OTA_FLASHWRITER_HPP
+#define LOOPP_OTA_FLASHWRITER_HPP
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "esp_ota_ops.h"
+#include "esp_partition.h"
+
+#include "loopp/core/MainLoop.hpp"
+#include "loopp/core/Mutex.hpp"
+#include "loopp/core/Queue.hpp"
+#include "loopp/core/Semaphore.hpp"
+#include "loopp/core/Task.hpp"
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace ota
+  {
+    // Writes a firmware image to an OTA partition from a separate task. Data
+    // is copied into a ring of buffers on the main loop and written to flash
+    // by the task, so that receiving the image and writing (and erasing)
+    // flash overlap. The task owns the OTA handle.
+    //
+    // The main loop never waits for flash. Data that does not fit in a free
+    // buffer is kept until the task has written one. Receivers pause while
+    // full() and resume from notify_available(), which keeps that backlog at
+    // about one received chunk.
+    //
+    // Must be destroyed on the main loop. The destructor waits until the
+    // writer task has finished the job it is working on.
+    class FlashWriter
+    {
+    public:
+      using complete_callback_t = std::function<void(std::error_code)>;
+      using available_callback_t = std::function<void()>;
+      using output_callback_t = std::function<void(loopp::utils::string_view data)>;
+      // Converts received data into image data on the writer task, e.g. by
+      // decompressing it, and passes the image data to output.
+      using decoder_t = std::function<std::error_code(loopp::utils::string_view data, const output_callback_t &output)>;
+
+      struct Statistics
+      {
+        std::size_t bytes = 0;
+        std::chrono::milliseconds elapsed{ 0 };
+        // Time spent erasing flash.
+        std::chrono::milliseconds erase_time{ 0 };
+        // Time spent writing flash, excluding erasing.
+        std::chrono::milliseconds write_time{ 0 };
+        // Time the receiver was paused waiting for a free buffer.
+        std::chrono::milliseconds stall_time{ 0 };
+      };
+
+      FlashWriter(std::shared_ptr<loopp::core::MainLoop> loop, std::size_t buffer_count, std::size_t buffer_size);
+      ~FlashWriter();
+
+      FlashWriter(const FlashWriter &) = delete;
+      FlashWriter &operator=(const FlashWriter &) = delete;
+
+      // Starts writing an image of image_size bytes (or OTA_SIZE_UNKNOWN) to
+      // partition. With erase_up_front, the writer task erases the image area
+      // at once. Otherwise each flash sector is erased just before it is written.
+      // Calling begin again restarts the image from the beginning; data of the
+      // previous attempt that was not written yet is discarded. The decoder,
+      // if any, runs on the writer task.
+      void begin(const esp_partition_t *partition, std::size_t image_size, bool erase_up_front, decoder_t decoder = decoder_t());
+
+      // Queues data for writing. Never blocks. Throws std::system_error when a
+      // previous write failed.
+      void write(const char *data, std::size_t size);
+
+      // Returns true when all buffers are waiting to be written. The receiver
+      // should pause until notify_available() calls back.
+      bool full() const;
+
+      // Invokes callback on the main loop as soon as a buffer is available.
+      void notify_available(available_callback_t callback);
+
+      // Writes the remaining data, completes the OTA update and invokes callback on the main loop.
+      void finish(complete_callback_t callback);
+
+      Statistics get_statistics() const;
+
+    private:
+      enum class JobType
+      {
+        Begin,
+        Write,
+        Finish,
+        Stop,
+      };
+
+      struct Job
+      {
+      public:
+        Job() = default;
+        Job(JobType type, unsigned generation, int buffer = -1, std::size_t size = 0)
+          : type(type)
+          , generation(generation)
+          , buffer(buffer)
+          , size(size)
+        {
+        }
+
+        JobType type = JobType::Write;
+        // Begin call the job belongs to.
+        unsigned generation = 0;
+        int buffer = -1;
+        std::size_t size = 0;
+
+        // Begin
+        const esp_partition_t *partition = nullptr;
+        std::size_t image_size = OTA_SIZE_UNKNOWN;
+        bool erase_up_front = false;
+        decoder_t decoder;
+      };
+
+      void fill_buffers(const char *data, std::size_t size);
+      void submit_buffer();
+      void submit_finish();
+      void on_buffer_released();
+      std::error_code get_error() const;
+      void set_error(std::error_code ec);
+
+      void writer_task();
+      void do_begin(Job &job);
+      void do_write(int buffer, std::size_t size);
+      void write_image(loopp::utils::string_view data);
+      void write_flash(const char *data, std::size_t size);
+      void do_finish();
+      void do_stop();
+      void release_buffer(int buffer);
+
+    private:
+      std::shared_ptr<loopp::core::MainLoop> loop;
+
+      std::size_t buffer_size;
+      std::vector<std::unique_ptr<char[]>> buffers;
+      loopp::core::Queue<int> free_buffers;
+      loopp::core::Queue<Job> jobs;
+      std::atomic<unsigned> generation{ 0 };
+      // Cleared by the destructor, so that callbacks still queued on the main
+      // loop do nothing.
+      std::shared_ptr<bool> alive;
+      loopp::core::Semaphore stopped{ 1, 0 };
+
+      // Owned by the main loop.
+      int current_buffer = -1;
+      std::size_t current_size = 0;
+      std::string backlog;
+      bool finish_pending = false;
+      std::chrono::steady_clock::time_point wait_start;
+      available_callback_t available_callback;
+
+      // Owned by the writer task.
+      const esp_partition_t *partition = nullptr;
+      std::size_t image_size = OTA_SIZE_UNKNOWN;
+      bool erase_up_front = false;
+      decoder_t decoder;
+      esp_ota_handle_t update_handle = 0;
+      std::size_t erased = 0;
+      std::size_t written = 0;
+      // Decoded image data, collected into buffer sized flash writes.
+      std::unique_ptr<char[]> staging;
+      std::size_t staging_size = 0;
+
+      mutable loopp::core::Mutex mutex;
+      std::error_code error;
+      unsigned error_generation = 0;
+      Statistics statistics;
+      std::chrono::steady_clock::time_point start_time;
+      complete_callback_t complete_callback;
+
+      // Last, so that the task starts after all other members are initialized.
+      loopp::core::Task task;
+    };
+  } // namespace ota
+} // namespace loopp
+
+#endif // LOOPP_OTA_FLASHWRITER_HPP
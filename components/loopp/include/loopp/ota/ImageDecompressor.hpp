@@ -0,0 +1,94 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_OTA_IMAGEDECOMPRESSOR_HPP
+#define LOOPP_OTA_IMAGEDECOMPRESSOR_HPP
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "loopp/compress/HeatshrinkDecoder.hpp"
+#include "loopp/http/Inflater.hpp"
+#include "loopp/utils/string_view.hpp"
+
+namespace loopp
+{
+  namespace ota
+  {
+    // Decompresses a firmware image while it is received. Supported are
+    // gzip and zlib streams, and heatshrink streams with the header
+    // (integers little endian):
+    //
+    //   magic "LPHS" (4) | window bits (1) | lookahead bits (1) | reserved (2) | image size (4)
+    //
+    // tools/compress_image.py creates all three. RAM use is fixed by the
+    // format: the 32 KiB inflate window plus the decompressor state, or the
+    // 2^window bits heatshrink window.
+    class ImageDecompressor
+    {
+    public:
+      using output_callback_t = std::function<void(loopp::utils::string_view data)>;
+
+      // Number of bytes is_compressed needs to recognize a compressed image.
+      static constexpr std::size_t MAGIC_SIZE = 4;
+
+      explicit ImageDecompressor(output_callback_t output);
+      ~ImageDecompressor() = default;
+
+      ImageDecompressor(const ImageDecompressor &) = delete;
+      ImageDecompressor &operator=(const ImageDecompressor &) = delete;
+
+      // Returns true if data starts like one of the supported formats.
+      static bool is_compressed(loopp::utils::string_view data);
+
+      // Decompresses the next part of the image. The result is passed to output.
+      std::error_code decompress(loopp::utils::string_view data);
+
+      // Returns true when the end of the compressed image has been reached.
+      bool done() const;
+
+    private:
+      enum class Format
+      {
+        Unknown,
+        Gzip,
+        Zlib,
+        Heatshrink,
+      };
+
+      static Format detect(loopp::utils::string_view data);
+      std::error_code parse_heatshrink_header(loopp::utils::string_view &data);
+
+    private:
+      output_callback_t output;
+      Format format = Format::Unknown;
+      std::error_code error;
+      std::unique_ptr<loopp::http::Inflater> inflater;
+      std::unique_ptr<loopp::compress::HeatshrinkDecoder> heatshrink;
+      std::string header;
+      std::size_t image_size = 0;
+    };
+  } // namespace ota
+} // namespace loopp
+
+#endif // LOOPP_OTA_IMAGEDECOMPRESSOR_HPP
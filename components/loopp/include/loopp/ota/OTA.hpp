@@ -25,9 +25,14 @@
 #include <memory>
 
 #include "esp_ota_ops.h"
+#include "mbedtls/sha256.h"
 
 #include "loopp/core/MainLoop.hpp"
 #include "loopp/http/HttpClient.hpp"
+#include "loopp/mqtt/MqttClient.hpp"
+#include "loopp/ota/DeltaPatcher.hpp"
+#include "loopp/ota/FlashWriter.hpp"
+#include "loopp/ota/ImageDecompressor.hpp"
 
 namespace loopp
 {
@@ -39,30 +44,112 @@ namespace loopp
       using ota_result_callback_t = std::function<void(std::error_code)>;
 
       OTA(std::shared_ptr<loopp::core::MainLoop> loop);
-      ~OTA() = default;
+      ~OTA();
 
       OTA(const OTA &) = delete;
       OTA &operator=(const OTA &) = delete;
 
       void set_client_certificate(const char *cert, const char *key);
       void set_ca_certificate(const char *cert);
+      // Number and size of the buffers between receiving the image and writing it to flash.
+      void set_write_buffers(std::size_t count, std::size_t size);
+      // Erase the update partition before writing instead of one sector at a time.
+      void set_erase_up_front(bool erase_up_front);
+      // SHA-256 digest (hex) the image must have. For a delta patch or a
+      // compressed image this is the digest of the image written to flash.
+      void set_expected_sha256(const std::string &digest);
+      // PEM encoded ECDSA public key. When set, the image must be signed
+      // with the corresponding private key.
+      void set_signing_key(const char *key);
+      // DER encoded ECDSA signature (hex) of the SHA-256 digest of the image.
+      void set_signature(const std::string &signature);
 
       void upgrade_async(const std::string &url, std::chrono::seconds timeout_duration, const ota_result_callback_t &callback);
+      // Receives the firmware as a single message on topic over an existing MQTT connection.
+      void upgrade_async(std::shared_ptr<loopp::mqtt::MqttClient> mqtt,
+                         const std::string &topic,
+                         std::chrono::seconds timeout_duration,
+                         const ota_result_callback_t &callback);
       void commit();
 
     private:
       void check();
+      void request_firmware();
       void on_http_response(std::error_code ec, const loopp::http::Response &response);
       void retrieve_body();
+      void complete_download();
+      void resume_download(std::error_code ec);
+      void reset_checkpoint();
+      static bool parse_content_range(const std::string &content_range, std::size_t &first, std::size_t &total);
+      void on_mqtt_chunk(std::error_code ec, loopp::utils::string_view chunk, std::size_t offset, std::size_t total);
+      void complete_mqtt(std::error_code ec);
+      void start_timer(std::chrono::seconds timeout_duration);
+      void begin(std::size_t image_size);
+      void write_body(loopp::utils::string_view data);
+      std::error_code verify_image();
+      std::error_code verify_signature(const unsigned char *digest);
+      void finish(const ota_result_callback_t &finish_callback);
 
     private:
       std::shared_ptr<loopp::core::MainLoop> loop;
       std::shared_ptr<loopp::http::HttpClient> client;
+      std::shared_ptr<loopp::mqtt::MqttClient> mqtt;
+      std::string topic;
+      std::string url;
 
       ota_result_callback_t callback;
-      esp_ota_handle_t update_handle = 0;
+      std::shared_ptr<FlashWriter> writer;
+      std::size_t buffer_count = 4;
+      std::size_t buffer_size = 4096;
+      bool erase_up_front = false;
       const esp_partition_t *update_partition = nullptr;
       loopp::core::MainLoop::timer_id timeout_timer = 0;
+      int progress = -1;
+
+      // Progress of an HTTP download, used to resume it with a range request
+      // after the connection failed. Kept in RAM for the current boot only.
+      // The SHA-256 of the image is not part of it: the ImageDecoder keeps
+      // hashing across a resume, as it has seen exactly offset bytes.
+      struct Checkpoint
+      {
+        std::size_t offset = 0;
+        std::size_t total = 0;
+        std::string etag;
+        // False for an encoded (e.g. gzip) body, which is downloaded again from the start.
+        bool resumable = true;
+      };
+
+      // Turns the received data into the image on the flash writer task. The
+      // data is a delta patch or a compressed image if it starts with the
+      // corresponding magic. The main loop only reads the state after the
+      // writer has finished.
+      struct ImageDecoder
+      {
+        ImageDecoder();
+        ~ImageDecoder();
+
+        ImageDecoder(const ImageDecoder &) = delete;
+        ImageDecoder &operator=(const ImageDecoder &) = delete;
+
+        std::error_code decode(loopp::utils::string_view data, const FlashWriter::output_callback_t &output);
+        void write_image(loopp::utils::string_view data);
+
+        mbedtls_sha256_context sha;
+        std::unique_ptr<DeltaPatcher> patcher;
+        std::unique_ptr<ImageDecompressor> decompressor;
+        std::string prefix;
+        bool detected = false;
+        const FlashWriter::output_callback_t *output = nullptr;
+      };
+
+      Checkpoint checkpoint;
+      int resume_attempts = 0;
+      bool write_failed = false;
+      std::string expected_sha256;
+      const char *signing_key = nullptr;
+      std::string signature;
+      bool image_verified = false;
+      std::shared_ptr<ImageDecoder> decoder;
     };
   } // namespace ota
 } // namespace loopp
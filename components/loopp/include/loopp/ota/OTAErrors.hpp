@@ -33,7 +33,12 @@ namespace loopp
       // no 0
       Timeout = 1,
       InternalError,
-      InvalidURI
+      InvalidURI,
+      ImageTooLarge,
+      InvalidImage,
+      FlashError,
+      InvalidPatch,
+      InvalidSignature
     };
 
     std::error_code make_error_code(OTAErrc);
@@ -0,0 +1,143 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_STORAGE_FLASHLOG_HPP
+#define LOOPP_STORAGE_FLASHLOG_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "esp_partition.h"
+
+namespace loopp
+{
+  namespace storage
+  {
+    // Append-only log of timestamped records in a data partition.
+    //
+    // The partition is used as a ring of flash sectors that are erased in
+    // turn, so wear is spread evenly. When the ring is full, the oldest
+    // sector is discarded. Each record moves through a number of states by
+    // clearing one bit of its state byte at a time, which makes every step
+    // safe against power loss: a record that was not completely written
+    // is never returned, and a record is only returned until it is consumed.
+    class FlashLog
+    {
+    public:
+      struct Record
+      {
+        std::uint32_t timestamp = 0;
+        std::string data;
+        std::uint64_t position = 0;
+      };
+
+      struct Statistics
+      {
+        std::size_t appended = 0;
+        std::size_t consumed = 0;
+        std::size_t dropped = 0;
+        std::size_t corrupt = 0;
+        std::size_t erased_sectors = 0;
+      };
+
+      explicit FlashLog(const std::string &partition_label);
+
+      FlashLog(const FlashLog &) = delete;
+      FlashLog &operator=(const FlashLog &) = delete;
+
+      void append(std::uint32_t timestamp, const std::string &data);
+      bool peek(Record &record);
+      bool peek_after(const Record &previous, Record &record);
+      void consume(const Record &record);
+      void discard_before(std::uint32_t timestamp);
+
+      bool empty() const;
+      std::size_t size() const;
+      std::size_t max_record_size() const;
+      const Statistics &get_statistics() const;
+
+    private:
+      enum class RecordState : std::uint8_t
+      {
+        Empty = 0xff,
+        Allocated = 0xfe,
+        Committed = 0xfc,
+        Consumed = 0xf8,
+      };
+
+      struct SectorHeader
+      {
+        std::uint32_t magic;
+        std::uint32_t sequence;
+      };
+
+      struct RecordHeader
+      {
+        RecordState state;
+        std::uint8_t reserved;
+        std::uint16_t length;
+        std::uint32_t timestamp;
+        std::uint32_t crc;
+      };
+
+      // In-memory time index, one entry per sector.
+      struct SectorInfo
+      {
+        bool valid = false;
+        std::uint32_t sequence = 0;
+        std::uint32_t first_timestamp = 0;
+        std::uint32_t last_timestamp = 0;
+        std::size_t pending = 0;
+      };
+
+      void mount();
+      void scan_sector(std::size_t sector);
+      void start_sector(std::size_t sector);
+      void drop_sector(std::size_t sector);
+      bool read_header(std::size_t sector, std::size_t offset, RecordHeader &header);
+      bool read_record(std::size_t sector, std::size_t offset, const RecordHeader &header, Record &record);
+      std::size_t record_size(std::size_t length) const;
+      std::uint64_t read_position() const;
+      void read(std::size_t address, void *data, std::size_t size);
+      void write(std::size_t address, const void *data, std::size_t size);
+      void write_state(std::size_t sector, std::size_t offset, RecordState state);
+      std::uint32_t calculate_crc(const RecordHeader &header, const std::string &data) const;
+
+    private:
+      const esp_partition_t *partition = nullptr;
+      std::vector<SectorInfo> sectors;
+      std::size_t num_sectors = 0;
+      std::uint32_t sequence = 0;
+      std::size_t write_sector = 0;
+      std::size_t write_offset = 0;
+      bool write_sector_started = false;
+      std::size_t read_sector = 0;
+      std::size_t read_offset = 0;
+      std::size_t pending_count = 0;
+      Statistics statistics;
+
+      static constexpr std::uint32_t sector_magic = 0x474f4c46; // "FLOG"
+      static constexpr std::size_t sector_size = SPI_FLASH_SEC_SIZE;
+    };
+  } // namespace storage
+} // namespace loopp
+
+#endif // LOOPP_STORAGE_FLASHLOG_HPP
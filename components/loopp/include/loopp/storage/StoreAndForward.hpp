@@ -0,0 +1,112 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_STORAGE_STOREANDFORWARD_HPP
+#define LOOPP_STORAGE_STOREANDFORWARD_HPP
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "loopp/core/MainLoop.hpp"
+#include "loopp/mqtt/MqttClient.hpp"
+#include "loopp/storage/FlashLog.hpp"
+
+namespace loopp
+{
+  namespace storage
+  {
+    // Publishes JSON payloads to MQTT, or stores them in a flash log while the
+    // client is disconnected or cannot keep up. Stored messages are replayed
+    // oldest first at a limited rate once the client is available again. They
+    // are sent to '<topic>/backfill' as {"time": <timestamp>, "payload": <payload>}.
+    //
+    // Messages larger than a log record are split over several records and
+    // reassembled in memory during replay. Like other messages, they stay in
+    // the log until the broker has them. MQTT 5 publish properties are
+    // only sent with messages that are published directly; replayed
+    // messages do not have them.
+    class StoreAndForward : public std::enable_shared_from_this<StoreAndForward>
+    {
+    public:
+      struct Statistics
+      {
+        // Messages written to the log.
+        std::size_t stored = 0;
+        // Messages published from the log.
+        std::size_t replayed = 0;
+        // Messages that could not be stored.
+        std::size_t rejected = 0;
+        // Split messages of which a part was lost.
+        std::size_t incomplete = 0;
+      };
+
+      StoreAndForward(std::shared_ptr<loopp::core::MainLoop> loop, std::shared_ptr<loopp::mqtt::MqttClient> mqtt, std::shared_ptr<FlashLog> log);
+      ~StoreAndForward();
+
+      void set_replay_rate(std::size_t messages_per_second);
+      void set_max_age(std::chrono::seconds max_age);
+
+      void start();
+      void stop();
+
+      void publish(const std::string &topic,
+                   const std::string &payload,
+                   loopp::mqtt::PublishOptions options = loopp::mqtt::PublishOptions::None,
+                   const loopp::mqtt::PublishProperties &properties = loopp::mqtt::PublishProperties());
+
+      // Largest payload of a message on topic that is stored in a single log record.
+      std::size_t max_record_payload_size(const std::string &topic) const;
+
+      const Statistics &get_statistics() const;
+
+    private:
+      // A message read back from the log.
+      struct StoredMessage
+      {
+        std::string topic;
+        std::string payload;
+        loopp::mqtt::PublishOptions options = loopp::mqtt::PublishOptions::None;
+        std::uint32_t timestamp = 0;
+      };
+
+      void store(const std::string &topic, const std::string &payload, loopp::mqtt::PublishOptions options);
+      void on_replay_timer();
+      void read_fragments(const FlashLog::Record &record, const std::string &topic, std::uint8_t flags, std::size_t offset);
+      void replay(const StoredMessage &message, std::vector<FlashLog::Record> records);
+      void consume(const std::vector<FlashLog::Record> &records);
+
+    private:
+      std::shared_ptr<loopp::core::MainLoop> loop;
+      std::shared_ptr<loopp::mqtt::MqttClient> mqtt;
+      std::shared_ptr<FlashLog> log;
+      loopp::core::MainLoop::timer_id replay_timer = 0;
+      std::chrono::milliseconds replay_interval{ 1000 / default_replay_rate };
+      std::chrono::seconds max_age{ 0 };
+      bool replaying = false;
+      Statistics statistics;
+
+      static constexpr std::size_t default_replay_rate = 5;
+    };
+  } // namespace storage
+} // namespace loopp
+
+#endif // LOOPP_STORAGE_STOREANDFORWARD_HPP
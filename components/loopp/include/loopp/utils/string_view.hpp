@@ -0,0 +1,209 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#ifndef LOOPP_UTILS_STRING_VIEW_HPP
+#define LOOPP_UTILS_STRING_VIEW_HPP
+
+#if __cplusplus >= 201703L
+
+#include <string_view>
+
+namespace loopp
+{
+  namespace utils
+  {
+    using string_view = std::string_view;
+  } // namespace utils
+} // namespace loopp
+
+#else
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace loopp
+{
+  namespace utils
+  {
+    // Subset of std::string_view for builds that do not use C++17 yet.
+    class string_view
+    {
+    public:
+      using size_type = std::size_t;
+      using const_iterator = const char *;
+      using iterator = const_iterator;
+
+      static constexpr size_type npos = size_type(-1);
+
+      constexpr string_view() noexcept = default;
+
+      constexpr string_view(const char *data, size_type size) noexcept
+        : data_(data)
+        , size_(size)
+      {
+      }
+
+      string_view(const char *str)
+        : data_(str)
+        , size_(std::strlen(str))
+      {
+      }
+
+      string_view(const std::string &str) noexcept
+        : data_(str.data())
+        , size_(str.size())
+      {
+      }
+
+      explicit operator std::string() const
+      {
+        return std::string(data_, size_);
+      }
+
+      constexpr const_iterator begin() const noexcept
+      {
+        return data_;
+      }
+
+      constexpr const_iterator end() const noexcept
+      {
+        return data_ + size_;
+      }
+
+      constexpr const char *data() const noexcept
+      {
+        return data_;
+      }
+
+      constexpr size_type size() const noexcept
+      {
+        return size_;
+      }
+
+      constexpr size_type length() const noexcept
+      {
+        return size_;
+      }
+
+      constexpr bool empty() const noexcept
+      {
+        return size_ == 0;
+      }
+
+      constexpr const char &operator[](size_type pos) const
+      {
+        return data_[pos];
+      }
+
+      const char &front() const
+      {
+        return data_[0];
+      }
+
+      const char &back() const
+      {
+        return data_[size_ - 1];
+      }
+
+      void remove_prefix(size_type n)
+      {
+        data_ += n;
+        size_ -= n;
+      }
+
+      void remove_suffix(size_type n)
+      {
+        size_ -= n;
+      }
+
+      string_view substr(size_type pos = 0, size_type count = npos) const
+      {
+        if (pos > size_)
+          {
+            throw std::out_of_range("string_view::substr");
+          }
+        return string_view(data_ + pos, std::min(count, size_ - pos));
+      }
+
+      int compare(string_view other) const noexcept
+      {
+        int ret = std::char_traits<char>::compare(data_, other.data_, std::min(size_, other.size_));
+        if (ret == 0)
+          {
+            ret = (size_ < other.size_) ? -1 : (size_ > other.size_ ? 1 : 0);
+          }
+        return ret;
+      }
+
+      size_type find(char c, size_type pos = 0) const noexcept
+      {
+        for (size_type i = pos; i < size_; i++)
+          {
+            if (data_[i] == c)
+              {
+                return i;
+              }
+          }
+        return npos;
+      }
+
+      size_type find(string_view str, size_type pos = 0) const noexcept
+      {
+        if (str.size_ > size_)
+          {
+            return npos;
+          }
+        for (size_type i = pos; i <= size_ - str.size_; i++)
+          {
+            if (std::char_traits<char>::compare(data_ + i, str.data_, str.size_) == 0)
+              {
+                return i;
+              }
+          }
+        return npos;
+      }
+
+    private:
+      const char *data_ = nullptr;
+      size_type size_ = 0;
+    };
+
+    inline bool operator==(string_view lhs, string_view rhs) noexcept
+    {
+      return lhs.size() == rhs.size() && lhs.compare(rhs) == 0;
+    }
+
+    inline bool operator!=(string_view lhs, string_view rhs) noexcept
+    {
+      return !(lhs == rhs);
+    }
+
+    inline bool operator<(string_view lhs, string_view rhs) noexcept
+    {
+      return lhs.compare(rhs) < 0;
+    }
+  } // namespace utils
+} // namespace loopp
+
+#endif
+
+#endif // LOOPP_UTILS_STRING_VIEW_HPP
@@ -195,7 +195,7 @@ BLEScanner::ScanResult::ScanResult(esp_ble_gap_cb_param_t::ble_scan_result_evt_p
 }
 
 std::string
-BLEScanner::ScanResult::bda_as_string()
+BLEScanner::ScanResult::bda_as_string() const
 {
   std::stringstream stream;
   stream << std::hex << std::setfill('0');
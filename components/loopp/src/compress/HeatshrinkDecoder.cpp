@@ -0,0 +1,152 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/compress/HeatshrinkDecoder.hpp"
+
+#include <stdexcept>
+
+#include "loopp/compress/HeatshrinkEncoder.hpp"
+
+using namespace loopp;
+using namespace loopp::compress;
+
+HeatshrinkDecoder::HeatshrinkDecoder(int window_bits, int lookahead_bits)
+  : window_bits(window_bits)
+  , lookahead_bits(lookahead_bits)
+{
+  if (!HeatshrinkEncoder::is_valid(window_bits, lookahead_bits))
+    {
+      throw std::invalid_argument("invalid heatshrink parameters");
+    }
+
+  window.resize(std::size_t(1) << window_bits);
+  window_mask = window.size() - 1;
+}
+
+bool
+HeatshrinkDecoder::decode(loopp::utils::string_view input, const output_callback_t &output)
+{
+  this->input = input;
+
+  // The padding of the last byte is shorter than any token, so it is never decoded.
+  bool valid = true;
+  bool more = true;
+  while (valid && more)
+    {
+      std::uint32_t value = 0;
+      switch (state)
+        {
+        case State::Tag:
+          if ((more = get_bits(1, value)))
+            {
+              state = value ? State::Literal : State::Offset;
+            }
+          break;
+
+        case State::Literal:
+          if ((more = get_bits(8, value)))
+            {
+              put(static_cast<std::uint8_t>(value), output);
+              state = State::Tag;
+            }
+          break;
+
+        case State::Offset:
+          if ((more = get_bits(window_bits, value)))
+            {
+              offset = value + 1;
+              state = State::Length;
+            }
+          break;
+
+        case State::Length:
+          if ((more = get_bits(lookahead_bits, value)))
+            {
+              if (offset > output_size)
+                {
+                  valid = false;
+                  break;
+                }
+
+              // The reference may overlap the data it produces.
+              for (std::uint32_t i = 0; i <= value; i++)
+                {
+                  put(window[(output_size - offset) & window_mask], output);
+                }
+              state = State::Tag;
+            }
+          break;
+        }
+    }
+
+  flush(output);
+  return valid;
+}
+
+std::size_t
+HeatshrinkDecoder::get_output_size() const noexcept
+{
+  return output_size;
+}
+
+bool
+HeatshrinkDecoder::get_bits(int count, std::uint32_t &value)
+{
+  while (bit_count < count)
+    {
+      if (input.empty())
+        {
+          return false;
+        }
+      bit_buffer = (bit_buffer << 8) | static_cast<std::uint8_t>(input.front());
+      bit_count += 8;
+      input.remove_prefix(1);
+    }
+
+  bit_count -= count;
+  value = (bit_buffer >> bit_count) & ((std::uint32_t(1) << count) - 1);
+  return true;
+}
+
+void
+HeatshrinkDecoder::put(std::uint8_t c, const output_callback_t &output)
+{
+  std::size_t index = output_size & window_mask;
+  window[index] = c;
+  output_size++;
+  pending_size++;
+
+  // Pass on the pending output before the window wraps.
+  if (index == window_mask)
+    {
+      flush(output);
+    }
+}
+
+void
+HeatshrinkDecoder::flush(const output_callback_t &output)
+{
+  if (pending_size > 0)
+    {
+      output(loopp::utils::string_view(reinterpret_cast<const char *>(window.data()) + pending_start, pending_size));
+    }
+  pending_start = output_size & window_mask;
+  pending_size = 0;
+}
@@ -0,0 +1,216 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/compress/HeatshrinkEncoder.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+using namespace loopp;
+using namespace loopp::compress;
+
+HeatshrinkEncoder::HeatshrinkEncoder(std::streambuf *output, int window_bits, int lookahead_bits)
+  : output(output)
+  , window_bits(window_bits)
+  , lookahead_bits(lookahead_bits)
+{
+  if (!is_valid(window_bits, lookahead_bits))
+    {
+      throw std::invalid_argument("invalid heatshrink parameters");
+    }
+
+  window_size = std::size_t(1) << window_bits;
+  lookahead_size = std::size_t(1) << lookahead_bits;
+  buffer.resize(2 * window_size);
+}
+
+// Compresses the remaining input and pads the last byte with zero bits.
+// Returns false if the output stream buffer did not accept all data.
+bool
+HeatshrinkEncoder::finish()
+{
+  encode(true);
+  if (bit_count > 0)
+    {
+      emit(0, 8 - bit_count);
+    }
+  return !failed;
+}
+
+std::size_t
+HeatshrinkEncoder::get_input_size() const noexcept
+{
+  return input_size;
+}
+
+std::size_t
+HeatshrinkEncoder::get_output_size() const noexcept
+{
+  return output_size;
+}
+
+std::chrono::microseconds
+HeatshrinkEncoder::get_time() const noexcept
+{
+  return time;
+}
+
+bool
+HeatshrinkEncoder::is_valid(int window_bits, int lookahead_bits)
+{
+  return window_bits >= 4 && window_bits <= 15 && lookahead_bits >= 3 && lookahead_bits < window_bits;
+}
+
+// Identifies the encoding and its parameters, e.g. heatshrink-w8-l4.
+std::string
+HeatshrinkEncoder::name(int window_bits, int lookahead_bits)
+{
+  return "heatshrink-w" + std::to_string(window_bits) + "-l" + std::to_string(lookahead_bits);
+}
+
+HeatshrinkEncoder::int_type
+HeatshrinkEncoder::overflow(int_type ch)
+{
+  if (traits_type::eq_int_type(ch, traits_type::eof()))
+    {
+      return traits_type::not_eof(ch);
+    }
+
+  char c = traits_type::to_char_type(ch);
+  return xsputn(&c, 1) == 1 ? ch : traits_type::eof();
+}
+
+std::streamsize
+HeatshrinkEncoder::xsputn(const char *data, std::streamsize size)
+{
+  std::streamsize remaining = size;
+
+  while (remaining > 0 && !failed)
+    {
+      std::size_t count = std::min<std::size_t>(remaining, buffer.size() - end);
+      std::memcpy(buffer.data() + end, data, count);
+      end += count;
+      data += count;
+      remaining -= count;
+      input_size += count;
+
+      if (end == buffer.size())
+        {
+          encode(false);
+        }
+    }
+
+  return failed ? 0 : size;
+}
+
+// Encodes buffered input. Unless flushing, input is only encoded while a full
+// lookahead is available, so that matches are not cut short.
+void
+HeatshrinkEncoder::encode(bool flush)
+{
+  const std::size_t backref_bits = 1 + window_bits + lookahead_bits;
+  auto start_time = std::chrono::steady_clock::now();
+
+  while (position < end && (flush || position + lookahead_size <= end))
+    {
+      std::size_t offset = 0;
+      std::size_t length = find_match(std::min(lookahead_size, end - position), offset);
+
+      if (length * 9 > backref_bits)
+        {
+          emit(0, 1);
+          emit(offset - 1, window_bits);
+          emit(length - 1, lookahead_bits);
+          position += length;
+        }
+      else
+        {
+          emit(0x100 | buffer[position], 9);
+          position++;
+        }
+    }
+
+  // Keep one window of history in front of the unencoded input.
+  if (position > window_size)
+    {
+      std::size_t shift = position - window_size;
+      std::memmove(buffer.data(), buffer.data() + shift, end - shift);
+      position -= shift;
+      end -= shift;
+    }
+
+  time += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time);
+}
+
+std::size_t
+HeatshrinkEncoder::find_match(std::size_t max_length, std::size_t &offset) const
+{
+  const std::uint8_t *input = buffer.data() + position;
+  std::size_t best_length = 0;
+  std::size_t first = position > window_size ? position - window_size : 0;
+
+  for (std::size_t candidate = position; candidate-- > first;)
+    {
+      const std::uint8_t *history = buffer.data() + candidate;
+      if (history[best_length] != input[best_length] || history[0] != input[0])
+        {
+          continue;
+        }
+
+      // The match may run into the input itself; the decoder copies byte by byte.
+      std::size_t length = 1;
+      while (length < max_length && history[length] == input[length])
+        {
+          length++;
+        }
+
+      if (length > best_length)
+        {
+          best_length = length;
+          offset = position - candidate;
+          if (length == max_length)
+            {
+              break;
+            }
+        }
+    }
+
+  return best_length;
+}
+
+void
+HeatshrinkEncoder::emit(std::uint32_t value, int count)
+{
+  for (int i = count - 1; i >= 0; i--)
+    {
+      bit_buffer = static_cast<std::uint8_t>((bit_buffer << 1) | ((value >> i) & 1));
+      if (++bit_count == 8)
+        {
+          if (traits_type::eq_int_type(output->sputc(static_cast<char>(bit_buffer)), traits_type::eof()))
+            {
+              failed = true;
+            }
+          output_size++;
+          bit_buffer = 0;
+          bit_count = 0;
+        }
+    }
+}
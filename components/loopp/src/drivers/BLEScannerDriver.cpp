@@ -20,6 +20,7 @@
 
 #include "loopp/drivers/BLEScannerDriver.hpp"
 
+#include <ostream>
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -42,6 +43,9 @@ static const char *tag = "BLE-SCANNER";
 BLEScannerDriver::BLEScannerDriver(loopp::drivers::DriverContext context, const nlohmann::json &config)
   : loop(context.get_loop())
   , mqtt(context.get_mqtt())
+  , store(context.get_store())
+  , scheduler(context.get_scheduler())
+  , publisher(context.get_publisher())
   , ble_scanner(loopp::ble::BLEScanner::instance())
 {
   topic_scan = context.get_topic_root() + "scan";
@@ -75,6 +79,82 @@ BLEScannerDriver::BLEScannerDriver(loopp::drivers::DriverContext context, const
         }
     }
 
+  it = config.find("qos");
+  if (it != config.end())
+    {
+      int qos = *it;
+
+      if (qos == 0)
+        {
+          publish_options = loopp::mqtt::PublishOptions::Qos0;
+        }
+      else if (qos == 1)
+        {
+          publish_options = loopp::mqtt::PublishOptions::Qos1;
+        }
+      else if (qos == 2)
+        {
+          publish_options = loopp::mqtt::PublishOptions::Qos2;
+        }
+      else
+        {
+          throw std::runtime_error("invalid qos value: " + std::to_string(qos));
+        }
+    }
+
+  // "compression": true, or { "window_bits": 8, "lookahead_bits": 4 }
+  if (mqtt)
+    {
+      it = config.find("compression");
+      if (it != config.end() && (it->is_object() || (it->is_boolean() && it->get<bool>())))
+        {
+          int window_bits = loopp::compress::HeatshrinkEncoder::default_window_bits;
+          int lookahead_bits = loopp::compress::HeatshrinkEncoder::default_lookahead_bits;
+          if (it->is_object())
+            {
+              window_bits = it->value("window_bits", window_bits);
+              lookahead_bits = it->value("lookahead_bits", lookahead_bits);
+            }
+          // Scan results batched by the publisher are compressed on its telemetry topic.
+          if (publisher)
+            {
+              publisher->set_compression(topic_scan, window_bits, lookahead_bits);
+            }
+          else
+            {
+              mqtt->set_compression(topic_scan, window_bits, lookahead_bits);
+            }
+        }
+      else if (publisher)
+        {
+          publisher->clear_compression(topic_scan);
+        }
+      else
+        {
+          mqtt->clear_compression(topic_scan);
+        }
+    }
+
+  if (publisher)
+    {
+      publisher->configure(topic_scan, config);
+    }
+
+  // "udp": { "host": "collector", "port": 5683, "key": "<hex AES key>", "ttl": 1 } sends scan results to a local
+  // collector over UDP instead of MQTT.
+  it = config.find("udp");
+  if (it != config.end())
+    {
+      transport = std::make_shared<loopp::net::DatagramTransport>(loop);
+      auto key = it->find("key");
+      if (key != it->end())
+        {
+          transport->set_key(hex_decode(key->get<std::string>()));
+        }
+      transport->set_multicast_ttl(it->value("ttl", 1));
+      transport->connect(it->at("host").get<std::string>(), it->at("port").get<int>());
+    }
+
   it = config.find("scan_interval");
   if (it != config.end())
     {
@@ -122,6 +202,58 @@ BLEScannerDriver::base64_encode(const std::string &in)
   return out;
 }
 
+std::string
+BLEScannerDriver::hex_decode(const std::string &in)
+{
+  if (in.size() % 2 != 0)
+    {
+      throw std::runtime_error("invalid hex string");
+    }
+
+  std::string out;
+  for (std::size_t i = 0; i < in.size(); i += 2)
+    {
+      out.push_back(static_cast<char>(std::stoi(in.substr(i, 2), nullptr, 16)));
+    }
+  return out;
+}
+
+json
+BLEScannerDriver::scan_result_to_json(const loopp::ble::BLEScanner::ScanResult &result)
+{
+  json jb;
+  jb["mac"] = result.bda_as_string();
+  jb["bda"] = base64_encode(std::string(reinterpret_cast<const char *>(result.bda), sizeof(result.bda)));
+  jb["rssi"] = result.rssi;
+  jb["adv_data"] = base64_encode(result.adv_data);
+
+  decoder.decode(result.adv_data, jb);
+  return jb;
+}
+
+// Sends the scan results as JSON arrays that each fit in a single datagram.
+void
+BLEScannerDriver::send_scan_datagrams()
+{
+  std::string batch;
+  for (const auto &r : scan_results)
+    {
+      std::string entry = scan_result_to_json(r).dump();
+      if (!batch.empty() && batch.size() + entry.size() + 2 > transport->max_payload_size())
+        {
+          transport->send(batch + "]");
+          batch.clear();
+        }
+      batch += batch.empty() ? "[" : ",";
+      batch += entry;
+    }
+
+  if (!batch.empty())
+    {
+      transport->send(batch + "]");
+    }
+}
+
 void
 BLEScannerDriver::on_ble_scanner_scan_result(const loopp::ble::BLEScanner::ScanResult &result)
 {
@@ -141,21 +273,40 @@ BLEScannerDriver::on_scan_timer()
   try
     {
       json j;
-      if (mqtt && mqtt->connected().get() && scan_results.size() > 0)
+      if (transport && scan_results.size() > 0)
+        {
+          send_scan_datagrams();
+        }
+      else if (mqtt && (store || mqtt->can_publish()) && scan_results.size() > 0)
         {
-          for (auto r : scan_results)
+          for (const auto &r : scan_results)
             {
-              json jb;
-              jb["mac"] = r.bda_as_string();
-              jb["bda"] = base64_encode(std::string(reinterpret_cast<char *>(r.bda), sizeof(r.bda)));
-              jb["rssi"] = r.rssi;
-              jb["adv_data"] = base64_encode(r.adv_data);
-
-              decoder.decode(r.adv_data, jb);
-              j.push_back(jb);
+              j.push_back(scan_result_to_json(r));
             }
 
-          mqtt->publish(topic_scan, j.dump());
+          loopp::mqtt::PublishProperties properties;
+          properties.content_type = "application/json";
+          properties.user_properties.emplace_back("count", std::to_string(scan_results.size()));
+
+          if (publisher)
+            {
+              publisher->submit(topic_scan, std::move(j), publish_options, properties);
+            }
+          else if (store)
+            {
+              store->publish(topic_scan, j.dump(), publish_options, properties);
+            }
+          else
+            {
+              loopp::mqtt::PublishWriter writer = mqtt->begin_publish(topic_scan, publish_options, properties);
+              std::ostream stream(&writer.get_buffer());
+              stream << j;
+              if (!stream)
+                {
+                  throw std::runtime_error("scan results do not fit in packet");
+                }
+              writer.commit();
+            }
         }
     }
   catch (std::exception &e)
@@ -171,15 +322,30 @@ BLEScannerDriver::start()
   auto self = shared_from_this();
   scan_result_signal_connection = ble_scanner.scan_result_signal().connect(
     loopp::core::bind_loop(loop, [this, self](loopp::ble::BLEScanner::ScanResult scan_result) { on_ble_scanner_scan_result(scan_result); }));
-  scan_timer = loop->add_periodic_timer(std::chrono::milliseconds(1000), [this, self]() { on_scan_timer(); });
+  if (scheduler)
+    {
+      scan_task = scheduler->add(std::chrono::milliseconds(1000), [this, self]() { on_scan_timer(); });
+    }
+  else
+    {
+      scan_timer = loop->add_periodic_timer(std::chrono::milliseconds(1000), [this, self]() { on_scan_timer(); });
+    }
   ble_scanner.start();
 }
 
 void
 BLEScannerDriver::stop()
 {
-  loop->cancel_timer(scan_timer);
-  scan_timer = 0;
+  if (scan_task != 0)
+    {
+      scheduler->remove(scan_task);
+      scan_task = 0;
+    }
+  if (scan_timer != 0)
+    {
+      loop->cancel_timer(scan_timer);
+      scan_timer = 0;
+    }
   ble_scanner.stop();
   scan_result_signal_connection.disconnect();
 }
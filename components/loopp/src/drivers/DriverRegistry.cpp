@@ -23,10 +23,18 @@
 using namespace loopp;
 using namespace loopp::drivers;
 
-DriverContext::DriverContext(std::shared_ptr<loopp::core::MainLoop> loop, std::shared_ptr<loopp::mqtt::MqttClient> mqtt, std::string topic_root)
+DriverContext::DriverContext(std::shared_ptr<loopp::core::MainLoop> loop,
+                             std::shared_ptr<loopp::mqtt::MqttClient> mqtt,
+                             std::string topic_root,
+                             std::shared_ptr<loopp::storage::StoreAndForward> store,
+                             std::shared_ptr<loopp::mqtt::PublishScheduler> scheduler,
+                             std::shared_ptr<Publisher> publisher)
   : loop(loop)
   , mqtt(mqtt)
   , topic_root(topic_root)
+  , store(store)
+  , scheduler(scheduler)
+  , publisher(publisher)
 {
 }
 
@@ -48,6 +56,24 @@ DriverContext::get_topic_root() const
   return topic_root;
 }
 
+std::shared_ptr<loopp::storage::StoreAndForward>
+DriverContext::get_store() const
+{
+  return store;
+}
+
+std::shared_ptr<loopp::mqtt::PublishScheduler>
+DriverContext::get_scheduler() const
+{
+  return scheduler;
+}
+
+std::shared_ptr<Publisher>
+DriverContext::get_publisher() const
+{
+  return publisher;
+}
+
  DriverRegistry &
 DriverRegistry::instance()
 {
@@ -99,6 +99,7 @@ GPIODriver::gpio_task()
 GPIOPin::GPIOPin(loopp::drivers::DriverContext context, std::shared_ptr<loopp::core::QueueISR<gpio_num_t>> queue, const nlohmann::json &config)
   : loop(context.get_loop())
   , mqtt(context.get_mqtt())
+  , publisher(context.get_publisher())
   , queue(std::move(queue))
 {
   pin.pin_bit_mask = 0;
@@ -140,6 +141,17 @@ GPIOPin::GPIOPin(loopp::drivers::DriverContext context, std::shared_ptr<loopp::c
           retain = *it;
           ESP_LOGI(tag, "-> Retain    : %d", retain);
         }
+      it = config.find("priority");
+      if (it != config.end())
+        {
+          int priority = *it;
+          mqtt->set_topic_priority(topic, priority);
+          ESP_LOGI(tag, "-> Priority  : %d", priority);
+        }
+      if (publisher)
+        {
+          publisher->configure(topic, config);
+        }
     }
 
   if (is_out())
@@ -181,12 +193,13 @@ GPIOPin::start()
 
       mqtt->subscribe(topic);
       auto self = shared_from_this();
-      mqtt->add_filter(topic, loopp::core::bind_loop(loop, [this, self](std::string topic, std::string payload) {
-                         (void)topic;
-                         std::transform(payload.begin(), payload.end(), payload.begin(), ::tolower);
-                         bool on = (payload == "true" || payload == "1" || payload == "on" || payload == "yes");
-                         gpio_set_level(pin_no, (on != invert) ? 1 : 0);
-                       }));
+      mqtt->add_filter(topic, [this, self](loopp::utils::string_view topic, loopp::utils::string_view payload) {
+        (void)topic;
+        std::string value(payload);
+        std::transform(value.begin(), value.end(), value.begin(), ::tolower);
+        bool on = (value == "true" || value == "1" || value == "on" || value == "yes");
+        gpio_set_level(pin_no, (on != invert) ? 1 : 0);
+      });
     }
 
   started = true;
@@ -326,11 +339,18 @@ GPIOPin::trigger()
       ESP_LOGD(tag, "Pin: %d (debounced)", pin_no);
 
       bool on = (gpio_get_level(pin_no) != 0) != invert;
-      std::string payload = on ? "1" : "0";
+      auto options = retain ? loopp::mqtt::PublishOptions::Retain : loopp::mqtt::PublishOptions::None;
 
       auto self = shared_from_this();
-      loop->invoke([this, self, payload]() {
-        mqtt->publish(topic, payload, retain ? loopp::mqtt::PublishOptions::Retain : loopp::mqtt::PublishOptions::None);
+      loop->invoke([this, self, on, options]() {
+        if (publisher)
+          {
+            publisher->submit(topic, on ? 1 : 0, options);
+          }
+        else
+          {
+            mqtt->publish(topic, on ? "1" : "0", options);
+          }
       });
     }
   last_tick = current_tick;
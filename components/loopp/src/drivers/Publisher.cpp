@@ -0,0 +1,375 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/drivers/Publisher.hpp"
+
+#include <algorithm>
+
+#include "esp_log.h"
+
+static const char *tag = "PUBLISHER";
+
+using namespace loopp;
+using namespace loopp::drivers;
+
+Publisher::Publisher(std::shared_ptr<loopp::core::MainLoop> loop,
+                     std::shared_ptr<loopp::mqtt::MqttClient> mqtt,
+                     std::string topic_root,
+                     std::shared_ptr<loopp::storage::StoreAndForward> store,
+                     std::shared_ptr<loopp::mqtt::PublishScheduler> scheduler)
+  : loop(std::move(loop))
+  , mqtt(std::move(mqtt))
+  , store(std::move(store))
+  , scheduler(std::move(scheduler))
+  , topic_root(std::move(topic_root))
+{
+  telemetry_topic = this->topic_root + "telemetry";
+  update_telemetry_topic();
+}
+
+Publisher::~Publisher()
+{
+  stop();
+}
+
+void
+Publisher::set_period(std::chrono::milliseconds period)
+{
+  this->period = period;
+}
+
+void
+Publisher::set_batching(bool enabled)
+{
+  batching = enabled;
+  update_telemetry_topic();
+}
+
+void
+Publisher::set_max_pending(std::size_t max_pending)
+{
+  this->max_pending = std::max<std::size_t>(1, max_pending);
+}
+
+void
+Publisher::set_max_batch_size(std::size_t max_batch_size)
+{
+  this->max_batch_size = max_batch_size;
+}
+
+void
+Publisher::configure(const std::string &topic, const TopicOptions &options)
+{
+  Topic &t = topics[topic];
+  t.options = options;
+  t.options.burst = std::max<std::size_t>(1, options.burst);
+  t.tokens = static_cast<double>(t.options.burst);
+  t.last_refill = std::chrono::steady_clock::now();
+
+  mqtt->set_topic_priority(topic, options.priority);
+  update_telemetry_topic();
+}
+
+void
+Publisher::configure(const std::string &topic, const nlohmann::json &config)
+{
+  TopicOptions options;
+  options.priority = config.value("priority", options.priority);
+  options.rate = config.value("rate", options.rate);
+  options.burst = config.value("burst", options.burst);
+  options.batch = config.value("batch", options.batch);
+  configure(topic, options);
+}
+
+void
+Publisher::set_compression(const std::string &topic, int window_bits, int lookahead_bits)
+{
+  Topic &t = topics[topic];
+  t.compress = true;
+  t.window_bits = window_bits;
+  t.lookahead_bits = lookahead_bits;
+
+  mqtt->set_compression(topic, window_bits, lookahead_bits);
+  update_telemetry_topic();
+}
+
+void
+Publisher::clear_compression(const std::string &topic)
+{
+  auto it = topics.find(topic);
+  if (it != topics.end())
+    {
+      it->second.compress = false;
+    }
+
+  mqtt->clear_compression(topic);
+  update_telemetry_topic();
+}
+
+// Applies the priority and compression of the batched topics to the telemetry topic.
+void
+Publisher::update_telemetry_topic()
+{
+  bool has_batched_topic = false;
+  int priority = 0;
+  const Topic *compressed = nullptr;
+
+  if (batching)
+    {
+      for (const auto &t : topics)
+        {
+          if (!t.second.options.batch)
+            {
+              continue;
+            }
+          if (!has_batched_topic || t.second.options.priority > priority)
+            {
+              priority = t.second.options.priority;
+            }
+          has_batched_topic = true;
+          if (t.second.compress && compressed == nullptr)
+            {
+              compressed = &t.second;
+            }
+        }
+    }
+
+  mqtt->set_topic_priority(telemetry_topic, priority);
+  if (compressed != nullptr)
+    {
+      mqtt->set_compression(telemetry_topic, compressed->window_bits, compressed->lookahead_bits);
+    }
+  else
+    {
+      mqtt->clear_compression(telemetry_topic);
+    }
+}
+
+// Batches larger than a log record would be split when stored, so keep them below that size.
+std::size_t
+Publisher::get_max_batch_size() const
+{
+  if (store)
+    {
+      return std::min(max_batch_size, store->max_record_payload_size(telemetry_topic));
+    }
+  return max_batch_size;
+}
+
+void
+Publisher::start()
+{
+  stop();
+  if (scheduler)
+    {
+      task = scheduler->add(period, [this]() { flush(); });
+    }
+  else
+    {
+      timer = loop->add_periodic_timer(period, [this]() { flush(); });
+    }
+}
+
+void
+Publisher::stop()
+{
+  if (task != 0)
+    {
+      scheduler->remove(task);
+      task = 0;
+    }
+  if (timer != 0)
+    {
+      loop->cancel_timer(timer);
+      timer = 0;
+    }
+}
+
+bool
+Publisher::submit(const std::string &topic,
+                  nlohmann::json payload,
+                  loopp::mqtt::PublishOptions options,
+                  const loopp::mqtt::PublishProperties &properties)
+{
+  statistics.submitted++;
+
+  TopicOptions topic_options;
+  auto it = topics.find(topic);
+  if (it != topics.end())
+    {
+      if (!take_token(it->second))
+        {
+          statistics.rate_limited++;
+          return false;
+        }
+      topic_options = it->second.options;
+    }
+
+  if (pending.size() >= max_pending)
+    {
+      drop_lowest_priority();
+    }
+
+  // Retained messages keep their own topic, so that the broker retains each of them.
+  bool batch = batching && topic_options.batch && !(options & loopp::mqtt::PublishOptions::Retain);
+  pending.push_back(Event{ topic, std::move(payload), options, properties, topic_options.priority, batch });
+  return true;
+}
+
+bool
+Publisher::take_token(Topic &topic)
+{
+  if (topic.options.rate <= 0)
+    {
+      return true;
+    }
+
+  auto now = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed = now - topic.last_refill;
+  topic.last_refill = now;
+  topic.tokens = std::min(topic.tokens + elapsed.count() * topic.options.rate, static_cast<double>(topic.options.burst));
+
+  if (topic.tokens < 1.0)
+    {
+      return false;
+    }
+  topic.tokens -= 1.0;
+  return true;
+}
+
+// Drops the oldest event with the lowest priority, which may be the one that is about to be submitted.
+void
+Publisher::drop_lowest_priority()
+{
+  auto victim = std::min_element(pending.begin(), pending.end(), [](const Event &a, const Event &b) { return a.priority < b.priority; });
+  if (victim != pending.end())
+    {
+      pending.erase(victim);
+      statistics.overflowed++;
+    }
+}
+
+void
+Publisher::flush()
+{
+  if (pending.empty())
+    {
+      return;
+    }
+
+  if (!store && !mqtt->can_publish())
+    {
+      ESP_LOGD(tag, "Dropping %d events, not connected", pending.size());
+      statistics.overflowed += pending.size();
+      pending.clear();
+      return;
+    }
+
+  std::stable_sort(pending.begin(), pending.end(), [](const Event &a, const Event &b) { return a.priority > b.priority; });
+
+  std::string batch;
+  std::size_t batch_count = 0;
+  auto batch_options = loopp::mqtt::PublishOptions::None;
+  std::size_t batch_size = get_max_batch_size();
+
+  for (auto &event : pending)
+    {
+      std::string payload = event.payload.dump();
+      if (!event.batch)
+        {
+          send(event.topic, payload, event.options, event.properties);
+          continue;
+        }
+
+      std::string topic = event.topic.compare(0, topic_root.size(), topic_root) == 0 ? event.topic.substr(topic_root.size()) : event.topic;
+      std::string entry = "{\"topic\":" + nlohmann::json(topic).dump() + ",\"data\":" + payload + "}";
+
+      if (!batch.empty() && batch.size() + entry.size() + 2 > batch_size)
+        {
+          send_batch(batch, batch_count, batch_options);
+          batch_count = 0;
+          batch_options = loopp::mqtt::PublishOptions::None;
+        }
+
+      batch += batch.empty() ? "[" : ",";
+      batch += entry;
+      batch_count++;
+
+      // The batch is sent with the highest QoS of its events.
+      auto qos = std::max((event.options & loopp::mqtt::PublishOptions::QosMask).value(),
+                          (batch_options & loopp::mqtt::PublishOptions::QosMask).value());
+      batch_options = static_cast<loopp::mqtt::PublishOptions>(qos);
+    }
+
+  if (!batch.empty())
+    {
+      send_batch(batch, batch_count, batch_options);
+    }
+
+  pending.clear();
+}
+
+void
+Publisher::send_batch(std::string &batch, std::size_t count, loopp::mqtt::PublishOptions options)
+{
+  loopp::mqtt::PublishProperties properties;
+  properties.content_type = "application/json";
+  properties.user_properties.emplace_back("count", std::to_string(count));
+
+  batch += "]";
+  send(telemetry_topic, batch, options, properties);
+  batch.clear();
+}
+
+void
+Publisher::send(const std::string &topic,
+                const std::string &payload,
+                loopp::mqtt::PublishOptions options,
+                const loopp::mqtt::PublishProperties &properties)
+{
+  try
+    {
+      if (store)
+        {
+          store->publish(topic, payload, options, properties);
+        }
+      else
+        {
+          mqtt->publish(topic, payload, options, loopp::mqtt::MqttClient::publish_callback_t(), properties);
+        }
+      statistics.messages++;
+    }
+  catch (std::exception &e)
+    {
+      ESP_LOGE(tag, "Failed to publish to %s: %s", topic.c_str(), e.what());
+    }
+}
+
+const std::string &
+Publisher::get_telemetry_topic() const
+{
+  return telemetry_topic;
+}
+
+const PublisherStatistics &
+Publisher::get_statistics() const
+{
+  return statistics;
+}
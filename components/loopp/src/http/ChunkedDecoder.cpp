@@ -0,0 +1,177 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/http/ChunkedDecoder.hpp"
+
+#include <algorithm>
+#include <cctype>
+
+using namespace loopp::http;
+using loopp::utils::string_view;
+
+void
+ChunkedDecoder::reset()
+{
+  state = State::Size;
+  chunk_size = 0;
+  digits = 0;
+}
+
+ChunkedDecoder::Result
+ChunkedDecoder::decode(string_view &input, string_view &data)
+{
+  data = string_view();
+
+  while (!input.empty() && state != State::Done)
+    {
+      if (state == State::Data)
+        {
+          std::size_t size = std::min(chunk_size, input.size());
+          data = input.substr(0, size);
+          input.remove_prefix(size);
+          chunk_size -= size;
+          if (chunk_size == 0)
+            {
+              state = State::DataCR;
+            }
+          return Result::Data;
+        }
+
+      char c = input.front();
+      input.remove_prefix(1);
+
+      switch (state)
+        {
+        case State::Size:
+          if (isxdigit(static_cast<unsigned char>(c)))
+            {
+              if (chunk_size > (std::size_t(-1) >> 4))
+                {
+                  return Result::Invalid;
+                }
+              chunk_size = (chunk_size << 4) | (isdigit(static_cast<unsigned char>(c)) ? c - '0' : (tolower(c) - 'a' + 10));
+              digits++;
+            }
+          else if (c == ';' || c == ' ' || c == '\t')
+            {
+              state = State::Extension;
+            }
+          else if (c == '\r')
+            {
+              state = State::SizeLF;
+            }
+          else if (c != '\n' || !end_of_size_line())
+            {
+              return Result::Invalid;
+            }
+          break;
+
+        case State::Extension:
+          if (c == '\r')
+            {
+              state = State::SizeLF;
+            }
+          else if (c == '\n' && !end_of_size_line())
+            {
+              return Result::Invalid;
+            }
+          break;
+
+        case State::SizeLF:
+          if (c != '\n' || !end_of_size_line())
+            {
+              return Result::Invalid;
+            }
+          break;
+
+        case State::DataCR:
+          if (c == '\r')
+            {
+              state = State::DataLF;
+            }
+          else if (c == '\n')
+            {
+              state = State::Size;
+            }
+          else
+            {
+              return Result::Invalid;
+            }
+          break;
+
+        case State::DataLF:
+          if (c != '\n')
+            {
+              return Result::Invalid;
+            }
+          state = State::Size;
+          break;
+
+        case State::Trailer:
+          if (c == '\r')
+            {
+              state = State::TrailerLF;
+            }
+          else if (c == '\n')
+            {
+              state = State::Done;
+            }
+          else
+            {
+              state = State::TrailerLine;
+            }
+          break;
+
+        case State::TrailerLine:
+          if (c == '\n')
+            {
+              state = State::Trailer;
+            }
+          break;
+
+        case State::TrailerLF:
+          if (c != '\n')
+            {
+              return Result::Invalid;
+            }
+          state = State::Done;
+          break;
+
+        case State::Data:
+        case State::Done:
+          break;
+        }
+    }
+
+  return state == State::Done ? Result::Done : Result::Incomplete;
+}
+
+bool
+ChunkedDecoder::end_of_size_line()
+{
+  if (digits == 0)
+    {
+      return false;
+    }
+
+  state = chunk_size == 0 ? State::Trailer : State::Data;
+  digits = 0;
+  return true;
+}
@@ -0,0 +1,138 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/http/ConnectionPool.hpp"
+
+#include <algorithm>
+
+#include "esp_log.h"
+
+static const char *tag = "HTTP";
+
+using namespace loopp;
+using namespace loopp::http;
+
+ConnectionPool::ConnectionPool(std::shared_ptr<loopp::core::MainLoop> loop)
+  : loop(std::move(loop))
+{
+}
+
+ConnectionPool::~ConnectionPool()
+{
+  clear();
+}
+
+void
+ConnectionPool::set_idle_timeout(std::chrono::milliseconds timeout)
+{
+  idle_timeout = timeout;
+}
+
+void
+ConnectionPool::set_max_idle(std::size_t max_idle)
+{
+  this->max_idle = max_idle;
+  while (connections.size() > max_idle)
+    {
+      close(std::prev(connections.end()));
+    }
+}
+
+std::string
+ConnectionPool::make_key(const std::string &scheme, const std::string &host, int port)
+{
+  return scheme + "://" + host + ":" + std::to_string(port);
+}
+
+std::shared_ptr<loopp::net::Stream>
+ConnectionPool::acquire(const std::string &scheme, const std::string &host, int port)
+{
+  std::string key = make_key(scheme, host, port);
+
+  for (auto it = connections.begin(); it != connections.end();)
+    {
+      if (it->key != key)
+        {
+          ++it;
+        }
+      else if (!it->stream->connected().get())
+        {
+          auto dead = it++;
+          close(dead);
+        }
+      else
+        {
+          std::shared_ptr<loopp::net::Stream> stream = std::move(it->stream);
+          loop->cancel_timer(it->timer);
+          connections.erase(it);
+          ESP_LOGD(tag, "Reusing connection to %s", key.c_str());
+          return stream;
+        }
+    }
+  return nullptr;
+}
+
+void
+ConnectionPool::release(const std::string &scheme, const std::string &host, int port, std::shared_ptr<loopp::net::Stream> stream)
+{
+  if (max_idle == 0 || !stream->connected().get())
+    {
+      stream->close();
+      return;
+    }
+
+  while (connections.size() >= max_idle)
+    {
+      close(std::prev(connections.end()));
+    }
+
+  connections.push_front(Connection{ make_key(scheme, host, port), std::move(stream), 0 });
+
+  loopp::net::Stream *id = connections.front().stream.get();
+  connections.front().timer = loop->add_timer(idle_timeout, [this, id]() {
+    auto it = std::find_if(connections.begin(), connections.end(), [id](const Connection &c) { return c.stream.get() == id; });
+    if (it != connections.end())
+      {
+        it->timer = 0;
+        ESP_LOGD(tag, "Closing idle connection to %s", it->key.c_str());
+        close(it);
+      }
+  });
+}
+
+void
+ConnectionPool::clear()
+{
+  while (!connections.empty())
+    {
+      close(connections.begin());
+    }
+}
+
+void
+ConnectionPool::close(std::list<Connection>::iterator it)
+{
+  if (it->timer != 0)
+    {
+      loop->cancel_timer(it->timer);
+    }
+  it->stream->close();
+  connections.erase(it);
+}
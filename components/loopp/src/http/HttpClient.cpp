@@ -21,20 +21,24 @@
 #include "loopp/http/HttpClient.hpp"
 
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
 #include <sstream>
 
 #include "boost_xtensa.hpp"
 #include "boost/algorithm/string.hpp"
-#include "boost/lexical_cast.hpp"
 
 #include "esp_heap_caps.h"
 #include "esp_log.h"
 
+#include "loopp/http/ConnectionPool.hpp"
 #include "loopp/http/Headers.hpp"
+#include "loopp/http/HttpErrors.hpp"
 #include "loopp/http/Request.hpp"
 #include "loopp/http/Response.hpp"
 #include "loopp/http/Uri.hpp"
+#include "loopp/net/NetworkErrors.hpp"
 #include "loopp/net/StreamBuffer.hpp"
 #include "loopp/net/TCPStream.hpp"
 #include "loopp/net/TLSStream.hpp"
@@ -45,7 +49,8 @@ using namespace loopp;
 using namespace loopp::http;
 
 HttpClient::HttpClient(std::shared_ptr<loopp::core::MainLoop> loop)
-  : loop(std::move(loop))
+  : loop(loop)
+  , pool(std::make_shared<ConnectionPool>(loop))
 {
 }
 
@@ -62,15 +67,79 @@ HttpClient::set_ca_certificate(const char *cert)
   ca_cert = cert;
 }
 
+void
+HttpClient::set_connection_pool(std::shared_ptr<ConnectionPool> pool)
+{
+  this->pool = std::move(pool);
+}
+
+void
+HttpClient::set_pipelining(bool enabled)
+{
+  pipelining = enabled;
+}
+
 void
 HttpClient::execute(Request request, request_complete_callback_t callback)
 {
-  this->request = std::move(request);
-  this->complete_callback = std::move(callback);
+  exchanges.push_back(Exchange{ std::move(request), std::move(callback) });
+
+  if (response_active)
+    {
+      complete_response();
+    }
+  else if (!connecting && !awaiting_response)
+    {
+      start_next();
+    }
+  else if (pipelining && !connecting)
+    {
+      send_requests();
+    }
+}
+
+void
+HttpClient::start_next()
+{
+  if (exchanges.empty())
+    {
+      release_connection();
+      return;
+    }
 
+  const Request &request = exchanges.front().request;
+  if (sock && !is_same_connection(request))
+    {
+      release_connection();
+    }
+
+  if (!sock)
+    {
+      sock = pool->acquire(request.scheme(), request.uri().host(), request.uri().port());
+      sock_reused = sock != nullptr;
+      responses_on_connection = 0;
+      sock_scheme = request.scheme();
+      sock_host = request.uri().host();
+      sock_port = request.uri().port();
+    }
+
+  if (!sock)
+    {
+      connect();
+    }
+  else
+    {
+      send_requests();
+      read_response();
+    }
+}
+
+void
+HttpClient::connect()
+{
   try
     {
-      if (this->request.scheme() == "https")
+      if (sock_scheme == "https")
         {
           std::shared_ptr<loopp::net::TLSStream> tls_sock = std::make_shared<loopp::net::TLSStream>(loop);
           if (client_cert != nullptr && client_key != nullptr)
@@ -88,11 +157,14 @@ HttpClient::execute(Request request, request_complete_callback_t callback)
           sock = std::make_shared<loopp::net::TCPStream>(loop);
         }
 
+      connecting = true;
       auto self = shared_from_this();
-      sock->connect(this->request.uri().host(), this->request.uri().port(), [this, self](std::error_code ec) {
+      sock->connect(sock_host, sock_port, [this, self](std::error_code ec) {
+        connecting = false;
         if (!ec)
           {
-            send_request();
+            send_requests();
+            read_response();
           }
         else
           {
@@ -102,201 +174,673 @@ HttpClient::execute(Request request, request_complete_callback_t callback)
     }
   catch (std::system_error &e)
     {
+      connecting = false;
       handle_error(std::string("connect: ") + e.what(), e.code());
     }
 }
 
+bool
+HttpClient::is_same_connection(const Request &request) const
+{
+  return request.scheme() == sock_scheme && request.uri().host() == sock_host && request.uri().port() == sock_port;
+}
+
+bool
+HttpClient::is_idempotent(const Request &request)
+{
+  // A produced body cannot be sent a second time.
+  return (request.method() == "GET" || request.method() == "HEAD") && !request.content_producer();
+}
+
+// Sends the first queued request, followed by the requests that may be pipelined behind it.
+void
+HttpClient::send_requests()
+{
+  if (uploading)
+    {
+      return;
+    }
+
+  try
+    {
+      bool first = true;
+      for (auto &exchange : exchanges)
+        {
+          if (!exchange.sent)
+            {
+              if (!first && !(pipelining && is_idempotent(exchange.request) && is_same_connection(exchange.request)))
+                {
+                  break;
+                }
+              write_request(exchange.request);
+              exchange.sent = true;
+              if (!is_idempotent(exchange.request))
+                {
+                  break;
+                }
+            }
+          else if (!is_idempotent(exchange.request))
+            {
+              // Nothing is pipelined behind a request that may not be repeated.
+              break;
+            }
+          first = false;
+        }
+
+      flush_requests();
+    }
+  catch (std::system_error &e)
+    {
+      handle_error(std::string("send request: ") + e.what(), e.code());
+    }
+}
+
 void
-HttpClient::read_body_async(std::size_t size, const body_callback_t &callback)
+HttpClient::write_request(Request &request)
 {
-  std::size_t bytes_to_read = std::min<std::size_t>(body_length_left, std::max<int>(0, size - response_buffer.consume_size()));
+  update_request_headers(request);
 
-  if (bytes_to_read > 0)
+  std::ostream stream(&request_buffer);
+
+  stream << request.method() << " " << request.uri().path() << " HTTP/1.1\r\n";
+
+  for (auto header : request.headers())
     {
-      auto self = shared_from_this();
-      sock->read_async(response_buffer, bytes_to_read, [this, self, callback](std::error_code ec, std::size_t bytes_transferred) {
-        if (!ec)
-          {
-            this->body_length_left -= bytes_transferred;
-            callback(ec, &response_buffer);
-          }
-        else
-          {
-            handle_error("read response", ec);
-          }
-      });
+      stream << header.first << ": " << header.second << "\r\n";
+    }
+  stream << "\r\n";
+
+  if (request.content_producer())
+    {
+      upload_producer = request.content_producer();
+      upload_chunked = request.content_length() == Request::UNKNOWN_LENGTH;
+      upload_left = upload_chunked ? 0 : request.content_length();
+      uploading = upload_chunked || upload_left > 0;
     }
   else
     {
-      callback(std::error_code(), &response_buffer);
+      stream << request.content();
     }
 }
 
 void
-HttpClient::send_request()
+HttpClient::update_request_headers(Request &request)
 {
-  try
+  loopp::http::Headers &headers = request.headers();
+
+  headers.emplace("Host", request.uri().host());
+
+  if (request.content_producer() && request.content_length() == Request::UNKNOWN_LENGTH)
     {
-      update_request_headers();
+      headers.set("Transfer-Encoding", "chunked");
+    }
+  else if (!request.headers().has("Transfer-Encoding") || !boost::ifind_first(request.headers()["Transfer-Encoding"], "chunked"))
+    {
+      headers.emplace("Content-Length", std::to_string(request.content_length()));
+    }
+}
 
-      std::ostream stream(&request_buffer);
+// Produces the next block of a request body into the request buffer. With the
+// chunked transfer coding, the chunk size is written with a fixed width so that
+// the data can be produced in place after it.
+void
+HttpClient::produce_request_body()
+{
+  const std::size_t chunk_header_size = 6; // "%04x\r\n"
+  std::size_t block_size = upload_block_size;
+  if (!upload_chunked)
+    {
+      block_size = std::min(block_size, upload_left);
+    }
 
-      stream << request.method() << " " << request.uri().path() << " HTTP/1.1\r\n";
+  char *data = request_buffer.produce_data(block_size + (upload_chunked ? chunk_header_size + 2 : 0));
+  char *body = upload_chunked ? data + chunk_header_size : data;
+  std::size_t size = std::min(upload_producer(body, block_size), block_size);
 
-      for (auto header : request.headers())
+  if (upload_chunked)
+    {
+      char header[chunk_header_size + 1];
+      snprintf(header, sizeof(header), "%04x\r\n", static_cast<unsigned int>(size));
+      memcpy(data, header, chunk_header_size);
+      memcpy(body + size, "\r\n", 2);
+      request_buffer.produce_commit(chunk_header_size + size + 2);
+
+      // An empty chunk ends the body.
+      uploading = size > 0;
+    }
+  else
+    {
+      if (size == 0)
         {
-          stream << header.first << ": " << header.second << "\r\n";
+          throw std::system_error(HttpErrc::InternalError, "request body is shorter than its content length");
         }
-      stream << "\r\n";
+      request_buffer.produce_commit(size);
+      upload_left -= size;
+      uploading = upload_left > 0;
+    }
+
+  if (!uploading)
+    {
+      upload_producer = nullptr;
+    }
+}
 
-#ifdef NOT_YET_USED
-      bool chunked = false;
-      if (request.headers().has("Transfer-Encoding"))
+// Requests added while a write is in progress are sent by that write. A request
+// body is produced one block at a time, each after the previous block has been
+// written, so the socket paces the producer.
+void
+HttpClient::flush_requests()
+{
+  if (writing)
+    {
+      return;
+    }
+
+  if (request_buffer.consume_size() == 0 && uploading)
+    {
+      try
         {
-          chunked = boost::ifind_first(request.headers()["Transfer-Encoding"], "chunked");
+          produce_request_body();
         }
-#endif
-      auto self = shared_from_this();
-      sock->write_async(request_buffer, [this, self](std::error_code ec, std::size_t bytes_transferred) {
-        (void)bytes_transferred;
+      catch (std::system_error &e)
+        {
+          handle_error(std::string("send request: ") + e.what(), e.code());
+          return;
+        }
+    }
+
+  if (request_buffer.consume_size() == 0)
+    {
+      return;
+    }
+
+  writing = true;
+  auto self = shared_from_this();
+  sock->write_async(request_buffer, [this, self](std::error_code ec, std::size_t bytes_transferred) {
+    (void)bytes_transferred;
+    writing = false;
+    if (!ec)
+      {
+        flush_requests();
+      }
+    else
+      {
+        handle_error("send request", ec);
+      }
+  });
+}
+
+void
+HttpClient::read_body_async(std::size_t size, const body_callback_t &callback)
+{
+  body_sink_t sink = [this](loopp::utils::string_view data) {
+    std::copy(data.begin(), data.end(), body_buffer.produce_data(data.size()));
+    body_buffer.produce_commit(data.size());
+  };
+
+  std::error_code ec = decode_body(sink);
+  if (!ec && !body_done && body_buffer.consume_size() < size)
+    {
+      read_body_data(size - body_buffer.consume_size(), [this, sink, callback](std::error_code ec) {
         if (!ec)
           {
-            // TODO: support sending chunked body.
-            send_body();
-          }
-        else
-          {
-            handle_error("send header", ec);
+            ec = decode_body(sink);
           }
+        complete_body_read(ec, callback);
       });
     }
-  catch (std::system_error &e)
+  else
     {
-      handle_error(std::string("send publish: ") + e.what(), e.code());
+      complete_body_read(ec, callback);
     }
 }
 
 void
-HttpClient::update_request_headers()
+HttpClient::complete_body_read(std::error_code ec, const body_callback_t &callback)
 {
-  loopp::http::Headers &headers = request.headers();
+  if (ec)
+    {
+      ESP_LOGE(tag, "Failed to read body: %s", ec.message().c_str());
+      reusable = false;
+    }
 
-  headers.emplace("Host", request.uri().host());
+  callback(ec, &body_buffer);
 
-  if (!request.headers().has("Transfer-Encoding") || !boost::ifind_first(request.headers()["Transfer-Encoding"], "chunked"))
+  if (response_active && (ec || (body_done && body_buffer.consume_size() == 0)))
     {
-      headers.emplace("Content-Length", std::to_string(request.content().size()));
+      complete_response();
     }
 }
 
 void
-HttpClient::send_body()
+HttpClient::stream_body_async(body_sink_t sink, body_complete_callback_t callback)
+{
+  body_sink = std::move(sink);
+  body_complete = std::move(callback);
+  continue_stream_body();
+}
+
+void
+HttpClient::continue_stream_body()
 {
-  if (!request.content().empty())
+  std::error_code ec = decode_body(body_sink);
+  if (ec || body_done)
     {
-      std::ostream stream(&request_buffer);
-      stream << request.content();
+      finish_stream_body(ec);
+      return;
+    }
 
-      auto self = shared_from_this();
-      sock->write_async(request_buffer, [this, self](std::error_code ec, std::size_t bytes_transferred) {
-        (void)bytes_transferred;
-        if (!ec)
-          {
-            read_response();
-          }
-        else
-          {
-            handle_error("send body", ec);
-          }
-      });
+  if (body_paused)
+    {
+      body_read_deferred = true;
+      return;
     }
-  else
+
+  read_body_data(body_read_size, [this](std::error_code ec) {
+    if (ec)
+      {
+        finish_stream_body(ec);
+      }
+    else
+      {
+        continue_stream_body();
+      }
+  });
+}
+
+void
+HttpClient::pause_body()
+{
+  body_paused = true;
+}
+
+void
+HttpClient::resume_body()
+{
+  body_paused = false;
+  if (body_read_deferred)
     {
-      read_response();
+      body_read_deferred = false;
+      continue_stream_body();
     }
 }
 
 void
-HttpClient::read_response()
+HttpClient::finish_stream_body(std::error_code ec)
+{
+  body_complete_callback_t callback = std::move(body_complete);
+  body_complete = nullptr;
+  body_sink = nullptr;
+
+  if (ec)
+    {
+      ESP_LOGE(tag, "Failed to read body: %s", ec.message().c_str());
+      reusable = false;
+    }
+
+  complete_response();
+  if (callback)
+    {
+      callback(ec);
+    }
+}
+
+// Reads at most max_size bytes of the raw body into the response buffer.
+void
+HttpClient::read_body_data(std::size_t max_size, const body_complete_callback_t &callback)
 {
   auto self = shared_from_this();
-  sock->read_until_async(response_buffer, "\r\n\r\n", [this, self](std::error_code ec, std::size_t bytes_transferred) {
-    (void)bytes_transferred;
-    if (!ec)
+  auto stream = sock;
+  auto on_read = [this, self, stream, callback](std::error_code ec, std::size_t bytes_transferred) {
+    if (stream != sock)
       {
-        handle_response();
+        // The response was abandoned.
+        return;
       }
-    else
+
+    if (framing == BodyFraming::Length)
       {
-        handle_error("read response", ec);
+        body_length_left -= bytes_transferred;
       }
-  });
+    else if (framing == BodyFraming::UntilClose && ec == loopp::net::NetworkErrc::ConnectionClosed)
+      {
+        body_done = true;
+        ec = std::error_code();
+      }
+    callback(ec);
+  };
+
+  if (framing == BodyFraming::Length)
+    {
+      sock->read_async(response_buffer, std::min(max_size, body_length_left), on_read);
+    }
+  else
+    {
+      sock->read_some_async(response_buffer, max_size, on_read);
+    }
+}
+
+// Removes the transfer coding and content coding from the received body data.
+std::error_code
+HttpClient::decode_body(const body_sink_t &sink)
+{
+  loopp::utils::string_view input(response_buffer.consume_data(), response_buffer.consume_size());
+  std::error_code ec;
+
+  if (framing == BodyFraming::Chunked)
+    {
+      while (!ec && !body_done && !input.empty())
+        {
+          loopp::utils::string_view data;
+          switch (chunked_decoder.decode(input, data))
+            {
+            case ChunkedDecoder::Result::Data:
+              ec = deliver_body(data, sink);
+              break;
+            case ChunkedDecoder::Result::Done:
+              body_done = true;
+              break;
+            case ChunkedDecoder::Result::Invalid:
+              ec = HttpErrc::ProtocolError;
+              break;
+            case ChunkedDecoder::Result::Incomplete:
+              break;
+            }
+        }
+
+      // Data after the last chunk belongs to the next pipelined response.
+      if (!ec && body_done && !input.empty())
+        {
+          std::copy(input.begin(), input.end(), pipeline_buffer.produce_data(input.size()));
+          pipeline_buffer.produce_commit(input.size());
+        }
+    }
+  else if (!input.empty())
+    {
+      ec = deliver_body(input, sink);
+    }
+
+  if (framing == BodyFraming::Length && body_length_left == 0)
+    {
+      body_done = true;
+    }
+  response_buffer.clear();
+
+  if (!ec && body_done && inflater && !inflater->done())
+    {
+      ec = HttpErrc::InvalidEncoding;
+    }
+  return ec;
+}
+
+std::error_code
+HttpClient::deliver_body(loopp::utils::string_view data, const body_sink_t &sink)
+{
+  try
+    {
+      if (inflater)
+        {
+          return inflater->inflate(data, sink);
+        }
+      sink(data);
+    }
+  catch (std::system_error &e)
+    {
+      return e.code();
+    }
+  catch (std::length_error &)
+    {
+      return HttpErrc::InternalError;
+    }
+  return std::error_code();
+}
+
+void
+HttpClient::read_response()
+{
+  awaiting_response = true;
+
+  response_buffer.clear();
+  if (pipeline_buffer.consume_size() > 0)
+    {
+      std::size_t size = pipeline_buffer.consume_size();
+      std::copy(pipeline_buffer.consume_data(), pipeline_buffer.consume_data() + size, response_buffer.produce_data(size));
+      response_buffer.produce_commit(size);
+      pipeline_buffer.clear();
+    }
+
+  parser.reset();
+  read_response_header();
+}
+
+// The parser resumes its search for the end of the header where it stopped.
+void
+HttpClient::read_response_header()
+{
+  ResponseParser::Result result = parser.parse(response_buffer.consume_data(), response_buffer.consume_size());
+
+  if (result == ResponseParser::Result::Complete)
+    {
+      handle_response();
+    }
+  else if (result == ResponseParser::Result::Invalid || response_buffer.consume_size() >= max_header_size)
+    {
+      handle_error("parse response", HttpErrc::ProtocolError);
+    }
+  else
+    {
+      auto self = shared_from_this();
+      sock->read_some_async(response_buffer, 512, [this, self](std::error_code ec, std::size_t bytes_transferred) {
+        (void)bytes_transferred;
+        if (!ec)
+          {
+            read_response_header();
+          }
+        else
+          {
+            handle_error("read response", ec);
+          }
+      });
+    }
 }
 
 void
 HttpClient::handle_response()
 {
-  std::istream response_stream(&response_buffer);
-  response_stream.imbue(std::locale::classic());
+  if (!process_headers(exchanges.front().request))
+    {
+      handle_error("parse response", HttpErrc::ProtocolError);
+      return;
+    }
+
+  awaiting_response = false;
+  responses_on_connection++;
+
+  if (uploading)
+    {
+      // The server responded before the request body was complete.
+      uploading = false;
+      upload_producer = nullptr;
+      reusable = false;
+    }
+
+  Exchange exchange = std::move(exchanges.front());
+  exchanges.pop_front();
 
-  parse_status_line(response_stream);
-  parse_headers(response_stream);
+  response = Response();
+  response.http_version(std::string(parser.http_version()));
+  response.status_code(parser.status_code());
+  response.status_message(std::string(parser.status_message()));
+  for (const auto &field : parser.headers())
+    {
+      response.headers().set(std::string(field.first), std::string(field.second));
+    }
+
+  if (parser.dropped_fields() > 0)
+    {
+      ESP_LOGW(tag, "Warning: dropped %d response header fields", parser.dropped_fields());
+    }
 
-  complete_callback(std::error_code(), response);
+  response_buffer.consume_commit(parser.header_size());
+  body_buffer.clear();
+
+  // Data beyond the body belongs to the next pipelined response.
+  if (reusable && framing != BodyFraming::Chunked && response_buffer.consume_size() > body_length)
+    {
+      std::size_t excess = response_buffer.consume_size() - body_length;
+      std::copy(response_buffer.consume_data() + body_length,
+                response_buffer.consume_data() + body_length + excess,
+                pipeline_buffer.produce_data(excess));
+      pipeline_buffer.produce_commit(excess);
+      response_buffer.produce_rewind(excess);
+    }
+
+  response_active = true;
+  exchange.callback(std::error_code(), response);
 }
 
+// Ends the current response. A body that is still being streamed, e.g. when
+// the next request is executed before it was read, is cancelled.
 void
-HttpClient::parse_status_line(std::istream &response_stream)
+HttpClient::complete_response()
 {
-  std::string http_version;
-  response_stream >> http_version;
+  body_complete_callback_t callback = std::move(body_complete);
 
-  std::string status_code;
-  response_stream >> status_code;
+  response_active = false;
+  body_sink = nullptr;
+  body_complete = nullptr;
+  body_paused = false;
+  body_read_deferred = false;
+  inflater.reset();
 
-  std::string status_message;
-  std::getline(response_stream, status_message);
-  boost::algorithm::trim(status_message);
+  if (!reusable || !body_done)
+    {
+      close_connection();
+    }
 
-  response.status_code(boost::lexical_cast<int>(status_code));
-  response.status_message(status_message);
+  start_next();
+
+  if (callback)
+    {
+      callback(HttpErrc::Cancelled);
+    }
 }
 
 void
-HttpClient::parse_headers(std::istream &response_stream)
+HttpClient::release_connection()
 {
-  response.headers().parse(response_stream);
+  if (sock)
+    {
+      bool pending = std::any_of(exchanges.begin(), exchanges.end(), [](const Exchange &e) { return e.sent; });
+      if (reusable && !pending && !writing && pipeline_buffer.consume_size() == 0)
+        {
+          pool->release(sock_scheme, sock_host, sock_port, sock);
+          sock.reset();
+        }
+      else
+        {
+          close_connection();
+        }
+    }
+}
 
-  if (response.headers().has("connection"))
+void
+HttpClient::close_connection()
+{
+  if (sock)
     {
-      // TODO: pipelining
-      keep_alive = !boost::iequals(response.headers()["Connection"], "close");
+      sock->close();
+      sock.reset();
+    }
+  writing = false;
+  uploading = false;
+  upload_producer = nullptr;
+  request_buffer.clear();
+  pipeline_buffer.clear();
+
+  // Pipelined requests are sent again on the next connection.
+  for (auto &exchange : exchanges)
+    {
+      exchange.sent = false;
+    }
+}
+
+bool
+HttpClient::process_headers(const Request &request)
+{
+  const HeaderView &headers = parser.headers();
+
+  // HTTP/1.1 connections are persistent unless either side closes them.
+  keep_alive = parser.http_version() == "HTTP/1.1";
+  if (headers.has("Connection"))
+    {
+      keep_alive = !ResponseParser::iequals(headers.find("Connection"), "close");
     }
 
   bool chunked = false;
-  if (response.headers().has("transfer-encoding"))
+  if (headers.has("Transfer-Encoding"))
     {
-      chunked = boost::ifind_first(response.headers()["transfer-encoding"], "chunked");
+      chunked = headers.find("Transfer-Encoding").find("chunked") != loopp::utils::string_view::npos;
     }
 
-  if (!chunked)
+  body_length = 0;
+  body_length_left = 0;
+
+  int status = parser.status_code();
+  if (request.method() == "HEAD" || status == 204 || status == 304 || (status >= 100 && status < 200))
+    {
+      framing = BodyFraming::None;
+    }
+  else if (chunked)
     {
-      if (response.headers().has("Content-Length"))
+      framing = BodyFraming::Chunked;
+    }
+  else if (headers.has("Content-Length"))
+    {
+      framing = BodyFraming::Length;
+    }
+  else
+    {
+      framing = BodyFraming::UntilClose;
+    }
+
+  // The connection can only be reused when the end of the body is known.
+  reusable = keep_alive && framing != BodyFraming::UntilClose;
+  body_done = framing == BodyFraming::None;
+  chunked_decoder.reset();
+  inflater.reset();
+
+  if (framing == BodyFraming::Length)
+    {
+      if (!ResponseParser::parse_size(headers.find("Content-Length"), body_length))
         {
-          body_length = boost::lexical_cast<std::size_t>(response.headers()["Content-Length"]);
+          return false;
+        }
 
-          if (body_length > response_buffer.consume_size())
-            {
-              body_length_left = body_length - response_buffer.consume_size();
-            }
-          else
-            {
-              body_length_left = 0;
-            }
+      std::size_t in_buffer = response_buffer.consume_size() - parser.header_size();
+      body_length_left = body_length > in_buffer ? body_length - in_buffer : 0;
+      body_done = body_length == 0;
+
+      ESP_LOGD(tag, "body-size=%d left=%d in-buffer=%d", body_length, body_length_left, in_buffer);
+    }
 
-          ESP_LOGD(tag, "body-size=%d left=%d in-buffer=%d", body_length, body_length_left, response_buffer.consume_size());
+  loopp::utils::string_view encoding = headers.find("Content-Encoding");
+  if (framing != BodyFraming::None && !encoding.empty())
+    {
+      if (ResponseParser::iequals(encoding, "gzip") || ResponseParser::iequals(encoding, "x-gzip"))
+        {
+          inflater = std::unique_ptr<Inflater>(new Inflater(Inflater::Format::Gzip));
+        }
+      else if (ResponseParser::iequals(encoding, "deflate"))
+        {
+          inflater = std::unique_ptr<Inflater>(new Inflater(Inflater::Format::Deflate));
+        }
+      else if (!ResponseParser::iequals(encoding, "identity"))
+        {
+          ESP_LOGW(tag, "Unsupported content encoding %s", std::string(encoding).c_str());
         }
     }
+  return true;
 }
 
 void
@@ -305,8 +849,28 @@ HttpClient::handle_error(const std::string &what, std::error_code ec)
   if (ec)
     {
       ESP_LOGE(tag, "HTTP Error: %s %s", what.c_str(), ec.message().c_str());
-      sock->close();
-      sock.reset();
-      complete_callback(ec, response);
+
+      bool reused = sock_reused || responses_on_connection > 0;
+      connecting = false;
+      awaiting_response = false;
+      response_active = false;
+      reusable = false;
+      close_connection();
+
+      // A kept-alive connection may have been closed by the server while it was idle.
+      if (reused && !exchanges.empty() && !exchanges.front().retried && is_idempotent(exchanges.front().request))
+        {
+          ESP_LOGI(tag, "Retrying on a new connection");
+          exchanges.front().retried = true;
+          start_next();
+          return;
+        }
+
+      std::deque<Exchange> failed;
+      failed.swap(exchanges);
+      for (auto &exchange : failed)
+        {
+          exchange.callback(ec, Response());
+        }
     }
 }
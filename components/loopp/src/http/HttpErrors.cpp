@@ -45,6 +45,10 @@ namespace
           return "protocol error";
         case loopp::http::HttpErrc::InvalidURI:
           return "invalid URI";
+        case loopp::http::HttpErrc::InvalidEncoding:
+          return "invalid content encoding";
+        case loopp::http::HttpErrc::Cancelled:
+          return "cancelled";
         default:
           return "(unrecognized error)";
       }
@@ -0,0 +1,183 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/http/Inflater.hpp"
+
+#include <algorithm>
+
+#include "loopp/http/HttpErrors.hpp"
+
+using namespace loopp::http;
+using loopp::utils::string_view;
+
+namespace
+{
+  const uint8_t GZIP_FHCRC = 0x02;
+  const uint8_t GZIP_FEXTRA = 0x04;
+  const uint8_t GZIP_FNAME = 0x08;
+  const uint8_t GZIP_FCOMMENT = 0x10;
+
+  // Fixed part of the gzip header: ID1 ID2 CM FLG MTIME(4) XFL OS
+  const std::size_t GZIP_HEADER_SIZE = 10;
+} // namespace
+
+Inflater::Inflater(Format format)
+  : format(format)
+  , decompressor(new tinfl_decompressor)
+  , window(new uint8_t[TINFL_LZ_DICT_SIZE])
+{
+  tinfl_init(decompressor.get());
+}
+
+std::error_code
+Inflater::inflate(string_view input, const output_callback_t &output)
+{
+  if (state == State::Header)
+    {
+      if (format == Format::Gzip)
+        {
+          if (!parse_gzip_header(input))
+            {
+              return input.empty() ? std::error_code() : HttpErrc::InvalidEncoding;
+            }
+        }
+      else
+        {
+          if (input.empty())
+            {
+              return std::error_code();
+            }
+
+          // Servers send "deflate" both with and without the zlib wrapper.
+          uint8_t cmf = static_cast<uint8_t>(input[0]);
+          if ((cmf & 0x0f) == 8 && (cmf >> 4) <= 7)
+            {
+              flags = TINFL_FLAG_PARSE_ZLIB_HEADER;
+            }
+        }
+      state = State::Data;
+    }
+
+  while (state == State::Data)
+    {
+      std::size_t in_size = input.size();
+      std::size_t out_size = TINFL_LZ_DICT_SIZE - window_pos;
+
+      tinfl_status status = tinfl_decompress(decompressor.get(),
+                                             reinterpret_cast<const mz_uint8 *>(input.data()),
+                                             &in_size,
+                                             window.get(),
+                                             window.get() + window_pos,
+                                             &out_size,
+                                             flags | TINFL_FLAG_HAS_MORE_INPUT);
+      input.remove_prefix(in_size);
+
+      if (out_size > 0)
+        {
+          output(string_view(reinterpret_cast<const char *>(window.get() + window_pos), out_size));
+          window_pos = (window_pos + out_size) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+
+      if (status < TINFL_STATUS_DONE)
+        {
+          return HttpErrc::InvalidEncoding;
+        }
+      else if (status == TINFL_STATUS_DONE)
+        {
+          // The gzip trailer that may follow is not verified.
+          state = State::Done;
+        }
+      else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && input.empty())
+        {
+          break;
+        }
+    }
+
+  return std::error_code();
+}
+
+// Returns true when the complete header has been consumed, false when more
+// input is needed. Input that remains in a false return indicates an invalid header.
+bool
+Inflater::parse_gzip_header(string_view &input)
+{
+  while (!input.empty())
+    {
+      uint8_t c = static_cast<uint8_t>(input.front());
+
+      if (header_pos < GZIP_HEADER_SIZE)
+        {
+          if ((header_pos == 0 && c != 0x1f) || (header_pos == 1 && c != 0x8b) || (header_pos == 2 && c != 8))
+            {
+              return false;
+            }
+          if (header_pos == 3)
+            {
+              header_flags = c;
+            }
+          header_pos++;
+          input.remove_prefix(1);
+        }
+      else if (header_flags & GZIP_FEXTRA)
+        {
+          // Two length bytes, followed by the extra field itself.
+          if (header_pos < GZIP_HEADER_SIZE + 2)
+            {
+              extra_left |= std::size_t(c) << (8 * (header_pos - GZIP_HEADER_SIZE));
+              header_pos++;
+              input.remove_prefix(1);
+            }
+          else
+            {
+              std::size_t size = std::min(extra_left, input.size());
+              input.remove_prefix(size);
+              extra_left -= size;
+              if (extra_left == 0)
+                {
+                  header_flags &= ~GZIP_FEXTRA;
+                }
+            }
+        }
+      else if (header_flags & GZIP_FNAME)
+        {
+          header_flags &= c == 0 ? ~GZIP_FNAME : 0xff;
+          input.remove_prefix(1);
+        }
+      else if (header_flags & GZIP_FCOMMENT)
+        {
+          header_flags &= c == 0 ? ~GZIP_FCOMMENT : 0xff;
+          input.remove_prefix(1);
+        }
+      else if (header_flags & GZIP_FHCRC)
+        {
+          extra_left++;
+          input.remove_prefix(1);
+          if (extra_left == 2)
+            {
+              header_flags &= ~GZIP_FHCRC;
+            }
+        }
+      else
+        {
+          return true;
+        }
+    }
+  return (header_pos == GZIP_HEADER_SIZE) && (header_flags & (GZIP_FEXTRA | GZIP_FNAME | GZIP_FCOMMENT | GZIP_FHCRC)) == 0;
+}
@@ -0,0 +1,245 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/http/ResponseParser.hpp"
+
+#include <cctype>
+
+using namespace loopp::http;
+using loopp::utils::string_view;
+
+namespace
+{
+  // Fields needed to find the end of the body and to decode it.
+  const char *const framing_fields[] = {
+    "Content-Length", "Transfer-Encoding", "Connection", "Content-Encoding", "Content-Range", "ETag",
+  };
+  const std::size_t num_framing_fields = sizeof(framing_fields) / sizeof(framing_fields[0]);
+} // namespace
+
+bool
+HeaderView::add(string_view name, string_view value)
+{
+  if (count == max_fields)
+    {
+      return false;
+    }
+  fields[count++] = field_t(name, value);
+  return true;
+}
+
+void
+HeaderView::clear()
+{
+  count = 0;
+}
+
+bool
+HeaderView::has(string_view name) const
+{
+  for (const auto &field : *this)
+    {
+      if (ResponseParser::iequals(field.first, name))
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+string_view
+HeaderView::find(string_view name) const
+{
+  for (const auto &field : *this)
+    {
+      if (ResponseParser::iequals(field.first, name))
+        {
+          return field.second;
+        }
+    }
+  return string_view();
+}
+
+void
+ResponseParser::reset()
+{
+  scan_pos = 0;
+  header_size_ = 0;
+  http_version_ = string_view();
+  status_code_ = 0;
+  status_message_ = string_view();
+  headers_.clear();
+  dropped_fields_ = 0;
+}
+
+ResponseParser::Result
+ResponseParser::parse(const char *data, std::size_t size)
+{
+  // Look for the empty line that ends the header, starting where the previous call stopped.
+  for (std::size_t i = scan_pos; i < size; i++)
+    {
+      if (data[i] == '\n' && i > 0)
+        {
+          if (data[i - 1] == '\n' || (data[i - 1] == '\r' && i > 1 && data[i - 2] == '\n'))
+            {
+              scan_pos = i + 1;
+              header_size_ = i + 1;
+              return parse_header(data, header_size_);
+            }
+        }
+    }
+
+  scan_pos = size;
+  return Result::Incomplete;
+}
+
+ResponseParser::Result
+ResponseParser::parse_header(const char *data, std::size_t size)
+{
+  headers_.clear();
+  dropped_fields_ = 0;
+
+  string_view header(data, size);
+  bool status_line = true;
+
+  while (!header.empty())
+    {
+      std::size_t eol = header.find('\n');
+      string_view line = header.substr(0, eol);
+      header.remove_prefix(eol + 1);
+
+      if (!line.empty() && line.back() == '\r')
+        {
+          line.remove_suffix(1);
+        }
+
+      if (line.empty())
+        {
+          break;
+        }
+
+      if (status_line)
+        {
+          // HTTP/1.1 200 OK
+          std::size_t sp = line.find(' ');
+          if (sp == string_view::npos || line.substr(0, 5) != "HTTP/")
+            {
+              return Result::Invalid;
+            }
+          http_version_ = line.substr(0, sp);
+
+          string_view rest = line.substr(sp + 1);
+          if (rest.size() < 3 || !isdigit(rest[0]) || !isdigit(rest[1]) || !isdigit(rest[2]) || (rest.size() > 3 && rest[3] != ' '))
+            {
+              return Result::Invalid;
+            }
+          status_code_ = (rest[0] - '0') * 100 + (rest[1] - '0') * 10 + (rest[2] - '0');
+          status_message_ = trim(rest.substr(3));
+          status_line = false;
+        }
+      else
+        {
+          std::size_t colon = line.find(':');
+          if (colon == string_view::npos || colon == 0 || line[0] == ' ' || line[0] == '\t')
+            {
+              return Result::Invalid;
+            }
+
+          string_view name = trim(line.substr(0, colon));
+          if (headers_.size() >= HeaderView::max_fields - num_framing_fields && !is_framing_field(name))
+            {
+              dropped_fields_++;
+              continue;
+            }
+
+          if (!headers_.add(name, trim(line.substr(colon + 1))))
+            {
+              return Result::Invalid;
+            }
+        }
+    }
+
+  return status_line ? Result::Invalid : Result::Complete;
+}
+
+bool
+ResponseParser::iequals(string_view a, string_view b)
+{
+  if (a.size() != b.size())
+    {
+      return false;
+    }
+  for (std::size_t i = 0; i < a.size(); i++)
+    {
+      if (tolower(static_cast<unsigned char>(a[i])) != tolower(static_cast<unsigned char>(b[i])))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+bool
+ResponseParser::parse_size(string_view s, std::size_t &value)
+{
+  if (s.empty())
+    {
+      return false;
+    }
+
+  std::size_t result = 0;
+  for (char c : s)
+    {
+      if (!isdigit(static_cast<unsigned char>(c)) || result > (std::size_t(-1) - 9) / 10)
+        {
+          return false;
+        }
+      result = result * 10 + (c - '0');
+    }
+  value = result;
+  return true;
+}
+
+bool
+ResponseParser::is_framing_field(string_view name)
+{
+  for (const char *field : framing_fields)
+    {
+      if (iequals(name, field))
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+string_view
+ResponseParser::trim(string_view s)
+{
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    {
+      s.remove_prefix(1);
+    }
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+    {
+      s.remove_suffix(1);
+    }
+  return s;
+}
@@ -20,16 +20,15 @@
 
 #include "loopp/http/Uri.hpp"
 
-#include "boost_xtensa.hpp"
-
-#include <boost/regex.hpp>
-#include <boost/lexical_cast.hpp>
-#include <boost/algorithm/string.hpp>
+#include <cctype>
+#include <ostream>
 
 #include "loopp/http/HttpErrors.hpp"
+#include "loopp/utils/string_view.hpp"
 
 using namespace std;
 using namespace loopp::http;
+using loopp::utils::string_view;
 
 namespace
 {
@@ -37,12 +36,52 @@ namespace
   {
     return c + (c > 9 ? ('A' - 10) : '0');
   }
+
+  inline int from_hex(unsigned char c)
+  {
+    if (isdigit(c))
+      {
+        return c - '0';
+      }
+    if (isxdigit(c))
+      {
+        return tolower(c) - 'a' + 10;
+      }
+    return -1;
+  }
+
+  // Returns the position of the first character in s that is one of chars.
+  std::size_t find_any(string_view s, const char *chars)
+  {
+    for (std::size_t i = 0; i < s.size(); i++)
+      {
+        for (const char *c = chars; *c != 0; c++)
+          {
+            if (s[i] == *c)
+              {
+                return i;
+              }
+          }
+      }
+    return string_view::npos;
+  }
+
+  inline bool is_host_char(char c)
+  {
+    return isalnum(static_cast<unsigned char>(c)) || c == '.' || c == '-';
+  }
+
+  [[noreturn]] void invalid_uri()
+  {
+    throw std::system_error(HttpErrc::InvalidURI, "URI invalid");
+  }
 } // namespace
 
 const std::string
 Uri::escape(const std::string &in)
 {
   std::string ret;
+  ret.reserve(in.size());
   for (unsigned char ch : in)
     {
       if ((isalnum(ch) != 0) || (ch == '-') || (ch == '_') || (ch == '.') || (ch == '~'))
@@ -63,75 +102,146 @@ Uri::escape(const std::string &in)
   return ret;
 }
 
+// Reverses escape(). Malformed escape sequences are copied as is.
 const std::string
 Uri::unescape(const std::string &in)
 {
-  string ret = in;
-  // TODO:
+  std::string ret;
+  ret.reserve(in.size());
+  for (std::size_t i = 0; i < in.size(); i++)
+    {
+      char ch = in[i];
+      if (ch == '+')
+        {
+          ret += ' ';
+        }
+      else if (ch == '%' && i + 2 < in.size() && from_hex(in[i + 1]) >= 0 && from_hex(in[i + 2]) >= 0)
+        {
+          ret += static_cast<char>((from_hex(in[i + 1]) << 4) | from_hex(in[i + 2]));
+          i += 2;
+        }
+      else
+        {
+          ret += ch;
+        }
+    }
   return ret;
 }
 
+// [scheme://][username[:password]@]host[:port][path][?query][#fragment]
 void
 Uri::parse(const std::string &uri)
 {
-  const string uri_regex = "((?<scheme>[^:/?#]+)://)?"
-                           "((?<username>[^:@]+)(:(?<password>[^@]+))?@)?"
-                           "(?<host>[a-zA-Z0-9.-]*)"
-                           "(:(?<port>[\\d]{2,5}))?"
-                           "(?<fullpath>"
-                           "(?<path>[/\\\\][^?#]*)?"
-                           "(\\?(?<query>[^#]*))?"
-                           "(#(?<fragment>.*))?"
-                           ")";
-
-  boost::regex re(uri_regex, boost::regex::icase);
-
-  boost::smatch matches;
-  bool found = boost::regex_match(uri, matches, re);
-  if (!found)
+  string_view rest(uri);
+
+  uri_ = uri;
+  scheme_ = "http";
+  username_.clear();
+  password_.clear();
+  query_parameters_.clear();
+
+  std::size_t pos = find_any(rest, ":/?#");
+  if (pos != string_view::npos && pos > 0 && rest.substr(pos, 3) == "://")
     {
-      throw std::system_error(HttpErrc::InvalidURI, "URI invalid");
+      scheme_ = std::string(rest.substr(0, pos));
+      rest.remove_prefix(pos + 3);
     }
 
-  scheme_ = matches["scheme"];
-  if (scheme_.empty())
+  // The authority ends at the path, query or fragment.
+  std::size_t authority_end = find_any(rest, "/\\?#");
+  string_view authority = rest.substr(0, authority_end);
+  rest.remove_prefix(authority.size());
+
+  pos = authority.find('@');
+  if (pos != string_view::npos)
     {
-      scheme_ = "http";
+      string_view userinfo = authority.substr(0, pos);
+      authority.remove_prefix(pos + 1);
+
+      std::size_t colon = userinfo.find(':');
+      string_view username = userinfo.substr(0, colon);
+      if (username.empty() || authority.find('@') != string_view::npos)
+        {
+          invalid_uri();
+        }
+      username_ = std::string(username);
+      if (colon != string_view::npos)
+        {
+          password_ = std::string(userinfo.substr(colon + 1));
+        }
     }
 
-  username_ = matches["username"];
-  password_ = matches["password"];
+  pos = authority.find(':');
+  string_view host = authority.substr(0, pos);
+  for (char c : host)
+    {
+      if (!is_host_char(c))
+        {
+          invalid_uri();
+        }
+    }
+  host_ = std::string(host);
 
-  host_ = matches["host"];
-  std::string portstr = matches["port"];
-  if (!portstr.empty())
+  if (pos != string_view::npos)
     {
-      port_ = boost::lexical_cast<uint16_t>(portstr);
+      string_view port = authority.substr(pos + 1);
+      if (port.size() < 2 || port.size() > 5)
+        {
+          invalid_uri();
+        }
+
+      unsigned long value = 0;
+      for (char c : port)
+        {
+          if (!isdigit(static_cast<unsigned char>(c)))
+            {
+              invalid_uri();
+            }
+          value = value * 10 + (c - '0');
+        }
+      if (value > 65535)
+        {
+          invalid_uri();
+        }
+      port_ = static_cast<uint16_t>(value);
     }
   else
     {
       port_ = (scheme_ == "https") ? 443 : 80;
     }
 
-  path_ = matches["path"];
-  query_ = matches["query"];
-  fragment_ = matches["fragment"];
-  fullpath_ = matches["fullpath"];
+  fullpath_ = std::string(rest);
+
+  pos = find_any(rest, "?#");
+  path_ = std::string(rest.substr(0, pos));
+  rest.remove_prefix(path_.size());
 
-  if (!query_.empty())
+  query_.clear();
+  if (!rest.empty() && rest.front() == '?')
     {
-      vector<string> query_params;
-      boost::split(query_params, query_, boost::is_any_of("&"));
+      pos = rest.find('#');
+      query_ = std::string(rest.substr(1, pos == string_view::npos ? pos : pos - 1));
+      rest.remove_prefix(query_.size() + 1);
+    }
 
-      for (auto & query_param : query_params)
-        {
-          vector<string> param_elements;
-          boost::split(param_elements, query_param, boost::is_any_of("="));
+  fragment_.clear();
+  if (!rest.empty())
+    {
+      fragment_ = std::string(rest.substr(1));
+    }
 
-          if (param_elements.size() == 2)
-            {
-              query_parameters_[param_elements[0]] = param_elements[1];
-            }
+  // Only parameters of the form name=value are recognized.
+  string_view query(query_);
+  while (!query.empty())
+    {
+      pos = query.find('&');
+      string_view param = query.substr(0, pos);
+      query.remove_prefix(pos == string_view::npos ? query.size() : pos + 1);
+
+      std::size_t equals = param.find('=');
+      if (equals != string_view::npos && param.find('=', equals + 1) == string_view::npos)
+        {
+          query_parameters_[std::string(param.substr(0, equals))] = std::string(param.substr(equals + 1));
         }
     }
 }
@@ -22,12 +22,15 @@
 
 #include <algorithm>
 #include <numeric>
+#include <stdexcept>
 
 #include "boost/format.hpp"
 
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "esp_system.h"
 
+#include "loopp/core/ScopedLock.hpp"
 #include "loopp/mqtt/MqttPacket.hpp"
 #include "loopp/mqtt/MqttErrors.hpp"
 #include "loopp/net/TCPStream.hpp"
@@ -39,12 +42,17 @@ static const char *tag = "MQTT";
 using namespace loopp;
 using namespace loopp::mqtt;
 
+// PINGREQ has no variable content and is encoded once.
+static constexpr char pingreq_packet[] = { static_cast<char>(0xc0), 0x00 };
+
 MqttClient::MqttClient(std::shared_ptr<loopp::core::MainLoop> loop, std::string client_id, std::string host, int port)
   : loop(std::move(loop))
   , client_id(std::move(client_id))
   , host(std::move(host))
   , port(port)
+  , ping_packet(std::make_shared<MqttPacket>())
 {
+  ping_packet->append(pingreq_packet, sizeof(pingreq_packet));
 }
 
 MqttClient::~MqttClient()
@@ -96,6 +104,108 @@ MqttClient::set_will_retain(bool retain)
   will_retain = retain;
 }
 
+void
+MqttClient::set_max_inflight(std::size_t max_inflight)
+{
+  this->max_inflight = std::max<std::size_t>(1, std::min<std::size_t>(max_inflight, max_packet_ids / 2));
+}
+
+void
+MqttClient::set_offline_queue(std::size_t byte_budget, DropPolicy policy)
+{
+  if (byte_budget == 0)
+    {
+      offline_queue.reset();
+    }
+  else
+    {
+      offline_queue = std::make_unique<PublishQueue>(byte_budget, policy);
+    }
+}
+
+void
+MqttClient::set_offline_queue_drain_rate(std::size_t messages_per_second)
+{
+  drain_interval = std::chrono::milliseconds(1000 / std::max<std::size_t>(1, std::min<std::size_t>(messages_per_second, 1000)));
+}
+
+void
+MqttClient::set_topic_priority(const std::string &topic, int priority)
+{
+  topic_priorities[topic] = priority;
+}
+
+void
+MqttClient::set_protocol_version(ProtocolVersion version)
+{
+  protocol_version = version;
+}
+
+void
+MqttClient::set_session_expiry(std::uint32_t seconds)
+{
+  session_expiry = seconds;
+}
+
+// Compresses publishes on topic. The encoding is announced in a
+// content-encoding user property with MQTT 5, and appended to the topic as
+// '/heatshrink-w<window_bits>-l<lookahead_bits>' otherwise.
+void
+MqttClient::set_compression(const std::string &topic, int window_bits, int lookahead_bits)
+{
+  if (!loopp::compress::HeatshrinkEncoder::is_valid(window_bits, lookahead_bits))
+    {
+      throw std::invalid_argument("invalid compression parameters");
+    }
+  compressed_topics[topic] = Compression{ window_bits, lookahead_bits };
+}
+
+void
+MqttClient::clear_compression(const std::string &topic)
+{
+  compressed_topics.erase(topic);
+}
+
+// With a clean session, the server discards subscriptions and QoS state when
+// the connection is lost. Otherwise they survive a reconnect. With MQTT 5 the
+// session expiry interval decides how long the session outlives the connection.
+// A session is never resumed across a reboot.
+void
+MqttClient::set_clean_session(bool clean_session)
+{
+  this->clean_session = clean_session;
+}
+
+// A keep alive of 0 disables pings.
+void
+MqttClient::set_keep_alive(std::chrono::seconds keep_alive)
+{
+  this->keep_alive = std::min(keep_alive, std::chrono::seconds(0xffff));
+}
+
+// Time within which a PINGRESP or the acknowledgement of a QoS 1/2 publish
+// must arrive before the connection is considered dead.
+void
+MqttClient::set_response_timeout(std::chrono::seconds timeout)
+{
+  response_timeout = std::max(timeout, std::chrono::seconds(1));
+}
+
+void
+MqttClient::set_reconnect_backoff(std::chrono::milliseconds initial_delay, std::chrono::milliseconds max_delay)
+{
+  reconnect_initial_delay = std::max(std::chrono::milliseconds(1), initial_delay);
+  reconnect_max_delay = std::max(reconnect_initial_delay, max_delay);
+}
+
+// A failure threshold of 0 disables the circuit breaker.
+void
+MqttClient::set_circuit_breaker(std::size_t failure_threshold, std::chrono::milliseconds open_duration)
+{
+  circuit_failure_threshold = failure_threshold;
+  circuit_open_duration = open_duration;
+}
+
 void
 MqttClient::connect()
 {
@@ -152,12 +262,18 @@ MqttClient::disconnect()
       throw std::system_error(MqttErrc::NotConnected, "not connected to MQTT server");
     }
 
-  if (ping_timer != 0)
+  stop_keep_alive();
+
+  if (reconnect_timer != 0)
     {
-      loop->cancel_timer(ping_timer);
-      ping_timer = 0;
+      loop->cancel_timer(reconnect_timer);
+      reconnect_timer = 0;
     }
 
+  stop_draining();
+  cancel_publishes(MqttErrc::NotConnected);
+  abort_stream(MqttErrc::NotConnected);
+
   if (sock)
     {
       sock->close();
@@ -166,23 +282,161 @@ MqttClient::disconnect()
 }
 
 void
-MqttClient::publish(const std::string &topic, const std::string &payload, PublishOptions options)
+MqttClient::publish(const std::string &topic,
+                    const std::string &payload,
+                    PublishOptions options,
+                    publish_callback_t callback,
+                    const PublishProperties &properties)
 {
-  if (!connected_property.get())
+  PublishWriter writer = begin_publish(topic, options, properties, payload.size());
+  writer.append(payload.data(), payload.size());
+  writer.commit(std::move(callback));
+}
+
+void
+MqttClient::publish(const std::string &topic,
+                    std::string &&payload,
+                    PublishOptions options,
+                    publish_callback_t callback,
+                    const PublishProperties &properties)
+{
+  if (compressed_topics.find(topic) != compressed_topics.end())
+    {
+      publish(topic, static_cast<const std::string &>(payload), options, std::move(callback), properties);
+      return;
+    }
+
+  std::shared_ptr<MqttPacket> packet = begin_publish(topic, options, properties).packet;
+  packet->set_payload(std::move(payload));
+  commit_publish(std::move(packet), topic, options, std::move(callback));
+}
+
+PublishWriter
+MqttClient::begin_publish(const std::string &topic,
+                          PublishOptions options,
+                          const PublishProperties &properties,
+                          std::size_t payload_size)
+{
+  if (!can_publish())
     {
       throw std::system_error(MqttErrc::NotConnected, "not connected to MQTT server");
     }
 
+  BitMask<PublishFlags> flags = PublishFlags::None;
+  BitMask<PublishOptions> qos = options & PublishOptions::QosMask;
+
+  if (options & PublishOptions::Retain)
+    {
+      flags |= PublishFlags::Retain;
+    }
+  if (qos == PublishOptions::Qos1)
+    {
+      flags |= PublishFlags::Qos1;
+    }
+  else if (qos == PublishOptions::Qos2)
+    {
+      flags |= PublishFlags::Qos2;
+    }
+
+  auto compression = compressed_topics.find(topic);
+  std::string encoding;
+  if (compression != compressed_topics.end())
+    {
+      encoding = loopp::compress::HeatshrinkEncoder::name(compression->second.window_bits, compression->second.lookahead_bits);
+    }
+
+  MqttProperties message_properties;
+  if (protocol_version == ProtocolVersion::Mqtt5)
+    {
+      if (properties.message_expiry_interval != 0)
+        {
+          message_properties.add_uint32(PropertyId::MessageExpiryInterval, properties.message_expiry_interval);
+        }
+      if (!properties.content_type.empty())
+        {
+          message_properties.add(PropertyId::ContentType, properties.content_type);
+        }
+      for (const auto &property : properties.user_properties)
+        {
+          message_properties.add(PropertyId::UserProperty, property.first, property.second);
+        }
+      if (!encoding.empty())
+        {
+          message_properties.add(PropertyId::UserProperty, "content-encoding", encoding);
+        }
+    }
+
+  std::shared_ptr<MqttPacket> packet = acquire_packet();
+  if (!encoding.empty() && protocol_version != ProtocolVersion::Mqtt5)
+    {
+      packet->begin_publish(protocol_version, topic + "/" + encoding, static_cast<std::uint8_t>(flags.value()), message_properties.data(),
+                            payload_size);
+    }
+  else
+    {
+      packet->begin_publish(protocol_version, topic, static_cast<std::uint8_t>(flags.value()), message_properties.data(),
+                            payload_size);
+    }
+
+  PublishWriter writer(shared_from_this(), std::move(packet), topic, options);
+  if (!encoding.empty())
+    {
+      writer.encoder = std::make_unique<loopp::compress::HeatshrinkEncoder>(&writer.packet->get_buffer(),
+                                                                            compression->second.window_bits,
+                                                                            compression->second.lookahead_bits);
+    }
+  return writer;
+}
+
+std::shared_ptr<MqttPacket>
+MqttClient::acquire_packet()
+{
+  loopp::core::ScopedLock l(packet_pool_mutex);
+
+  // A packet that is only referenced by the pool is no longer queued or being written.
+  for (auto &packet : packet_pool)
+    {
+      if (packet.use_count() == 1)
+        {
+          packet->clear();
+          return packet;
+        }
+    }
+
+  std::shared_ptr<MqttPacket> packet = std::make_shared<MqttPacket>();
+  if (packet_pool.size() < packet_pool_size)
+    {
+      packet_pool.push_back(packet);
+    }
+  return packet;
+}
+
+void
+MqttClient::commit_publish(std::shared_ptr<MqttPacket> packet,
+                           const std::string &topic,
+                           PublishOptions options,
+                           publish_callback_t callback)
+{
   auto self = shared_from_this();
-  loop->invoke([this, self, topic, payload, options]() { send_publish(topic, payload, options); });
+  loop->invoke([this, self, packet, topic, options, callback]() { queue_publish(packet, topic, options, callback); });
 }
 
 void
 MqttClient::subscribe(const std::string &topic)
 {
+  // Subscriptions are sent again after a reconnect, see handle_connect_ack().
+  if (std::find(subscriptions.begin(), subscriptions.end(), topic) != subscriptions.end())
+    {
+      return;
+    }
+
   subscriptions.push_back(topic);
 
-  if (connected_property.get())
+  if (!connected_property.get())
+    {
+      subscriptions_changed = true;
+    }
+  else
     {
       auto self = shared_from_this();
       loop->invoke([this, self, topic]() {
@@ -198,7 +452,13 @@ MqttClient::unsubscribe(const std::string &topic)
 {
   subscriptions.remove(topic);
 
-  if (connected_property.get())
+  if (!connected_property.get())
+    {
+      // A resumed session still has the subscription, see handle_connect_ack().
+      subscriptions_changed = true;
+      unsent_unsubscribes.push_back(topic);
+    }
+  else
     {
       auto self = shared_from_this();
       loop->invoke([this, self, topic]() {
@@ -220,22 +480,33 @@ MqttClient::send_connect()
 {
   try
     {
-      std::shared_ptr<MqttPacket> pkt = std::make_shared<MqttPacket>();
+      std::shared_ptr<MqttPacket> pkt = acquire_packet();
       BitMask<ConnectFlags> flags(ConnectFlags::None);
-      std::size_t len = 10;
+      bool mqtt5 = protocol_version == ProtocolVersion::Mqtt5;
+      std::size_t len = MqttPacket::string_size(4) + 4;
+
+      MqttProperties properties;
+      if (mqtt5)
+        {
+          if (session_expiry != 0)
+            {
+              properties.add_uint32(PropertyId::SessionExpiryInterval, session_expiry);
+            }
+          len += MqttPacket::properties_size(properties.size());
+        }
 
-      len += client_id.size() + 2;
+      len += MqttPacket::string_size(client_id.size());
 
       if (!username.empty())
         {
           flags |= ConnectFlags::UserName;
-          len += username.size() + 2;
+          len += MqttPacket::string_size(username.size());
         }
 
       if (!password.empty())
         {
           flags |= ConnectFlags::Password;
-          len += password.size() + 2;
+          len += MqttPacket::string_size(password.size());
         }
 
       if (!will_topic.empty() && !will_data.empty())
@@ -245,23 +516,39 @@ MqttClient::send_connect()
             {
               flags |= ConnectFlags::WillRetain;
             }
-          len += will_topic.size() + 2;
-          len += will_data.size() + 2;
+          len += MqttPacket::string_size(will_topic.size());
+          len += MqttPacket::string_size(will_data.size());
+          if (mqtt5)
+            {
+              len += MqttPacket::properties_size(0);
+            }
         }
 
-      flags |= ConnectFlags::CleanSession;
+      // A session that outlives the connection is resumed, so that subscriptions and QoS state survive.
+      // The first connection after boot always starts a new session: a session left on the server by
+      // an earlier boot holds subscriptions this client no longer knows about.
+      if (!session_created || (clean_session && (!mqtt5 || session_expiry == 0)))
+        {
+          flags |= ConnectFlags::CleanSession;
+        }
 
-      pkt->add_fixed_header(loopp::mqtt::PacketType::Connect, 0);
-      pkt->add_length(len);
+      pkt->begin(loopp::mqtt::PacketType::Connect, 0, len);
       pkt->add("MQTT");
-      pkt->add(0x04);
+      pkt->add(static_cast<std::uint8_t>(protocol_version));
       pkt->add(static_cast<uint8_t>(flags.value()));
-      pkt->add(static_cast<std::uint8_t>(keep_alive_sec >> 8));
-      pkt->add(static_cast<std::uint8_t>(keep_alive_sec & 0xff));
+      pkt->add_uint16(static_cast<std::uint16_t>(keep_alive.count()));
+      if (mqtt5)
+        {
+          pkt->add_properties(properties.data());
+        }
       pkt->add(client_id);
 
       if (flags & loopp::mqtt::ConnectFlags::Will)
         {
+          if (mqtt5)
+            {
+              pkt->add_properties(std::string());
+            }
           pkt->add(will_topic);
           pkt->add(will_data);
         }
@@ -296,19 +583,22 @@ MqttClient::send_ping()
 {
   try
     {
-      std::shared_ptr<MqttPacket> pkt = std::make_shared<MqttPacket>();
+      // The previous ping is still being written.
+      if (ping_packet.use_count() > 1)
+        {
+          return;
+        }
+
+      std::shared_ptr<MqttPacket> pkt = ping_packet;
+      pkt->rewind();
+
+      ping_pending = true;
+      ping_sent = std::chrono::steady_clock::now();
+      last_sent = ping_sent;
 
-      pkt->add_fixed_header(loopp::mqtt::PacketType::PingReq, 0);
-      pkt->add(0);
       auto self = shared_from_this();
       sock->write_async(pkt->get_buffer(), [this, self, pkt](std::error_code ec, std::size_t bytes_transferred) {
         verify("send ping", bytes_transferred, pkt->size(), ec);
-        pending_ping_count++;
-
-        if (pending_ping_count > pending_ping_count_limit)
-          {
-            handle_error("ping response timeout ", MqttErrc::Timeout);
-          }
       });
     }
   catch (std::system_error &e)
@@ -317,158 +607,615 @@ MqttClient::send_ping()
     }
 }
 
+// Pings are only sent when nothing was sent for most of the keep alive
+// interval, which is what the server requires. Incoming traffic does not
+// postpone a ping. A dead connection is detected by the response timeout of
+// the ping or of unacknowledged QoS 1/2 publishes.
 void
-MqttClient::send_publish(const std::string &topic, const std::string &payload, PublishOptions options)
+MqttClient::schedule_keep_alive()
 {
-  try
-    {
-      std::shared_ptr<MqttPacket> pkt = std::make_shared<MqttPacket>();
-
-      std::size_t len = 0;
-      BitMask<PublishFlags> flags = PublishFlags::None;
+  using clock = std::chrono::steady_clock;
 
-      if (options & PublishOptions::Retain)
+  auto due = clock::time_point::max();
+  std::chrono::seconds interval = server_keep_alive.count() != 0 ? server_keep_alive : keep_alive;
+  if (interval.count() != 0 && !ping_pending)
+    {
+      due = last_sent + std::chrono::milliseconds(interval) * 3 / 4;
+    }
+  if (ping_pending)
+    {
+      due = std::min(due, ping_sent + response_timeout);
+    }
+  for (const auto &publish : inflight)
+    {
+      if (publish.sent)
         {
-          flags |= PublishFlags::Retain;
+          due = std::min(due, publish.send_time + response_timeout);
         }
-
-      len += topic.size() + 2;
-      len += payload.size();
-
-      pkt->add_fixed_header(loopp::mqtt::PacketType::Publish, static_cast<uint8_t>(flags.value()));
-      pkt->add_length(len);
-      pkt->add(topic);
-      pkt->append(payload);
-
-      auto self = shared_from_this();
-      sock->write_async(pkt->get_buffer(), [this, self, pkt](std::error_code ec, std::size_t bytes_transferred) {
-        verify("send publish", bytes_transferred, pkt->size(), ec);
-      });
     }
-  catch (std::system_error &e)
+
+  stop_keep_alive();
+  if (due != clock::time_point::max())
     {
-      handle_error(std::string("send publish: ") + e.what(), e.code());
+      auto delay = std::chrono::duration_cast<std::chrono::milliseconds>(due - clock::now());
+      keep_alive_timer = loop->add_timer(std::max(delay, std::chrono::milliseconds(0)), std::bind(&MqttClient::check_keep_alive, this));
     }
 }
 
 void
-MqttClient::send_subscribe(const std::list<std::string> &topics)
+MqttClient::check_keep_alive()
 {
-  try
+  auto now = std::chrono::steady_clock::now();
+  keep_alive_timer = 0;
+
+  if (!sock)
     {
-      std::shared_ptr<MqttPacket> pkt = std::make_shared<MqttPacket>();
-      packet_id++;
+      return;
+    }
 
-      std::size_t len = 2 +
-                        std::accumulate(topics.begin(), topics.end(), 0, [](int sum, const std::string &s) { return sum + s.size() + 2 + 1; });
+  if (ping_pending && now - ping_sent >= response_timeout)
+    {
+      handle_error("ping response timeout", MqttErrc::Timeout);
+      return;
+    }
 
-      pkt->add_fixed_header(loopp::mqtt::PacketType::Subscribe, 0b0010u);
-      pkt->add_length(len);
-      pkt->add(static_cast<std::uint8_t>(packet_id >> 8));
-      pkt->add(static_cast<std::uint8_t>(packet_id & 0xff));
-      for (const auto &topic : topics)
+  for (const auto &publish : inflight)
+    {
+      if (publish.sent && now - publish.send_time >= response_timeout)
         {
-          pkt->add(topic);
-          pkt->add(0);
+          handle_error("acknowledgement timeout", MqttErrc::Timeout);
+          return;
         }
+    }
 
-      auto self = shared_from_this();
-      sock->write_async(pkt->get_buffer(), [this, self, pkt](std::error_code ec, std::size_t bytes_transferred) {
-        verify("send subscribe", bytes_transferred, pkt->size(), ec);
-      });
+  std::chrono::seconds interval = server_keep_alive.count() != 0 ? server_keep_alive : keep_alive;
+  if (interval.count() != 0 && !ping_pending && now - last_sent >= std::chrono::milliseconds(interval) * 3 / 4)
+    {
+      send_ping();
     }
-  catch (std::system_error &e)
+
+  schedule_keep_alive();
+}
+
+void
+MqttClient::stop_keep_alive()
+{
+  if (keep_alive_timer != 0)
     {
-      handle_error(std::string("send subscribe: ") + e.what(), e.code());
+      loop->cancel_timer(keep_alive_timer);
+      keep_alive_timer = 0;
     }
 }
 
 void
-MqttClient::send_unsubscribe(const std::list<std::string> &topics)
+MqttClient::queue_publish(std::shared_ptr<MqttPacket> packet,
+                          const std::string &topic,
+                          PublishOptions options,
+                          publish_callback_t callback)
 {
-  try
+  // Messages published while the queue drains go to the back to keep them in order.
+  if (offline_queue && (!connected_property.get() || !offline_queue->empty()))
     {
-      std::shared_ptr<MqttPacket> pkt = std::make_shared<MqttPacket>();
-      packet_id++;
+      PublishQueue::Message message;
+      // The packet topic of a compressed message has an encoding suffix
+      // under MQTT 3.1.1; priorities are configured for the base topic.
+      message.topic = topic;
+      message.packet = std::move(packet);
+      message.options = options;
+      message.callback = std::move(callback);
+
+      auto it = topic_priorities.find(message.topic);
+      if (it != topic_priorities.end())
+        {
+          message.priority = it->second;
+        }
 
-      std::size_t len = 2 + std::accumulate(topics.begin(), topics.end(), 0, [](int sum, const std::string &s) { return sum + s.size() + 2; });
+      offline_queue->push(std::move(message));
+      update_queue_statistics();
+      start_draining();
+      return;
+    }
 
-      pkt->add_fixed_header(loopp::mqtt::PacketType::Unsubscribe, 0b0010u);
-      pkt->add_length(len);
-      pkt->add(static_cast<std::uint8_t>(packet_id >> 8));
-      pkt->add(static_cast<std::uint8_t>(packet_id & 0xff));
-      for (const auto &topic : topics)
+  if (!connected_property.get())
+    {
+      if (callback)
         {
-          pkt->add(topic);
+          callback(MqttErrc::NotConnected);
         }
-
-      auto self = shared_from_this();
-      sock->write_async(pkt->get_buffer(), [this, self, pkt](std::error_code ec, std::size_t bytes_transferred) {
-        verify("send unsubscribe", bytes_transferred, pkt->size(), ec);
-      });
+      return;
     }
-  catch (std::system_error &e)
+
+  send_publish(std::move(packet), options, std::move(callback));
+}
+
+void
+MqttClient::start_draining()
+{
+  if (offline_queue && !offline_queue->empty() && connected_property.get() && drain_timer == 0)
     {
-      handle_error(std::string("send unsubscribe: ") + e.what(), e.code());
+      ESP_LOGI(tag, "Info: Draining %d queued messages", offline_queue->size());
+      drain_timer = loop->add_periodic_timer(drain_interval, std::bind(&MqttClient::drain_offline_queue, this));
     }
 }
 
 void
-MqttClient::async_read_control_packet()
+MqttClient::stop_draining()
 {
-  auto self = shared_from_this();
-  sock->read_async(buffer, 1, [this, self](std::error_code ec, std::size_t bytes_transferred) {
-    ec = verify("fixed header", bytes_transferred, 1, ec);
-    if (!ec)
-      {
-        handle_control_packet();
-      }
-  });
+  if (drain_timer != 0)
+    {
+      loop->cancel_timer(drain_timer);
+      drain_timer = 0;
+    }
 }
 
 void
-MqttClient::handle_control_packet()
+MqttClient::drain_offline_queue()
 {
-  remaining_length = 0;
-  remaining_length_multiplier = 1;
-  fixed_header = *buffer.consume_data();
-  buffer.consume_commit(1);
+  // Wait for the in-flight window to open up instead of moving the backlog to the pending list.
+  if (connected_property.get() && pending_publishes.empty())
+    {
+      PublishQueue::Message message;
+      if (offline_queue->pop(message))
+        {
+          update_queue_statistics();
+          send_publish(std::move(message.packet), message.options, std::move(message.callback));
+        }
+    }
 
-  async_read_remaining_length();
+  if (!connected_property.get() || offline_queue->empty())
+    {
+      stop_draining();
+    }
 }
 
 void
-MqttClient::async_read_remaining_length()
+MqttClient::update_queue_statistics()
 {
-  auto self = shared_from_this();
-  sock->read_async(buffer, 1, [this, self](std::error_code ec, std::size_t bytes_transferred) {
-    ec = verify("remaining length", bytes_transferred, 1, ec);
-    if (!ec)
-      {
-        handle_remaining_length();
-      }
-  });
+  publish_statistics.queue_depth = offline_queue->size();
+  publish_statistics.queue_bytes = offline_queue->bytes();
+  publish_statistics.queue_dropped = offline_queue->dropped();
 }
 
 void
-MqttClient::handle_remaining_length()
+MqttClient::update_compression_statistics(std::size_t input_size, std::size_t output_size, std::chrono::microseconds time)
 {
-  uint8_t header = *reinterpret_cast<uint8_t *>(buffer.consume_data());
-  buffer.consume_commit(1);
+  ESP_LOGD(tag, "Compressed %d bytes to %d bytes in %d us", input_size, output_size, static_cast<int>(time.count()));
 
-  remaining_length += (header & 0b01111111) * remaining_length_multiplier;
-  remaining_length_multiplier *= 128;
+  publish_statistics.compressed++;
+  publish_statistics.uncompressed_bytes += input_size;
+  publish_statistics.compressed_bytes += output_size;
+  publish_statistics.compression_time += time;
+}
 
-  if ((header & 0b10000000u) != 0u)
+void
+MqttClient::send_publish(std::shared_ptr<MqttPacket> packet, PublishOptions options, publish_callback_t callback)
+{
+  try
     {
-      async_read_remaining_length();
-    }
+      BitMask<PublishOptions> qos = options & PublishOptions::QosMask;
+
+      if (qos != PublishOptions::Qos0 && inflight.size() >= send_window())
+        {
+          pending_publishes.push_back(PendingPublish{ std::move(packet), options, std::move(callback) });
+          return;
+        }
+
+      if (!sock && qos == PublishOptions::Qos0)
+        {
+          if (callback)
+            {
+              callback(MqttErrc::NotConnected);
+            }
+          return;
+        }
+
+      // Without a topic alias the header is at its largest.
+      if (maximum_packet_size != 0)
+        {
+          packet->complete_publish();
+          if (packet->size() > maximum_packet_size)
+            {
+              publish_statistics.failed++;
+              if (callback)
+                {
+                  callback(MqttErrc::PacketTooLarge);
+                }
+              return;
+            }
+        }
+
+      publish_statistics.published++;
+
+      if (qos == PublishOptions::Qos0)
+        {
+          write_publish(std::move(packet), std::move(callback));
+        }
+      else
+        {
+          std::uint16_t packet_id = allocate_packet_id();
+          packet->set_packet_id(packet_id);
+
+          InflightPublish publish;
+          publish.packet_id = packet_id;
+          publish.state = (qos == PublishOptions::Qos1) ? InflightState::PubAck : InflightState::PubRec;
+          publish.packet = std::move(packet);
+          publish.callback = std::move(callback);
+          inflight.push_back(std::move(publish));
+
+          send_inflight(inflight.back());
+
+          // Starts the acknowledgement deadline.
+          if (inflight.size() == 1)
+            {
+              schedule_keep_alive();
+            }
+        }
+    }
+  catch (std::system_error &e)
+    {
+      if (callback)
+        {
+          callback(e.code());
+        }
+      handle_error(std::string("send publish: ") + e.what(), e.code());
+    }
+}
+
+void
+MqttClient::write_publish(std::shared_ptr<MqttPacket> packet, publish_callback_t callback)
+{
+  // Aliases are assigned in the order packets are written, which is the order the server receives them.
+  std::uint16_t topic_alias = 0;
+  bool omit_topic = false;
+  if (topic_alias_maximum > 0)
+    {
+      auto it = topic_aliases.find(packet->get_topic());
+      if (it != topic_aliases.end())
+        {
+          topic_alias = it->second;
+          omit_topic = true;
+        }
+      else if (topic_aliases.size() < topic_alias_maximum)
+        {
+          topic_alias = static_cast<std::uint16_t>(topic_aliases.size() + 1);
+          topic_aliases.emplace(packet->get_topic(), topic_alias);
+        }
+    }
+  packet->complete_publish(topic_alias, omit_topic);
+  last_sent = std::chrono::steady_clock::now();
+
+  auto self = shared_from_this();
+  loopp::net::StreamBuffer *payload = packet->get_payload_buffer();
+
+  // A payload owned by the packet is written straight after the header; writes complete in order.
+  if (payload != nullptr)
+    {
+      sock->write_async(packet->get_buffer(), [this, self, packet](std::error_code ec, std::size_t bytes_transferred) {
+        verify("send publish", bytes_transferred, packet->get_buffer().consume_size(), ec);
+      });
+    }
+
+  sock->write_async(payload != nullptr ? *payload : packet->get_buffer(),
+                    [this, self, packet, callback](std::error_code ec, std::size_t bytes_transferred) {
+                      ec = verify("send publish", bytes_transferred, packet->size(), ec);
+                      if (callback)
+                        {
+                          callback(ec);
+                        }
+                    });
+}
+
+void
+MqttClient::send_pending_publishes()
+{
+  while (sock && !pending_publishes.empty() && inflight.size() < send_window())
+    {
+      PendingPublish publish = std::move(pending_publishes.front());
+      pending_publishes.pop_front();
+      send_publish(std::move(publish.packet), publish.options, std::move(publish.callback));
+    }
+}
+
+// The server's Receive Maximum further limits the number of unacknowledged publishes.
+std::size_t
+MqttClient::send_window() const
+{
+  return std::min(max_inflight, receive_maximum);
+}
+
+void
+MqttClient::send_inflight(InflightPublish &publish)
+{
+  if (!sock)
+    {
+      // Retransmitted after reconnecting.
+      return;
+    }
+
+  bool duplicate = publish.sent;
+  publish.sent = true;
+  publish.send_time = std::chrono::steady_clock::now();
+
+  if (publish.state == InflightState::PubComp)
+    {
+      send_ack(PacketType::PubRel, publish.packet_id);
+      return;
+    }
+
+  if (duplicate)
+    {
+      publish.packet->set_duplicate();
+      publish_statistics.retransmitted++;
+    }
+
+  write_publish(publish.packet, publish_callback_t());
+}
+
+void
+MqttClient::send_ack(PacketType type, std::uint16_t packet_id)
+{
+  if (!sock)
+    {
+      return;
+    }
+
+  try
+    {
+      std::shared_ptr<MqttPacket> pkt = acquire_packet();
+
+      pkt->begin(type, type == PacketType::PubRel ? 0b0010u : 0, 2);
+      pkt->add_packet_id(packet_id);
+      last_sent = std::chrono::steady_clock::now();
+
+      auto self = shared_from_this();
+      sock->write_async(pkt->get_buffer(), [this, self, pkt](std::error_code ec, std::size_t bytes_transferred) {
+        verify("send ack", bytes_transferred, pkt->size(), ec);
+      });
+    }
+  catch (std::system_error &e)
+    {
+      handle_error(std::string("send ack: ") + e.what(), e.code());
+    }
+}
+
+void
+MqttClient::complete_publish(std::uint16_t packet_id, std::error_code ec)
+{
+  auto it = std::find_if(inflight.begin(), inflight.end(), [packet_id](const InflightPublish &p) { return p.packet_id == packet_id; });
+  if (it == inflight.end())
+    {
+      ESP_LOGW(tag, "Warning: acknowledgement for unknown packet id %d", packet_id);
+      return;
+    }
+
+  auto latency = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - it->send_time);
+  if (!ec)
+    {
+      publish_statistics.acknowledged++;
+      publish_statistics.last_ack_latency = latency;
+      publish_statistics.max_ack_latency = std::max(publish_statistics.max_ack_latency, latency);
+      publish_statistics.total_ack_latency += latency;
+      ESP_LOGD(tag, "Publish %d acknowledged in %d ms", packet_id, static_cast<int>(latency.count()));
+    }
+  else
+    {
+      publish_statistics.failed++;
+    }
+
+  publish_callback_t callback = std::move(it->callback);
+  release_packet_id(packet_id);
+  inflight.erase(it);
+
+  if (callback)
+    {
+      callback(ec);
+    }
+
+  send_pending_publishes();
+}
+
+void
+MqttClient::cancel_publishes(std::error_code ec)
+{
+  std::list<InflightPublish> cancelled_inflight;
+  std::deque<PendingPublish> cancelled_pending;
+
+  cancelled_inflight.swap(inflight);
+  cancelled_pending.swap(pending_publishes);
+  packet_ids.reset();
+
+  publish_statistics.failed += cancelled_inflight.size() + cancelled_pending.size();
+
+  for (auto &publish : cancelled_inflight)
+    {
+      if (publish.callback)
+        {
+          publish.callback(ec);
+        }
+    }
+  for (auto &publish : cancelled_pending)
+    {
+      if (publish.callback)
+        {
+          publish.callback(ec);
+        }
+    }
+}
+
+std::uint16_t
+MqttClient::allocate_packet_id()
+{
+  for (std::size_t i = 1; i < max_packet_ids; i++)
+    {
+      std::uint16_t id = next_packet_id;
+      next_packet_id = (next_packet_id % (max_packet_ids - 1)) + 1;
+
+      if (!packet_ids.test(id))
+        {
+          packet_ids.set(id);
+          return id;
+        }
+    }
+
+  throw std::system_error(MqttErrc::InternalError, "no free packet id");
+}
+
+void
+MqttClient::release_packet_id(std::uint16_t packet_id)
+{
+  if (packet_id < max_packet_ids)
+    {
+      packet_ids.reset(packet_id);
+    }
+}
+
+void
+MqttClient::send_subscribe(const std::list<std::string> &topics)
+{
+  try
+    {
+      std::shared_ptr<MqttPacket> pkt = acquire_packet();
+      std::uint16_t packet_id = allocate_packet_id();
+
+      std::size_t len = 2 + std::accumulate(topics.begin(), topics.end(), std::size_t(0), [](std::size_t sum, const std::string &s) {
+                          return sum + MqttPacket::string_size(s.size()) + 1;
+                        });
+
+      if (protocol_version == ProtocolVersion::Mqtt5)
+        {
+          len += MqttPacket::properties_size(0);
+        }
+
+      pkt->begin(loopp::mqtt::PacketType::Subscribe, 0b0010u, len);
+      pkt->add_packet_id(packet_id);
+      if (protocol_version == ProtocolVersion::Mqtt5)
+        {
+          pkt->add_properties(std::string());
+        }
+      for (const auto &topic : topics)
+        {
+          pkt->add(topic);
+          pkt->add(0);
+        }
+      last_sent = std::chrono::steady_clock::now();
+      pending_subscribes[packet_id] = topics;
+
+      auto self = shared_from_this();
+      sock->write_async(pkt->get_buffer(), [this, self, pkt](std::error_code ec, std::size_t bytes_transferred) {
+        verify("send subscribe", bytes_transferred, pkt->size(), ec);
+      });
+    }
+  catch (std::system_error &e)
+    {
+      handle_error(std::string("send subscribe: ") + e.what(), e.code());
+    }
+}
+
+void
+MqttClient::send_unsubscribe(const std::list<std::string> &topics)
+{
+  try
+    {
+      std::shared_ptr<MqttPacket> pkt = acquire_packet();
+      std::uint16_t packet_id = allocate_packet_id();
+
+      std::size_t len = 2 + std::accumulate(topics.begin(), topics.end(), std::size_t(0), [](std::size_t sum, const std::string &s) {
+                          return sum + MqttPacket::string_size(s.size());
+                        });
+
+      if (protocol_version == ProtocolVersion::Mqtt5)
+        {
+          len += MqttPacket::properties_size(0);
+        }
+
+      pkt->begin(loopp::mqtt::PacketType::Unsubscribe, 0b0010u, len);
+      pkt->add_packet_id(packet_id);
+      if (protocol_version == ProtocolVersion::Mqtt5)
+        {
+          pkt->add_properties(std::string());
+        }
+      for (const auto &topic : topics)
+        {
+          pkt->add(topic);
+        }
+      last_sent = std::chrono::steady_clock::now();
+      pending_unsubscribes[packet_id] = topics;
+
+      auto self = shared_from_this();
+      sock->write_async(pkt->get_buffer(), [this, self, pkt](std::error_code ec, std::size_t bytes_transferred) {
+        verify("send unsubscribe", bytes_transferred, pkt->size(), ec);
+      });
+    }
+  catch (std::system_error &e)
+    {
+      handle_error(std::string("send unsubscribe: ") + e.what(), e.code());
+    }
+}
+
+void
+MqttClient::async_read_control_packet()
+{
+  auto self = shared_from_this();
+  sock->read_async(buffer, 1, [this, self](std::error_code ec, std::size_t bytes_transferred) {
+    ec = verify("fixed header", bytes_transferred, 1, ec);
+    if (!ec)
+      {
+        handle_control_packet();
+      }
+  });
+}
+
+void
+MqttClient::handle_control_packet()
+{
+  remaining_length = 0;
+  remaining_length_multiplier = 1;
+  fixed_header = *buffer.consume_data();
+  buffer.consume_commit(1);
+
+  async_read_remaining_length();
+}
+
+void
+MqttClient::async_read_remaining_length()
+{
+  auto self = shared_from_this();
+  sock->read_async(buffer, 1, [this, self](std::error_code ec, std::size_t bytes_transferred) {
+    ec = verify("remaining length", bytes_transferred, 1, ec);
+    if (!ec)
+      {
+        handle_remaining_length();
+      }
+  });
+}
+
+void
+MqttClient::handle_remaining_length()
+{
+  uint8_t header = *reinterpret_cast<uint8_t *>(buffer.consume_data());
+  buffer.consume_commit(1);
+
+  remaining_length += (header & 0b01111111) * remaining_length_multiplier;
+  remaining_length_multiplier *= 128;
+
+  if ((header & 0b10000000u) != 0u)
+    {
+      async_read_remaining_length();
+    }
   else
     {
       if (remaining_length == 0)
         {
           handle_payload();
         }
+      else if (static_cast<PacketType>(fixed_header >> 4) == PacketType::Publish && remaining_length > max_buffered_packet_size)
+        {
+          // Large messages are passed to stream filters while they are received.
+          stream_read = 0;
+          stream_paused = false;
+          stream_read_deferred = false;
+          async_read_stream();
+        }
       else
         {
           async_read_payload();
@@ -489,6 +1236,82 @@ MqttClient::async_read_payload()
   });
 }
 
+void
+MqttClient::async_read_stream()
+{
+  std::size_t size = std::min(remaining_length - stream_read, stream_chunk_size);
+
+  auto self = shared_from_this();
+  sock->read_async(buffer, size, [this, self, size](std::error_code ec, std::size_t bytes_transferred) {
+    ec = verify("payload", bytes_transferred, size, ec);
+    if (!ec)
+      {
+        handle_stream(size);
+      }
+  });
+}
+
+void
+MqttClient::handle_stream(std::size_t size)
+{
+  try
+    {
+      auto data = reinterpret_cast<uint8_t *>(buffer.consume_data());
+      std::size_t index = 0;
+
+      if (stream_read == 0)
+        {
+          // The variable header must fit in the first chunk.
+          loopp::utils::string_view topic;
+          index = read_publish_header(data, size, topic, stream_packet_id);
+
+          stream_topic = static_cast<std::string>(topic);
+          stream_offset = 0;
+          stream_size = remaining_length - index;
+          stream_sinks.clear();
+          if (is_new_publish(stream_packet_id))
+            {
+              stream_filters.match(topic, [this](const stream_callback_t &callback) { stream_sinks.push_back(callback); });
+            }
+          if (stream_sinks.empty())
+            {
+              ESP_LOGW(tag, "Warning: dropping %d bytes on %s", stream_size, stream_topic.c_str());
+            }
+        }
+
+      stream_read += size;
+      dispatch_stream(std::error_code(), loopp::utils::string_view(reinterpret_cast<const char *>(data + index), size - index));
+      buffer.consume_commit(size);
+
+      if (stream_read == remaining_length)
+        {
+          stream_sinks.clear();
+          if (sock)
+            {
+              acknowledge_publish(stream_packet_id);
+              async_read_control_packet();
+            }
+        }
+      else if (!sock)
+        {
+          // A sink disconnected the client.
+          abort_stream(MqttErrc::NotConnected);
+        }
+      else if (stream_paused)
+        {
+          stream_read_deferred = true;
+        }
+      else
+        {
+          async_read_stream();
+        }
+    }
+  catch (std::system_error &e)
+    {
+      handle_error(std::string("handle publish: ") + e.what(), e.code());
+    }
+}
+
 std::error_code
 MqttClient::handle_payload()
 {
@@ -533,13 +1356,18 @@ MqttClient::handle_payload()
         ec = handle_ping_response();
         break;
 
+      case PacketType::Disconnect:
+        ec = handle_disconnect();
+        break;
+
       default:
         verify((boost::format("invalid payload type: %1%") % (static_cast<int>(packet_type))).str(), 0, 0, MqttErrc::ProtocolError);
     }
 
   buffer.consume_commit(remaining_length);
 
-  if (!ec)
+  // A subscriber may have disconnected the client.
+  if (!ec && sock)
     {
       async_read_control_packet();
     }
@@ -550,11 +1378,26 @@ MqttClient::handle_payload()
 std::error_code
 MqttClient::handle_connect_ack()
 {
-  std::error_code ec = verify("handle ConnAck", remaining_length, 2, std::error_code());
-  if (!ec)
+  std::error_code ec;
+
+  try
     {
+      bool mqtt5 = protocol_version == ProtocolVersion::Mqtt5;
+      if (remaining_length < (mqtt5 ? 3 : 2))
+        {
+          throw std::system_error(MqttErrc::ProtocolError, "short packet");
+        }
+
       auto payload_buffer = reinterpret_cast<uint8_t *>(buffer.consume_data());
+      bool session_present = (payload_buffer[0] & 0x01) != 0;
       auto connect_return_code = static_cast<std::uint8_t>(payload_buffer[1]);
+
+      receive_maximum = max_packet_ids;
+      server_keep_alive = std::chrono::seconds(0);
+      maximum_packet_size = 0;
+      topic_alias_maximum = 0;
+      topic_aliases.clear();
+
       if (connect_return_code != 0)
         {
           ESP_LOGE(tag, "Error: Connect return code = %d", connect_return_code);
@@ -562,22 +1405,148 @@ MqttClient::handle_connect_ack()
         }
       else
         {
-          ESP_LOGI(tag, "Info: Connect OK");
-          ping_timer = loop->add_periodic_timer(std::chrono::milliseconds(ping_interval_sec * 1000), std::bind(&MqttClient::send_ping, this));
+          if (mqtt5)
+            {
+              std::size_t index = 2;
+              std::size_t properties_length = MqttPropertyReader::read_length(payload_buffer, remaining_length, index);
+              if (remaining_length - index < properties_length)
+                {
+                  throw std::system_error(MqttErrc::ProtocolError, "short packet");
+                }
+              read_connect_properties(payload_buffer + index, properties_length);
+            }
+          session_created = mqtt5 ? session_expiry != 0 : !clean_session;
+
+          ESP_LOGI(tag, "Info: Connect OK%s", session_present ? " - Session resumed" : "");
+          reconnect_attempts = 0;
+          circuit_state_property.set(CircuitState::Closed);
+          last_sent = std::chrono::steady_clock::now();
+          ping_pending = false;
+          schedule_keep_alive();
+
+          // Packet ids of subscriptions that were never acknowledged died with the previous connection.
+          packet_ids.reset();
+          if (!session_present)
+            {
+              received_packet_ids.clear();
+            }
+          for (auto &publish : inflight)
+            {
+              packet_ids.set(publish.packet_id);
+              send_inflight(publish);
+            }
+          send_pending_publishes();
+
+          // Subscribe and unsubscribe requests that were not acknowledged are sent again. A new
+          // session has no subscriptions, so all of them are sent and there is nothing to unsubscribe.
+          std::list<std::string> subscribes;
+          std::list<std::string> unsubscribes;
+          if (!session_present || subscriptions_changed)
+            {
+              subscribes = subscriptions;
+            }
+          else
+            {
+              for (auto &pending : pending_subscribes)
+                {
+                  subscribes.splice(subscribes.end(), pending.second);
+                }
+              subscribes.remove_if([this](const std::string &topic) {
+                return std::find(subscriptions.begin(), subscriptions.end(), topic) == subscriptions.end();
+              });
+            }
+          if (session_present)
+            {
+              unsubscribes.splice(unsubscribes.end(), unsent_unsubscribes);
+              for (auto &pending : pending_unsubscribes)
+                {
+                  unsubscribes.splice(unsubscribes.end(), pending.second);
+                }
+              unsubscribes.remove_if([this](const std::string &topic) {
+                return std::find(subscriptions.begin(), subscriptions.end(), topic) != subscriptions.end();
+              });
+              unsubscribes.sort();
+              unsubscribes.unique();
+            }
+          pending_subscribes.clear();
+          pending_unsubscribes.clear();
+          unsent_unsubscribes.clear();
+          subscriptions_changed = false;
+
+          if (!unsubscribes.empty())
+            {
+              ESP_LOGI(tag, "Info: Connect OK - Sending unsubscriptions");
+              send_unsubscribe(unsubscribes);
+            }
+
+          if (!subscribes.empty())
+            {
+              ESP_LOGI(tag, "Info: Connect OK - Sending subscriptions");
+              send_subscribe(subscribes);
+            }
+          else
+            {
+              connected_property.set(true);
+              start_draining();
+            }
+        }
+    }
+  catch (std::system_error &e)
+    {
+      handle_error(std::string("handle ConnAck: ") + e.what(), e.code());
+      ec = e.code();
+    }
+
+  return ec;
+}
+
+void
+MqttClient::read_connect_properties(const std::uint8_t *data, std::size_t size)
+{
+  MqttPropertyReader reader(data, size);
+  while (reader.next())
+    {
+      switch (reader.id())
+        {
+          case PropertyId::ReceiveMaximum:
+            receive_maximum = std::max<std::size_t>(1, reader.value());
+            break;
+
+          case PropertyId::MaximumPacketSize:
+            maximum_packet_size = reader.value();
+            break;
 
-          if (!subscriptions.empty())
-            {
-              ESP_LOGI(tag, "Info: Connect OK - Sending subscriptions");
-              send_subscribe(subscriptions);
-            }
-          else
-            {
-              connected_property.set(true);
-            }
+          case PropertyId::TopicAliasMaximum:
+            topic_alias_maximum = static_cast<std::uint16_t>(reader.value());
+            break;
+
+          case PropertyId::ServerKeepAlive:
+            server_keep_alive = std::chrono::seconds(reader.value());
+            break;
+
+          case PropertyId::SessionExpiryInterval:
+            session_expiry = reader.value();
+            break;
+
+          case PropertyId::AssignedClientIdentifier:
+            // Needed to resume the session after reconnecting.
+            client_id = static_cast<std::string>(reader.string());
+            break;
+
+          case PropertyId::ReasonString:
+            ESP_LOGI(tag, "Info: %.*s", static_cast<int>(reader.string().size()), reader.string().data());
+            break;
+
+          default:
+            break;
         }
     }
 
-  return ec;
+  ESP_LOGI(tag,
+           "Info: Receive maximum %d, maximum packet size %d, topic alias maximum %d",
+           receive_maximum,
+           maximum_packet_size,
+           topic_alias_maximum);
 }
 
 std::error_code
@@ -588,77 +1557,171 @@ MqttClient::handle_publish()
   try
     {
       auto payload_buffer = reinterpret_cast<uint8_t *>(buffer.consume_data());
-      BitMask<PublishFlags> flags{};
+      loopp::utils::string_view topic;
+      std::uint16_t packet_id = 0;
+      std::size_t index = read_publish_header(payload_buffer, remaining_length, topic, packet_id);
 
-      flags.set(fixed_header & 0x0f);
+      loopp::utils::string_view payload(reinterpret_cast<const char *>(payload_buffer + index), remaining_length - index);
 
-      if ((flags & PublishFlags::QosMask) != PublishFlags::Qos0)
+      if (is_new_publish(packet_id))
         {
-          throw std::system_error(MqttErrc::ProtocolError, "QoS1/2 not supported");
+          ESP_LOGD(tag, "Received %d bytes on %.*s", payload.size(), static_cast<int>(topic.size()), topic.data());
+          dispatch(topic, payload);
         }
 
-      std::size_t index = 0;
-      std::uint16_t topic_len = (payload_buffer[index] << 8) + payload_buffer[index + 1];
-      index += 2;
+      acknowledge_publish(packet_id);
+    }
+  catch (std::system_error &e)
+    {
+      handle_error(std::string("handle publish: ") + e.what(), e.code());
+      ec = e.code();
+    }
+  return ec;
+}
 
-      if (remaining_length - index < topic_len)
-        {
-          throw std::system_error(MqttErrc::ProtocolError, "short packet");
-        }
+// Parses the variable header of a PUBLISH packet and returns the offset of the payload.
+std::size_t
+MqttClient::read_publish_header(const std::uint8_t *data, std::size_t size, loopp::utils::string_view &topic, std::uint16_t &packet_id)
+{
+  BitMask<PublishFlags> flags{};
+  flags.set(fixed_header & 0x0f);
+
+  BitMask<PublishFlags> qos = flags & PublishFlags::QosMask;
+  if (qos == PublishFlags::QosMask)
+    {
+      throw std::system_error(MqttErrc::ProtocolError, "invalid QoS");
+    }
+
+  if (size < 2)
+    {
+      throw std::system_error(MqttErrc::ProtocolError, "short packet");
+    }
+
+  std::size_t index = 0;
+  std::uint16_t topic_len = (data[index] << 8) + data[index + 1];
+  index += 2;
 
-      std::string topic(reinterpret_cast<char *>(payload_buffer + index), topic_len);
-      index += topic_len;
+  if (size - index < topic_len)
+    {
+      throw std::system_error(MqttErrc::ProtocolError, "short packet");
+    }
 
-      std::string payload(reinterpret_cast<char *>(payload_buffer + index), remaining_length - index);
+  topic = loopp::utils::string_view(reinterpret_cast<const char *>(data + index), topic_len);
+  index += topic_len;
 
-      ESP_LOGI(tag, "Info: Received %s -> %s", topic.c_str(), payload.c_str());
-      bool matched = false;
-      for (auto kv : filters)
+  packet_id = 0;
+  if (qos != PublishFlags::Qos0)
+    {
+      if (size - index < 2)
         {
-          if (match_topic(topic, kv.first))
-            {
-              kv.second(topic, payload);
-              matched = true;
-            }
+          throw std::system_error(MqttErrc::ProtocolError, "short packet");
         }
-      if (!matched)
+      packet_id = (data[index] << 8) + data[index + 1];
+      index += 2;
+    }
+
+  // No topic aliases are accepted from the server, so none of the properties are needed.
+  if (protocol_version == ProtocolVersion::Mqtt5)
+    {
+      std::size_t properties_length = MqttPropertyReader::read_length(data, size, index);
+      if (size - index < properties_length)
         {
-          subscribe_callback(topic, payload);
+          throw std::system_error(MqttErrc::ProtocolError, "short packet");
         }
+      index += properties_length;
     }
-  catch (std::system_error &e)
+
+  return index;
+}
+
+// A QoS 2 message is delivered once; a duplicate is only acknowledged again.
+bool
+MqttClient::is_new_publish(std::uint16_t packet_id)
+{
+  BitMask<PublishFlags> flags{};
+  flags.set(fixed_header & 0x0f);
+
+  if ((flags & PublishFlags::QosMask) == PublishFlags::Qos2)
     {
-      handle_error(std::string("handle publish: ") + e.what(), e.code());
-      ec = e.code();
+      return received_packet_ids.insert(packet_id).second;
+    }
+  return true;
+}
+
+void
+MqttClient::acknowledge_publish(std::uint16_t packet_id)
+{
+  BitMask<PublishFlags> flags{};
+  flags.set(fixed_header & 0x0f);
+
+  BitMask<PublishFlags> qos = flags & PublishFlags::QosMask;
+  if (qos == PublishFlags::Qos1)
+    {
+      send_ack(PacketType::PubAck, packet_id);
+    }
+  else if (qos == PublishFlags::Qos2)
+    {
+      send_ack(PacketType::PubRec, packet_id);
     }
-  return ec;
 }
 
 std::error_code
 MqttClient::handle_publish_ack()
 {
-  std::error_code ec;
+  std::uint16_t packet_id = 0;
+  std::error_code ec = read_packet_id("handle PubAck", packet_id);
+  if (!ec)
+    {
+      complete_publish(packet_id, read_reason_code() < 0x80 ? std::error_code() : MqttErrc::Rejected);
+    }
   return ec;
 }
 
 std::error_code
 MqttClient::handle_publish_received()
 {
-  std::error_code ec;
+  std::uint16_t packet_id = 0;
+  std::error_code ec = read_packet_id("handle PubRec", packet_id);
+  if (!ec && read_reason_code() >= 0x80)
+    {
+      complete_publish(packet_id, MqttErrc::Rejected);
+    }
+  else if (!ec)
+    {
+      auto it = std::find_if(inflight.begin(), inflight.end(), [packet_id](const InflightPublish &p) { return p.packet_id == packet_id; });
+      if (it != inflight.end())
+        {
+          // The broker owns the message now; only the packet id needs to be remembered.
+          it->state = InflightState::PubComp;
+          it->packet.reset();
+        }
+      send_ack(PacketType::PubRel, packet_id);
+    }
   return ec;
 }
 
 std::error_code
 MqttClient::handle_publish_release()
 {
-  std::error_code ec;
+  std::uint16_t packet_id = 0;
+  std::error_code ec = read_packet_id("handle PubRel", packet_id);
+  if (!ec)
+    {
+      received_packet_ids.erase(packet_id);
+      send_ack(PacketType::PubComp, packet_id);
+    }
   return ec;
 }
 
 std::error_code
 MqttClient::handle_publish_complete()
 {
-  std::error_code ec;
+  std::uint16_t packet_id = 0;
+  std::error_code ec = read_packet_id("handle PubComp", packet_id);
+  if (!ec)
+    {
+      complete_publish(packet_id, read_reason_code() < 0x80 ? std::error_code() : MqttErrc::Rejected);
+    }
   return ec;
 }
 
@@ -674,11 +1737,13 @@ MqttClient::handle_subscribe_ack()
           throw std::system_error(MqttErrc::ProtocolError, "no packet id in suback");
         }
 
-#ifdef NOT_YEY_USED
-      // TODO: return response to client
       uint8_t *payload_buffer = reinterpret_cast<uint8_t *>(buffer.consume_data());
-      int id = (payload_buffer[0] << 8) + payload_buffer[1];
+      std::uint16_t packet_id = (payload_buffer[0] << 8) + payload_buffer[1];
+      pending_subscribes.erase(packet_id);
+      release_packet_id(packet_id);
 
+#ifdef NOT_YEY_USED
+      // TODO: return response to client
       for (int i = 2; i < remaining_length; i++)
         {
           uint8_t status = payload_buffer[i];
@@ -686,6 +1751,7 @@ MqttClient::handle_subscribe_ack()
 #endif
 
       connected_property.set(true);
+      start_draining();
     }
   catch (std::system_error &e)
     {
@@ -707,10 +1773,10 @@ MqttClient::handle_unsubscribe_ack()
           throw std::system_error(MqttErrc::ProtocolError, "no packet id in suback");
         }
 
-#ifdef NOT_USED
-      uint8_t *payload_buffer = reinterpret_cast<uint8_t *>(buffer.data());
-      int id = (payload_buffer[0] << 8) + payload_buffer[1];
-#endif
+      uint8_t *payload_buffer = reinterpret_cast<uint8_t *>(buffer.consume_data());
+      std::uint16_t packet_id = (payload_buffer[0] << 8) + payload_buffer[1];
+      pending_unsubscribes.erase(packet_id);
+      release_packet_id(packet_id);
     }
   catch (std::system_error &e)
     {
@@ -724,7 +1790,16 @@ std::error_code
 MqttClient::handle_ping_response()
 {
   std::error_code ec;
-  pending_ping_count--;
+  ping_pending = false;
+  return ec;
+}
+
+std::error_code
+MqttClient::handle_disconnect()
+{
+  std::error_code ec = MqttErrc::ServerDisconnected;
+  ESP_LOGE(tag, "Error: Disconnected by server, reason code = %d", read_reason_code());
+  handle_error("handle Disconnect", ec);
   return ec;
 }
 
@@ -735,12 +1810,10 @@ MqttClient::handle_error(const std::string &what, std::error_code ec)
     {
       ESP_LOGE(tag, "Error: %s %s", what.c_str(), ec.message().c_str());
       connected_property.set(false);
+      stop_draining();
 
-      if (ping_timer != 0)
-        {
-          loop->cancel_timer(ping_timer);
-          ping_timer = 0;
-        }
+      stop_keep_alive();
+      abort_stream(ec);
 
       heap_caps_print_heap_info(MALLOC_CAP_DEFAULT);
       if (sock)
@@ -752,11 +1825,54 @@ MqttClient::handle_error(const std::string &what, std::error_code ec)
 
       if (ec != loopp::net::NetworkErrc::Cancelled)
         {
-          connect();
+          schedule_reconnect();
         }
     }
 }
 
+// Reconnects after an exponential backoff with full jitter, so that clients
+// that lost their connection at the same time do not reconnect at the same time.
+void
+MqttClient::schedule_reconnect()
+{
+  if (reconnect_timer != 0)
+    {
+      return;
+    }
+
+  reconnect_attempts++;
+
+  std::chrono::milliseconds delay;
+  if (circuit_failure_threshold > 0 && reconnect_attempts >= circuit_failure_threshold)
+    {
+      ESP_LOGW(tag, "Warning: %d failed connection attempts, not retrying for %d s",
+               reconnect_attempts, static_cast<int>(circuit_open_duration.count() / 1000));
+      circuit_state_property.set(CircuitState::Open);
+      delay = circuit_open_duration + std::chrono::milliseconds(esp_random() % (reconnect_max_delay.count() + 1));
+    }
+  else
+    {
+      std::chrono::milliseconds ceiling = reconnect_initial_delay;
+      for (std::size_t i = 1; i < reconnect_attempts && ceiling < reconnect_max_delay; i++)
+        {
+          ceiling *= 2;
+        }
+      ceiling = std::min(ceiling, reconnect_max_delay);
+      delay = std::chrono::milliseconds(esp_random() % (ceiling.count() + 1));
+      ESP_LOGI(tag, "Info: Reconnecting in %d ms", static_cast<int>(delay.count()));
+    }
+
+  auto self = shared_from_this();
+  reconnect_timer = loop->add_timer(delay, [this, self]() {
+    reconnect_timer = 0;
+    if (circuit_state_property.get() == CircuitState::Open)
+      {
+        circuit_state_property.set(CircuitState::HalfOpen);
+      }
+    connect();
+  });
+}
+
 std::error_code
 MqttClient::verify(const std::string &what, std::size_t actual_size, std::size_t expect_size, std::error_code ec)
 {
@@ -771,60 +1887,124 @@ MqttClient::verify(const std::string &what, std::size_t actual_size, std::size_t
   return ec;
 }
 
+std::error_code
+MqttClient::read_packet_id(const std::string &what, std::uint16_t &packet_id)
+{
+  std::error_code ec;
+
+  if (remaining_length < 2)
+    {
+      ESP_LOGE(tag, "Error: %s no packet id", what.c_str());
+      ec = MqttErrc::ProtocolError;
+      handle_error(what, ec);
+    }
+  else
+    {
+      auto payload_buffer = reinterpret_cast<uint8_t *>(buffer.consume_data());
+      packet_id = (payload_buffer[0] << 8) + payload_buffer[1];
+    }
+
+  return ec;
+}
+
+// MQTT 5 acknowledgements may carry a reason code after the packet id; it is
+// omitted on success. A DISCONNECT carries it as first byte.
+std::uint8_t
+MqttClient::read_reason_code() const
+{
+  auto payload_buffer = reinterpret_cast<const uint8_t *>(buffer.consume_data());
+  auto packet_type = static_cast<PacketType>(fixed_header >> 4);
+  std::size_t index = packet_type == PacketType::Disconnect ? 0 : 2;
+
+  if (protocol_version != ProtocolVersion::Mqtt5 || remaining_length <= index)
+    {
+      return 0;
+    }
+  return payload_buffer[index];
+}
+
 loopp::core::Property<bool> &
 MqttClient::connected()
 {
   return connected_property;
 }
 
+loopp::core::Property<CircuitState> &
+MqttClient::circuit_state()
+{
+  return circuit_state_property;
+}
+
+bool
+MqttClient::can_publish()
+{
+  return connected_property.get() || offline_queue != nullptr;
+}
+
 bool
-MqttClient::match_topic(const std::string &topic, const std::string &filter)
+MqttClient::is_backpressured() const
+{
+  return !pending_publishes.empty() || (offline_queue && !offline_queue->empty());
+}
+
+const PublishStatistics &
+MqttClient::get_publish_statistics() const
+{
+  return publish_statistics;
+}
+
+void
+MqttClient::dispatch(loopp::utils::string_view topic, loopp::utils::string_view payload)
 {
-  auto topic_it = topic.begin();
-  auto filter_it = filter.begin();
+  bool matched = false;
 
-  while (true)
+  dispatching = true;
+  filters.match(topic, [&](const subscribe_callback_t &callback) {
+    matched = true;
+    try
+      {
+        callback(topic, payload);
+      }
+    catch (std::exception &e)
+      {
+        ESP_LOGE(tag, "Error: subscriber of %.*s failed: %s", static_cast<int>(topic.size()), topic.data(), e.what());
+      }
+  });
+  dispatching = false;
+
+  // A small message is passed to stream filters as a single chunk.
+  std::vector<stream_callback_t> sinks;
+  stream_filters.match(topic, [&sinks](const stream_callback_t &callback) { sinks.push_back(callback); });
+  for (const auto &sink : sinks)
     {
-      if (filter_it == filter.end())
+      matched = true;
+      try
         {
-          return topic_it == topic.end();
+          sink(std::error_code(), topic, payload, 0, payload.size());
         }
-
-      if (topic_it == topic.end()) // && filter_it != filter.end()
+      catch (std::exception &e)
         {
-          if (*filter_it == '/')
-            {
-              filter_it++;
-              if ((filter_it != filter.end()) && (*filter_it == '#'))
-                {
-                  return true;
-                }
-            }
-          return false;
+          ESP_LOGE(tag, "Error: subscriber of %.*s failed: %s", static_cast<int>(topic.size()), topic.data(), e.what());
         }
+    }
 
-      if (*filter_it == '+')
-        {
-          while (*topic_it != '/' && topic_it < topic.end())
-            {
-              ++topic_it;
-            }
-          ++filter_it;
-        }
+  if (!matched && subscribe_callback)
+    {
+      subscribe_callback(topic, payload);
+    }
 
-      else if (*filter_it == '#')
+  // Filters changed by subscribers cannot be applied while the trie is being walked.
+  while (!deferred_filters.empty())
+    {
+      auto filter = std::move(deferred_filters.front());
+      deferred_filters.pop_front();
+      if (filter.second)
         {
-          return true;
+          add_filter(filter.first, std::move(filter.second));
         }
-
       else
         {
-          if (*topic_it != *filter_it)
-            {
-              return false;
-            }
-          ++topic_it;
-          ++filter_it;
+          remove_filter(filter.first);
         }
     }
 }
@@ -832,11 +2012,156 @@ MqttClient::match_topic(const std::string &topic, const std::string &filter)
 void
 MqttClient::add_filter(const std::string &filter, subscribe_callback_t callback)
 {
-  filters[filter] = std::move(callback);
+  if (dispatching)
+    {
+      deferred_filters.emplace_back(filter, std::move(callback));
+    }
+  else
+    {
+      filters.insert(filter, std::move(callback));
+    }
 }
 
 void
 MqttClient::remove_filter(const std::string &filter)
 {
-  filters.erase(filter);
+  if (dispatching)
+    {
+      deferred_filters.emplace_back(filter, subscribe_callback_t());
+    }
+  else
+    {
+      filters.remove(filter);
+    }
+}
+
+void
+MqttClient::dispatch_stream(std::error_code ec, loopp::utils::string_view chunk)
+{
+  // The sinks are moved out, so that a sink that disconnects the client does not abort the stream under our feet.
+  std::vector<stream_callback_t> sinks;
+  sinks.swap(stream_sinks);
+
+  for (const auto &sink : sinks)
+    {
+      try
+        {
+          sink(ec, stream_topic, chunk, stream_offset, stream_size);
+        }
+      catch (std::exception &e)
+        {
+          ESP_LOGE(tag, "Error: subscriber of %s failed: %s", stream_topic.c_str(), e.what());
+        }
+    }
+  stream_offset += chunk.size();
+
+  if (!ec)
+    {
+      stream_sinks.swap(sinks);
+    }
+}
+
+void
+MqttClient::pause_stream()
+{
+  stream_paused = true;
+}
+
+void
+MqttClient::resume_stream()
+{
+  stream_paused = false;
+  if (stream_read_deferred)
+    {
+      stream_read_deferred = false;
+      if (sock)
+        {
+          async_read_stream();
+        }
+    }
+}
+
+void
+MqttClient::abort_stream(std::error_code ec)
+{
+  stream_paused = false;
+  stream_read_deferred = false;
+
+  if (!stream_sinks.empty())
+    {
+      dispatch_stream(ec, loopp::utils::string_view());
+      stream_sinks.clear();
+    }
+}
+
+void
+MqttClient::add_stream_filter(const std::string &filter, stream_callback_t callback)
+{
+  stream_filters.insert(filter, std::move(callback));
+}
+
+void
+MqttClient::remove_stream_filter(const std::string &filter)
+{
+  stream_filters.remove(filter);
+}
+
+PublishWriter::PublishWriter(std::shared_ptr<MqttClient> client,
+                             std::shared_ptr<MqttPacket> packet,
+                             const std::string &topic,
+                             PublishOptions options)
+  : client(std::move(client))
+  , packet(std::move(packet))
+  , topic(topic)
+  , options(options)
+{
+}
+
+std::streambuf &
+PublishWriter::get_buffer()
+{
+  if (encoder)
+    {
+      return *encoder;
+    }
+  return packet->get_buffer();
+}
+
+void
+PublishWriter::append(const char *data, std::size_t size)
+{
+  if (encoder)
+    {
+      encoder->sputn(data, size);
+    }
+  else
+    {
+      packet->append(data, size);
+    }
+}
+
+void
+PublishWriter::commit(MqttClient::publish_callback_t callback)
+{
+  if (packet)
+    {
+      if (encoder)
+        {
+          if (!encoder->finish())
+            {
+              throw std::length_error("compressed payload does not fit in packet");
+            }
+
+          std::size_t input_size = encoder->get_input_size();
+          std::size_t output_size = encoder->get_output_size();
+          std::chrono::microseconds time = encoder->get_time();
+          client->loop->invoke([client = this->client, input_size, output_size, time]() {
+            client->update_compression_statistics(input_size, output_size, time);
+          });
+          encoder.reset();
+        }
+
+      client->commit_publish(std::move(packet), topic, options, std::move(callback));
+      packet.reset();
+    }
 }
@@ -45,6 +45,14 @@ namespace
           return "protocol error";
         case loopp::mqtt::MqttErrc::NotConnected:
           return "not connected";
+        case loopp::mqtt::MqttErrc::MessageDropped:
+          return "message dropped";
+        case loopp::mqtt::MqttErrc::PacketTooLarge:
+          return "packet too large";
+        case loopp::mqtt::MqttErrc::Rejected:
+          return "rejected by server";
+        case loopp::mqtt::MqttErrc::ServerDisconnected:
+          return "disconnected by server";
         default:
           return "(unrecognized error)";
       }
@@ -20,58 +20,258 @@
 
 #include "loopp/mqtt/MqttPacket.hpp"
 
+#include <cstring>
+#include <stdexcept>
+
+#include "loopp/mqtt/MqttProperties.hpp"
+
 using namespace loopp;
 using namespace loopp::mqtt;
 
-MqttPacket::MqttPacket()
-  : stream(&buffer)
+namespace
 {
-}
+  char *
+  encode_length(char *data, std::size_t size)
+  {
+    std::size_t count = MqttPacket::length_size(size);
+    for (std::size_t i = 0; i < count; i++)
+      {
+        std::uint8_t b = size % 128;
+        size >>= 7;
+        if (i + 1 < count)
+          {
+            b |= 128;
+          }
+        *data++ = static_cast<char>(b);
+      }
+    return data;
+  }
 
+  char *
+  encode_uint16(char *data, std::uint16_t value)
+  {
+    *data++ = static_cast<char>(value >> 8);
+    *data++ = static_cast<char>(value & 0xff);
+    return data;
+  }
+} // namespace
+
+// Reserves the complete packet up front, so that encoding the variable header
+// and payload never reallocates the buffer.
 void
-MqttPacket::add(uint8_t value)
+MqttPacket::begin(loopp::mqtt::PacketType type, std::uint8_t flags, std::size_t remaining_length)
 {
-  stream << value;
+  buffer.produce_data(packet_size(remaining_length));
+
+  char *data = buffer.produce_data(1);
+  data[0] = static_cast<char>((static_cast<std::uint8_t>(type) << 4) | (flags & 0x0f));
+  buffer.produce_commit(1);
+  add_length(remaining_length);
 }
 
 void
-MqttPacket::append(const std::string &s)
+MqttPacket::add(std::uint8_t value)
 {
-  stream << s;
+  char *data = buffer.produce_data(1);
+  data[0] = static_cast<char>(value);
+  buffer.produce_commit(1);
 }
 
 void
 MqttPacket::add(const std::string &str)
 {
-  std::size_t size = str.size();
+  add_string(str.data(), str.size());
+}
+
+void
+MqttPacket::add_string(const char *str, std::size_t size)
+{
+  char *data = buffer.produce_data(string_size(size));
+  data[0] = static_cast<char>(size >> 8);
+  data[1] = static_cast<char>(size & 0xff);
+  std::memcpy(data + 2, str, size);
+  buffer.produce_commit(string_size(size));
+}
+
+void
+MqttPacket::add_uint16(std::uint16_t value)
+{
+  char *data = buffer.produce_data(2);
+  data[0] = static_cast<char>(value >> 8);
+  data[1] = static_cast<char>(value & 0xff);
+  buffer.produce_commit(2);
+}
+
+void
+MqttPacket::add_packet_id(std::uint16_t id)
+{
+  add_uint16(id);
+}
 
-  stream << static_cast<uint8_t>(size >> 8);
-  stream << static_cast<uint8_t>(size & 0xff);
-  stream << str;
+void
+MqttPacket::append(const char *data, std::size_t size)
+{
+  std::memcpy(buffer.produce_data(size), data, size);
+  buffer.produce_commit(size);
 }
 
 void
 MqttPacket::add_length(std::size_t size)
 {
-  do
+  std::size_t count = length_size(size);
+  encode_length(buffer.produce_data(count), size);
+  buffer.produce_commit(count);
+}
+
+// Adds an MQTT 5 property list, preceded by its length.
+void
+MqttPacket::add_properties(const std::string &properties)
+{
+  add_length(properties.size());
+  append(properties.data(), properties.size());
+}
+
+// Reserves room for the largest possible fixed and variable header in front
+// of the payload. The header itself is encoded by complete_publish(). The
+// MQTT 5 properties of the message are stored between header and payload.
+// When the payload size is known, the buffer is allocated for the complete
+// packet at once instead of growing while the payload is appended.
+void
+MqttPacket::begin_publish(ProtocolVersion version,
+                          const std::string &topic,
+                          std::uint8_t flags,
+                          const std::string &properties,
+                          std::size_t payload_size)
+{
+  this->version = version;
+  this->topic = topic;
+  this->flags = flags;
+
+  header_size = max_fixed_header_size + string_size(topic.size()) + 2;
+  if (version == ProtocolVersion::Mqtt5)
     {
-      uint8_t b = size % 128;
-      size >>= 7;
+      // Property length and topic alias.
+      header_size += 4 + 3;
+    }
 
-      if (size > 0)
+  buffer.produce_data(header_size + properties.size() + payload_size);
+  buffer.produce_commit(header_size);
+
+  if (version == ProtocolVersion::Mqtt5)
+    {
+      append(properties.data(), properties.size());
+      publish_properties_size = properties.size();
+    }
+}
+
+// Encodes the header right-aligned against the properties and payload and
+// rewinds the packet for writing. Called again before each retransmission,
+// as the packet id, duplicate flag and topic alias may have changed.
+void
+MqttPacket::complete_publish(std::uint16_t topic_alias, bool omit_topic)
+{
+  bool mqtt5 = version == ProtocolVersion::Mqtt5;
+  bool has_packet_id = (flags & static_cast<std::uint8_t>(PublishFlags::QosMask)) != 0;
+  std::size_t topic_size = omit_topic ? 0 : topic.size();
+  std::size_t alias_size = (mqtt5 && topic_alias != 0) ? 3 : 0;
+  std::size_t properties_length = publish_properties_size + alias_size;
+
+  std::size_t variable_size = string_size(topic_size) + (has_packet_id ? 2 : 0);
+  if (mqtt5)
+    {
+      variable_size += length_size(properties_length) + alias_size;
+    }
+
+  buffer.consume_rewind(buffer.max_size());
+  if (payload_buffer)
+    {
+      payload_buffer->consume_rewind(payload_buffer->max_size());
+    }
+
+  std::size_t remaining_length = variable_size + buffer.consume_size() - header_size;
+  if (payload_buffer)
+    {
+      remaining_length += payload_buffer->consume_size();
+    }
+
+  std::size_t header = 1 + length_size(remaining_length) + variable_size;
+  if (header > header_size)
+    {
+      throw std::length_error("publish header too large");
+    }
+
+  start = header_size - header;
+  char *data = buffer.consume_data() + start;
+  *data++ = static_cast<char>((static_cast<std::uint8_t>(PacketType::Publish) << 4) | (flags & 0x0f));
+  data = encode_length(data, remaining_length);
+  data = encode_uint16(data, static_cast<std::uint16_t>(topic_size));
+  std::memcpy(data, topic.data(), topic_size);
+  data += topic_size;
+  if (has_packet_id)
+    {
+      data = encode_uint16(data, packet_id);
+    }
+  if (mqtt5)
+    {
+      data = encode_length(data, properties_length);
+      if (alias_size != 0)
         {
-          b |= 128;
+          *data++ = static_cast<char>(PropertyId::TopicAlias);
+          data = encode_uint16(data, topic_alias);
         }
-      stream << b;
     }
-  while (size > 0);
+  buffer.consume_commit(start);
+}
+
+void
+MqttPacket::set_packet_id(std::uint16_t id)
+{
+  packet_id = id;
+}
+
+void
+MqttPacket::set_payload(std::string &&payload)
+{
+  payload_buffer.reset(new loopp::net::StreamBuffer(std::move(payload)));
+}
+
+void
+MqttPacket::rewind()
+{
+  // Nothing is consumed from a packet buffer before it is written, so the
+  // start of the buffer is the start of the packet.
+  buffer.consume_rewind(buffer.max_size());
+  buffer.consume_commit(start);
+  if (payload_buffer)
+    {
+      payload_buffer->consume_rewind(payload_buffer->max_size());
+    }
 }
 
 void
-MqttPacket::add_fixed_header(loopp::mqtt::PacketType type, std::uint8_t flags)
+MqttPacket::clear()
 {
-  uint8_t header = ((static_cast<std::uint8_t>(type) << 4) | (flags & 0x0f));
-  stream << header;
+  buffer.clear();
+  payload_buffer.reset();
+  start = 0;
+  version = ProtocolVersion::Mqtt311;
+  topic.clear();
+  flags = 0;
+  packet_id = 0;
+  header_size = 0;
+  publish_properties_size = 0;
+}
+
+void
+MqttPacket::set_duplicate()
+{
+  flags |= static_cast<std::uint8_t>(PublishFlags::Duplicate);
+}
+
+const std::string &
+MqttPacket::get_topic() const noexcept
+{
+  return topic;
 }
 
 loopp::net::StreamBuffer &
@@ -80,8 +280,14 @@ MqttPacket::get_buffer()
   return buffer;
 }
 
+loopp::net::StreamBuffer *
+MqttPacket::get_payload_buffer()
+{
+  return payload_buffer.get();
+}
+
 std::size_t
 MqttPacket::size() const noexcept
 {
-  return buffer.consume_size();
+  return buffer.consume_size() + (payload_buffer ? payload_buffer->consume_size() : 0);
 }
@@ -0,0 +1,245 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/mqtt/MqttProperties.hpp"
+
+#include <system_error>
+
+#include "loopp/mqtt/MqttErrors.hpp"
+
+using namespace loopp;
+using namespace loopp::mqtt;
+
+void
+MqttProperties::add(PropertyId id, std::uint8_t value)
+{
+  properties.push_back(static_cast<char>(id));
+  properties.push_back(static_cast<char>(value));
+}
+
+void
+MqttProperties::add_uint16(PropertyId id, std::uint16_t value)
+{
+  properties.push_back(static_cast<char>(id));
+  properties.push_back(static_cast<char>(value >> 8));
+  properties.push_back(static_cast<char>(value & 0xff));
+}
+
+void
+MqttProperties::add_uint32(PropertyId id, std::uint32_t value)
+{
+  properties.push_back(static_cast<char>(id));
+  for (int shift = 24; shift >= 0; shift -= 8)
+    {
+      properties.push_back(static_cast<char>((value >> shift) & 0xff));
+    }
+}
+
+void
+MqttProperties::add(PropertyId id, const std::string &value)
+{
+  properties.push_back(static_cast<char>(id));
+  add_string(value);
+}
+
+void
+MqttProperties::add(PropertyId id, const std::string &name, const std::string &value)
+{
+  properties.push_back(static_cast<char>(id));
+  add_string(name);
+  add_string(value);
+}
+
+void
+MqttProperties::add_string(const std::string &value)
+{
+  properties.push_back(static_cast<char>(value.size() >> 8));
+  properties.push_back(static_cast<char>(value.size() & 0xff));
+  properties.append(value);
+}
+
+const std::string &
+MqttProperties::data() const noexcept
+{
+  return properties;
+}
+
+std::size_t
+MqttProperties::size() const noexcept
+{
+  return properties.size();
+}
+
+bool
+MqttProperties::empty() const noexcept
+{
+  return properties.empty();
+}
+
+MqttPropertyReader::MqttPropertyReader(const std::uint8_t *data, std::size_t size)
+  : data(data)
+  , size(size)
+{
+}
+
+bool
+MqttPropertyReader::next()
+{
+  if (index >= size)
+    {
+      return false;
+    }
+
+  property_id = static_cast<PropertyId>(data[index++]);
+  integer_value = 0;
+  string_value = loopp::utils::string_view();
+  name_value = loopp::utils::string_view();
+
+  std::size_t integer_size = 0;
+  switch (property_id)
+    {
+      case PropertyId::PayloadFormatIndicator:
+      case PropertyId::RequestProblemInformation:
+      case PropertyId::RequestResponseInformation:
+      case PropertyId::MaximumQos:
+      case PropertyId::RetainAvailable:
+      case PropertyId::WildcardSubscriptionAvailable:
+      case PropertyId::SubscriptionIdentifierAvailable:
+      case PropertyId::SharedSubscriptionAvailable:
+        integer_size = 1;
+        break;
+
+      case PropertyId::ServerKeepAlive:
+      case PropertyId::ReceiveMaximum:
+      case PropertyId::TopicAliasMaximum:
+      case PropertyId::TopicAlias:
+        integer_size = 2;
+        break;
+
+      case PropertyId::MessageExpiryInterval:
+      case PropertyId::SessionExpiryInterval:
+      case PropertyId::WillDelayInterval:
+      case PropertyId::MaximumPacketSize:
+        integer_size = 4;
+        break;
+
+      case PropertyId::SubscriptionIdentifier:
+        integer_value = read_length(data, size, index);
+        return true;
+
+      case PropertyId::ContentType:
+      case PropertyId::ResponseTopic:
+      case PropertyId::CorrelationData:
+      case PropertyId::AssignedClientIdentifier:
+      case PropertyId::AuthenticationMethod:
+      case PropertyId::AuthenticationData:
+      case PropertyId::ResponseInformation:
+      case PropertyId::ServerReference:
+      case PropertyId::ReasonString:
+        string_value = read_string();
+        return true;
+
+      case PropertyId::UserProperty:
+        name_value = read_string();
+        string_value = read_string();
+        return true;
+
+      default:
+        throw std::system_error(MqttErrc::ProtocolError, "unknown property");
+    }
+
+  if (size - index < integer_size)
+    {
+      throw std::system_error(MqttErrc::ProtocolError, "short property");
+    }
+  for (std::size_t i = 0; i < integer_size; i++)
+    {
+      integer_value = (integer_value << 8) | data[index++];
+    }
+  return true;
+}
+
+PropertyId
+MqttPropertyReader::id() const noexcept
+{
+  return property_id;
+}
+
+std::uint32_t
+MqttPropertyReader::value() const noexcept
+{
+  return integer_value;
+}
+
+loopp::utils::string_view
+MqttPropertyReader::string() const noexcept
+{
+  return string_value;
+}
+
+loopp::utils::string_view
+MqttPropertyReader::name() const noexcept
+{
+  return name_value;
+}
+
+loopp::utils::string_view
+MqttPropertyReader::read_string()
+{
+  if (size - index < 2)
+    {
+      throw std::system_error(MqttErrc::ProtocolError, "short property");
+    }
+
+  std::size_t length = (data[index] << 8) + data[index + 1];
+  index += 2;
+
+  if (size - index < length)
+    {
+      throw std::system_error(MqttErrc::ProtocolError, "short property");
+    }
+
+  loopp::utils::string_view value(reinterpret_cast<const char *>(data + index), length);
+  index += length;
+  return value;
+}
+
+std::uint32_t
+MqttPropertyReader::read_length(const std::uint8_t *data, std::size_t size, std::size_t &index)
+{
+  std::uint32_t length = 0;
+
+  for (int shift = 0; shift < 28; shift += 7)
+    {
+      if (index >= size)
+        {
+          break;
+        }
+
+      std::uint8_t b = data[index++];
+      length |= static_cast<std::uint32_t>(b & 0x7f) << shift;
+      if ((b & 0x80) == 0)
+        {
+          return length;
+        }
+    }
+
+  throw std::system_error(MqttErrc::ProtocolError, "invalid variable byte integer");
+}
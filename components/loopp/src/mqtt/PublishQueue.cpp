@@ -0,0 +1,136 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/mqtt/PublishQueue.hpp"
+
+#include <algorithm>
+
+#include "esp_log.h"
+
+#include "loopp/mqtt/MqttErrors.hpp"
+
+static const char *tag = "MQTT";
+
+using namespace loopp;
+using namespace loopp::mqtt;
+
+std::size_t
+PublishQueue::Message::size() const
+{
+  return sizeof(Message) + topic.size() + (packet ? packet->size() : 0);
+}
+
+PublishQueue::PublishQueue(std::size_t byte_budget, DropPolicy policy)
+  : byte_budget(byte_budget)
+  , policy(policy)
+{
+}
+
+void
+PublishQueue::push(Message message)
+{
+  std::size_t message_size = message.size();
+
+  if (message_size > byte_budget)
+    {
+      drop(message);
+      return;
+    }
+
+  while (queued_bytes + message_size > byte_budget)
+    {
+      auto victim = queue.begin();
+
+      if (policy == DropPolicy::DropNewest)
+        {
+          drop(message);
+          return;
+        }
+
+      if (policy == DropPolicy::DropLowestPriority)
+        {
+          // Oldest message of the lowest priority; the new message loses if it ranks below all queued messages.
+          victim = std::min_element(queue.begin(), queue.end(), [](const Message &a, const Message &b) { return a.priority < b.priority; });
+          if (message.priority < victim->priority)
+            {
+              drop(message);
+              return;
+            }
+        }
+
+      Message dropped_message = std::move(*victim);
+      queued_bytes -= dropped_message.size();
+      queue.erase(victim);
+      drop(dropped_message);
+    }
+
+  queued_bytes += message_size;
+  queue.push_back(std::move(message));
+}
+
+bool
+PublishQueue::pop(Message &message)
+{
+  if (queue.empty())
+    {
+      return false;
+    }
+
+  message = std::move(queue.front());
+  queue.pop_front();
+  queued_bytes -= message.size();
+  return true;
+}
+
+bool
+PublishQueue::empty() const
+{
+  return queue.empty();
+}
+
+std::size_t
+PublishQueue::size() const
+{
+  return queue.size();
+}
+
+std::size_t
+PublishQueue::bytes() const
+{
+  return queued_bytes;
+}
+
+std::size_t
+PublishQueue::dropped() const
+{
+  return dropped_count;
+}
+
+void
+PublishQueue::drop(Message &message)
+{
+  ESP_LOGW(tag, "Warning: offline queue full, dropping message for %s", message.topic.c_str());
+  dropped_count++;
+
+  if (message.callback)
+    {
+      message.callback(MqttErrc::MessageDropped);
+    }
+}
@@ -0,0 +1,153 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/mqtt/PublishScheduler.hpp"
+
+#include <stdexcept>
+
+#include "esp_log.h"
+
+static const char *tag = "MQTT";
+
+using namespace loopp;
+using namespace loopp::mqtt;
+
+PublishScheduler::PublishScheduler(std::shared_ptr<loopp::core::MainLoop> loop)
+  : loop(std::move(loop))
+{
+}
+
+PublishScheduler::~PublishScheduler()
+{
+  for (auto &task : tasks)
+    {
+      loop->cancel_timer(task.second.timer);
+    }
+}
+
+// FNV-1a spreads similar ids, such as MAC addresses of the same vendor, evenly over the period.
+void
+PublishScheduler::set_phase_from_id(const std::string &id)
+{
+  std::uint32_t hash = 2166136261u;
+  for (char c : id)
+    {
+      hash ^= static_cast<std::uint8_t>(c);
+      hash *= 16777619u;
+    }
+  set_phase(hash);
+}
+
+void
+PublishScheduler::set_slot(std::uint32_t slot, std::uint32_t slot_count)
+{
+  if (slot_count == 0 || slot >= slot_count)
+    {
+      throw std::out_of_range("invalid publish slot");
+    }
+  set_phase(static_cast<std::uint32_t>((static_cast<std::uint64_t>(slot) << 32) / slot_count));
+}
+
+std::chrono::milliseconds
+PublishScheduler::get_offset(std::chrono::milliseconds period) const
+{
+  return std::chrono::milliseconds((static_cast<std::uint64_t>(period.count()) * phase) >> 32);
+}
+
+PublishScheduler::id_t
+PublishScheduler::add(std::chrono::milliseconds period, callback_t callback)
+{
+  if (period.count() <= 0)
+    {
+      throw std::invalid_argument("invalid publish period");
+    }
+
+  id_t id = next_id++;
+  Task &task = tasks[id];
+  task.period = period;
+  task.callback = std::move(callback);
+  schedule(id, task, true);
+  return id;
+}
+
+void
+PublishScheduler::remove(id_t id)
+{
+  auto it = tasks.find(id);
+  if (it != tasks.end())
+    {
+      loop->cancel_timer(it->second.timer);
+      tasks.erase(it);
+    }
+}
+
+void
+PublishScheduler::set_phase(std::uint32_t phase)
+{
+  if (phase != this->phase)
+    {
+      this->phase = phase;
+      for (auto &task : tasks)
+        {
+          loop->cancel_timer(task.second.timer);
+          schedule(task.first, task.second, true);
+        }
+    }
+}
+
+void
+PublishScheduler::schedule(id_t id, Task &task, bool align)
+{
+  auto now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch());
+
+  task.next += task.period;
+
+  // Re-align after a phase change, a late tick, or when the clock was set.
+  if (align || task.next <= now || task.next > now + task.period)
+    {
+      auto period = task.period.count();
+      auto delay = (get_offset(task.period).count() - now.count() % period + period) % period;
+      task.next = now + std::chrono::milliseconds(delay == 0 ? period : delay);
+      ESP_LOGD(tag, "Scheduling publish task %d with period %d ms at offset %d ms",
+               static_cast<int>(id), static_cast<int>(period), static_cast<int>(get_offset(task.period).count()));
+    }
+
+  task.timer = loop->add_timer(task.next - now, [this, id]() { on_timer(id); });
+}
+
+void
+PublishScheduler::on_timer(id_t id)
+{
+  auto it = tasks.find(id);
+  if (it == tasks.end())
+    {
+      return;
+    }
+
+  it->second.timer = 0;
+  it->second.callback();
+
+  // The callback may have removed the task.
+  it = tasks.find(id);
+  if (it != tasks.end() && it->second.timer == 0)
+    {
+      schedule(id, it->second, false);
+    }
+}
@@ -0,0 +1,302 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/net/DatagramSocket.hpp"
+
+#include <string>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <netdb.h>
+
+#include "loopp/net/NetworkErrors.hpp"
+
+#include "lwip/sockets.h"
+#include "lwip/sys.h"
+
+#include "esp_log.h"
+
+static const char *tag = "NET";
+
+using namespace loopp;
+using namespace loopp::net;
+
+DatagramSocket::DatagramSocket(std::shared_ptr<loopp::core::MainLoop> loop)
+  : loop(std::move(loop))
+  , resolver(Resolver::instance())
+{
+}
+
+DatagramSocket::~DatagramSocket()
+{
+  close();
+}
+
+void
+DatagramSocket::connect(const std::string &host, int port, const connect_callback_t &callback)
+{
+  ESP_LOGI(tag, "Sending datagrams to %s:%d", host.c_str(), port);
+  auto self = shared_from_this();
+
+  resolver.resolve_async(host,
+                         std::to_string(port),
+                         loopp::core::bind_loop(loop, [this, self, callback](std::error_code ec, struct addrinfo *addr_list) {
+                           if (!ec)
+                             {
+                               on_resolved(addr_list, callback);
+                             }
+                           else
+                             {
+                               callback(ec);
+                             }
+
+                           if (addr_list != nullptr)
+                             {
+                               freeaddrinfo(addr_list);
+                             }
+                         }));
+}
+
+void
+DatagramSocket::on_resolved(struct addrinfo *addr_list, const connect_callback_t &callback)
+{
+  try
+    {
+      struct addrinfo *addr = nullptr;
+      for (struct addrinfo *cur = addr_list; cur != nullptr && addr == nullptr; cur = cur->ai_next)
+        {
+          if (cur->ai_family == AF_INET || cur->ai_family == AF_INET6)
+            {
+              addr = cur;
+            }
+        }
+
+      if (addr == nullptr)
+        {
+          throw std::system_error(NetworkErrc::NameResolutionFailed, "No suitable IP address");
+        }
+
+      open(addr->ai_family);
+
+      if (addr->ai_family == AF_INET)
+        {
+          auto *sin = reinterpret_cast<struct sockaddr_in *>(addr->ai_addr);
+          if (IN_MULTICAST(ntohl(sin->sin_addr.s_addr)))
+            {
+              std::uint8_t ttl = static_cast<std::uint8_t>(multicast_ttl);
+              setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+            }
+        }
+
+      // Only sets the default destination; no packets are exchanged.
+      if (::connect(sock, addr->ai_addr, addr->ai_addrlen) < 0)
+        {
+          throw std::system_error(NetworkErrc::InvalidAddress, "Could not set destination");
+        }
+
+      callback(std::error_code());
+    }
+  catch (const std::system_error &ex)
+    {
+      ESP_LOGD(tag, "connect exception %d %s", ex.code().value(), ex.what());
+      close();
+      callback(ex.code());
+    }
+}
+
+void
+DatagramSocket::bind(int port)
+{
+  open(AF_INET);
+
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port);
+
+  if (::bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) < 0)
+    {
+      throw std::system_error(NetworkErrc::InternalError, "Could not bind socket");
+    }
+}
+
+void
+DatagramSocket::set_multicast_ttl(int ttl)
+{
+  multicast_ttl = ttl;
+}
+
+void
+DatagramSocket::open(int family)
+{
+  if (sock != -1)
+    {
+      return;
+    }
+
+  sock = socket(family, SOCK_DGRAM, IPPROTO_UDP);
+  if (sock < 0)
+    {
+      sock = -1;
+      throw std::system_error(NetworkErrc::InternalError, "Could not create socket");
+    }
+
+  int ret = fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+  if (ret < 0)
+    {
+      close();
+      throw std::system_error(NetworkErrc::InternalError, "Could not set non-blocking");
+    }
+}
+
+void
+DatagramSocket::send_async(StreamBuffer &buffer, const io_callback_t &callback)
+{
+  if (sock == -1)
+    {
+      callback(NetworkErrc::ConnectionClosed, 0);
+    }
+  else
+    {
+      auto self = shared_from_this();
+
+      loop->invoke([this, self, &buffer, callback]() {
+        send_op_queue.push_back(SendOperation{ buffer, callback });
+        if (send_op_queue.size() == 1)
+          {
+            do_send_async();
+          }
+      });
+    }
+}
+
+void
+DatagramSocket::do_send_async()
+{
+  auto &send_op = send_op_queue.front();
+  std::error_code ec;
+  std::size_t size = send_op.buffer.consume_size();
+
+  int ret = ::send(sock, send_op.buffer.consume_data(), size, 0);
+  if (ret < 0 && errno == EAGAIN)
+    {
+      do_wait_send_async();
+      return;
+    }
+  else if (ret < 0)
+    {
+      // Datagrams are loss tolerant; the caller decides whether a failed send matters.
+      ec = NetworkErrc::WriteError;
+      size = 0;
+    }
+  else
+    {
+      send_op.buffer.consume_commit(size);
+    }
+
+  auto callback = std::move(send_op.callback);
+  send_op_queue.pop_front();
+  callback(ec, size);
+
+  if (!send_op_queue.empty() && sock != -1)
+    {
+      do_send_async();
+    }
+}
+
+void
+DatagramSocket::do_wait_send_async()
+{
+  auto self = shared_from_this();
+  loop->notify_write(sock, [this, self](std::error_code ec) {
+    if (send_op_queue.empty())
+      {
+        return;
+      }
+    if (!ec)
+      {
+        do_send_async();
+      }
+    else
+      {
+        auto callback = std::move(send_op_queue.front().callback);
+        send_op_queue.pop_front();
+        callback(ec, 0);
+        if (!send_op_queue.empty())
+          {
+            do_wait_send_async();
+          }
+      }
+  });
+}
+
+void
+DatagramSocket::receive_async(StreamBuffer &buffer, const io_callback_t &callback)
+{
+  if (sock == -1)
+    {
+      callback(NetworkErrc::ConnectionClosed, 0);
+      return;
+    }
+
+  int ret = ::recv(sock, buffer.produce_data(max_datagram_size), max_datagram_size, 0);
+  if (ret >= 0)
+    {
+      buffer.produce_commit(ret);
+      callback(std::error_code(), ret);
+    }
+  else if (errno == EAGAIN)
+    {
+      auto self = shared_from_this();
+      loop->notify_read(sock, [this, self, &buffer, callback](std::error_code ec) {
+        if (!ec)
+          {
+            receive_async(buffer, callback);
+          }
+        else
+          {
+            callback(ec, 0);
+          }
+      });
+    }
+  else
+    {
+      callback(NetworkErrc::ReadError, 0);
+    }
+}
+
+void
+DatagramSocket::close()
+{
+  if (sock != -1)
+    {
+      loop->unnotify(sock);
+      ::close(sock);
+      sock = -1;
+    }
+  send_op_queue.clear();
+}
+
+bool
+DatagramSocket::is_open() const
+{
+  return sock != -1;
+}
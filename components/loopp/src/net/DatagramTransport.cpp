@@ -0,0 +1,174 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/net/DatagramTransport.hpp"
+
+#include <algorithm>
+
+#include "esp_log.h"
+#include "esp_system.h"
+
+#include "loopp/net/NetworkErrors.hpp"
+
+static const char *tag = "NET";
+
+using namespace loopp;
+using namespace loopp::net;
+
+namespace
+{
+  void
+  encode_uint32(std::uint8_t *data, std::uint32_t value)
+  {
+    data[0] = static_cast<std::uint8_t>(value >> 24);
+    data[1] = static_cast<std::uint8_t>(value >> 16);
+    data[2] = static_cast<std::uint8_t>(value >> 8);
+    data[3] = static_cast<std::uint8_t>(value);
+  }
+} // namespace
+
+DatagramTransport::DatagramTransport(std::shared_ptr<loopp::core::MainLoop> loop)
+  : loop(loop)
+  , socket(std::make_shared<DatagramSocket>(loop))
+  , boot_id(esp_random())
+{
+  esp_efuse_mac_get_default(mac);
+  mbedtls_gcm_init(&gcm);
+}
+
+DatagramTransport::~DatagramTransport()
+{
+  mbedtls_gcm_free(&gcm);
+}
+
+void
+DatagramTransport::set_key(const std::string &key)
+{
+  if (key.size() != 16 && key.size() != 24 && key.size() != 32)
+    {
+      throw std::system_error(NetworkErrc::InternalError, "invalid datagram key size");
+    }
+
+  int ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, reinterpret_cast<const unsigned char *>(key.data()), key.size() * 8);
+  if (ret != 0)
+    {
+      throw std::system_error(NetworkErrc::InternalError, "could not set datagram key");
+    }
+  authenticated = true;
+}
+
+void
+DatagramTransport::set_multicast_ttl(int ttl)
+{
+  socket->set_multicast_ttl(ttl);
+}
+
+void
+DatagramTransport::connect(const std::string &host, int port, const connect_callback_t &callback)
+{
+  socket->connect(host, port, [host, callback](std::error_code ec) {
+    if (ec)
+      {
+        ESP_LOGE(tag, "Could not send datagrams to %s: %s", host.c_str(), ec.message().c_str());
+      }
+    if (callback)
+      {
+        callback(ec);
+      }
+  });
+}
+
+std::size_t
+DatagramTransport::max_payload_size() const
+{
+  return max_datagram_size - header_size - (authenticated ? tag_size : 0);
+}
+
+bool
+DatagramTransport::send(const std::string &payload)
+{
+  if (!socket->is_open() || payload.size() > max_payload_size())
+    {
+      statistics.failed++;
+      return false;
+    }
+
+  std::size_t size = header_size + payload.size() + (authenticated ? tag_size : 0);
+  auto buffer = std::make_shared<StreamBuffer>(size);
+  auto data = reinterpret_cast<std::uint8_t *>(buffer->produce_data(size));
+
+  std::uint32_t seq = sequence++;
+  data[0] = 'L';
+  data[1] = 'P';
+  data[2] = version;
+  data[3] = authenticated ? flag_authenticated : 0;
+  encode_uint32(data + 4, boot_id);
+  encode_uint32(data + 8, seq);
+  std::copy(mac, mac + sizeof(mac), data + 12);
+
+  if (authenticated)
+    {
+      std::uint8_t nonce[12];
+      std::copy(data + 4, data + 12, nonce);
+      std::copy(mac + 2, mac + 6, nonce + 8);
+
+      int ret = mbedtls_gcm_crypt_and_tag(&gcm,
+                                          MBEDTLS_GCM_ENCRYPT,
+                                          payload.size(),
+                                          nonce,
+                                          sizeof(nonce),
+                                          data,
+                                          header_size,
+                                          reinterpret_cast<const unsigned char *>(payload.data()),
+                                          data + header_size,
+                                          tag_size,
+                                          data + header_size + payload.size());
+      if (ret != 0)
+        {
+          statistics.failed++;
+          return false;
+        }
+    }
+  else
+    {
+      std::copy(payload.begin(), payload.end(), data + header_size);
+    }
+  buffer->produce_commit(size);
+
+  auto self = shared_from_this();
+  socket->send_async(*buffer, [this, self, buffer, size](std::error_code ec, std::size_t) {
+    if (ec)
+      {
+        statistics.failed++;
+      }
+    else
+      {
+        statistics.sent++;
+        statistics.bytes += size;
+      }
+  });
+  return true;
+}
+
+const DatagramStatistics &
+DatagramTransport::get_statistics() const
+{
+  return statistics;
+}
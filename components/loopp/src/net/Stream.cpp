@@ -187,6 +187,13 @@ Stream::read_until_async(StreamBuffer &buffer, const std::string &until, const i
   do_read_until_async(buffer, until, 0, callback);
 }
 
+// Completes as soon as at least one byte is available.
+void
+Stream::read_some_async(StreamBuffer &buffer, std::size_t max_count, const io_callback_t &callback)
+{
+  do_read_some_async(buffer, max_count, callback);
+}
+
 void
 Stream::do_write_async()
 {
@@ -291,6 +298,56 @@ Stream::do_read_async(StreamBuffer &buf, std::size_t count, std::size_t bytes_tr
   callback(ec, bytes_transferred);
 }
 
+void
+Stream::do_read_some_async(StreamBuffer &buf, std::size_t max_count, const io_callback_t &callback)
+{
+  auto self = shared_from_this();
+  std::error_code ec;
+  std::size_t bytes_transferred = 0;
+
+  if (!connected_property.get())
+    {
+      ec = NetworkErrc::ConnectionClosed;
+    }
+  else
+    {
+      auto data = reinterpret_cast<uint8_t *>(buf.produce_data(max_count));
+      int ret = socket_read(data, max_count);
+
+      if (ret > 0)
+        {
+          buf.produce_commit(ret);
+          bytes_transferred = ret;
+        }
+      else if (ret == 0)
+        {
+          ESP_LOGI(tag, "Connection closed");
+          connected_property.set(false);
+          ec = NetworkErrc::ConnectionClosed;
+        }
+      else if (ret == -EAGAIN)
+        {
+          loop->notify_read(sock, [this, self, &buf, max_count, callback](std::error_code ec) {
+            if (!ec)
+              {
+                do_read_some_async(buf, max_count, callback);
+              }
+            else
+              {
+                callback(ec, 0);
+              }
+          });
+          return;
+        }
+      else
+        {
+          ec = NetworkErrc::ReadError;
+        }
+    }
+
+  callback(ec, bytes_transferred);
+}
+
 bool
 Stream::match_until(StreamBuffer &buf, std::size_t &start_pos, const std::string &match)
 {
@@ -20,6 +20,8 @@
 
 #include "loopp/net/StreamBuffer.hpp"
 
+#include <algorithm>
+
 using namespace loopp;
 using namespace loopp::net;
 
@@ -31,6 +33,24 @@ StreamBuffer::StreamBuffer(std::size_t max_buffer_size)
   setp(&buffer[0], &buffer[0] + buffer.size());
 }
 
+// Takes over the contents of data as the data available for consumption.
+StreamBuffer::StreamBuffer(std::string &&data)
+  : max_buffer_size(std::max<std::size_t>(data.size(), std::size_t(DEFAULT_MAX_BUFFER_SIZE)))
+  , buffer(std::move(data))
+{
+  if (buffer.empty())
+    {
+      buffer.resize(BUFFER_INCREASE_SIZE);
+      setg(&buffer[0], &buffer[0], &buffer[0]);
+      setp(&buffer[0], &buffer[0] + buffer.size());
+    }
+  else
+    {
+      setg(&buffer[0], &buffer[0], &buffer[0] + buffer.size());
+      setp(&buffer[0] + buffer.size(), &buffer[0] + buffer.size());
+    }
+}
+
 std::size_t
 StreamBuffer::max_size() const noexcept
 {
@@ -53,6 +73,15 @@ StreamBuffer::produce_commit(std::size_t n)
   setg(eback(), gptr(), pptr());
 }
 
+// Removes the last n bytes of the data available for consumption.
+void
+StreamBuffer::produce_rewind(std::size_t n)
+{
+  n = std::min<std::size_t>(n, consume_size());
+  pbump(-static_cast<int>(n));
+  setg(eback(), gptr(), pptr());
+}
+
 char *
 StreamBuffer::consume_data() const noexcept
 {
@@ -72,6 +101,20 @@ StreamBuffer::consume_commit(std::size_t n)
   gbump(static_cast<int>(n));
 }
 
+void
+StreamBuffer::consume_rewind(std::size_t n)
+{
+  n = std::min<std::size_t>(n, gptr() - eback());
+  gbump(-static_cast<int>(n));
+}
+
+void
+StreamBuffer::clear()
+{
+  setg(&buffer[0], &buffer[0], &buffer[0]);
+  setp(&buffer[0], &buffer[0] + buffer.size());
+}
+
 StreamBuffer::int_type
 StreamBuffer::underflow()
 {
@@ -116,7 +159,8 @@ StreamBuffer::reserve(std::size_t n)
             {
               throw std::length_error("stream buffer full");
             }
-          buffer.resize(new_size);
+          // Grow geometrically so that data written in small pieces is not copied over and over.
+          buffer.resize(std::max(new_size, std::min(2 * buffer.size(), max_buffer_size)));
         }
 
       setg(&buffer[0], &buffer[0], &buffer[0] + pptr_offset);
@@ -0,0 +1,257 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/ota/DeltaPatcher.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+
+#include "loopp/ota/OTAErrors.hpp"
+
+static const char *tag = "OTA";
+
+using namespace loopp;
+using namespace loopp::ota;
+using loopp::utils::string_view;
+
+namespace
+{
+  const char PATCH_MAGIC[] = "LPDELTA1";
+  const std::size_t PATCH_HEADER_SIZE = 48;
+  const std::size_t CONTROL_SIZE = 12;
+
+  uint32_t get_le32(const uint8_t *p)
+  {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+  }
+} // namespace
+
+DeltaPatcher::DeltaPatcher(const esp_partition_t *source, output_callback_t output)
+  : source(source)
+  , output(std::move(output))
+  , inflater(loopp::http::Inflater::Format::Deflate)
+{
+}
+
+bool
+DeltaPatcher::is_patch(string_view data)
+{
+  return data.size() >= MAGIC_SIZE && memcmp(data.data(), PATCH_MAGIC, MAGIC_SIZE) == 0;
+}
+
+bool
+DeltaPatcher::done() const
+{
+  return state == State::Control && control_pos == 0 && produced == target_size;
+}
+
+std::error_code
+DeltaPatcher::apply(string_view patch)
+{
+  if (!error && state == State::Header)
+    {
+      error = parse_header(patch);
+    }
+
+  if (!error && !patch.empty())
+    {
+      if (inflater.done())
+        {
+          ESP_LOGE(tag, "Data after end of patch");
+          error = OTAErrc::InvalidPatch;
+        }
+      else
+        {
+          std::error_code ec = inflater.inflate(patch, [this](string_view data) {
+            if (!error)
+              {
+                error = process(data);
+              }
+          });
+          if (ec && !error)
+            {
+              ESP_LOGE(tag, "Corrupt patch data");
+              error = OTAErrc::InvalidPatch;
+            }
+        }
+    }
+
+  return error;
+}
+
+std::error_code
+DeltaPatcher::parse_header(string_view &patch)
+{
+  std::size_t n = std::min(PATCH_HEADER_SIZE - header.size(), patch.size());
+  header.append(patch.data(), n);
+  patch.remove_prefix(n);
+
+  if (header.size() < PATCH_HEADER_SIZE)
+    {
+      return std::error_code();
+    }
+
+  if (!is_patch(header))
+    {
+      return OTAErrc::InvalidPatch;
+    }
+
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(header.data()) + MAGIC_SIZE;
+  source_size = get_le32(p);
+  target_size = get_le32(p + 4);
+  target_digest = header.substr(MAGIC_SIZE + 8);
+
+  if (source_size > source->size)
+    {
+      ESP_LOGE(tag, "Patch source of %d bytes does not fit in running partition", static_cast<int>(source_size));
+      return OTAErrc::InvalidPatch;
+    }
+
+  ESP_LOGI(tag, "Applying patch from %d to %d bytes", static_cast<int>(source_size), static_cast<int>(target_size));
+  state = State::Control;
+  return std::error_code();
+}
+
+std::error_code
+DeltaPatcher::process(string_view data)
+{
+  while (!data.empty())
+    {
+      std::error_code ec;
+      std::size_t n = 0;
+
+      switch (state)
+        {
+        case State::Header:
+          return OTAErrc::InternalError;
+
+        case State::Control:
+          n = std::min(CONTROL_SIZE - control_pos, data.size());
+          memcpy(control + control_pos, data.data(), n);
+          control_pos += n;
+          if (control_pos == CONTROL_SIZE)
+            {
+              ec = start_record();
+            }
+          break;
+
+        case State::Diff:
+          n = std::min(std::min(diff_left, data.size()), sizeof(source_buffer));
+          ec = apply_diff(data.substr(0, n));
+          if (!ec && diff_left == 0)
+            {
+              if (extra_left > 0)
+                {
+                  state = State::Extra;
+                }
+              else
+                {
+                  ec = end_record();
+                }
+            }
+          break;
+
+        case State::Extra:
+          n = std::min(extra_left, data.size());
+          output(data.substr(0, n));
+          produced += n;
+          extra_left -= n;
+          if (extra_left == 0)
+            {
+              ec = end_record();
+            }
+          break;
+        }
+
+      if (ec)
+        {
+          return ec;
+        }
+      data.remove_prefix(n);
+    }
+
+  return std::error_code();
+}
+
+std::error_code
+DeltaPatcher::start_record()
+{
+  diff_left = get_le32(control);
+  extra_left = get_le32(control + 4);
+  seek = static_cast<int32_t>(get_le32(control + 8));
+  control_pos = 0;
+
+  if (produced + diff_left + extra_left > target_size || source_pos + diff_left > source_size)
+    {
+      ESP_LOGE(tag, "Patch record out of bounds");
+      return OTAErrc::InvalidPatch;
+    }
+
+  if (diff_left > 0)
+    {
+      state = State::Diff;
+      return std::error_code();
+    }
+  if (extra_left > 0)
+    {
+      state = State::Extra;
+      return std::error_code();
+    }
+  return end_record();
+}
+
+std::error_code
+DeltaPatcher::end_record()
+{
+  state = State::Control;
+
+  int64_t pos = static_cast<int64_t>(source_pos) + seek;
+  if (pos < 0 || pos > static_cast<int64_t>(source_size))
+    {
+      ESP_LOGE(tag, "Patch seeks outside source image");
+      return OTAErrc::InvalidPatch;
+    }
+  source_pos = static_cast<std::size_t>(pos);
+  return std::error_code();
+}
+
+std::error_code
+DeltaPatcher::apply_diff(string_view data)
+{
+  esp_err_t err = esp_partition_read(source, source_pos, source_buffer, data.size());
+  if (err != ESP_OK)
+    {
+      ESP_LOGE(tag, "Could not read running partition, error 0x%x", err);
+      return OTAErrc::FlashError;
+    }
+
+  for (std::size_t i = 0; i < data.size(); i++)
+    {
+      source_buffer[i] += static_cast<uint8_t>(data[i]);
+    }
+
+  output(string_view(reinterpret_cast<const char *>(source_buffer), data.size()));
+  source_pos += data.size();
+  produced += data.size();
+  diff_left -= data.size();
+  return std::error_code();
+}
@@ -0,0 +1,500 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/ota/FlashWriter.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+
+#include "loopp/core/ScopedLock.hpp"
+#include "loopp/ota/OTAErrors.hpp"
+
+static const char *tag = "OTA";
+
+using namespace loopp;
+using namespace loopp::ota;
+
+namespace
+{
+  std::chrono::milliseconds since(std::chrono::steady_clock::time_point start)
+  {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start);
+  }
+} // namespace
+
+FlashWriter::FlashWriter(std::shared_ptr<loopp::core::MainLoop> loop, std::size_t buffer_count, std::size_t buffer_size)
+  : loop(loop)
+  , buffer_size(buffer_size)
+  , free_buffers(buffer_count)
+  , jobs(buffer_count + 2)
+  , alive(std::make_shared<bool>(true))
+  , task("ota_writer_task", std::bind(&FlashWriter::writer_task, this), loopp::core::Task::CoreId::NoAffinity, 4096)
+{
+  for (std::size_t i = 0; i < buffer_count; i++)
+    {
+      buffers.emplace_back(new char[buffer_size]);
+      free_buffers.push(static_cast<int>(i));
+    }
+}
+
+FlashWriter::~FlashWriter()
+{
+  *alive = false;
+
+  // Queued data is not written. The task stops after the job it is working on,
+  // so that it is not deleted in the middle of a flash operation.
+  generation++;
+  jobs.push(Job(JobType::Stop, generation));
+  stopped.take();
+}
+
+void
+FlashWriter::begin(const esp_partition_t *partition, std::size_t image_size, bool erase_up_front, decoder_t decoder)
+{
+  // Drop data of an interrupted attempt that has not been submitted yet. The
+  // writer task skips the data that has been submitted.
+  generation++;
+  current_size = 0;
+  backlog.clear();
+  finish_pending = false;
+
+  Job job(JobType::Begin, generation);
+  job.partition = partition;
+  job.image_size = image_size;
+  job.erase_up_front = erase_up_front;
+  job.decoder = std::move(decoder);
+  jobs.push(std::move(job));
+}
+
+void
+FlashWriter::write(const char *data, std::size_t size)
+{
+  std::error_code ec = get_error();
+  if (ec)
+    {
+      throw std::system_error(ec, "failed to write firmware");
+    }
+
+  if (!backlog.empty())
+    {
+      backlog.append(data, size);
+      return;
+    }
+  fill_buffers(data, size);
+}
+
+bool
+FlashWriter::full() const
+{
+  return !backlog.empty() || (current_buffer == -1 && free_buffers.size() == 0);
+}
+
+void
+FlashWriter::notify_available(available_callback_t callback)
+{
+  if (!full())
+    {
+      loop->invoke(callback);
+    }
+  else
+    {
+      wait_start = std::chrono::steady_clock::now();
+      available_callback = std::move(callback);
+    }
+}
+
+void
+FlashWriter::finish(complete_callback_t callback)
+{
+  {
+    loopp::core::ScopedLock l(mutex);
+    complete_callback = std::move(callback);
+  }
+
+  if (backlog.empty())
+    {
+      submit_finish();
+    }
+  else
+    {
+      finish_pending = true;
+    }
+}
+
+FlashWriter::Statistics
+FlashWriter::get_statistics() const
+{
+  loopp::core::ScopedLock l(mutex);
+  return statistics;
+}
+
+// Copies data into free buffers and submits the full ones. Data for which no
+// buffer is free goes to the backlog.
+void
+FlashWriter::fill_buffers(const char *data, std::size_t size)
+{
+  while (size > 0)
+    {
+      if (current_buffer == -1)
+        {
+          if (!free_buffers.pop_for(current_buffer, std::chrono::milliseconds(0)))
+            {
+              // Flash is slower than the network.
+              current_buffer = -1;
+              backlog.append(data, size);
+              return;
+            }
+          current_size = 0;
+        }
+
+      std::size_t n = std::min(size, buffer_size - current_size);
+      memcpy(buffers[current_buffer].get() + current_size, data, n);
+      current_size += n;
+      data += n;
+      size -= n;
+
+      if (current_size == buffer_size)
+        {
+          submit_buffer();
+        }
+    }
+}
+
+void
+FlashWriter::submit_buffer()
+{
+  jobs.push(Job(JobType::Write, generation, current_buffer, current_size));
+  current_buffer = -1;
+  current_size = 0;
+}
+
+void
+FlashWriter::submit_finish()
+{
+  if (current_buffer != -1)
+    {
+      submit_buffer();
+    }
+  jobs.push(Job(JobType::Finish, generation));
+}
+
+// Runs on the main loop each time the writer task has released a buffer.
+void
+FlashWriter::on_buffer_released()
+{
+  if (!backlog.empty())
+    {
+      std::string data;
+      data.swap(backlog);
+      fill_buffers(data.data(), data.size());
+    }
+
+  if (finish_pending && backlog.empty())
+    {
+      finish_pending = false;
+      submit_finish();
+    }
+
+  if (available_callback && !full())
+    {
+      {
+        loopp::core::ScopedLock l(mutex);
+        statistics.stall_time += since(wait_start);
+      }
+
+      available_callback_t callback = std::move(available_callback);
+      available_callback = nullptr;
+      callback();
+    }
+}
+
+std::error_code
+FlashWriter::get_error() const
+{
+  loopp::core::ScopedLock l(mutex);
+  // An error of a previous attempt is cleared once the writer task starts the new one.
+  return error_generation == generation ? error : std::error_code();
+}
+
+void
+FlashWriter::set_error(std::error_code ec)
+{
+  loopp::core::ScopedLock l(mutex);
+  if (!error)
+    {
+      error = ec;
+    }
+}
+
+void
+FlashWriter::writer_task()
+{
+  while (true)
+    {
+      Job job;
+      if (jobs.pop(job))
+        {
+          // Data of an attempt that was restarted by begin is not written.
+          bool current = job.generation == generation;
+
+          switch (job.type)
+            {
+            case JobType::Begin:
+              if (current)
+                {
+                  do_begin(job);
+                }
+              break;
+            case JobType::Write:
+              if (current)
+                {
+                  do_write(job.buffer, job.size);
+                }
+              release_buffer(job.buffer);
+              break;
+            case JobType::Finish:
+              do_finish();
+              break;
+            case JobType::Stop:
+              do_stop();
+              break;
+            }
+        }
+    }
+}
+
+void
+FlashWriter::do_begin(Job &job)
+{
+  if (update_handle != 0)
+    {
+      // A previous attempt was interrupted.
+      esp_ota_end(update_handle);
+      update_handle = 0;
+    }
+
+  partition = job.partition;
+  image_size = job.image_size;
+  erase_up_front = job.erase_up_front;
+  decoder = std::move(job.decoder);
+  written = 0;
+  staging_size = 0;
+
+  {
+    loopp::core::ScopedLock l(mutex);
+    error = std::error_code();
+    error_generation = job.generation;
+    statistics = Statistics();
+    start_time = std::chrono::steady_clock::now();
+  }
+
+  // esp_ota_begin erases the flash for the given image size, or the whole
+  // partition if the size is unknown. Without an up-front erase, a size below
+  // one sector makes it erase only the first sector; do_write erases the others.
+  std::size_t erase_size = erase_up_front ? image_size : SPI_FLASH_SEC_SIZE - 1;
+
+  auto start = std::chrono::steady_clock::now();
+  esp_err_t err = esp_ota_begin(partition, erase_size, &update_handle);
+  if (err != ESP_OK)
+    {
+      update_handle = 0;
+      ESP_LOGE(tag, "Could not start OTA, error 0x%x", err);
+      set_error(OTAErrc::InternalError);
+      return;
+    }
+
+  if (!erase_up_front)
+    {
+      erased = SPI_FLASH_SEC_SIZE;
+    }
+  else if (image_size == OTA_SIZE_UNKNOWN)
+    {
+      erased = partition->size;
+    }
+  else
+    {
+      erased = (image_size / SPI_FLASH_SEC_SIZE + 1) * SPI_FLASH_SEC_SIZE;
+    }
+
+  loopp::core::ScopedLock l(mutex);
+  statistics.erase_time += since(start);
+}
+
+void
+FlashWriter::do_write(int buffer, std::size_t size)
+{
+  if (update_handle == 0 || get_error())
+    {
+      return;
+    }
+
+  loopp::utils::string_view data(buffers[buffer].get(), size);
+  if (!decoder)
+    {
+      write_flash(data.data(), data.size());
+      return;
+    }
+
+  std::error_code ec = decoder(data, [this](loopp::utils::string_view image_data) { write_image(image_data); });
+  if (ec)
+    {
+      ESP_LOGE(tag, "Could not decode image: %s", ec.message().c_str());
+      set_error(ec);
+    }
+}
+
+// Collects decoded image data, which may come in small pieces, into writes of a full buffer.
+void
+FlashWriter::write_image(loopp::utils::string_view data)
+{
+  if (!staging)
+    {
+      staging.reset(new char[buffer_size]);
+    }
+
+  while (!data.empty())
+    {
+      std::size_t n = std::min(data.size(), buffer_size - staging_size);
+      memcpy(staging.get() + staging_size, data.data(), n);
+      staging_size += n;
+      data.remove_prefix(n);
+
+      if (staging_size == buffer_size)
+        {
+          write_flash(staging.get(), staging_size);
+          staging_size = 0;
+        }
+    }
+}
+
+void
+FlashWriter::write_flash(const char *data, std::size_t size)
+{
+  if (get_error())
+    {
+      return;
+    }
+
+  if (written + size > partition->size)
+    {
+      ESP_LOGE(tag, "Image does not fit in partition");
+      set_error(OTAErrc::ImageTooLarge);
+      return;
+    }
+
+  std::chrono::milliseconds erase_time(0);
+  if (written + size > erased)
+    {
+      std::size_t erase_size = ((written + size - erased + SPI_FLASH_SEC_SIZE - 1) / SPI_FLASH_SEC_SIZE) * SPI_FLASH_SEC_SIZE;
+      erase_size = std::min(erase_size, static_cast<std::size_t>(partition->size - erased));
+
+      auto start = std::chrono::steady_clock::now();
+      esp_err_t err = esp_partition_erase_range(partition, erased, erase_size);
+      if (err != ESP_OK)
+        {
+          ESP_LOGE(tag, "Could not erase flash, error 0x%x", err);
+          set_error(OTAErrc::FlashError);
+          return;
+        }
+      erase_time = since(start);
+      erased += erase_size;
+    }
+
+  auto start = std::chrono::steady_clock::now();
+  esp_err_t err = esp_ota_write(update_handle, data, size);
+  if (err != ESP_OK)
+    {
+      ESP_LOGE(tag, "Could not write OTA, error 0x%x", err);
+      set_error(OTAErrc::FlashError);
+      return;
+    }
+  written += size;
+
+  loopp::core::ScopedLock l(mutex);
+  statistics.bytes += size;
+  statistics.erase_time += erase_time;
+  statistics.write_time += since(start);
+}
+
+void
+FlashWriter::do_finish()
+{
+  if (update_handle != 0)
+    {
+      if (staging_size > 0)
+        {
+          write_flash(staging.get(), staging_size);
+          staging_size = 0;
+        }
+
+      esp_err_t err = esp_ota_end(update_handle);
+      update_handle = 0;
+      if (err != ESP_OK)
+        {
+          ESP_LOGE(tag, "Could not complete OTA, error 0x%x", err);
+          set_error(OTAErrc::InvalidImage);
+        }
+    }
+  decoder = nullptr;
+
+  complete_callback_t callback;
+  std::error_code ec;
+  {
+    loopp::core::ScopedLock l(mutex);
+    statistics.elapsed = since(start_time);
+    callback = std::move(complete_callback);
+    ec = error;
+  }
+
+  if (callback)
+    {
+      loop->invoke([callback, ec]() { callback(ec); });
+    }
+}
+
+// Abandons an unfinished update and tells the destructor that the task no
+// longer uses the writer. The task then waits for jobs that never come,
+// until the destructor deletes it.
+void
+FlashWriter::do_stop()
+{
+  if (update_handle != 0)
+    {
+      esp_ota_end(update_handle);
+      update_handle = 0;
+    }
+  stopped.give();
+}
+
+void
+FlashWriter::release_buffer(int buffer)
+{
+  free_buffers.push(buffer);
+
+  std::shared_ptr<bool> alive = this->alive;
+  loop->invoke([this, alive]() {
+    if (*alive)
+      {
+        on_buffer_released();
+      }
+  });
+}
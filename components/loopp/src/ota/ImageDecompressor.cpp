@@ -0,0 +1,194 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/ota/ImageDecompressor.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#include "esp_log.h"
+
+#include "loopp/compress/HeatshrinkEncoder.hpp"
+#include "loopp/ota/OTAErrors.hpp"
+
+static const char *tag = "OTA";
+
+using namespace loopp;
+using namespace loopp::ota;
+using loopp::utils::string_view;
+
+namespace
+{
+  const char HEATSHRINK_MAGIC[] = "LPHS";
+  const std::size_t HEATSHRINK_HEADER_SIZE = 12;
+
+  uint32_t get_le32(const uint8_t *p)
+  {
+    return p[0] | (p[1] << 8) | (p[2] << 16) | (static_cast<uint32_t>(p[3]) << 24);
+  }
+} // namespace
+
+ImageDecompressor::ImageDecompressor(output_callback_t output)
+  : output(std::move(output))
+{
+}
+
+bool
+ImageDecompressor::is_compressed(string_view data)
+{
+  return detect(data) != Format::Unknown;
+}
+
+ImageDecompressor::Format
+ImageDecompressor::detect(string_view data)
+{
+  if (data.size() < MAGIC_SIZE)
+    {
+      return Format::Unknown;
+    }
+
+  uint8_t b0 = static_cast<uint8_t>(data[0]);
+  uint8_t b1 = static_cast<uint8_t>(data[1]);
+  if (b0 == 0x1f && b1 == 0x8b)
+    {
+      return Format::Gzip;
+    }
+  // Deflate with a 32 KiB window. Firmware images start with 0xe9.
+  if (b0 == 0x78 && ((b0 << 8) | b1) % 31 == 0)
+    {
+      return Format::Zlib;
+    }
+  if (memcmp(data.data(), HEATSHRINK_MAGIC, MAGIC_SIZE) == 0)
+    {
+      return Format::Heatshrink;
+    }
+  return Format::Unknown;
+}
+
+bool
+ImageDecompressor::done() const
+{
+  if (inflater)
+    {
+      return inflater->done();
+    }
+  if (heatshrink)
+    {
+      return heatshrink->get_output_size() == image_size;
+    }
+  return false;
+}
+
+std::error_code
+ImageDecompressor::decompress(string_view data)
+{
+  if (!error && format == Format::Unknown)
+    {
+      std::size_t n = std::min(MAGIC_SIZE - header.size(), data.size());
+      header.append(data.data(), n);
+      data.remove_prefix(n);
+      if (header.size() < MAGIC_SIZE)
+        {
+          return error;
+        }
+
+      format = detect(header);
+      switch (format)
+        {
+        case Format::Gzip:
+          inflater.reset(new loopp::http::Inflater(loopp::http::Inflater::Format::Gzip));
+          break;
+        case Format::Zlib:
+          inflater.reset(new loopp::http::Inflater(loopp::http::Inflater::Format::Deflate));
+          break;
+        case Format::Heatshrink:
+          break;
+        case Format::Unknown:
+          error = OTAErrc::InvalidImage;
+          return error;
+        }
+
+      // The bytes used for detection are part of the stream.
+      std::string prefix;
+      prefix.swap(header);
+      if (decompress(prefix))
+        {
+          return error;
+        }
+    }
+
+  if (!error && format == Format::Heatshrink && !heatshrink)
+    {
+      error = parse_heatshrink_header(data);
+    }
+
+  if (error || data.empty())
+    {
+      return error;
+    }
+
+  if (inflater)
+    {
+      // Data after the end of the stream, such as the gzip trailer, is ignored.
+      if (!inflater->done() && inflater->inflate(data, output))
+        {
+          ESP_LOGE(tag, "Corrupt compressed image");
+          error = OTAErrc::InvalidImage;
+        }
+    }
+  else if (heatshrink)
+    {
+      if (!heatshrink->decode(data, output) || heatshrink->get_output_size() > image_size)
+        {
+          ESP_LOGE(tag, "Corrupt compressed image");
+          error = OTAErrc::InvalidImage;
+        }
+    }
+
+  return error;
+}
+
+std::error_code
+ImageDecompressor::parse_heatshrink_header(string_view &data)
+{
+  std::size_t n = std::min(HEATSHRINK_HEADER_SIZE - header.size(), data.size());
+  header.append(data.data(), n);
+  data.remove_prefix(n);
+
+  if (header.size() < HEATSHRINK_HEADER_SIZE)
+    {
+      return std::error_code();
+    }
+
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(header.data());
+  int window_bits = p[4];
+  int lookahead_bits = p[5];
+  image_size = get_le32(p + 8);
+
+  if (!loopp::compress::HeatshrinkEncoder::is_valid(window_bits, lookahead_bits))
+    {
+      ESP_LOGE(tag, "Unsupported heatshrink parameters w%d l%d", window_bits, lookahead_bits);
+      return OTAErrc::InvalidImage;
+    }
+
+  ESP_LOGI(tag, "Decompressing heatshrink image of %d bytes", static_cast<int>(image_size));
+  heatshrink.reset(new loopp::compress::HeatshrinkDecoder(window_bits, lookahead_bits));
+  return std::error_code();
+}
@@ -20,6 +20,7 @@
 
 #include "loopp/ota/OTA.hpp"
 
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 
@@ -27,11 +28,36 @@
 
 #include "esp_log.h"
 #include "esp_heap_caps.h"
+#include "mbedtls/pk.h"
 
+#include "loopp/http/ResponseParser.hpp"
+#include "loopp/ota/DeltaPatcher.hpp"
+#include "loopp/ota/ImageDecompressor.hpp"
 #include "loopp/ota/OTAErrors.hpp"
 
 static const char *tag = "OTA";
 
+namespace
+{
+  // Number of consecutive attempts to resume a download without receiving any data.
+  const int MAX_RESUME_ATTEMPTS = 6;
+
+  bool hex_decode(const std::string &hex, std::string &data)
+  {
+    if (hex.size() % 2 != 0 || hex.find_first_not_of("0123456789abcdefABCDEF") != std::string::npos)
+      {
+        return false;
+      }
+
+    data.clear();
+    for (std::size_t i = 0; i < hex.size(); i += 2)
+      {
+        data += static_cast<char>(std::stoi(hex.substr(i, 2), nullptr, 16));
+      }
+    return true;
+  }
+} // namespace
+
 using namespace loopp;
 using namespace loopp::ota;
 
@@ -42,6 +68,8 @@ OTA::OTA(std::shared_ptr<loopp::core::MainLoop> loop)
   check();
 }
 
+OTA::~OTA() = default;
+
 void
 OTA::set_client_certificate(const char *cert, const char *key)
 {
@@ -54,6 +82,43 @@ OTA::set_ca_certificate(const char *cert)
   client->set_ca_certificate(cert);
 }
 
+void
+OTA::set_write_buffers(std::size_t count, std::size_t size)
+{
+  buffer_count = count;
+  buffer_size = size;
+}
+
+void
+OTA::set_erase_up_front(bool erase_up_front)
+{
+  this->erase_up_front = erase_up_front;
+}
+
+void
+OTA::set_expected_sha256(const std::string &digest)
+{
+  if (digest.size() != 64 || !hex_decode(digest, expected_sha256))
+    {
+      throw std::system_error(OTAErrc::InternalError, "invalid SHA-256 digest");
+    }
+}
+
+void
+OTA::set_signing_key(const char *key)
+{
+  signing_key = key;
+}
+
+void
+OTA::set_signature(const std::string &signature)
+{
+  if (signature.empty() || !hex_decode(signature, this->signature))
+    {
+      throw std::system_error(OTAErrc::InternalError, "invalid signature");
+    }
+}
+
 void
 OTA::check()
 {
@@ -73,101 +138,528 @@ OTA::upgrade_async(const std::string &url, std::chrono::seconds timeout_duration
   try
     {
       this->callback = callback;
+      this->url = url;
+      start_timer(timeout_duration);
+      begin(OTA_SIZE_UNKNOWN);
+      reset_checkpoint();
+      request_firmware();
+    }
+  catch (const std::system_error &ex)
+    {
+      ESP_LOGD(tag, "upgrade_async exception %d %s", ex.code().value(), ex.what());
+      callback(ex.code());
+    }
+}
 
-      if (timeout_duration != std::chrono::seconds(0))
+void
+OTA::reset_checkpoint()
+{
+  checkpoint.offset = 0;
+  checkpoint.total = 0;
+  checkpoint.etag.clear();
+  checkpoint.resumable = true;
+}
+
+void
+OTA::request_firmware()
+{
+  loopp::http::Request request("GET", url);
+  if (checkpoint.offset > 0 && !checkpoint.resumable)
+    {
+      ESP_LOGI(tag, "Downloading encoded image again from the start");
+    }
+  else if (checkpoint.offset > 0)
+    {
+      ESP_LOGI(tag, "Resuming download at %d of %d bytes", static_cast<int>(checkpoint.offset), static_cast<int>(checkpoint.total));
+      request.headers().set("Range", "bytes=" + std::to_string(checkpoint.offset) + "-");
+      if (!checkpoint.etag.empty())
         {
-          timeout_timer = loop->add_timer(std::chrono::seconds(timeout_duration), []() { esp_restart(); });
+          // Makes the server send the complete image if it has changed.
+          request.headers().set("If-Range", checkpoint.etag);
         }
+    }
+
+  client->execute(request, std::bind(&OTA::on_http_response, this, std::placeholders::_1, std::placeholders::_2));
+}
+
+void
+OTA::on_http_response(std::error_code ec, const loopp::http::Response &response)
+{
+  if (ec)
+    {
+      ESP_LOGE(tag, "Failed to request firmware");
+      resume_download(ec);
+      return;
+    }
+
+  ESP_LOGI(tag, "Status %03d: %s", response.status_code(), response.status_message().c_str());
 
-      update_partition = esp_ota_get_next_update_partition(nullptr);
-      ESP_LOGI(tag,
-               "Writing to partition, type %d subtype %d at offset 0x%x",
-               update_partition->type,
-               update_partition->subtype,
-               update_partition->address);
+  try
+    {
+      std::string etag = response.headers().has("ETag") ? response.headers()["ETag"] : "";
 
-      uint32_t err = esp_ota_begin(update_partition, OTA_SIZE_UNKNOWN, &update_handle);
-      if (err != ESP_OK)
+      // Range requests count bytes of the encoded body, while the checkpoint
+      // counts decoded bytes, so an encoded image cannot be resumed.
+      std::string encoding = response.headers().has("Content-Encoding") ? response.headers()["Content-Encoding"] : "";
+      bool encoded = !encoding.empty() && !loopp::http::ResponseParser::iequals(encoding, "identity");
+
+      if (response.status_code() == 206 && checkpoint.offset > 0)
+        {
+          std::size_t first = 0;
+          std::size_t total = 0;
+          if (!response.headers().has("Content-Range") || !parse_content_range(response.headers()["Content-Range"], first, total)
+              || first != checkpoint.offset || (checkpoint.total != 0 && total != checkpoint.total)
+              || (!checkpoint.etag.empty() && !etag.empty() && etag != checkpoint.etag) || encoded)
+            {
+              // Do not mix parts of different images.
+              ESP_LOGW(tag, "Range response does not match the partial image, restarting download");
+              begin(OTA_SIZE_UNKNOWN);
+              reset_checkpoint();
+              resume_download(OTAErrc::InternalError);
+              return;
+            }
+        }
+      else if (response.status_code() == 200)
+        {
+          if (checkpoint.offset > 0)
+            {
+              ESP_LOGW(tag, "Server sent the complete image, restarting download");
+              begin(OTA_SIZE_UNKNOWN);
+              reset_checkpoint();
+            }
+          checkpoint.etag = etag;
+          checkpoint.resumable = !encoded;
+          // The length of an encoded body says nothing about the size of the image.
+          checkpoint.total = encoded ? 0 : client->get_body_length();
+        }
+      else
         {
-          throw std::system_error(OTAErrc::InternalError, (boost::format("Could not start OTA, error %1%") % err).str());
+          throw std::system_error(OTAErrc::InternalError, (boost::format("unexpected HTTP status %1%") % response.status_code()).str());
         }
 
-      loopp::http::Request request("GET", url);
-      auto self = shared_from_this();
-      client->execute(request, std::bind(&OTA::on_http_response, this, std::placeholders::_1, std::placeholders::_2));
+      ESP_LOGI(tag, "Retrieving firmware");
+      retrieve_body();
     }
   catch (const std::system_error &ex)
     {
-      ESP_LOGD(tag, "upgrade_async exception %d %s", ex.code().value(), ex.what());
+      ESP_LOGE(tag, "upgrade_async exception %d %s", ex.code().value(), ex.what());
       callback(ex.code());
     }
 }
 
 void
-OTA::on_http_response(std::error_code ec, const loopp::http::Response &response)
+OTA::retrieve_body()
+{
+  progress = -1;
+  write_failed = false;
+
+  auto self = shared_from_this();
+  client->stream_body_async(
+    [this, self](loopp::utils::string_view data) {
+      try
+        {
+          write_body(data);
+        }
+      catch (const std::system_error &)
+        {
+          write_failed = true;
+          throw;
+        }
+
+      checkpoint.offset += data.size();
+      resume_attempts = 0;
+
+      if (checkpoint.total > 0 && (100 * checkpoint.offset) / checkpoint.total != static_cast<std::size_t>(progress))
+        {
+          progress = (100 * checkpoint.offset) / checkpoint.total;
+          ESP_LOGI(tag, "Progress: %d%%", progress);
+        }
+
+      // Stop receiving until the flash writer has caught up.
+      if (writer->full())
+        {
+          client->pause_body();
+          writer->notify_available([this, self]() { client->resume_body(); });
+        }
+    },
+    loopp::core::bind_loop(loop, [this, self](std::error_code ec) {
+      if (ec && write_failed)
+        {
+          ESP_LOGE(tag, "upgrade_async exception %d %s", ec.value(), ec.message().c_str());
+          callback(ec);
+        }
+      else if (ec || (checkpoint.total != 0 && checkpoint.offset < checkpoint.total))
+        {
+          resume_download(ec ? ec : OTAErrc::InternalError);
+        }
+      else
+        {
+          complete_download();
+        }
+    }));
+}
+
+void
+OTA::complete_download()
+{
+  auto self = shared_from_this();
+  finish([this, self](std::error_code ec) {
+    if (!ec)
+      {
+        ESP_LOGD(tag, "OTA ready");
+      }
+    callback(ec);
+  });
+}
+
+// Retries the download after a failure, continuing where the previous attempt stopped.
+void
+OTA::resume_download(std::error_code ec)
+{
+  if (resume_attempts >= MAX_RESUME_ATTEMPTS)
+    {
+      ESP_LOGE(tag, "Download failed: %s", ec.message().c_str());
+      callback(ec);
+      return;
+    }
+
+  resume_attempts++;
+  std::chrono::seconds delay(1 << resume_attempts);
+  ESP_LOGW(tag, "Download interrupted (%s), retrying in %d s", ec.message().c_str(), static_cast<int>(delay.count()));
+
+  auto self = shared_from_this();
+  loop->add_timer(delay, [this, self]() { request_firmware(); });
+}
+
+// Parses "bytes <first>-<last>/<total>". A total of "*" is returned as 0.
+bool
+OTA::parse_content_range(const std::string &content_range, std::size_t &first, std::size_t &total)
 {
-  if (!ec)
+  unsigned long first_value = 0;
+  unsigned long last_value = 0;
+  unsigned long total_value = 0;
+  if (sscanf(content_range.c_str(), "bytes %lu-%lu/%lu", &first_value, &last_value, &total_value) == 3)
+    {
+      first = first_value;
+      total = total_value;
+      return true;
+    }
+  if (sscanf(content_range.c_str(), "bytes %lu-%lu/*", &first_value, &last_value) == 2)
     {
-      ESP_LOGI(tag, "Status %03d: %s", response.status_code(), response.status_message().c_str());
-      if (response.status_code() != 200)
+      first = first_value;
+      total = 0;
+      return true;
+    }
+  return false;
+}
+
+void
+OTA::upgrade_async(std::shared_ptr<loopp::mqtt::MqttClient> mqtt,
+                   const std::string &topic,
+                   std::chrono::seconds timeout_duration,
+                   const ota_result_callback_t &callback)
+{
+  this->callback = callback;
+  this->mqtt = mqtt;
+  this->topic = topic;
+  start_timer(timeout_duration);
+
+  // The image is written to flash as it arrives, so that it never has to fit in memory.
+  auto self = shared_from_this();
+  mqtt->add_stream_filter(topic,
+                          [this, self](std::error_code ec,
+                                       loopp::utils::string_view,
+                                       loopp::utils::string_view chunk,
+                                       std::size_t offset,
+                                       std::size_t total) { on_mqtt_chunk(ec, chunk, offset, total); });
+  mqtt->subscribe(topic);
+  ESP_LOGI(tag, "Waiting for firmware on %s", topic.c_str());
+}
+
+void
+OTA::on_mqtt_chunk(std::error_code ec, loopp::utils::string_view chunk, std::size_t offset, std::size_t total)
+{
+  try
+    {
+      if (ec)
+        {
+          throw std::system_error(ec, "failed to receive firmware");
+        }
+
+      if (offset == 0)
+        {
+          begin(total);
+          progress = -1;
+        }
+      write_body(chunk);
+
+      // Stop receiving until the flash writer has caught up.
+      if (writer->full())
+        {
+          auto self = shared_from_this();
+          mqtt->pause_stream();
+          writer->notify_available([this, self]() { mqtt->resume_stream(); });
+        }
+
+      std::size_t done = offset + chunk.size();
+      if (done < total)
         {
-          this->callback(OTAErrc::InternalError);
+          if (static_cast<int>((100 * done) / total) != progress)
+            {
+              progress = static_cast<int>((100 * done) / total);
+              ESP_LOGI(tag, "Progress: %d%%", progress);
+            }
         }
       else
         {
-          ESP_LOGI(tag, "Retrieving firmware");
-          retrieve_body();
+          auto self = shared_from_this();
+          finish([this, self](std::error_code ec) {
+            if (!ec)
+              {
+                ESP_LOGD(tag, "OTA ready");
+              }
+            complete_mqtt(ec);
+          });
         }
     }
-  else
+  catch (const std::system_error &ex)
     {
-      ESP_LOGE(tag, "Failed to request firmware");
-      this->callback(ec);
+      ESP_LOGE(tag, "upgrade_async exception %d %s", ex.code().value(), ex.what());
+      complete_mqtt(ex.code());
     }
 }
 
 void
-OTA::retrieve_body()
+OTA::complete_mqtt(std::error_code ec)
 {
+  // Removing the filter releases the reference the filter holds to this object.
   auto self = shared_from_this();
-  client->read_body_async(2048, loopp::core::bind_loop(loop, [this, self](std::error_code ec, loopp::net::StreamBuffer *buffer) {
-                            try
-                              {
-                                if (ec)
-                                  {
-                                    throw std::system_error(ec, "failed to read body");
-                                  }
-
-                                if (buffer->consume_size() > 0)
-                                  {
-                                    esp_err_t err = esp_ota_write(update_handle, buffer->consume_data(), buffer->consume_size());
-                                    if (err != ESP_OK)
-                                      {
-                                        throw std::system_error(OTAErrc::InternalError,
-                                                                (boost::format("Could not write OTA, error %1%") % err).str());
-                                      }
-
-                                    buffer->consume_commit(buffer->consume_size());
-
-                                    std::size_t total = client->get_body_length();
-                                    std::size_t left = client->get_body_length_left();
-                                    int done = (100 * (total - left)) / total;
-                                    ESP_LOGI(tag, "Progress: %d%%", done);
-
-                                    retrieve_body();
-                                  }
-                                else
-                                  {
-                                    ESP_LOGD(tag, "OTA ready");
-                                    callback(std::error_code());
-                                  }
-                              }
-                            catch (const std::system_error &ex)
-                              {
-                                ESP_LOGE(tag, "upgrade_async exception %d %s", ex.code().value(), ex.what());
-                                callback(ex.code());
-                              }
-                          }));
+  mqtt->remove_stream_filter(topic);
+  if (mqtt->connected().get())
+    {
+      mqtt->unsubscribe(topic);
+    }
+  callback(ec);
+}
+
+void
+OTA::start_timer(std::chrono::seconds timeout_duration)
+{
+  if (timeout_duration != std::chrono::seconds(0))
+    {
+      timeout_timer = loop->add_timer(std::chrono::seconds(timeout_duration), []() { esp_restart(); });
+    }
+}
+
+void
+OTA::begin(std::size_t image_size)
+{
+  update_partition = esp_ota_get_next_update_partition(nullptr);
+  if (update_partition == nullptr)
+    {
+      throw std::system_error(OTAErrc::InternalError, "no OTA partition");
+    }
+  if (image_size != OTA_SIZE_UNKNOWN && image_size > update_partition->size)
+    {
+      throw std::system_error(OTAErrc::ImageTooLarge, (boost::format("Image of %1% bytes does not fit in partition") % image_size).str());
+    }
+
+  ESP_LOGI(tag,
+           "Writing to partition, type %d subtype %d at offset 0x%x",
+           update_partition->type,
+           update_partition->subtype,
+           update_partition->address);
+
+  if (!writer)
+    {
+      writer = std::make_shared<FlashWriter>(loop, buffer_count, buffer_size);
+    }
+  // The decoder starts over with the image. It runs on the writer task, so
+  // that data expanded by decompression or patching does not hold up the main loop.
+  std::shared_ptr<ImageDecoder> image_decoder = std::make_shared<ImageDecoder>();
+  decoder = image_decoder;
+  writer->begin(update_partition,
+                image_size,
+                erase_up_front,
+                [image_decoder](loopp::utils::string_view data, const FlashWriter::output_callback_t &output) {
+                  return image_decoder->decode(data, output);
+                });
+}
+
+void
+OTA::write_body(loopp::utils::string_view data)
+{
+  writer->write(data.data(), data.size());
+}
+
+OTA::ImageDecoder::ImageDecoder()
+{
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts_ret(&sha, 0);
+}
+
+OTA::ImageDecoder::~ImageDecoder()
+{
+  mbedtls_sha256_free(&sha);
+}
+
+// Passes received data on to output, reconstructing the image first if the
+// data is a delta patch or decompressing it if it is a compressed image.
+std::error_code
+OTA::ImageDecoder::decode(loopp::utils::string_view data, const FlashWriter::output_callback_t &output)
+{
+  this->output = &output;
+
+  if (!detected)
+    {
+      prefix.append(data.data(), data.size());
+      if (prefix.size() < DeltaPatcher::MAGIC_SIZE)
+        {
+          return std::error_code();
+        }
+
+      detected = true;
+      if (DeltaPatcher::is_patch(prefix))
+        {
+          ESP_LOGI(tag, "Received delta patch");
+          patcher.reset(new DeltaPatcher(esp_ota_get_running_partition(),
+                                         [this](loopp::utils::string_view image_data) { write_image(image_data); }));
+        }
+      else if (ImageDecompressor::is_compressed(prefix))
+        {
+          ESP_LOGI(tag, "Received compressed image");
+          decompressor.reset(new ImageDecompressor([this](loopp::utils::string_view image_data) { write_image(image_data); }));
+        }
+
+      std::string body;
+      body.swap(prefix);
+      return decode(body, output);
+    }
+
+  if (patcher)
+    {
+      return patcher->apply(data);
+    }
+  else if (decompressor)
+    {
+      return decompressor->decompress(data);
+    }
+
+  write_image(data);
+  return std::error_code();
+}
+
+void
+OTA::ImageDecoder::write_image(loopp::utils::string_view data)
+{
+  mbedtls_sha256_update_ret(&sha, reinterpret_cast<const unsigned char *>(data.data()), data.size());
+  (*output)(data);
+}
+
+// Checks the image against the digest in the patch, the one passed to
+// set_expected_sha256 and the signature. The digest was computed while the
+// image was written, so flash is not read back. Called after the writer
+// has finished, as the decoder runs on the writer task.
+std::error_code
+OTA::verify_image()
+{
+  image_verified = false;
+
+  unsigned char digest[32];
+  mbedtls_sha256_finish_ret(&decoder->sha, digest);
+  std::string image_digest(reinterpret_cast<char *>(digest), sizeof(digest));
+
+  std::ostringstream hex;
+  for (unsigned char c : digest)
+    {
+      hex << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(c);
+    }
+  ESP_LOGI(tag, "Image SHA-256: %s", hex.str().c_str());
+
+  if (!decoder->detected)
+    {
+      ESP_LOGE(tag, "Image too small");
+      return OTAErrc::InvalidImage;
+    }
+  if (decoder->patcher && (!decoder->patcher->done() || decoder->patcher->get_target_digest() != image_digest))
+    {
+      ESP_LOGE(tag, "Patched image does not match the target image");
+      return OTAErrc::InvalidPatch;
+    }
+  if (decoder->decompressor && !decoder->decompressor->done())
+    {
+      ESP_LOGE(tag, "Compressed image is incomplete");
+      return OTAErrc::InvalidImage;
+    }
+  if (!expected_sha256.empty() && expected_sha256 != image_digest)
+    {
+      ESP_LOGE(tag, "SHA-256 digest of the image does not match");
+      return OTAErrc::InvalidImage;
+    }
+  if (signing_key != nullptr)
+    {
+      return verify_signature(digest);
+    }
+  return std::error_code();
+}
+
+// Verifies the signature of the image digest with the signing key. Once a
+// signing key is set, unsigned images are rejected.
+std::error_code
+OTA::verify_signature(const unsigned char *digest)
+{
+  if (signature.empty())
+    {
+      ESP_LOGE(tag, "Image is not signed");
+      return OTAErrc::InvalidSignature;
+    }
+
+  mbedtls_pk_context key;
+  mbedtls_pk_init(&key);
+  int ret = mbedtls_pk_parse_public_key(&key, reinterpret_cast<const unsigned char *>(signing_key), strlen(signing_key) + 1);
+  if (ret == 0)
+    {
+      ret = mbedtls_pk_verify(&key,
+                              MBEDTLS_MD_SHA256,
+                              digest,
+                              32,
+                              reinterpret_cast<const unsigned char *>(signature.data()),
+                              signature.size());
+    }
+  mbedtls_pk_free(&key);
+
+  if (ret != 0)
+    {
+      ESP_LOGE(tag, "Signature verification failed, error -0x%x", -ret);
+      return OTAErrc::InvalidSignature;
+    }
+
+  ESP_LOGI(tag, "Signature verified");
+  return std::error_code();
+}
+
+void
+OTA::finish(const ota_result_callback_t &finish_callback)
+{
+  auto self = shared_from_this();
+  writer->finish([this, self, finish_callback](std::error_code ec) {
+    FlashWriter::Statistics stats = writer->get_statistics();
+    int elapsed = static_cast<int>(stats.elapsed.count());
+    ESP_LOGI(tag,
+             "Wrote %d bytes in %d ms (%d KiB/s), flash erase %d ms, write %d ms, receive stalled %d ms",
+             static_cast<int>(stats.bytes),
+             elapsed,
+             elapsed > 0 ? static_cast<int>((stats.bytes * 1000 / 1024) / elapsed) : 0,
+             static_cast<int>(stats.erase_time.count()),
+             static_cast<int>(stats.write_time.count()),
+             static_cast<int>(stats.stall_time.count()));
+    if (!ec)
+      {
+        ec = verify_image();
+      }
+    image_verified = !ec;
+    finish_callback(ec);
+  });
 }
 
 void
@@ -178,6 +670,12 @@ OTA::commit()
       loop->cancel_timer(timeout_timer);
     }
 
+  if (!image_verified)
+    {
+      ESP_LOGE(tag, "Image was not verified, keeping the current firmware");
+      esp_restart();
+    }
+
   esp_err_t err = esp_ota_set_boot_partition(update_partition);
   if (err != ESP_OK)
     {
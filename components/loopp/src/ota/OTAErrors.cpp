@@ -43,6 +43,16 @@ namespace
           return "internal error";
         case loopp::ota::OTAErrc::InvalidURI:
           return "invalid URI";
+        case loopp::ota::OTAErrc::ImageTooLarge:
+          return "image too large";
+        case loopp::ota::OTAErrc::InvalidImage:
+          return "invalid image";
+        case loopp::ota::OTAErrc::FlashError:
+          return "flash write failed";
+        case loopp::ota::OTAErrc::InvalidPatch:
+          return "invalid delta patch";
+        case loopp::ota::OTAErrc::InvalidSignature:
+          return "invalid signature";
         default:
           return "(unrecognized error)";
       }
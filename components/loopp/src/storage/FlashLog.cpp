@@ -0,0 +1,454 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/storage/FlashLog.hpp"
+
+#include <algorithm>
+
+#include "boost/format.hpp"
+
+#include "esp_log.h"
+#include "rom/crc.h"
+
+#include "loopp/storage/StorageErrors.hpp"
+
+static const char *tag = "FLASHLOG";
+
+using namespace loopp;
+using namespace loopp::storage;
+
+FlashLog::FlashLog(const std::string &partition_label)
+{
+  partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, partition_label.c_str());
+  if (partition == nullptr)
+    {
+      throw std::system_error(StorageErrc::PartitionNotFound, "no partition named " + partition_label);
+    }
+
+  num_sectors = partition->size / sector_size;
+  if (num_sectors < 2)
+    {
+      throw std::system_error(StorageErrc::PartitionNotFound, "partition " + partition_label + " is too small");
+    }
+
+  mount();
+}
+
+void
+FlashLog::mount()
+{
+  sectors.resize(num_sectors);
+
+  bool found = false;
+  std::uint32_t oldest_sequence = 0;
+
+  for (std::size_t sector = 0; sector < num_sectors; sector++)
+    {
+      SectorHeader header;
+      read(sector * sector_size, &header, sizeof(header));
+
+      if (header.magic == sector_magic)
+        {
+          SectorInfo &info = sectors[sector];
+          info.valid = true;
+          info.sequence = header.sequence;
+          scan_sector(sector);
+
+          if (!found || header.sequence > sequence)
+            {
+              sequence = header.sequence;
+              write_sector = sector;
+            }
+          if (!found || header.sequence < oldest_sequence)
+            {
+              oldest_sequence = header.sequence;
+              read_sector = sector;
+            }
+          found = true;
+        }
+    }
+
+  if (!found)
+    {
+      write_sector = num_sectors - 1;
+      read_sector = 0;
+    }
+
+  // The tail of the newest sector may hold a partially written header, so
+  // appending always continues in a freshly erased sector.
+  write_sector_started = false;
+  read_offset = sizeof(SectorHeader);
+
+  ESP_LOGI(tag, "Mounted %s: %d sectors, %d pending records", partition->label, num_sectors, pending_count);
+}
+
+void
+FlashLog::scan_sector(std::size_t sector)
+{
+  SectorInfo &info = sectors[sector];
+  std::size_t offset = sizeof(SectorHeader);
+  RecordHeader header;
+
+  while (read_header(sector, offset, header))
+    {
+      if (header.state != RecordState::Allocated)
+        {
+          if (info.first_timestamp == 0)
+            {
+              info.first_timestamp = header.timestamp;
+            }
+          info.last_timestamp = header.timestamp;
+        }
+
+      if (header.state == RecordState::Committed)
+        {
+          info.pending++;
+          pending_count++;
+        }
+
+      offset += record_size(header.length);
+    }
+}
+
+void
+FlashLog::append(std::uint32_t timestamp, const std::string &data)
+{
+  if (data.size() > max_record_size())
+    {
+      throw std::system_error(StorageErrc::RecordTooLarge, (boost::format("record of %1% bytes") % data.size()).str());
+    }
+
+  std::size_t size = record_size(data.size());
+  if (!write_sector_started || write_offset + size > sector_size)
+    {
+      start_sector((write_sector + 1) % num_sectors);
+    }
+
+  RecordHeader header;
+  header.state = RecordState::Empty;
+  header.reserved = 0xff;
+  header.length = static_cast<std::uint16_t>(data.size());
+  header.timestamp = timestamp;
+  header.crc = calculate_crc(header, data);
+
+  // The state byte is written separately once the rest of the header is in
+  // flash, so the length of an allocated record can always be trusted.
+  std::size_t address = write_sector * sector_size + write_offset;
+  write(address + 1, reinterpret_cast<const std::uint8_t *>(&header) + 1, sizeof(header) - 1);
+  write_state(write_sector, write_offset, RecordState::Allocated);
+  if (!data.empty())
+    {
+      write(address + sizeof(header), data.data(), data.size());
+    }
+  write_state(write_sector, write_offset, RecordState::Committed);
+
+  write_offset += size;
+
+  SectorInfo &info = sectors[write_sector];
+  if (info.first_timestamp == 0)
+    {
+      info.first_timestamp = timestamp;
+    }
+  info.last_timestamp = timestamp;
+  info.pending++;
+  pending_count++;
+  statistics.appended++;
+}
+
+bool
+FlashLog::peek(Record &record)
+{
+  std::size_t visited = 0;
+
+  while (pending_count > 0 && visited <= num_sectors)
+    {
+      SectorInfo &info = sectors[read_sector];
+      RecordHeader header;
+
+      if (info.pending > 0 && read_header(read_sector, read_offset, header))
+        {
+          if (header.state == RecordState::Committed)
+            {
+              if (read_record(read_sector, read_offset, header, record))
+                {
+                  return true;
+                }
+
+              ESP_LOGW(tag, "Warning: corrupt record in sector %d at %d", read_sector, read_offset);
+              write_state(read_sector, read_offset, RecordState::Consumed);
+              info.pending--;
+              pending_count--;
+              statistics.corrupt++;
+            }
+
+          read_offset += record_size(header.length);
+          continue;
+        }
+
+      // Records that could not be found were lost to a torn write.
+      pending_count -= info.pending;
+      info.pending = 0;
+
+      read_sector = (read_sector + 1) % num_sectors;
+      read_offset = sizeof(SectorHeader);
+      visited++;
+    }
+
+  pending_count = 0;
+  return false;
+}
+
+// Returns the first record after previous, which was returned by peek() or
+// peek_after(), without moving the read position. Corrupt records are
+// skipped; peek() discards them once they are at the read position.
+bool
+FlashLog::peek_after(const Record &previous, Record &record)
+{
+  std::uint32_t previous_sequence = static_cast<std::uint32_t>(previous.position >> 32);
+  std::size_t sector = 0;
+  while (sector < num_sectors && !(sectors[sector].valid && sectors[sector].sequence == previous_sequence))
+    {
+      sector++;
+    }
+  if (sector == num_sectors)
+    {
+      // The sector was reclaimed.
+      return false;
+    }
+
+  std::size_t offset = static_cast<std::size_t>(previous.position & 0xffffffff) + record_size(previous.data.size());
+
+  for (std::size_t visited = 0; visited < num_sectors; visited++)
+    {
+      RecordHeader header;
+      while (sectors[sector].pending > 0 && read_header(sector, offset, header))
+        {
+          if (header.state == RecordState::Committed && read_record(sector, offset, header, record))
+            {
+              return true;
+            }
+          offset += record_size(header.length);
+        }
+
+      // Sectors are written in turn, so the next sector holds newer records
+      // unless it has not been used since the log wrapped around.
+      std::size_t next = (sector + 1) % num_sectors;
+      if (!sectors[next].valid || sectors[next].sequence <= sectors[sector].sequence)
+        {
+          return false;
+        }
+      sector = next;
+      offset = sizeof(SectorHeader);
+    }
+
+  return false;
+}
+
+void
+FlashLog::consume(const Record &record)
+{
+  // The record may already be gone if its sector was reclaimed after peek().
+  RecordHeader header;
+  if (pending_count == 0 || record.position != read_position() || !read_header(read_sector, read_offset, header) ||
+      header.state != RecordState::Committed)
+    {
+      return;
+    }
+
+  write_state(read_sector, read_offset, RecordState::Consumed);
+  read_offset += record_size(header.length);
+
+  sectors[read_sector].pending--;
+  pending_count--;
+  statistics.consumed++;
+}
+
+void
+FlashLog::discard_before(std::uint32_t timestamp)
+{
+  for (std::size_t sector = 0; sector < num_sectors; sector++)
+    {
+      SectorInfo &info = sectors[sector];
+      bool writing = write_sector_started && sector == write_sector;
+
+      if (info.valid && !writing && info.pending > 0 && info.last_timestamp < timestamp)
+        {
+          drop_sector(sector);
+
+          esp_err_t err = esp_partition_erase_range(partition, sector * sector_size, sector_size);
+          if (err != ESP_OK)
+            {
+              throw std::system_error(StorageErrc::FlashError, (boost::format("failed to erase sector %1%: %2%") % sector % err).str());
+            }
+          statistics.erased_sectors++;
+        }
+    }
+}
+
+bool
+FlashLog::empty() const
+{
+  return pending_count == 0;
+}
+
+std::size_t
+FlashLog::size() const
+{
+  return pending_count;
+}
+
+std::size_t
+FlashLog::max_record_size() const
+{
+  return sector_size - sizeof(SectorHeader) - sizeof(RecordHeader);
+}
+
+const FlashLog::Statistics &
+FlashLog::get_statistics() const
+{
+  return statistics;
+}
+
+void
+FlashLog::start_sector(std::size_t sector)
+{
+  if (sectors[sector].valid)
+    {
+      drop_sector(sector);
+    }
+
+  esp_err_t err = esp_partition_erase_range(partition, sector * sector_size, sector_size);
+  if (err != ESP_OK)
+    {
+      throw std::system_error(StorageErrc::FlashError, (boost::format("failed to erase sector %1%: %2%") % sector % err).str());
+    }
+  statistics.erased_sectors++;
+
+  SectorHeader header;
+  header.magic = sector_magic;
+  header.sequence = ++sequence;
+  write(sector * sector_size, &header, sizeof(header));
+
+  SectorInfo &info = sectors[sector];
+  info.valid = true;
+  info.sequence = header.sequence;
+
+  write_sector = sector;
+  write_offset = sizeof(SectorHeader);
+  write_sector_started = true;
+}
+
+void
+FlashLog::drop_sector(std::size_t sector)
+{
+  SectorInfo &info = sectors[sector];
+  if (info.pending > 0)
+    {
+      ESP_LOGW(tag, "Warning: log full, dropping %d records", info.pending);
+      statistics.dropped += info.pending;
+      pending_count -= info.pending;
+    }
+  info = SectorInfo();
+
+  if (read_sector == sector)
+    {
+      read_sector = (sector + 1) % num_sectors;
+      read_offset = sizeof(SectorHeader);
+    }
+}
+
+bool
+FlashLog::read_header(std::size_t sector, std::size_t offset, RecordHeader &header)
+{
+  if (offset + sizeof(RecordHeader) > sector_size)
+    {
+      return false;
+    }
+
+  read(sector * sector_size + offset, &header, sizeof(header));
+
+  if (header.state != RecordState::Allocated && header.state != RecordState::Committed && header.state != RecordState::Consumed)
+    {
+      return false;
+    }
+
+  return offset + record_size(header.length) <= sector_size;
+}
+
+// Reads the data of a committed record. Returns false when it does not match its CRC.
+bool
+FlashLog::read_record(std::size_t sector, std::size_t offset, const RecordHeader &header, Record &record)
+{
+  record.timestamp = header.timestamp;
+  record.position = (static_cast<std::uint64_t>(sectors[sector].sequence) << 32) | offset;
+  record.data.resize(header.length);
+  if (header.length > 0)
+    {
+      read(sector * sector_size + offset + sizeof(header), &record.data[0], header.length);
+    }
+
+  return calculate_crc(header, record.data) == header.crc;
+}
+
+std::size_t
+FlashLog::record_size(std::size_t length) const
+{
+  return sizeof(RecordHeader) + ((length + 3) & ~3u);
+}
+
+std::uint64_t
+FlashLog::read_position() const
+{
+  return (static_cast<std::uint64_t>(sectors[read_sector].sequence) << 32) | read_offset;
+}
+
+void
+FlashLog::read(std::size_t address, void *data, std::size_t size)
+{
+  esp_err_t err = esp_partition_read(partition, address, data, size);
+  if (err != ESP_OK)
+    {
+      throw std::system_error(StorageErrc::FlashError, (boost::format("failed to read %1% bytes at %2%: %3%") % size % address % err).str());
+    }
+}
+
+void
+FlashLog::write(std::size_t address, const void *data, std::size_t size)
+{
+  esp_err_t err = esp_partition_write(partition, address, data, size);
+  if (err != ESP_OK)
+    {
+      throw std::system_error(StorageErrc::FlashError, (boost::format("failed to write %1% bytes at %2%: %3%") % size % address % err).str());
+    }
+}
+
+void
+FlashLog::write_state(std::size_t sector, std::size_t offset, RecordState state)
+{
+  write(sector * sector_size + offset, &state, sizeof(state));
+}
+
+std::uint32_t
+FlashLog::calculate_crc(const RecordHeader &header, const std::string &data) const
+{
+  std::uint32_t crc = crc32_le(0, reinterpret_cast<const std::uint8_t *>(&header.length), sizeof(header.length));
+  crc = crc32_le(crc, reinterpret_cast<const std::uint8_t *>(&header.timestamp), sizeof(header.timestamp));
+  return crc32_le(crc, reinterpret_cast<const std::uint8_t *>(data.data()), data.size());
+}
@@ -0,0 +1,63 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/storage/StorageErrors.hpp"
+
+namespace
+{
+  struct StorageErrCategory : std::error_category
+  {
+    const char *name() const noexcept override;
+    std::string message(int ev) const override;
+  };
+
+  const char *StorageErrCategory::name() const noexcept
+  {
+    return "storage";
+  }
+
+  std::string StorageErrCategory::message(int ev) const
+  {
+    switch (static_cast<loopp::storage::StorageErrc>(ev))
+      {
+        case loopp::storage::StorageErrc::PartitionNotFound:
+          return "partition not found";
+        case loopp::storage::StorageErrc::FlashError:
+          return "flash error";
+        case loopp::storage::StorageErrc::RecordTooLarge:
+          return "record too large";
+        default:
+          return "(unrecognized error)";
+      }
+  }
+
+  const StorageErrCategory theStorageErrCategory{};
+} // namespace
+
+namespace loopp
+{
+  namespace storage
+  {
+    std::error_code make_error_code(StorageErrc ec)
+    {
+      return { static_cast<int>(ec), theStorageErrCategory };
+    }
+  } // namespace storage
+} // namespace loopp
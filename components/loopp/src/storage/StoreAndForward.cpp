@@ -0,0 +1,356 @@
+// Copyright (C) 2018 Rob Caelers <rob.caelers@gmail.com>
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+#include "loopp/storage/StoreAndForward.hpp"
+
+#include <algorithm>
+#include <ctime>
+
+#include "boost/format.hpp"
+
+#include "esp_log.h"
+
+#include "loopp/storage/StorageErrors.hpp"
+
+static const char *tag = "STORE-AND-FORWARD";
+
+using namespace loopp;
+using namespace loopp::storage;
+
+// Stored record: options | topic length | topic [| fragment index] | payload.
+// The upper bits of the options byte mark records that hold a part of a message.
+namespace
+{
+  const std::uint8_t RECORD_FRAGMENT = 0x40;
+  const std::uint8_t RECORD_LAST_FRAGMENT = 0x80;
+  const std::size_t MAX_FRAGMENTS = 256;
+} // namespace
+
+StoreAndForward::StoreAndForward(std::shared_ptr<loopp::core::MainLoop> loop,
+                                 std::shared_ptr<loopp::mqtt::MqttClient> mqtt,
+                                 std::shared_ptr<FlashLog> log)
+  : loop(std::move(loop))
+  , mqtt(std::move(mqtt))
+  , log(std::move(log))
+{
+}
+
+StoreAndForward::~StoreAndForward()
+{
+  stop();
+}
+
+void
+StoreAndForward::set_replay_rate(std::size_t messages_per_second)
+{
+  replay_interval = std::chrono::milliseconds(1000 / std::max<std::size_t>(1, std::min<std::size_t>(messages_per_second, 1000)));
+}
+
+void
+StoreAndForward::set_max_age(std::chrono::seconds max_age)
+{
+  this->max_age = max_age;
+}
+
+void
+StoreAndForward::start()
+{
+  if (replay_timer == 0)
+    {
+      ESP_LOGI(tag, "%d stored messages", log->size());
+      auto self = shared_from_this();
+      replay_timer = loop->add_periodic_timer(replay_interval, [this, self]() { on_replay_timer(); });
+    }
+}
+
+void
+StoreAndForward::stop()
+{
+  if (replay_timer != 0)
+    {
+      loop->cancel_timer(replay_timer);
+      replay_timer = 0;
+    }
+}
+
+void
+StoreAndForward::publish(const std::string &topic,
+                         const std::string &payload,
+                         loopp::mqtt::PublishOptions options,
+                         const loopp::mqtt::PublishProperties &properties)
+{
+  if (mqtt->connected().get() && !mqtt->is_backpressured())
+    {
+      try
+        {
+          // Messages that do not make it to the broker are stored after all.
+          auto self = shared_from_this();
+          mqtt->publish(
+            topic,
+            payload,
+            options,
+            [this, self, topic, payload, options](std::error_code ec) {
+              if (ec)
+                {
+                  store(topic, payload, options);
+                }
+            },
+            properties);
+          return;
+        }
+      catch (std::system_error &e)
+        {
+          ESP_LOGW(tag, "Warning: failed to publish to %s: %s", topic.c_str(), e.what());
+        }
+    }
+
+  store(topic, payload, options);
+}
+
+std::size_t
+StoreAndForward::max_record_payload_size(const std::string &topic) const
+{
+  std::size_t header_size = 2 + topic.size();
+  return header_size < log->max_record_size() ? log->max_record_size() - header_size : 0;
+}
+
+const StoreAndForward::Statistics &
+StoreAndForward::get_statistics() const
+{
+  return statistics;
+}
+
+void
+StoreAndForward::store(const std::string &topic, const std::string &payload, loopp::mqtt::PublishOptions options)
+{
+  try
+    {
+      if (topic.size() > 255)
+        {
+          throw std::system_error(StorageErrc::RecordTooLarge, "topic too long");
+        }
+
+      std::uint32_t timestamp = static_cast<std::uint32_t>(std::time(nullptr));
+      std::size_t header_size = 2 + topic.size();
+      if (header_size + 1 >= log->max_record_size())
+        {
+          throw std::system_error(StorageErrc::RecordTooLarge, "topic too long");
+        }
+
+      std::string data;
+      if (header_size + payload.size() <= log->max_record_size())
+        {
+          data.reserve(header_size + payload.size());
+          data.push_back(static_cast<char>(options));
+          data.push_back(static_cast<char>(topic.size()));
+          data.append(topic);
+          data.append(payload);
+          log->append(timestamp, data);
+        }
+      else
+        {
+          std::size_t capacity = log->max_record_size() - header_size - 1;
+          std::size_t count = (payload.size() + capacity - 1) / capacity;
+          if (count > MAX_FRAGMENTS)
+            {
+              throw std::system_error(StorageErrc::RecordTooLarge, (boost::format("message of %1% bytes") % payload.size()).str());
+            }
+
+          for (std::size_t i = 0; i < count; i++)
+            {
+              std::uint8_t flags = RECORD_FRAGMENT | (i + 1 == count ? RECORD_LAST_FRAGMENT : 0);
+              data.clear();
+              data.push_back(static_cast<char>(static_cast<std::uint8_t>(options) | flags));
+              data.push_back(static_cast<char>(topic.size()));
+              data.append(topic);
+              data.push_back(static_cast<char>(i));
+              data.append(payload, i * capacity, capacity);
+              log->append(timestamp, data);
+            }
+        }
+      statistics.stored++;
+    }
+  catch (std::system_error &e)
+    {
+      ESP_LOGE(tag, "Error: failed to store message for %s: %s", topic.c_str(), e.what());
+      statistics.rejected++;
+    }
+}
+
+void
+StoreAndForward::on_replay_timer()
+{
+  try
+    {
+      if (max_age.count() > 0)
+        {
+          std::time_t now = std::time(nullptr);
+          if (now > max_age.count())
+            {
+              log->discard_before(static_cast<std::uint32_t>(now - max_age.count()));
+            }
+        }
+
+      if (replaying || !mqtt->connected().get() || mqtt->is_backpressured())
+        {
+          return;
+        }
+
+      FlashLog::Record record;
+      if (log->empty() || !log->peek(record))
+        {
+          return;
+        }
+
+      std::size_t topic_length = record.data.size() >= 2 ? static_cast<std::uint8_t>(record.data[1]) : 0;
+      if (topic_length == 0 || record.data.size() < 2 + topic_length)
+        {
+          ESP_LOGW(tag, "Warning: discarding invalid stored message");
+          log->consume(record);
+          return;
+        }
+
+      std::uint8_t flags = static_cast<std::uint8_t>(record.data[0]);
+      std::string topic = record.data.substr(2, topic_length);
+      if (flags & RECORD_FRAGMENT)
+        {
+          read_fragments(record, topic, flags, 2 + topic_length);
+          return;
+        }
+
+      StoredMessage message;
+      message.topic = topic;
+      message.payload = record.data.substr(2 + topic_length);
+      message.options = static_cast<loopp::mqtt::PublishOptions>(flags);
+      message.timestamp = record.timestamp;
+      replay(message, std::vector<FlashLog::Record>{ record });
+    }
+  catch (std::system_error &e)
+    {
+      replaying = false;
+      ESP_LOGE(tag, "Error: failed to replay stored message: %s", e.what());
+    }
+}
+
+// Reassembles a message that was split over several records, starting at its
+// first part. The parts are only consumed once the message has been published,
+// so that a reset in between does not lose it. Parts of a message that was not
+// stored completely are discarded.
+void
+StoreAndForward::read_fragments(const FlashLog::Record &record, const std::string &topic, std::uint8_t flags, std::size_t offset)
+{
+  StoredMessage message;
+  message.topic = topic;
+  message.options = static_cast<loopp::mqtt::PublishOptions>(flags & ~(RECORD_FRAGMENT | RECORD_LAST_FRAGMENT));
+  message.timestamp = record.timestamp;
+
+  std::vector<FlashLog::Record> fragments;
+  FlashLog::Record fragment = record;
+
+  while (fragments.size() < MAX_FRAGMENTS)
+    {
+      // All parts have the same topic and are stored one after the other.
+      if (fragment.data.size() <= offset || fragment.data.compare(1, offset - 1, record.data, 1, offset - 1) != 0)
+        {
+          break;
+        }
+      std::uint8_t fragment_flags = static_cast<std::uint8_t>(fragment.data[0]);
+      std::size_t index = static_cast<std::uint8_t>(fragment.data[offset]);
+      if ((fragment_flags & RECORD_FRAGMENT) == 0 || index != fragments.size())
+        {
+          break;
+        }
+
+      message.payload.append(fragment.data, offset + 1, std::string::npos);
+
+      FlashLog::Record next;
+      bool last = (fragment_flags & RECORD_LAST_FRAGMENT) != 0;
+      bool more = !last && log->peek_after(fragment, next);
+
+      // Only the position is needed to consume the record.
+      fragment.data.clear();
+      fragments.push_back(std::move(fragment));
+
+      if (last)
+        {
+          replay(message, std::move(fragments));
+          return;
+        }
+      if (!more)
+        {
+          break;
+        }
+      fragment = std::move(next);
+    }
+
+  // The start of the message was dropped from the log, or a part was lost or corrupt.
+  ESP_LOGW(tag, "Warning: discarding incomplete stored message for %s", topic.c_str());
+  statistics.incomplete++;
+  if (fragments.empty())
+    {
+      fragments.push_back(record);
+    }
+  consume(fragments);
+}
+
+// Publishes a stored message. Its records are consumed once the broker has it.
+void
+StoreAndForward::replay(const StoredMessage &message, std::vector<FlashLog::Record> records)
+{
+  // Backfilled messages are history, never the retained state of a topic.
+  auto options = static_cast<loopp::mqtt::PublishOptions>(static_cast<std::uint8_t>(message.options) &
+                                                          static_cast<std::uint8_t>(loopp::mqtt::PublishOptions::QosMask));
+
+  std::string topic = message.topic + "/backfill";
+  std::string payload = (boost::format("{\"time\":%1%,\"payload\":%2%}") % message.timestamp % message.payload).str();
+
+  ESP_LOGD(tag, "Replaying message for %s (%d left)", topic.c_str(), log->size());
+
+  for (auto &record : records)
+    {
+      record.data.clear();
+    }
+
+  replaying = true;
+  auto self = shared_from_this();
+  mqtt->publish(topic, std::move(payload), options, [this, self, records](std::error_code ec) {
+    replaying = false;
+    if (!ec)
+      {
+        statistics.replayed++;
+        consume(records);
+      }
+  });
+}
+
+// Consumes records in log order. Each one must be at the read position when it
+// is consumed, which peek() moves past records that were consumed before.
+void
+StoreAndForward::consume(const std::vector<FlashLog::Record> &records)
+{
+  for (const auto &record : records)
+    {
+      FlashLog::Record head;
+      if (log->peek(head))
+        {
+          log->consume(record);
+        }
+    }
+}
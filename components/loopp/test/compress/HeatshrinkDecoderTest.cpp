@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "unity.h"
+
+#include "loopp/compress/HeatshrinkDecoder.hpp"
+#include "loopp/compress/HeatshrinkEncoder.hpp"
+
+using loopp::compress::HeatshrinkDecoder;
+using loopp::compress::HeatshrinkEncoder;
+using loopp::utils::string_view;
+
+static std::string test_data()
+{
+  std::string data;
+  for (int i = 0; i < 200; i++)
+    {
+      data += "{\"address\":\"c4:7c:8d:6a:" + std::to_string(10 + i % 50) + ":01\",\"rssi\":-" + std::to_string(40 + i % 7) + "}";
+      data += static_cast<char>(i);
+    }
+  return data;
+}
+
+static std::string encode(const std::string &input, int window_bits, int lookahead_bits)
+{
+  std::stringbuf output;
+  HeatshrinkEncoder encoder(&output, window_bits, lookahead_bits);
+  encoder.sputn(input.data(), input.size());
+  TEST_ASSERT(encoder.finish());
+  return output.str();
+}
+
+// Decodes data in pieces of at most piece_size bytes.
+static bool decode(const std::string &data, int window_bits, int lookahead_bits, std::size_t piece_size, std::string &result)
+{
+  HeatshrinkDecoder decoder(window_bits, lookahead_bits);
+  result.clear();
+
+  for (std::size_t pos = 0; pos < data.size(); pos += piece_size)
+    {
+      string_view piece(data.data() + pos, std::min(piece_size, data.size() - pos));
+      if (!decoder.decode(piece, [&result](string_view output) { result.append(output.data(), output.size()); }))
+        {
+          return false;
+        }
+    }
+  TEST_ASSERT_EQUAL(result.size(), decoder.get_output_size());
+  return true;
+}
+
+TEST_CASE("HeatshrinkDecoder: round trip", "[compress]")
+{
+  const int parameters[][2] = { { 4, 3 }, { 8, 4 }, { 10, 5 }, { 12, 11 } };
+  std::string input = test_data();
+
+  for (const auto &p : parameters)
+    {
+      std::string compressed = encode(input, p[0], p[1]);
+
+      for (std::size_t piece_size : { compressed.size(), std::size_t(1), std::size_t(3), std::size_t(100) })
+        {
+          std::string result;
+          TEST_ASSERT(decode(compressed, p[0], p[1], piece_size, result));
+          TEST_ASSERT(result == input);
+        }
+    }
+}
+
+TEST_CASE("HeatshrinkDecoder: empty and short input", "[compress]")
+{
+  std::string result;
+  TEST_ASSERT(decode(encode("", 8, 4), 8, 4, 1, result));
+  TEST_ASSERT(result.empty());
+  TEST_ASSERT(decode(encode("a", 8, 4), 8, 4, 1, result));
+  TEST_ASSERT_EQUAL_STRING("a", result.c_str());
+}
+
+TEST_CASE("HeatshrinkDecoder: truncated input", "[compress]")
+{
+  std::string input = test_data();
+  std::string compressed = encode(input, 8, 4);
+
+  // A truncated stream decodes to a prefix of the data, never to other data.
+  for (std::size_t size = 0; size < compressed.size(); size += 37)
+    {
+      std::string result;
+      TEST_ASSERT(decode(compressed.substr(0, size), 8, 4, 5, result));
+      TEST_ASSERT(result.size() < input.size());
+      TEST_ASSERT(input.compare(0, result.size(), result) == 0);
+    }
+}
+
+TEST_CASE("HeatshrinkDecoder: invalid input", "[compress]")
+{
+  std::string result;
+
+  // A back reference to offset 1 before any output.
+  TEST_ASSERT(!decode(std::string("\x00\x00", 2), 8, 4, 2, result));
+
+  // A back reference beyond the output: literal 'a', then offset 2.
+  TEST_ASSERT(!decode(std::string("\xb0\x80\x40\x00", 4), 8, 4, 1, result));
+}
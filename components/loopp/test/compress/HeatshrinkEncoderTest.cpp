@@ -0,0 +1,110 @@
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "unity.h"
+
+#include "loopp/compress/HeatshrinkEncoder.hpp"
+
+using loopp::compress::HeatshrinkEncoder;
+
+// Accepts at most limit bytes.
+class LimitedBuffer : public std::streambuf
+{
+public:
+  explicit LimitedBuffer(std::size_t limit)
+    : limit(limit)
+  {
+  }
+
+  std::string data;
+
+private:
+  int_type overflow(int_type ch) override
+  {
+    if (traits_type::eq_int_type(ch, traits_type::eof()) || data.size() == limit)
+      {
+        return traits_type::eof();
+      }
+    data += traits_type::to_char_type(ch);
+    return ch;
+  }
+
+  std::size_t limit;
+};
+
+static std::string encode(const std::string &input, int window_bits = 8, int lookahead_bits = 4)
+{
+  std::stringbuf output;
+  HeatshrinkEncoder encoder(&output, window_bits, lookahead_bits);
+  std::ostream stream(&encoder);
+  stream << input;
+  TEST_ASSERT(encoder.finish());
+  TEST_ASSERT_EQUAL(input.size(), encoder.get_input_size());
+  TEST_ASSERT_EQUAL(output.str().size(), encoder.get_output_size());
+  return output.str();
+}
+
+TEST_CASE("HeatshrinkEncoder: literals and back reference", "[compress]")
+{
+  // 'a', 'b' and 'c' as literals (1 + 8 bits each), then a back reference
+  // (0, offset - 1 = 2 in 8 bits, length - 1 = 5 in 4 bits).
+  const char expected[] = { '\xb0', '\xd8', '\xac', '\x60', '\x25' };
+  TEST_ASSERT(encode("abcabcabc") == std::string(expected, sizeof(expected)));
+}
+
+TEST_CASE("HeatshrinkEncoder: padding", "[compress]")
+{
+  // A single literal of 9 bits, padded with zero bits.
+  TEST_ASSERT(encode("a") == std::string("\xb0\x80", 2));
+  TEST_ASSERT(encode("").empty());
+}
+
+TEST_CASE("HeatshrinkEncoder: repeated data", "[compress]")
+{
+  // Longer than the encoder buffer, so that the window moves.
+  std::string input(2000, 'x');
+  std::string output = encode(input);
+  // Each back reference of 13 bits covers 16 bytes.
+  TEST_ASSERT(output.size() < input.size() / 8);
+
+  std::string text;
+  for (int i = 0; i < 100; i++)
+    {
+      text += "{\"address\":\"c4:7c:8d:6a:" + std::to_string(10 + i % 50) + ":01\",\"rssi\":-" + std::to_string(40 + i % 7) + "}";
+    }
+  TEST_ASSERT(encode(text, 10, 5).size() < text.size() / 2);
+}
+
+TEST_CASE("HeatshrinkEncoder: parameters", "[compress]")
+{
+  TEST_ASSERT(HeatshrinkEncoder::is_valid(4, 3));
+  TEST_ASSERT(HeatshrinkEncoder::is_valid(15, 14));
+  TEST_ASSERT(!HeatshrinkEncoder::is_valid(3, 3));
+  TEST_ASSERT(!HeatshrinkEncoder::is_valid(16, 4));
+  TEST_ASSERT(!HeatshrinkEncoder::is_valid(8, 2));
+  TEST_ASSERT(!HeatshrinkEncoder::is_valid(8, 8));
+  TEST_ASSERT_EQUAL_STRING("heatshrink-w8-l4", HeatshrinkEncoder::name(8, 4).c_str());
+
+  std::stringbuf output;
+  bool thrown = false;
+  try
+    {
+      HeatshrinkEncoder encoder(&output, 8, 8);
+    }
+  catch (std::invalid_argument &)
+    {
+      thrown = true;
+    }
+  TEST_ASSERT(thrown);
+}
+
+TEST_CASE("HeatshrinkEncoder: output full", "[compress]")
+{
+  LimitedBuffer output(2);
+  HeatshrinkEncoder encoder(&output);
+  std::ostream stream(&encoder);
+  stream << "abcdefgh";
+  TEST_ASSERT(!encoder.finish());
+  TEST_ASSERT_EQUAL(2, output.data.size());
+}
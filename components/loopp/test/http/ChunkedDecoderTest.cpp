@@ -0,0 +1,113 @@
+#include <string>
+
+#include "unity.h"
+
+#include "loopp/http/ChunkedDecoder.hpp"
+
+using loopp::http::ChunkedDecoder;
+using loopp::utils::string_view;
+
+// Decodes body in two pieces, split at every possible position. Returns
+// false when the body is invalid or incomplete. Data after the last chunk is
+// returned in rest.
+static bool decode(const std::string &body, std::string &result, std::string &rest)
+{
+  bool ok = true;
+  std::string first_result;
+
+  for (std::size_t split = 0; split <= body.size(); split++)
+    {
+      ChunkedDecoder decoder;
+      std::string decoded;
+      ChunkedDecoder::Result r = ChunkedDecoder::Result::Incomplete;
+      string_view input;
+
+      for (int piece = 0; piece < 2 && r != ChunkedDecoder::Result::Done && r != ChunkedDecoder::Result::Invalid; piece++)
+        {
+          input = piece == 0 ? string_view(body.data(), split) : string_view(body.data() + split, body.size() - split);
+          do
+            {
+              string_view data;
+              r = decoder.decode(input, data);
+              decoded.append(data.data(), data.size());
+            }
+          while (r == ChunkedDecoder::Result::Data);
+        }
+
+      if (r != ChunkedDecoder::Result::Done)
+        {
+          return false;
+        }
+
+      if (split == 0)
+        {
+          first_result = decoded;
+        }
+      else if (decoded != first_result)
+        {
+          ok = false;
+        }
+      // With the split at the end, all data that follows the body remains in the input.
+      if (split == body.size())
+        {
+          rest = std::string(input.data(), input.size());
+        }
+    }
+
+  result = first_result;
+  return ok;
+}
+
+TEST_CASE("ChunkedDecoder: chunks", "[http]")
+{
+  std::string result, rest;
+  TEST_ASSERT(decode("5\r\nhello\r\n7\r\n, world\r\n0\r\n\r\n", result, rest));
+  TEST_ASSERT_EQUAL_STRING("hello, world", result.c_str());
+
+  TEST_ASSERT(decode("A\r\n0123456789\r\na\r\nabcdefghij\r\n0\r\n\r\n", result, rest));
+  TEST_ASSERT_EQUAL_STRING("0123456789abcdefghij", result.c_str());
+
+  TEST_ASSERT(decode("0\r\n\r\n", result, rest));
+  TEST_ASSERT_EQUAL_STRING("", result.c_str());
+}
+
+TEST_CASE("ChunkedDecoder: bare line feeds", "[http]")
+{
+  std::string result, rest;
+  TEST_ASSERT(decode("3\nabc\n0\n\n", result, rest));
+  TEST_ASSERT_EQUAL_STRING("abc", result.c_str());
+}
+
+TEST_CASE("ChunkedDecoder: chunk extensions", "[http]")
+{
+  std::string result, rest;
+  TEST_ASSERT(decode("3;name=value\r\nabc\r\n2 ; x\r\nde\r\n0;last\r\n\r\n", result, rest));
+  TEST_ASSERT_EQUAL_STRING("abcde", result.c_str());
+}
+
+TEST_CASE("ChunkedDecoder: trailers", "[http]")
+{
+  std::string result, rest;
+  TEST_ASSERT(decode("3\r\nabc\r\n0\r\nExpires: never\r\nX-Checksum: 1234\r\n\r\n", result, rest));
+  TEST_ASSERT_EQUAL_STRING("abc", result.c_str());
+}
+
+TEST_CASE("ChunkedDecoder: data after the body", "[http]")
+{
+  std::string result, rest;
+  TEST_ASSERT(decode("3\r\nabc\r\n0\r\n\r\nHTTP/1.1 200 OK\r\n", result, rest));
+  TEST_ASSERT_EQUAL_STRING("abc", result.c_str());
+  TEST_ASSERT_EQUAL_STRING("HTTP/1.1 200 OK\r\n", rest.c_str());
+}
+
+TEST_CASE("ChunkedDecoder: invalid", "[http]")
+{
+  std::string result, rest;
+  TEST_ASSERT(!decode("x\r\nabc\r\n0\r\n\r\n", result, rest));
+  TEST_ASSERT(!decode("\r\nabc\r\n0\r\n\r\n", result, rest));
+  TEST_ASSERT(!decode("3\r\nabcd\r\n0\r\n\r\n", result, rest));
+  TEST_ASSERT(!decode("3\rabc\r\n0\r\n\r\n", result, rest));
+  TEST_ASSERT(!decode("3\r\nabc\r\n0\r\n\rx", result, rest));
+  TEST_ASSERT(!decode("3\r\nabc\r\n0\r\n", result, rest));
+  TEST_ASSERT(!decode("fffffffffffffffff\r\n", result, rest));
+}
@@ -0,0 +1,94 @@
+#include <algorithm>
+#include <string>
+
+#include "unity.h"
+
+#include "loopp/http/Inflater.hpp"
+
+using loopp::http::Inflater;
+using loopp::utils::string_view;
+
+static const char *text = "The quick brown fox jumps over the lazy dog. The quick brown fox jumps over the lazy dog. "
+                          "The quick brown fox jumps over the lazy dog. ";
+
+// Raw deflate stream of text.
+static const unsigned char deflate_data[] = {
+  0x0b, 0xc9, 0x48, 0x55, 0x28, 0x2c, 0xcd, 0x4c, 0xce, 0x56, 0x48, 0x2a, 0xca, 0x2f, 0xcf, 0x53, 0x48,
+  0xcb, 0xaf, 0x50, 0xc8, 0x2a, 0xcd, 0x2d, 0x28, 0x56, 0xc8, 0x2f, 0x4b, 0x2d, 0x52, 0x28, 0x01, 0x4a,
+  0xe7, 0x24, 0x56, 0x55, 0x2a, 0xa4, 0xe4, 0xa7, 0xeb, 0x29, 0x84, 0xd0, 0x4c, 0x31, 0x00,
+};
+
+// Deflate stream of text with zlib header and trailer.
+static const unsigned char zlib_data[] = {
+  0x78, 0xda, 0x0b, 0xc9, 0x48, 0x55, 0x28, 0x2c, 0xcd, 0x4c, 0xce, 0x56, 0x48, 0x2a, 0xca, 0x2f, 0xcf,
+  0x53, 0x48, 0xcb, 0xaf, 0x50, 0xc8, 0x2a, 0xcd, 0x2d, 0x28, 0x56, 0xc8, 0x2f, 0x4b, 0x2d, 0x52, 0x28,
+  0x01, 0x4a, 0xe7, 0x24, 0x56, 0x55, 0x2a, 0xa4, 0xe4, 0xa7, 0xeb, 0x29, 0x84, 0xd0, 0x4c, 0x31, 0x00,
+  0xf9, 0x3c, 0x30, 0x76,
+};
+
+// gzip member of text with all optional header fields: extra field "ab\x01\x02",
+// file name "name.txt", comment "comment" and header CRC.
+static const unsigned char gzip_data[] = {
+  0x1f, 0x8b, 0x08, 0x1e, 0x00, 0x00, 0x00, 0x00, 0x02, 0x03, 0x04, 0x00, 0x61, 0x62, 0x01, 0x02, 0x6e,
+  0x61, 0x6d, 0x65, 0x2e, 0x74, 0x78, 0x74, 0x00, 0x63, 0x6f, 0x6d, 0x6d, 0x65, 0x6e, 0x74, 0x00, 0x46,
+  0xe0, 0x0b, 0xc9, 0x48, 0x55, 0x28, 0x2c, 0xcd, 0x4c, 0xce, 0x56, 0x48, 0x2a, 0xca, 0x2f, 0xcf, 0x53,
+  0x48, 0xcb, 0xaf, 0x50, 0xc8, 0x2a, 0xcd, 0x2d, 0x28, 0x56, 0xc8, 0x2f, 0x4b, 0x2d, 0x52, 0x28, 0x01,
+  0x4a, 0xe7, 0x24, 0x56, 0x55, 0x2a, 0xa4, 0xe4, 0xa7, 0xeb, 0x29, 0x84, 0xd0, 0x4c, 0x31, 0x00, 0x58,
+  0x00, 0x1e, 0x00, 0x87, 0x00, 0x00, 0x00,
+};
+
+// Inflates data in pieces of at most piece_size bytes.
+static bool inflate(Inflater::Format format, const unsigned char *data, std::size_t size, std::size_t piece_size, std::string &result)
+{
+  Inflater inflater(format);
+  result.clear();
+
+  for (std::size_t pos = 0; pos < size; pos += piece_size)
+    {
+      string_view piece(reinterpret_cast<const char *>(data) + pos, std::min(piece_size, size - pos));
+      std::error_code ec = inflater.inflate(piece, [&result](string_view output) { result.append(output.data(), output.size()); });
+      if (ec)
+        {
+          return false;
+        }
+    }
+  return inflater.done();
+}
+
+TEST_CASE("Inflater: deflate", "[http]")
+{
+  std::string result;
+  TEST_ASSERT(inflate(Inflater::Format::Deflate, deflate_data, sizeof(deflate_data), sizeof(deflate_data), result));
+  TEST_ASSERT_EQUAL_STRING(text, result.c_str());
+}
+
+TEST_CASE("Inflater: deflate with zlib header", "[http]")
+{
+  std::string result;
+  TEST_ASSERT(inflate(Inflater::Format::Deflate, zlib_data, sizeof(zlib_data), sizeof(zlib_data), result));
+  TEST_ASSERT_EQUAL_STRING(text, result.c_str());
+}
+
+TEST_CASE("Inflater: gzip header fields", "[http]")
+{
+  for (std::size_t piece_size = 1; piece_size <= sizeof(gzip_data); piece_size++)
+    {
+      std::string result;
+      TEST_ASSERT(inflate(Inflater::Format::Gzip, gzip_data, sizeof(gzip_data), piece_size, result));
+      TEST_ASSERT_EQUAL_STRING(text, result.c_str());
+    }
+}
+
+TEST_CASE("Inflater: invalid gzip header", "[http]")
+{
+  unsigned char data[sizeof(gzip_data)];
+  std::string result;
+
+  std::copy(gzip_data, gzip_data + sizeof(gzip_data), data);
+  data[1] = 0x8c;
+  TEST_ASSERT(!inflate(Inflater::Format::Gzip, data, sizeof(data), sizeof(data), result));
+
+  std::copy(gzip_data, gzip_data + sizeof(gzip_data), data);
+  data[2] = 0x07;
+  TEST_ASSERT(!inflate(Inflater::Format::Gzip, data, sizeof(data), 1, result));
+}
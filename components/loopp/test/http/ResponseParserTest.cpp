@@ -0,0 +1,82 @@
+#include <string>
+
+#include "unity.h"
+
+#include "loopp/http/ResponseParser.hpp"
+
+using loopp::http::ResponseParser;
+
+static std::string str(loopp::utils::string_view s)
+{
+  return std::string(s.data(), s.size());
+}
+
+TEST_CASE("ResponseParser: status line and headers", "[http]")
+{
+  std::string data = "HTTP/1.1 206 Partial Content\r\nContent-Length: 10\r\nETag:  \"abc\" \r\n\r\n0123456789";
+
+  ResponseParser parser;
+  TEST_ASSERT(parser.parse(data.data(), data.size()) == ResponseParser::Result::Complete);
+  TEST_ASSERT_EQUAL_STRING("HTTP/1.1", str(parser.http_version()).c_str());
+  TEST_ASSERT_EQUAL(206, parser.status_code());
+  TEST_ASSERT_EQUAL_STRING("Partial Content", str(parser.status_message()).c_str());
+  TEST_ASSERT_EQUAL(data.size() - 10, parser.header_size());
+  TEST_ASSERT_EQUAL(2, parser.headers().size());
+  TEST_ASSERT_EQUAL_STRING("10", str(parser.headers().find("content-length")).c_str());
+  TEST_ASSERT_EQUAL_STRING("\"abc\"", str(parser.headers().find("ETag")).c_str());
+}
+
+TEST_CASE("ResponseParser: incremental", "[http]")
+{
+  std::string data = "HTTP/1.1 200 OK\nConnection: close\n\n";
+
+  ResponseParser parser;
+  for (std::size_t size = 0; size < data.size(); size++)
+    {
+      TEST_ASSERT(parser.parse(data.data(), size) == ResponseParser::Result::Incomplete);
+    }
+  TEST_ASSERT(parser.parse(data.data(), data.size()) == ResponseParser::Result::Complete);
+  TEST_ASSERT_EQUAL_STRING("close", str(parser.headers().find("Connection")).c_str());
+}
+
+TEST_CASE("ResponseParser: invalid", "[http]")
+{
+  const char *invalid[] = {
+    "HTTP/1.1 20 OK\r\n\r\n",
+    "HTTP/1.1 200OK\r\n\r\n",
+    "ICY 200 OK\r\n\r\n",
+    "HTTP/1.1 200 OK\r\nNo colon\r\n\r\n",
+    "HTTP/1.1 200 OK\r\n Folded: value\r\n\r\n",
+  };
+
+  for (const char *data : invalid)
+    {
+      ResponseParser parser;
+      TEST_ASSERT(parser.parse(data, std::char_traits<char>::length(data)) == ResponseParser::Result::Invalid);
+    }
+}
+
+TEST_CASE("ResponseParser: more fields than fit", "[http]")
+{
+  std::string data = "HTTP/1.1 200 OK\r\n";
+  for (int i = 0; i < 40; i++)
+    {
+      data += "X-Field-" + std::to_string(i) + ": " + std::to_string(i) + "\r\n";
+    }
+  data += "Content-Length: 5\r\nTransfer-Encoding: chunked\r\nConnection: keep-alive\r\n";
+  data += "Content-Encoding: gzip\r\nContent-Range: bytes 0-4/5\r\nETag: \"x\"\r\n\r\n";
+
+  ResponseParser parser;
+  TEST_ASSERT(parser.parse(data.data(), data.size()) == ResponseParser::Result::Complete);
+  TEST_ASSERT_EQUAL(loopp::http::HeaderView::max_fields, parser.headers().size());
+  TEST_ASSERT_EQUAL(40 - (loopp::http::HeaderView::max_fields - 6), parser.dropped_fields());
+
+  TEST_ASSERT_EQUAL_STRING("0", str(parser.headers().find("X-Field-0")).c_str());
+  TEST_ASSERT(!parser.headers().has("X-Field-39"));
+  TEST_ASSERT_EQUAL_STRING("5", str(parser.headers().find("Content-Length")).c_str());
+  TEST_ASSERT_EQUAL_STRING("chunked", str(parser.headers().find("Transfer-Encoding")).c_str());
+  TEST_ASSERT_EQUAL_STRING("keep-alive", str(parser.headers().find("Connection")).c_str());
+  TEST_ASSERT_EQUAL_STRING("gzip", str(parser.headers().find("Content-Encoding")).c_str());
+  TEST_ASSERT_EQUAL_STRING("bytes 0-4/5", str(parser.headers().find("Content-Range")).c_str());
+  TEST_ASSERT_EQUAL_STRING("\"x\"", str(parser.headers().find("ETag")).c_str());
+}
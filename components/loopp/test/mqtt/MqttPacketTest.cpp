@@ -0,0 +1,192 @@
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "unity.h"
+
+#include "loopp/mqtt/MqttPacket.hpp"
+#include "loopp/mqtt/MqttProperties.hpp"
+
+using loopp::mqtt::MqttPacket;
+using loopp::mqtt::MqttProperties;
+using loopp::mqtt::MqttPropertyReader;
+using loopp::mqtt::PacketType;
+using loopp::mqtt::PropertyId;
+using loopp::mqtt::ProtocolVersion;
+using loopp::mqtt::PublishFlags;
+
+// Returns the bytes of the packet as they would be written to the socket.
+static std::string bytes(MqttPacket &packet)
+{
+  std::string result(packet.get_buffer().consume_data(), packet.get_buffer().consume_size());
+  loopp::net::StreamBuffer *payload = packet.get_payload_buffer();
+  if (payload != nullptr)
+    {
+      result.append(payload->consume_data(), payload->consume_size());
+    }
+  return result;
+}
+
+// Returns the first size bytes of the packet.
+static std::string head(MqttPacket &packet, std::size_t size)
+{
+  return std::string(packet.get_buffer().consume_data(), std::min(size, packet.get_buffer().consume_size()));
+}
+
+TEST_CASE("MqttPacket: remaining length size", "[mqtt]")
+{
+  TEST_ASSERT_EQUAL(1, MqttPacket::length_size(0));
+  TEST_ASSERT_EQUAL(1, MqttPacket::length_size(127));
+  TEST_ASSERT_EQUAL(2, MqttPacket::length_size(128));
+  TEST_ASSERT_EQUAL(2, MqttPacket::length_size(16383));
+  TEST_ASSERT_EQUAL(3, MqttPacket::length_size(16384));
+  TEST_ASSERT_EQUAL(3, MqttPacket::length_size(2097151));
+  TEST_ASSERT_EQUAL(4, MqttPacket::length_size(2097152));
+  TEST_ASSERT_EQUAL(4, MqttPacket::length_size(268435455));
+
+  TEST_ASSERT_EQUAL(1 + 1 + 127, MqttPacket::packet_size(127));
+  TEST_ASSERT_EQUAL(1 + 2 + 128, MqttPacket::packet_size(128));
+  TEST_ASSERT_EQUAL(1 + 3 + 16384, MqttPacket::packet_size(16384));
+}
+
+TEST_CASE("MqttPacket: remaining length one and two bytes", "[mqtt]")
+{
+  struct
+  {
+    std::size_t length;
+    std::string header;
+  } cases[] = {
+    { 0, std::string("\xe0\x00", 2) },
+    { 127, std::string("\xe0\x7f", 2) },
+    { 128, std::string("\xe0\x80\x01", 3) },
+    { 1000, std::string("\xe0\xe8\x07", 3) },
+  };
+
+  for (const auto &c : cases)
+    {
+      MqttPacket packet;
+      packet.begin(PacketType::Disconnect, 0, c.length);
+      packet.append(std::string(c.length, 'x').data(), c.length);
+
+      TEST_ASSERT_EQUAL(MqttPacket::packet_size(c.length), packet.size());
+      TEST_ASSERT(head(packet, c.header.size()) == c.header);
+    }
+}
+
+TEST_CASE("MqttPacket: remaining length two and three bytes", "[mqtt]")
+{
+  // Topic "t" and no packet id: the remaining length is 3 plus the payload size.
+  struct
+  {
+    std::size_t length;
+    std::string header;
+  } cases[] = {
+    { 16383, std::string("\x30\xff\x7f\x00\x01t", 6) },
+    { 16384, std::string("\x30\x80\x80\x01\x00\x01t", 7) },
+  };
+
+  for (const auto &c : cases)
+    {
+      MqttPacket packet;
+      packet.begin_publish(ProtocolVersion::Mqtt311, "t", 0, "");
+      packet.set_payload(std::string(c.length - 3, 'x'));
+      packet.complete_publish();
+
+      TEST_ASSERT_EQUAL(MqttPacket::packet_size(c.length), packet.size());
+      TEST_ASSERT_EQUAL(c.header.size(), packet.get_buffer().consume_size());
+      TEST_ASSERT(head(packet, c.header.size()) == c.header);
+    }
+}
+
+TEST_CASE("MqttPacket: decode remaining length", "[mqtt]")
+{
+  struct
+  {
+    std::uint32_t length;
+    std::string data;
+  } cases[] = {
+    { 0, std::string("\x00", 1) },
+    { 127, std::string("\x7f", 1) },
+    { 128, std::string("\x80\x01", 2) },
+    { 16383, std::string("\xff\x7f", 2) },
+    { 16384, std::string("\x80\x80\x01", 3) },
+    { 2097151, std::string("\xff\xff\x7f", 3) },
+    { 2097152, std::string("\x80\x80\x80\x01", 4) },
+    { 268435455, std::string("\xff\xff\xff\x7f", 4) },
+  };
+
+  for (const auto &c : cases)
+    {
+      std::size_t index = 0;
+      std::uint32_t length = MqttPropertyReader::read_length(reinterpret_cast<const std::uint8_t *>(c.data.data()), c.data.size(), index);
+      TEST_ASSERT_EQUAL(c.length, length);
+      TEST_ASSERT_EQUAL(c.data.size(), index);
+    }
+}
+
+TEST_CASE("MqttPacket: publish header at the one byte boundary", "[mqtt]")
+{
+  // The header is encoded right-aligned against the payload, so growing the
+  // remaining length past 127 moves the start of the packet.
+  for (std::size_t length = 126; length <= 129; length++)
+    {
+      MqttPacket packet;
+      std::string payload(length - 3, 'x');
+      packet.begin_publish(ProtocolVersion::Mqtt311, "t", 0, "", payload.size());
+      packet.append(payload.data(), payload.size());
+      packet.complete_publish();
+
+      std::string expected = length < 128 ? std::string(1, static_cast<char>(length)) : std::string(1, static_cast<char>(0x80 | (length & 0x7f))) + "\x01";
+      expected = "\x30" + expected + std::string("\x00\x01t", 3) + payload;
+      TEST_ASSERT(bytes(packet) == expected);
+    }
+}
+
+TEST_CASE("MqttPacket: publish with topic alias", "[mqtt]")
+{
+  MqttProperties properties;
+  properties.add(PropertyId::PayloadFormatIndicator, 1);
+
+  MqttPacket packet;
+  packet.begin_publish(ProtocolVersion::Mqtt5, "a/b", static_cast<std::uint8_t>(PublishFlags::Qos1), properties.data());
+  packet.append("xy", 2);
+  packet.set_packet_id(7);
+
+  // First use of the alias: topic, packet id, properties with alias 3.
+  packet.complete_publish(3, false);
+  TEST_ASSERT(bytes(packet) == std::string("\x32\x0f\x00\x03" "a/b" "\x00\x07\x05\x23\x00\x03\x01\x01" "xy", 17));
+
+  // Later uses: empty topic.
+  packet.complete_publish(3, true);
+  TEST_ASSERT(bytes(packet) == std::string("\x32\x0c\x00\x00\x00\x07\x05\x23\x00\x03\x01\x01" "xy", 14));
+
+  // Retransmission after reconnecting, without alias.
+  packet.set_duplicate();
+  packet.complete_publish();
+  TEST_ASSERT(bytes(packet) == std::string("\x3a\x0c\x00\x03" "a/b" "\x00\x07\x02\x01\x01" "xy", 14));
+}
+
+TEST_CASE("MqttPacket: topic alias with MQTT 3.1.1", "[mqtt]")
+{
+  MqttProperties properties;
+  properties.add(PropertyId::PayloadFormatIndicator, 1);
+
+  MqttPacket packet;
+  packet.begin_publish(ProtocolVersion::Mqtt311, "a/b", 0, properties.data());
+  packet.append("xy", 2);
+  packet.complete_publish(3, false);
+  TEST_ASSERT(bytes(packet) == std::string("\x30\x07\x00\x03" "a/b" "xy", 9));
+}
+
+TEST_CASE("MqttPacket: topic alias property", "[mqtt]")
+{
+  MqttProperties properties;
+  properties.add_uint16(PropertyId::TopicAlias, 0x1234);
+  TEST_ASSERT(properties.data() == std::string("\x23\x12\x34", 3));
+
+  MqttPropertyReader reader(reinterpret_cast<const std::uint8_t *>(properties.data().data()), properties.size());
+  TEST_ASSERT(reader.next());
+  TEST_ASSERT(reader.id() == PropertyId::TopicAlias);
+  TEST_ASSERT_EQUAL(0x1234, reader.value());
+  TEST_ASSERT(!reader.next());
+}
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "unity.h"
+
+#include "loopp/mqtt/TopicTrie.hpp"
+
+using loopp::mqtt::TopicTrie;
+
+// Returns the values of all filters that match topic, sorted.
+static std::vector<int> match(const TopicTrie<int> &trie, const std::string &topic)
+{
+  std::vector<int> result;
+  trie.match(topic, [&result](const int &value) { result.push_back(value); });
+  std::sort(result.begin(), result.end());
+  return result;
+}
+
+static bool matches(const TopicTrie<int> &trie, const std::string &topic, std::vector<int> expected)
+{
+  std::sort(expected.begin(), expected.end());
+  return match(trie, topic) == expected;
+}
+
+TEST_CASE("TopicTrie: exact match", "[mqtt]")
+{
+  TopicTrie<int> trie;
+  trie.insert("a/b", 1);
+  trie.insert("a/b/c", 2);
+  trie.insert("/a", 3);
+
+  TEST_ASSERT(matches(trie, "a/b", { 1 }));
+  TEST_ASSERT(matches(trie, "a/b/c", { 2 }));
+  TEST_ASSERT(matches(trie, "/a", { 3 }));
+  TEST_ASSERT(matches(trie, "a", {}));
+  TEST_ASSERT(matches(trie, "a/b/", {}));
+  TEST_ASSERT(matches(trie, "a/bc", {}));
+}
+
+TEST_CASE("TopicTrie: single level wildcard", "[mqtt]")
+{
+  TopicTrie<int> trie;
+  trie.insert("a/+", 1);
+  trie.insert("a/+/c", 2);
+  trie.insert("+/+", 3);
+  trie.insert("+", 4);
+
+  TEST_ASSERT(matches(trie, "a/b", { 1, 3 }));
+  TEST_ASSERT(matches(trie, "a/", { 1, 3 }));
+  TEST_ASSERT(matches(trie, "a/b/c", { 2 }));
+  TEST_ASSERT(matches(trie, "x/y", { 3 }));
+  TEST_ASSERT(matches(trie, "x", { 4 }));
+  TEST_ASSERT(matches(trie, "a/b/d", {}));
+}
+
+TEST_CASE("TopicTrie: multi level wildcard", "[mqtt]")
+{
+  TopicTrie<int> trie;
+  trie.insert("a/#", 1);
+  trie.insert("a/+/#", 2);
+  trie.insert("#", 3);
+
+  TEST_ASSERT(matches(trie, "a/b/c", { 1, 2, 3 }));
+  TEST_ASSERT(matches(trie, "a/b", { 1, 2, 3 }));
+  TEST_ASSERT(matches(trie, "b/c", { 3 }));
+}
+
+TEST_CASE("TopicTrie: multi level wildcard matches the parent level", "[mqtt]")
+{
+  TopicTrie<int> trie;
+  trie.insert("a/#", 1);
+  trie.insert("a/b/#", 2);
+
+  TEST_ASSERT(matches(trie, "a", { 1 }));
+  TEST_ASSERT(matches(trie, "a/b", { 1, 2 }));
+  TEST_ASSERT(matches(trie, "ab", {}));
+}
+
+TEST_CASE("TopicTrie: topics starting with $", "[mqtt]")
+{
+  TopicTrie<int> trie;
+  trie.insert("#", 1);
+  trie.insert("+/info", 2);
+  trie.insert("$SYS/#", 3);
+  trie.insert("$SYS/+", 4);
+
+  TEST_ASSERT(matches(trie, "$SYS/info", { 3, 4 }));
+  TEST_ASSERT(matches(trie, "$SYS", { 3 }));
+  TEST_ASSERT(matches(trie, "dev/info", { 1, 2 }));
+  TEST_ASSERT(matches(trie, "dev/$SYS", { 1 }));
+}
+
+TEST_CASE("TopicTrie: invalid filters", "[mqtt]")
+{
+  TopicTrie<int> trie;
+  for (const char *filter : { "a/#/b", "a#", "#/" })
+    {
+      bool thrown = false;
+      try
+        {
+          trie.insert(filter, 1);
+        }
+      catch (std::runtime_error &)
+        {
+          thrown = true;
+        }
+      TEST_ASSERT(thrown);
+    }
+  TEST_ASSERT(trie.empty());
+}
+
+TEST_CASE("TopicTrie: remove", "[mqtt]")
+{
+  TopicTrie<int> trie;
+  trie.insert("a/b", 1);
+  trie.insert("a/b/c", 2);
+  trie.insert("a/#", 3);
+
+  trie.remove("a/b");
+  TEST_ASSERT(matches(trie, "a/b", { 3 }));
+  TEST_ASSERT(matches(trie, "a/b/c", { 2, 3 }));
+
+  trie.remove("a/#");
+  TEST_ASSERT(matches(trie, "a/b/c", { 2 }));
+
+  trie.remove("a/x");
+  trie.remove("a/b/c/d");
+  TEST_ASSERT(matches(trie, "a/b/c", { 2 }));
+
+  trie.remove("a/b/c");
+  TEST_ASSERT(trie.empty());
+}
+
+TEST_CASE("TopicTrie: remove prunes single level wildcards", "[mqtt]")
+{
+  TopicTrie<int> trie;
+  trie.insert("+/b/+", 1);
+  trie.insert("+/b", 2);
+  trie.insert("a/b/c", 3);
+
+  trie.remove("+/b/+");
+  TEST_ASSERT(matches(trie, "x/b", { 2 }));
+  TEST_ASSERT(matches(trie, "x/b/c", {}));
+  TEST_ASSERT(matches(trie, "a/b/c", { 3 }));
+
+  trie.remove("+/b");
+  TEST_ASSERT(matches(trie, "x/b", {}));
+  TEST_ASSERT(matches(trie, "a/b/c", { 3 }));
+
+  trie.remove("a/b/c");
+  TEST_ASSERT(trie.empty());
+
+  trie.insert("+/+/#", 4);
+  trie.remove("+/+/#");
+  TEST_ASSERT(trie.empty());
+}
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <string>
+
+#include "unity.h"
+
+#include "esp_partition.h"
+
+#include "loopp/ota/DeltaPatcher.hpp"
+#include "loopp/ota/OTAErrors.hpp"
+
+using loopp::ota::DeltaPatcher;
+using loopp::ota::OTAErrc;
+using loopp::utils::string_view;
+
+// Source image: 512 bytes of a simple pattern.
+static std::string source_image()
+{
+  std::string data;
+  for (int i = 0; i < 512; i++)
+    {
+      data += static_cast<char>((i * 7 + i / 13) & 0xff);
+    }
+  return data;
+}
+
+// Target image: the source with 40 bytes replaced by 13 others, and every
+// 50th byte changed, like code that moved.
+static std::string target_image()
+{
+  std::string source = source_image();
+  std::string data = source.substr(0, 200) + "inserted code" + source.substr(240);
+  for (std::size_t i = 0; i < data.size(); i += 50)
+    {
+      data[i] = static_cast<char>(data[i] + 4);
+    }
+  return data;
+}
+
+// tools/make_delta.py create source.bin target.bin patch.bin
+static const unsigned char patch_data[] = {
+  0x4c, 0x50, 0x44, 0x45, 0x4c, 0x54, 0x41, 0x31, 0x00, 0x02, 0x00, 0x00, 0xe5, 0x01, 0x00, 0x00, 0x64,
+  0xcc, 0xce, 0xd4, 0x34, 0xde, 0x8d, 0x99, 0x18, 0x8f, 0x66, 0xa8, 0x72, 0xb4, 0x07, 0x7a, 0x61, 0x80,
+  0xb5, 0x15, 0x37, 0x0b, 0xe0, 0x1f, 0x56, 0x53, 0xd6, 0x4a, 0x96, 0xf8, 0xcf, 0x65, 0x78, 0xda, 0x63,
+  0x60, 0x60, 0x60, 0x60, 0x84, 0x62, 0x96, 0xe3, 0x40, 0x82, 0x17, 0x88, 0x35, 0x18, 0xc8, 0x00, 0x2c,
+  0x83, 0x52, 0x47, 0x6e, 0x5e, 0x71, 0x6a, 0x51, 0x49, 0x6a, 0x8a, 0x42, 0x72, 0x7e, 0x4a, 0xaa, 0x00,
+  0xe3, 0xb0, 0xf0, 0x13, 0x4d, 0x74, 0x00, 0x00, 0x02, 0x3d, 0x06, 0x51,
+};
+
+// The same patch with a complete zlib stream that ends 100 bytes into the
+// diff data of the second record.
+static const unsigned char truncated_patch[] = {
+  0x4c, 0x50, 0x44, 0x45, 0x4c, 0x54, 0x41, 0x31, 0x00, 0x02, 0x00, 0x00, 0xe5, 0x01, 0x00, 0x00, 0x64,
+  0xcc, 0xce, 0xd4, 0x34, 0xde, 0x8d, 0x99, 0x18, 0x8f, 0x66, 0xa8, 0x72, 0xb4, 0x07, 0x7a, 0x61, 0x80,
+  0xb5, 0x15, 0x37, 0x0b, 0xe0, 0x1f, 0x56, 0x53, 0xd6, 0x4a, 0x96, 0xf8, 0xcf, 0x65, 0x78, 0xda, 0x63,
+  0x60, 0x60, 0x60, 0x60, 0x84, 0x62, 0x96, 0xe3, 0x40, 0x82, 0x17, 0x88, 0x35, 0x18, 0xc8, 0x00, 0x2c,
+  0xa4, 0xeb, 0x00, 0x00, 0x70, 0xcb, 0x01, 0x0b,
+};
+
+// A patch whose only record has 1000 extra bytes, more than the target image.
+static const unsigned char oversized_patch[] = {
+  0x4c, 0x50, 0x44, 0x45, 0x4c, 0x54, 0x41, 0x31, 0x00, 0x02, 0x00, 0x00, 0xe5, 0x01, 0x00, 0x00, 0x64,
+  0xcc, 0xce, 0xd4, 0x34, 0xde, 0x8d, 0x99, 0x18, 0x8f, 0x66, 0xa8, 0x72, 0xb4, 0x07, 0x7a, 0x61, 0x80,
+  0xb5, 0x15, 0x37, 0x0b, 0xe0, 0x1f, 0x56, 0x53, 0xd6, 0x4a, 0x96, 0xf8, 0xcf, 0x65, 0x78, 0xda, 0x63,
+  0x60, 0x60, 0x60, 0x78, 0xc1, 0xcc, 0x00, 0x06, 0x15, 0x70, 0x00, 0x00, 0x2a, 0x61, 0x05, 0x9c,
+};
+
+// Writes the source image to the flash_test partition of the unit test app.
+static const esp_partition_t *write_source()
+{
+  const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "flash_test");
+  TEST_ASSERT_NOT_NULL(partition);
+
+  std::string data = source_image();
+  TEST_ESP_OK(esp_partition_erase_range(partition, 0, SPI_FLASH_SEC_SIZE));
+  TEST_ESP_OK(esp_partition_write(partition, 0, data.data(), data.size()));
+  return partition;
+}
+
+// Applies the patch in pieces of at most piece_size bytes.
+static std::error_code apply(DeltaPatcher &patcher, const unsigned char *data, std::size_t size, std::size_t piece_size)
+{
+  std::error_code ec;
+  for (std::size_t pos = 0; pos < size && !ec; pos += piece_size)
+    {
+      ec = patcher.apply(string_view(reinterpret_cast<const char *>(data) + pos, std::min(piece_size, size - pos)));
+    }
+  return ec;
+}
+
+TEST_CASE("DeltaPatcher: apply patch", "[ota]")
+{
+  const esp_partition_t *source = write_source();
+  std::string expected = target_image();
+
+  TEST_ASSERT(DeltaPatcher::is_patch(string_view(reinterpret_cast<const char *>(patch_data), DeltaPatcher::MAGIC_SIZE)));
+
+  for (std::size_t piece_size : { sizeof(patch_data), std::size_t(1), std::size_t(7), std::size_t(48) })
+    {
+      std::string result;
+      DeltaPatcher patcher(source, [&result](string_view data) { result.append(data.data(), data.size()); });
+
+      TEST_ASSERT(!apply(patcher, patch_data, sizeof(patch_data), piece_size));
+      TEST_ASSERT(patcher.done());
+      TEST_ASSERT_EQUAL(expected.size(), patcher.get_target_size());
+      TEST_ASSERT_EQUAL(32, patcher.get_target_digest().size());
+      TEST_ASSERT(result == expected);
+    }
+}
+
+TEST_CASE("DeltaPatcher: invalid header", "[ota]")
+{
+  const esp_partition_t *source = write_source();
+  unsigned char data[sizeof(patch_data)];
+  std::string result;
+
+  std::copy(patch_data, patch_data + sizeof(patch_data), data);
+  data[7] = '2';
+  TEST_ASSERT(!DeltaPatcher::is_patch(string_view(reinterpret_cast<const char *>(data), sizeof(data))));
+  DeltaPatcher bad_magic(source, [&result](string_view data) { result.append(data.data(), data.size()); });
+  TEST_ASSERT(apply(bad_magic, data, sizeof(data), sizeof(data)) == OTAErrc::InvalidPatch);
+
+  // A source image larger than the partition.
+  std::copy(patch_data, patch_data + sizeof(patch_data), data);
+  data[11] = 0x7f;
+  DeltaPatcher bad_size(source, [&result](string_view data) { result.append(data.data(), data.size()); });
+  TEST_ASSERT(apply(bad_size, data, sizeof(data), 1) == OTAErrc::InvalidPatch);
+
+  TEST_ASSERT(result.empty());
+}
+
+TEST_CASE("DeltaPatcher: truncated record", "[ota]")
+{
+  const esp_partition_t *source = write_source();
+  std::string result;
+
+  DeltaPatcher truncated(source, [&result](string_view data) { result.append(data.data(), data.size()); });
+  TEST_ASSERT(!apply(truncated, truncated_patch, sizeof(truncated_patch), sizeof(truncated_patch)));
+  TEST_ASSERT(!truncated.done());
+  TEST_ASSERT(truncated.apply(string_view("x", 1)) == OTAErrc::InvalidPatch);
+
+  // A patch that is cut off in the middle of the zlib stream.
+  DeltaPatcher cut(source, [&result](string_view data) { result.append(data.data(), data.size()); });
+  TEST_ASSERT(!apply(cut, patch_data, sizeof(patch_data) - 10, 1));
+  TEST_ASSERT(!cut.done());
+
+  DeltaPatcher oversized(source, [&result](string_view data) { result.append(data.data(), data.size()); });
+  TEST_ASSERT(apply(oversized, oversized_patch, sizeof(oversized_patch), sizeof(oversized_patch)) == OTAErrc::InvalidPatch);
+  TEST_ASSERT(!oversized.done());
+}
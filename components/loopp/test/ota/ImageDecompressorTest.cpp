@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <sstream>
+#include <string>
+
+#include "unity.h"
+
+#include "loopp/compress/HeatshrinkEncoder.hpp"
+#include "loopp/ota/ImageDecompressor.hpp"
+#include "loopp/ota/OTAErrors.hpp"
+
+using loopp::compress::HeatshrinkEncoder;
+using loopp::ota::ImageDecompressor;
+using loopp::ota::OTAErrc;
+using loopp::utils::string_view;
+
+// Looks like a firmware image: 0xe9 magic followed by repetitive data.
+static std::string image()
+{
+  std::string data("\xe9\x05\x02\x20", 4);
+  for (int i = 0; i < 3000; i++)
+    {
+      data += static_cast<char>(i % 64 < 48 ? i % 7 : i / 64);
+    }
+  return data;
+}
+
+static void put_le32(std::string &data, std::size_t value)
+{
+  for (int i = 0; i < 4; i++)
+    {
+      data += static_cast<char>((value >> (8 * i)) & 0xff);
+    }
+}
+
+// tools/compress_image.py --format heatshrink --window 8 --lookahead 4
+static const unsigned char tool_image[] = {
+  0x4c, 0x50, 0x48, 0x53, 0x08, 0x04, 0x00, 0x00, 0x36, 0x00, 0x00, 0x00, 0xb3, 0x5a, 0x6e, 0x56, 0xdb,
+  0xbd, 0x86, 0xe5, 0x65, 0x90, 0x02, 0x3c, 0x10, 0x36, 0x9b, 0x6d, 0x86, 0xce, 0x05, 0x19, 0x84, 0xc6,
+  0x65, 0x33, 0x9a, 0x4d, 0x66, 0xd3, 0x79, 0xc4, 0xe4, 0x15, 0x40,
+};
+
+// Heatshrink image with the header of tools/compress_image.py.
+static std::string compress(const std::string &input, int window_bits, int lookahead_bits, std::size_t image_size)
+{
+  std::string data("LPHS", 4);
+  data += static_cast<char>(window_bits);
+  data += static_cast<char>(lookahead_bits);
+  data += std::string(2, '\0');
+  put_le32(data, image_size);
+
+  std::stringbuf output;
+  HeatshrinkEncoder encoder(&output, window_bits, lookahead_bits);
+  encoder.sputn(input.data(), input.size());
+  TEST_ASSERT(encoder.finish());
+  return data + output.str();
+}
+
+// Decompresses data in pieces of at most piece_size bytes.
+static std::error_code decompress(const std::string &data, std::size_t piece_size, std::string &result, bool &done)
+{
+  result.clear();
+  ImageDecompressor decompressor([&result](string_view output) { result.append(output.data(), output.size()); });
+
+  std::error_code ec;
+  for (std::size_t pos = 0; pos < data.size() && !ec; pos += piece_size)
+    {
+      ec = decompressor.decompress(string_view(data.data() + pos, std::min(piece_size, data.size() - pos)));
+    }
+  done = decompressor.done();
+  return ec;
+}
+
+TEST_CASE("ImageDecompressor: heatshrink", "[ota]")
+{
+  std::string input = image();
+  std::string compressed = compress(input, 10, 5, input.size());
+
+  TEST_ASSERT(ImageDecompressor::is_compressed(compressed));
+  TEST_ASSERT(!ImageDecompressor::is_compressed(input));
+
+  for (std::size_t piece_size : { compressed.size(), std::size_t(1), std::size_t(5), std::size_t(13) })
+    {
+      std::string result;
+      bool done = false;
+      TEST_ASSERT(!decompress(compressed, piece_size, result, done));
+      TEST_ASSERT(done);
+      TEST_ASSERT(result == input);
+    }
+}
+
+TEST_CASE("ImageDecompressor: heatshrink image from compress_image.py", "[ota]")
+{
+  std::string result;
+  bool done = false;
+  TEST_ASSERT(!decompress(std::string(reinterpret_cast<const char *>(tool_image), sizeof(tool_image)), 1, result, done));
+  TEST_ASSERT(done);
+  TEST_ASSERT_EQUAL_STRING("firmware firmware firmware image 0123456789 0123456789", result.c_str());
+}
+
+TEST_CASE("ImageDecompressor: truncated heatshrink image", "[ota]")
+{
+  std::string input = image();
+  std::string compressed = compress(input, 8, 4, input.size());
+
+  for (std::size_t size : { std::size_t(6), std::size_t(12), compressed.size() / 2, compressed.size() - 1 })
+    {
+      std::string result;
+      bool done = true;
+      TEST_ASSERT(!decompress(compressed.substr(0, size), 7, result, done));
+      TEST_ASSERT(!done);
+      TEST_ASSERT(input.compare(0, result.size(), result) == 0);
+    }
+}
+
+TEST_CASE("ImageDecompressor: invalid heatshrink image", "[ota]")
+{
+  std::string input = image();
+  std::string result;
+  bool done = false;
+
+  // Window and lookahead sizes the decoder does not support.
+  TEST_ASSERT(decompress(compress(input, 8, 4, input.size()).replace(4, 1, 1, '\x10'), 64, result, done) == OTAErrc::InvalidImage);
+  TEST_ASSERT(decompress(compress(input, 8, 4, input.size()).replace(5, 1, 1, '\x08'), 64, result, done) == OTAErrc::InvalidImage);
+
+  // More data than the header announces.
+  TEST_ASSERT(decompress(compress(input, 8, 4, input.size() - 100), 64, result, done) == OTAErrc::InvalidImage);
+
+  // A back reference before the start of the image.
+  std::string header = compress("", 8, 4, 10);
+  TEST_ASSERT(decompress(header + std::string("\x00\x00", 2), 64, result, done) == OTAErrc::InvalidImage);
+}
@@ -5,6 +5,9 @@ endif
 ifdef CONFIG_CLIENT_CERTIFICATES
 COMPONENT_EMBED_TXTFILES += certs/esp32.crt certs/esp32.key
 endif
+ifdef CONFIG_OTA_SIGNATURE_VERIFICATION
+COMPONENT_EMBED_TXTFILES += certs/ota_signing.pem
+endif
 endif
 
 COMPONENT_ADD_INCLUDEDIRS := include src .
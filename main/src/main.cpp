@@ -29,10 +29,14 @@
 #include "loopp/core/MainLoop.hpp"
 #include "loopp/core/Task.hpp"
 #include "loopp/drivers/DriverRegistry.hpp"
+#include "loopp/drivers/Publisher.hpp"
 
 #include "loopp/mqtt/MqttClient.hpp"
+#include "loopp/mqtt/PublishScheduler.hpp"
 #include "loopp/net/Wifi.hpp"
 #include "loopp/ota/OTA.hpp"
+#include "loopp/storage/FlashLog.hpp"
+#include "loopp/storage/StoreAndForward.hpp"
 #include "loopp/utils/hexdump.hpp"
 #include "loopp/utils/json.hpp"
 #include "loopp/utils/memlog.hpp"
@@ -75,6 +79,10 @@ extern const uint8_t certificate_end[] asm("_binary_esp32_crt_end");
 extern const uint8_t private_key_start[] asm("_binary_esp32_key_start");
 extern const uint8_t private_key_end[] asm("_binary_esp32_key_end");
 #endif
+#ifdef CONFIG_OTA_SIGNATURE_VERIFICATION
+extern const uint8_t ota_signing_key_start[] asm("_binary_ota_signing_pem_start");
+extern const uint8_t ota_signing_key_end[] asm("_binary_ota_signing_pem_end");
+#endif
 #endif
 
 class Main
@@ -94,6 +102,53 @@ public:
 
     loop = std::make_shared<loopp::core::MainLoop>();
     mqtt = std::make_shared<loopp::mqtt::MqttClient>(loop, client_id, CONFIG_MQTT_HOST, CONFIG_MQTT_PORT);
+    scheduler = std::make_shared<loopp::mqtt::PublishScheduler>(loop);
+    scheduler->set_phase_from_id(mac);
+    mqtt->set_max_inflight(CONFIG_MQTT_MAX_INFLIGHT);
+    mqtt->set_keep_alive(std::chrono::seconds(CONFIG_MQTT_KEEP_ALIVE));
+    mqtt->set_response_timeout(std::chrono::seconds(CONFIG_MQTT_RESPONSE_TIMEOUT));
+#ifdef CONFIG_MQTT_PERSISTENT_SESSION
+    mqtt->set_clean_session(false);
+#endif
+    mqtt->set_reconnect_backoff(std::chrono::seconds(1), std::chrono::seconds(CONFIG_MQTT_RECONNECT_MAX_DELAY));
+#if CONFIG_MQTT_CIRCUIT_BREAKER_THRESHOLD > 0
+    mqtt->set_circuit_breaker(CONFIG_MQTT_CIRCUIT_BREAKER_THRESHOLD, std::chrono::seconds(CONFIG_MQTT_CIRCUIT_BREAKER_OPEN_TIME));
+#else
+    mqtt->set_circuit_breaker(0, std::chrono::seconds(0));
+#endif
+#ifdef CONFIG_MQTT_PROTOCOL_V5
+    mqtt->set_protocol_version(loopp::mqtt::ProtocolVersion::Mqtt5);
+    mqtt->set_session_expiry(CONFIG_MQTT_SESSION_EXPIRY);
+#endif
+#if CONFIG_MQTT_OFFLINE_QUEUE_SIZE > 0
+#if defined(CONFIG_MQTT_OFFLINE_QUEUE_DROP_NEWEST)
+    mqtt->set_offline_queue(CONFIG_MQTT_OFFLINE_QUEUE_SIZE, loopp::mqtt::DropPolicy::DropNewest);
+#elif defined(CONFIG_MQTT_OFFLINE_QUEUE_DROP_LOWEST_PRIORITY)
+    mqtt->set_offline_queue(CONFIG_MQTT_OFFLINE_QUEUE_SIZE, loopp::mqtt::DropPolicy::DropLowestPriority);
+#else
+    mqtt->set_offline_queue(CONFIG_MQTT_OFFLINE_QUEUE_SIZE, loopp::mqtt::DropPolicy::DropOldest);
+#endif
+    mqtt->set_offline_queue_drain_rate(CONFIG_MQTT_OFFLINE_QUEUE_DRAIN_RATE);
+#endif
+#ifdef CONFIG_STORE_AND_FORWARD
+    try
+      {
+        auto log = std::make_shared<loopp::storage::FlashLog>("storage");
+        store = std::make_shared<loopp::storage::StoreAndForward>(loop, mqtt, log);
+        store->set_replay_rate(CONFIG_STORE_AND_FORWARD_REPLAY_RATE);
+        store->set_max_age(std::chrono::hours(CONFIG_STORE_AND_FORWARD_MAX_AGE));
+      }
+    catch (std::system_error &e)
+      {
+        ESP_LOGE(tag, "Store and forward not available: %s", e.what());
+      }
+#endif
+    publisher = std::make_shared<loopp::drivers::Publisher>(loop, mqtt, topic_root, store, scheduler);
+#ifdef CONFIG_MQTT_PUBLISH_BATCHING
+    publisher->set_batching(true);
+#endif
+    publisher->start();
+
     task = std::make_shared<loopp::core::Task>("main_task", std::bind(&Main::main_task, this));
   }
 
@@ -151,7 +206,7 @@ private:
 #endif
 #endif
 #endif
-        mqtt->set_callback(loopp::core::bind_loop(loop, [this](std::string topic, std::string payload) { on_mqtt_data(topic, payload); }));
+        mqtt->set_callback([this](loopp::utils::string_view topic, loopp::utils::string_view payload) { on_mqtt_data(topic, payload); });
         mqtt->connected().connect(loopp::core::bind_loop(loop, std::bind(&Main::on_mqtt_connected, this, std::placeholders::_1)));
         mqtt->connect();
       }
@@ -166,27 +221,12 @@ private:
     if (connected)
       {
         ESP_LOGI(tag, "-> MQTT connected");
-        ESP_LOGI(tag, "-> Subscribing to configuration at %s", topic_configuration.c_str());
-        mqtt->subscribe(topic_configuration);
-        mqtt->add_filter(topic_configuration,
-                         loopp::core::bind_loop(loop, [this](std::string topic, std::string payload) { on_provisioning(payload); }));
-        ESP_LOGI(tag, "-> Subscribing to remote commands at %s", topic_command.c_str());
-        mqtt->subscribe(topic_command);
-        mqtt->add_filter(topic_command,
-                         loopp::core::bind_loop(loop, [this](std::string topic, std::string payload) { on_remote_command(payload); }));
-
-#ifdef CONFIG_DEFAULT_BLE_SCANNER
-        std::string name = "ble-scanner";
-        loopp::drivers::DriverContext context(loop, mqtt, topic_root);
-        json config;
-        std::shared_ptr<loopp::drivers::IDriver> driver = loopp::drivers::DriverRegistry::instance().create(name, context, config);
-        if (driver)
+        // The client restores subscriptions after a reconnect, so only the first connect subscribes.
+        if (!mqtt_subscribed)
           {
-            ESP_LOGI(tag, "Adding default BLE scanner");
-            drivers[name] = driver;
-            driver->start();
+            mqtt_subscribed = true;
+            start_mqtt_services();
           }
-#endif
       }
     else
       {
@@ -194,9 +234,42 @@ private:
       }
   }
 
-  void on_mqtt_data(const std::string &topic, const std::string &payload)
+  void start_mqtt_services()
+  {
+    ESP_LOGI(tag, "-> Subscribing to configuration at %s", topic_configuration.c_str());
+    mqtt->subscribe(topic_configuration);
+    mqtt->add_stream_filter(topic_configuration,
+                            [this](std::error_code ec,
+                                   loopp::utils::string_view topic,
+                                   loopp::utils::string_view chunk,
+                                   std::size_t offset,
+                                   std::size_t total) { on_provisioning_chunk(ec, chunk, offset, total); });
+    ESP_LOGI(tag, "-> Subscribing to remote commands at %s", topic_command.c_str());
+    mqtt->subscribe(topic_command);
+    mqtt->add_filter(topic_command, [this](loopp::utils::string_view topic, loopp::utils::string_view payload) { on_remote_command(payload); });
+
+#ifdef CONFIG_DEFAULT_BLE_SCANNER
+    std::string name = "ble-scanner";
+    loopp::drivers::DriverContext context(loop, mqtt, topic_root, store, scheduler, publisher);
+    json config;
+    std::shared_ptr<loopp::drivers::IDriver> driver = loopp::drivers::DriverRegistry::instance().create(name, context, config);
+    if (driver)
+      {
+        ESP_LOGI(tag, "Adding default BLE scanner");
+        drivers[name] = driver;
+        driver->start();
+      }
+#endif
+  }
+
+  void on_mqtt_data(loopp::utils::string_view topic, loopp::utils::string_view payload)
   {
-    ESP_LOGI(tag, "-> MQTT %s -> %s (free %d)", topic.c_str(), payload.c_str(), heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    ESP_LOGI(tag,
+             "-> MQTT %.*s -> %d bytes (free %d)",
+             static_cast<int>(topic.size()),
+             topic.data(),
+             payload.size(),
+             heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
   }
 
   void on_firmware_provisioning(json top)
@@ -205,7 +278,6 @@ private:
       {
         auto firmware = top.at("firmware");
         auto version = firmware.at("version").get<std::string>();
-        auto url = firmware.at("url").get<std::string>();
 
         int timeout = 0;
 
@@ -216,11 +288,25 @@ private:
           }
 
         ESP_LOGI(tag, "-> Version: %s (current %s)", version.c_str(), current_version);
-        ESP_LOGI(tag, "-> URI    : %s", url.c_str());
 
-        if (version != std::string(current_version))
+        it = firmware.find("topic");
+        if (it != firmware.end())
+          {
+            auto topic = it->get<std::string>();
+            ESP_LOGI(tag, "-> Topic  : %s", topic.c_str());
+            if (version != std::string(current_version))
+              {
+                firmware_update_mqtt(topic, firmware, timeout);
+              }
+          }
+        else
           {
-            firmware_update(url, timeout);
+            auto url = firmware.at("url").get<std::string>();
+            ESP_LOGI(tag, "-> URI    : %s", url.c_str());
+            if (version != std::string(current_version))
+              {
+                firmware_update(url, firmware, timeout);
+              }
           }
       }
     catch (json::out_of_range &e)
@@ -229,11 +315,34 @@ private:
       }
   }
 
-  void on_provisioning(const std::string &payload)
+  void on_provisioning_chunk(std::error_code ec, loopp::utils::string_view chunk, std::size_t offset, std::size_t total)
   {
-    ESP_LOGI(tag, "-> MQTT provisioning: %s", payload.c_str());
+    // The provisioning document may be larger than the MQTT receive buffer, so it is received in chunks.
+    if (offset == 0)
+      {
+        provisioning.clear();
+        provisioning.reserve(total);
+      }
+    if (ec)
+      {
+        provisioning.clear();
+        return;
+      }
 
-    auto top = json::parse(payload);
+    provisioning.append(chunk.data(), chunk.size());
+    if (provisioning.size() == total)
+      {
+        std::string document;
+        document.swap(provisioning);
+        on_provisioning(document);
+      }
+  }
+
+  void on_provisioning(loopp::utils::string_view payload)
+  {
+    ESP_LOGI(tag, "-> MQTT provisioning: %d bytes", payload.size());
+
+    auto top = json::parse(payload.data(), payload.data() + payload.size());
 
     ESP_LOGI(tag, "-> Name: %s", top["name"].get<std::string>().c_str());
 
@@ -243,6 +352,20 @@ private:
         on_firmware_provisioning(top);
       }
 
+    // "schedule": { "slot": 3, "slots": 20 } replaces the phase derived from the MAC address.
+    it = top.find("schedule");
+    if (it != top.end())
+      {
+        try
+          {
+            scheduler->set_slot(it->at("slot").get<std::uint32_t>(), it->at("slots").get<std::uint32_t>());
+          }
+        catch (std::exception &e)
+          {
+            ESP_LOGI(tag, "-> Invalid schedule: %s", e.what());
+          }
+      }
+
     it = top.find("devices");
     if (it != top.end())
       {
@@ -255,7 +378,7 @@ private:
         // Some drivers may have pending notifications that will keep it in memory
         // So invoke the next step asynchronously and give drivers a chance to close down.
         loop->invoke([this, top]() {
-          loopp::drivers::DriverContext context(loop, mqtt, topic_root);
+          loopp::drivers::DriverContext context(loop, mqtt, topic_root, store, scheduler, publisher);
           for (auto device_config : top.at("devices"))
             {
               std::string name = device_config["name"].get<std::string>();
@@ -278,11 +401,11 @@ private:
       }
   }
 
-  void on_remote_command(const std::string &payload)
+  void on_remote_command(loopp::utils::string_view payload)
   {
-    ESP_LOGI(tag, "-> MQTT remote command: %s", payload.c_str());
+    ESP_LOGI(tag, "-> MQTT remote command: %.*s", static_cast<int>(payload.size()), payload.data());
 
-    auto top = json::parse(payload);
+    auto top = json::parse(payload.data(), payload.data() + payload.size());
 
     try
       {
@@ -296,7 +419,6 @@ private:
           }
         else if (cmd == "firmware-upgrade")
           {
-            auto url = top.at("url").get<std::string>();
             int timeout = 0;
 
             auto it = top.find("timeout");
@@ -305,7 +427,15 @@ private:
                 timeout = *it;
               }
 
-            firmware_update(url, timeout);
+            it = top.find("topic");
+            if (it != top.end())
+              {
+                firmware_update_mqtt(it->get<std::string>(), top, timeout);
+              }
+            else
+              {
+                firmware_update(top.at("url").get<std::string>(), top, timeout);
+              }
           }
       }
     catch (json::out_of_range &e)
@@ -314,14 +444,51 @@ private:
       }
   }
 
-  void firmware_update(const std::string &url, int timeout)
+  // Returns nullptr if the optional "sha256" or "signature" of the firmware specification is invalid.
+  std::shared_ptr<loopp::ota::OTA> create_ota(const json &spec)
+  {
+    std::shared_ptr<loopp::ota::OTA> ota = std::make_shared<loopp::ota::OTA>(loop);
+    ota->set_write_buffers(CONFIG_OTA_WRITE_BUFFERS, CONFIG_OTA_WRITE_BUFFER_SIZE);
+#ifdef CONFIG_OTA_ERASE_UP_FRONT
+    ota->set_erase_up_front(true);
+#endif
+#ifdef CONFIG_OTA_SIGNATURE_VERIFICATION
+    ota->set_signing_key(reinterpret_cast<const char *>(ota_signing_key_start));
+#endif
+
+    try
+      {
+        auto it = spec.find("sha256");
+        if (it != spec.end())
+          {
+            ota->set_expected_sha256(it->get<std::string>());
+          }
+        it = spec.find("signature");
+        if (it != spec.end())
+          {
+            ota->set_signature(it->get<std::string>());
+          }
+      }
+    catch (const std::system_error &e)
+      {
+        ESP_LOGE(tag, "-> Invalid firmware specification: %s", e.what());
+        return nullptr;
+      }
+    return ota;
+  }
+
+  void firmware_update(const std::string &url, const json &spec, int timeout)
   {
     // 520K is insufficient to run two TLS connections, so close MQTT before retrieving new firmware.
     mqtt->disconnect();
 
     // Memory may be freed asynchronously, so delay firmware update until mainloop had a change to terminate the MQTT connection...
-    loop->add_timer(std::chrono::milliseconds(1000), [this, url, timeout]() {
-      std::shared_ptr<loopp::ota::OTA> ota = std::make_shared<loopp::ota::OTA>(loop);
+    loop->add_timer(std::chrono::milliseconds(1000), [this, url, spec, timeout]() {
+      std::shared_ptr<loopp::ota::OTA> ota = create_ota(spec);
+      if (!ota)
+        {
+          esp_restart();
+        }
 
 #ifdef CONFIG_EMBEDDED_CERTIFICATES
 #ifdef CONFIG_CA_CERTIFICATE
@@ -346,6 +513,29 @@ private:
     });
   }
 
+  // Receives the firmware over the MQTT connection, so no second TLS connection is needed.
+  void firmware_update_mqtt(const std::string &topic, const json &spec, int timeout)
+  {
+    std::shared_ptr<loopp::ota::OTA> ota = create_ota(spec);
+    if (!ota)
+      {
+        return;
+      }
+
+    ota->upgrade_async(mqtt, topic, std::chrono::seconds(timeout), loopp::core::bind_loop(loop, [ota](std::error_code ec) {
+                         ESP_LOGI(tag, "-> OTA ready");
+                         if (!ec)
+                           {
+                             ESP_LOGI(tag, "-> OTA commit");
+                             ota->commit();
+                           }
+                         else
+                           {
+                             esp_restart();
+                           }
+                       }));
+  }
+
 #ifdef LEDTEST
   void init_leds()
   {
@@ -404,6 +594,11 @@ private:
     ESP_LOGI(tag, "Main::main_task memory free %d", heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
     heap_caps_print_heap_info(MALLOC_CAP_DEFAULT);
 
+    if (store)
+      {
+        store->start();
+      }
+
 #ifdef LEDTEST
     init_leds();
 #endif
@@ -419,6 +614,9 @@ private:
   loopp::net::Wifi &wifi;
   std::shared_ptr<loopp::core::MainLoop> loop;
   std::shared_ptr<loopp::mqtt::MqttClient> mqtt;
+  std::shared_ptr<loopp::storage::StoreAndForward> store;
+  std::shared_ptr<loopp::mqtt::PublishScheduler> scheduler;
+  std::shared_ptr<loopp::drivers::Publisher> publisher;
   std::shared_ptr<loopp::core::Task> task;
 #ifdef LEDTEST
   std::shared_ptr<Leds> leds;
@@ -427,9 +625,11 @@ private:
   loopp::core::MainLoop::timer_id wifi_timeout_timer = 0;
   loopp::core::MainLoop::timer_id leds_timer = 0;
   int wifi_fail_count = 0;
+  bool mqtt_subscribed = false;
   std::string topic_root;
   std::string topic_command;
   std::string topic_configuration;
+  std::string provisioning;
   int count = 20;
 };
 
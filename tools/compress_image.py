@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+#
+# Compresses a firmware image for OTA updates. The device decompresses the
+# image while it is received, see loopp/ota/ImageDecompressor.hpp.
+#
+# Formats:
+#
+#   gzip, zlib   standard streams, decompressed with the 32 KiB inflate window
+#   heatshrink   LZSS with a small window, for devices short on RAM
+#
+# Heatshrink images start with a header (integers little endian):
+#
+#   magic "LPHS" (4) | window bits (1) | lookahead bits (1) | reserved (2) | image size (4)
+#
+# followed by the stream as produced by loopp::compress::HeatshrinkEncoder:
+# literals are a 1 bit followed by the byte, back references a 0 bit, the
+# offset minus one in window bits and the length minus one in lookahead
+# bits. Bits are packed MSB first.
+#
+# Usage: compress_image.py [--format heatshrink] [--window 10] [--lookahead 5] <image.bin> <compressed.bin>
+
+import argparse
+import gzip
+import struct
+import zlib
+
+HEATSHRINK_HEADER = struct.Struct('<4sBBHI')
+# Candidates examined per position when searching for a match.
+MAX_CHAIN = 32
+
+
+class BitWriter:
+    def __init__(self):
+        self.data = bytearray()
+        self.bits = 0
+        self.count = 0
+
+    def put(self, value, count):
+        self.bits = (self.bits << count) | value
+        self.count += count
+        while self.count >= 8:
+            self.count -= 8
+            self.data.append((self.bits >> self.count) & 0xff)
+        self.bits &= (1 << self.count) - 1
+
+    def finish(self):
+        if self.count > 0:
+            self.put(0, 8 - self.count)
+        return bytes(self.data)
+
+
+def heatshrink_encode(data, window_bits, lookahead_bits):
+    window_size = 1 << window_bits
+    lookahead_size = 1 << lookahead_bits
+    backref_bits = 1 + window_bits + lookahead_bits
+    chains = {}
+    out = BitWriter()
+
+    position = 0
+    while position < len(data):
+        max_length = min(lookahead_size, len(data) - position)
+        best_length = 0
+        best_offset = 0
+        for candidate in reversed(chains.get(data[position:position + 2], [])):
+            if position - candidate > window_size:
+                break
+            if data[candidate + best_length] != data[position + best_length]:
+                continue
+            length = 0
+            while length < max_length and data[candidate + length] == data[position + length]:
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_offset = position - candidate
+                if length == max_length:
+                    break
+
+        if best_length * 9 > backref_bits:
+            out.put(0, 1)
+            out.put(best_offset - 1, window_bits)
+            out.put(best_length - 1, lookahead_bits)
+            step = best_length
+        else:
+            out.put(0x100 | data[position], 9)
+            step = 1
+
+        for pos in range(position, position + step):
+            chain = chains.setdefault(data[pos:pos + 2], [])
+            chain.append(pos)
+            if len(chain) > MAX_CHAIN:
+                del chain[0]
+        position += step
+
+    return out.finish()
+
+
+def heatshrink_decode(data, window_bits, lookahead_bits):
+    out = bytearray()
+    bits = 0
+    count = 0
+    pos = 0
+
+    def get(n):
+        nonlocal bits, count, pos
+        while count < n:
+            if pos == len(data):
+                return None
+            bits = (bits << 8) | data[pos]
+            count += 8
+            pos += 1
+        count -= n
+        return (bits >> count) & ((1 << n) - 1)
+
+    while True:
+        tag = get(1)
+        if tag is None:
+            break
+        if tag:
+            value = get(8)
+            if value is None:
+                break
+            out.append(value)
+        else:
+            offset = get(window_bits)
+            length = get(lookahead_bits)
+            if offset is None or length is None:
+                break
+            for _ in range(length + 1):
+                out.append(out[-(offset + 1)])
+    return bytes(out)
+
+
+def compress(image, fmt, window_bits, lookahead_bits):
+    if fmt == 'gzip':
+        return gzip.compress(image, 9)
+    if fmt == 'zlib':
+        return zlib.compress(image, 9)
+
+    header = HEATSHRINK_HEADER.pack(b'LPHS', window_bits, lookahead_bits, 0, len(image))
+    stream = heatshrink_encode(image, window_bits, lookahead_bits)
+    # Verify before anyone sends the image to a device.
+    if heatshrink_decode(stream, window_bits, lookahead_bits) != image:
+        raise RuntimeError('heatshrink round trip failed')
+    return header + stream
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compress a firmware image for OTA updates')
+    parser.add_argument('--format', choices=['gzip', 'zlib', 'heatshrink'], default='zlib')
+    parser.add_argument('--window', type=int, default=10, help='heatshrink window bits (4-15)')
+    parser.add_argument('--lookahead', type=int, default=5, help='heatshrink lookahead bits')
+    parser.add_argument('image')
+    parser.add_argument('compressed')
+    args = parser.parse_args()
+
+    if args.format == 'heatshrink' and not (4 <= args.window <= 15 and 3 <= args.lookahead < args.window):
+        parser.error('invalid heatshrink parameters')
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+    compressed = compress(image, args.format, args.window, args.lookahead)
+    with open(args.compressed, 'wb') as f:
+        f.write(compressed)
+    print('%s: %d bytes (%.1f%% of %d)' % (args.compressed, len(compressed), 100.0 * len(compressed) / len(image), len(image)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,194 @@
+#!/usr/bin/env python3
+#
+# Creates delta patches for OTA updates. The device reconstructs the new
+# firmware from the patch and the firmware in its running partition, see
+# loopp/ota/DeltaPatcher.hpp.
+#
+# Patch layout (all integers little endian):
+#
+#   magic "LPDELTA1" (8) | source size (4) | target size (4) | target SHA-256 (32) | zlib stream
+#
+# The zlib stream holds bsdiff style records:
+#
+#   diff length (4) | extra length (4) | source seek (4, signed) | diff bytes | extra bytes
+#
+# Diff bytes are added (modulo 256) to the source at the current source
+# position, extra bytes are copied as is. Afterwards the source position
+# moves by the diff length plus the seek. Diff bytes are mostly zero for
+# code that only moved, which makes them compress well.
+#
+# Usage: make_delta.py create <old.bin> <new.bin> <patch.bin>
+#        make_delta.py apply <old.bin> <patch.bin> <new.bin>
+
+import argparse
+import hashlib
+import struct
+import sys
+import zlib
+
+MAGIC = b'LPDELTA1'
+HEADER = struct.Struct('<8sII32s')
+CONTROL = struct.Struct('<IIi')
+
+# Length of the blocks used to find matching data in the source.
+BLOCK_SIZE = 16
+# Source positions between indexed blocks. Matches are found at any target position.
+INDEX_STEP = 4
+# Shortest approximate match worth a diff record.
+MIN_MATCH = 32
+# Stop extending a match after this many bytes without improvement.
+MAX_MISMATCH_RUN = 64
+
+
+def build_index(source):
+    index = {}
+    for pos in range(0, len(source) - BLOCK_SIZE + 1, INDEX_STEP):
+        index.setdefault(source[pos:pos + BLOCK_SIZE], pos)
+    return index
+
+
+def extend_match(source, target, source_pos, target_pos):
+    # Approximate match as in bsdiff: the length that maximizes
+    # 2 * matching bytes - length, so that a few changed bytes (e.g. moved
+    # addresses) do not end the match.
+    score = 0
+    best_score = 0
+    best_length = 0
+    length = 0
+    limit = min(len(source) - source_pos, len(target) - target_pos)
+    while length < limit and length - best_length < MAX_MISMATCH_RUN:
+        score += 1 if source[source_pos + length] == target[target_pos + length] else -1
+        length += 1
+        if score > best_score:
+            best_score = score
+            best_length = length
+    return best_length
+
+
+def find_match(source, target, index, target_pos, aligned_pos):
+    block = target[target_pos:target_pos + BLOCK_SIZE]
+    if len(block) < BLOCK_SIZE:
+        return (None, 0)
+
+    # Prefer continuing at the source position that follows the previous match.
+    candidates = []
+    if 0 <= aligned_pos and source[aligned_pos:aligned_pos + BLOCK_SIZE] == block:
+        candidates.append(aligned_pos)
+    pos = index.get(block)
+    if pos is not None:
+        candidates.append(pos)
+
+    best = (None, 0)
+    for pos in candidates:
+        length = extend_match(source, target, pos, target_pos)
+        if length > best[1]:
+            best = (pos, length)
+    return best
+
+
+def create_patch(source, target):
+    index = build_index(source)
+    records = []
+
+    # Current record: diff section target[diff_start:diff_start + diff_length]
+    # against source[source_start:], followed by extra bytes up to target_pos.
+    diff_start = 0
+    diff_length = 0
+    source_start = 0
+    target_pos = 0
+
+    while target_pos < len(target):
+        aligned_pos = source_start + diff_length + (target_pos - diff_start - diff_length)
+        source_pos, length = find_match(source, target, index, target_pos, aligned_pos)
+        if source_pos is None or length < MIN_MATCH:
+            target_pos += 1
+            continue
+
+        extra_start = diff_start + diff_length
+        records.append((diff_start, diff_length, source_start, extra_start, target_pos,
+                        source_pos - (source_start + diff_length)))
+        diff_start = target_pos
+        diff_length = length
+        source_start = source_pos
+        target_pos += length
+
+    records.append((diff_start, diff_length, source_start, diff_start + diff_length, len(target), 0))
+
+    stream = bytearray()
+    for diff_start, diff_length, source_start, extra_start, extra_end, seek in records:
+        if diff_length == 0 and extra_start == extra_end and seek == 0:
+            continue
+        stream += CONTROL.pack(diff_length, extra_end - extra_start, seek)
+        stream += bytes((target[diff_start + i] - source[source_start + i]) & 0xff for i in range(diff_length))
+        stream += target[extra_start:extra_end]
+
+    header = HEADER.pack(MAGIC, len(source), len(target), hashlib.sha256(target).digest())
+    return header + zlib.compress(bytes(stream), 9)
+
+
+def apply_patch(source, patch):
+    magic, source_size, target_size, digest = HEADER.unpack_from(patch)
+    if magic != MAGIC:
+        raise ValueError('not a delta patch')
+    if source_size > len(source):
+        raise ValueError('source image too small')
+
+    stream = zlib.decompress(patch[HEADER.size:])
+    target = bytearray()
+    source_pos = 0
+    pos = 0
+    while pos < len(stream):
+        diff_length, extra_length, seek = CONTROL.unpack_from(stream, pos)
+        pos += CONTROL.size
+        for i in range(diff_length):
+            target.append((stream[pos + i] + source[source_pos + i]) & 0xff)
+        pos += diff_length
+        target += stream[pos:pos + extra_length]
+        pos += extra_length
+        source_pos += diff_length + seek
+
+    if len(target) != target_size or hashlib.sha256(target).digest() != digest:
+        raise ValueError('patched image does not match the target image')
+    return bytes(target)
+
+
+def read(filename):
+    with open(filename, 'rb') as f:
+        return f.read()
+
+
+def write(filename, data):
+    with open(filename, 'wb') as f:
+        f.write(data)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Create or apply delta patches for OTA updates')
+    subparsers = parser.add_subparsers(dest='command')
+    create = subparsers.add_parser('create', help='create a patch from old to new firmware')
+    create.add_argument('old')
+    create.add_argument('new')
+    create.add_argument('patch')
+    apply = subparsers.add_parser('apply', help='apply a patch to old firmware')
+    apply.add_argument('old')
+    apply.add_argument('patch')
+    apply.add_argument('new')
+    args = parser.parse_args()
+
+    if args.command == 'create':
+        source = read(args.old)
+        target = read(args.new)
+        patch = create_patch(source, target)
+        # Verify the patch before anyone sends it to a device.
+        apply_patch(source, patch)
+        write(args.patch, patch)
+        print('%s: %d bytes (%.1f%% of %d)' % (args.patch, len(patch), 100.0 * len(patch) / len(target), len(target)))
+    elif args.command == 'apply':
+        write(args.new, apply_patch(read(args.old), read(args.patch)))
+    else:
+        parser.print_help()
+        sys.exit(1)
+
+
+if __name__ == '__main__':
+    main()
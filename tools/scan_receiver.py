@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+#
+# Reference receiver for scan results sent by the "udp" transport of the
+# ble-scanner driver. Prints received scan results and keeps per device loss
+# statistics.
+#
+# Datagram layout (all integers big endian):
+#
+#   magic "LP" (2) | version (1) | flags (1) | boot id (4) | sequence (4) | device MAC (6) | payload [| tag (16)]
+#
+# With flags bit 0 set, the payload is encrypted with AES-GCM. The header is
+# the additional authenticated data and the nonce is
+# boot id | sequence | last 4 bytes of the MAC.
+#
+# Usage: scan_receiver.py [--port 5683] [--group 239.1.2.3] [--key <hex>] [--quiet]
+
+import argparse
+import json
+import socket
+import struct
+import sys
+import time
+
+HEADER = struct.Struct('>2sBBII6s')
+TAG_SIZE = 16
+FLAG_AUTHENTICATED = 0x01
+
+
+class DeviceStatistics:
+    def __init__(self):
+        self.boot_id = None
+        self.first = None
+        self.highest = None
+        self.seen = set()
+        self.received = 0
+        self.duplicates = 0
+        self.reordered = 0
+        self.lost_previous_boots = 0
+
+    def update(self, boot_id, sequence):
+        if boot_id != self.boot_id:
+            # The device rebooted; the sequence number restarts.
+            self.lost_previous_boots += self.lost()
+            self.boot_id = boot_id
+            self.first = sequence
+            self.highest = sequence
+            self.seen = set()
+
+        if sequence in self.seen:
+            self.duplicates += 1
+            return False
+
+        if sequence < self.highest:
+            self.reordered += 1
+        self.seen.add(sequence)
+        self.received += 1
+        self.first = min(self.first, sequence)
+        self.highest = max(self.highest, sequence)
+        return True
+
+    def lost(self):
+        if self.highest is None:
+            return 0
+        return (self.highest - self.first + 1) - len(self.seen)
+
+    def total_lost(self):
+        return self.lost_previous_boots + self.lost()
+
+
+def open_socket(port, group):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    sock.bind(('', port))
+    if group:
+        mreq = struct.pack('4s4s', socket.inet_aton(group), socket.inet_aton('0.0.0.0'))
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, mreq)
+    return sock
+
+
+def decrypt(aead, header, body):
+    _, _, _, boot_id, sequence, mac = HEADER.unpack(header)
+    nonce = struct.pack('>II', boot_id, sequence) + mac[2:]
+    return aead.decrypt(nonce, body, header)
+
+
+def print_statistics(devices):
+    for mac, stats in sorted(devices.items()):
+        total = stats.received + stats.total_lost()
+        loss = 100.0 * stats.total_lost() / total if total else 0.0
+        print('%s: received %d lost %d (%.2f%%) duplicates %d reordered %d' %
+              (mac, stats.received, stats.total_lost(), loss, stats.duplicates, stats.reordered), file=sys.stderr)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Receive scan results over UDP')
+    parser.add_argument('--port', type=int, default=5683)
+    parser.add_argument('--group', help='multicast group to join')
+    parser.add_argument('--key', help='AES key as hex string')
+    parser.add_argument('--interval', type=int, default=10, help='seconds between statistics')
+    parser.add_argument('--quiet', action='store_true', help='only print statistics')
+    args = parser.parse_args()
+
+    aead = None
+    if args.key:
+        from cryptography.hazmat.primitives.ciphers.aead import AESGCM
+        aead = AESGCM(bytes.fromhex(args.key))
+
+    sock = open_socket(args.port, args.group)
+    devices = {}
+    rejected = 0
+    last_report = time.monotonic()
+
+    while True:
+        sock.settimeout(max(0.1, args.interval - (time.monotonic() - last_report)))
+        try:
+            data, address = sock.recvfrom(2048)
+        except socket.timeout:
+            data = None
+
+        if data is not None:
+            if len(data) < HEADER.size:
+                rejected += 1
+                continue
+
+            header, body = data[:HEADER.size], data[HEADER.size:]
+            magic, version, flags, boot_id, sequence, mac = HEADER.unpack(header)
+            if magic != b'LP' or version != 1:
+                rejected += 1
+                continue
+
+            try:
+                if flags & FLAG_AUTHENTICATED:
+                    if aead is None:
+                        raise ValueError('no key')
+                    body = decrypt(aead, header, body)
+                elif aead is not None:
+                    raise ValueError('unauthenticated datagram')
+                results = json.loads(body)
+            except Exception:
+                rejected += 1
+                continue
+
+            mac_str = mac.hex()
+            stats = devices.setdefault(mac_str, DeviceStatistics())
+            if stats.update(boot_id, sequence) and not args.quiet:
+                for result in results:
+                    print(json.dumps({'scanner': mac_str, 'sequence': sequence, 'result': result}))
+
+        if time.monotonic() - last_report >= args.interval:
+            last_report = time.monotonic()
+            print_statistics(devices)
+            if rejected:
+                print('rejected %d datagrams' % rejected, file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+#
+# Signs firmware images for OTA updates with signature verification enabled
+# (CONFIG_OTA_SIGNATURE_VERIFICATION). The signature is an ECDSA signature
+# of the SHA-256 digest of the image, DER encoded and printed as hex. Pass it
+# as "signature" in the firmware specification, together with "sha256".
+#
+# Delta patches and compressed images are verified after reconstruction, so
+# always sign the plain image.
+#
+# Usage: sign_image.py keygen <private.pem> <main/certs/ota_signing.pem>
+#        sign_image.py sign <private.pem> <image.bin>
+#
+# openssl creates signatures in the same format:
+#   openssl dgst -sha256 -sign <private.pem> <image.bin> | xxd -p -c 256
+
+import argparse
+import hashlib
+import json
+
+from cryptography.hazmat.primitives import hashes, serialization
+from cryptography.hazmat.primitives.asymmetric import ec
+
+
+def keygen(private_filename, public_filename):
+    key = ec.generate_private_key(ec.SECP256R1())
+    with open(private_filename, 'wb') as f:
+        f.write(key.private_bytes(serialization.Encoding.PEM, serialization.PrivateFormat.PKCS8,
+                                  serialization.NoEncryption()))
+    with open(public_filename, 'wb') as f:
+        f.write(key.public_key().public_bytes(serialization.Encoding.PEM,
+                                              serialization.PublicFormat.SubjectPublicKeyInfo))
+
+
+def sign(private_filename, image_filename):
+    with open(private_filename, 'rb') as f:
+        key = serialization.load_pem_private_key(f.read(), password=None)
+    with open(image_filename, 'rb') as f:
+        image = f.read()
+
+    signature = key.sign(image, ec.ECDSA(hashes.SHA256()))
+    print(json.dumps({'sha256': hashlib.sha256(image).hexdigest(), 'signature': signature.hex()}))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Sign firmware images for OTA updates')
+    subparsers = parser.add_subparsers(dest='command')
+    keygen_parser = subparsers.add_parser('keygen', help='create a signing key pair')
+    keygen_parser.add_argument('private')
+    keygen_parser.add_argument('public')
+    sign_parser = subparsers.add_parser('sign', help='sign an image')
+    sign_parser.add_argument('private')
+    sign_parser.add_argument('image')
+    args = parser.parse_args()
+
+    if args.command == 'keygen':
+        keygen(args.private, args.public)
+    elif args.command == 'sign':
+        sign(args.private, args.image)
+    else:
+        parser.print_help()
+
+
+if __name__ == '__main__':
+    main()